@@ -170,6 +170,14 @@ void HtpBodyFree(HtpBody *body)
 {
     SCEnter();
 
+    MpmStreamStateFree(&body->mpm_state);
+
+    if (body->inspect_buf != NULL) {
+        HTPFree(body->inspect_buf, body->inspect_buf_size);
+        body->inspect_buf = NULL;
+        body->inspect_buf_size = body->inspect_buf_len = 0;
+    }
+
     if (body->first == NULL)
         return;
 
@@ -316,6 +316,10 @@ static void HtpTxUserDataFree(HtpTxUserData *htud) {
             HTPFree(htud->request_headers_raw, htud->request_headers_raw_len);
         if (htud->response_headers_raw)
             HTPFree(htud->response_headers_raw, htud->response_headers_raw_len);
+        if (htud->request_headers_buf)
+            HTPFree(htud->request_headers_buf, htud->request_headers_buf_len);
+        if (htud->response_headers_buf)
+            HTPFree(htud->response_headers_buf, htud->response_headers_buf_len);
         AppLayerDecoderEventsFreeEvents(&htud->decoder_events);
         if (htud->boundary)
             HTPFree(htud->boundary, htud->boundary_len);
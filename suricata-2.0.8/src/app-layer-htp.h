@@ -36,6 +36,7 @@
 #include "util-radix-tree.h"
 #include "util-file.h"
 #include "app-layer-htp-mem.h"
+#include "util-mpm.h"
 
 #include <htp/htp.h>
 
@@ -177,6 +178,17 @@ typedef struct HtpBody_ {
     uint64_t body_parsed;
     /* inspection tracker */
     uint64_t body_inspected;
+    /* mpm state, so we don't scan the overlapping part of the inspection
+     * buffer over and over */
+    MpmStreamState mpm_state;
+
+    /* reassembled inspection buffer, see DetectEngineHCBDGetBufferForTX */
+    uint8_t *inspect_buf;
+    uint32_t inspect_buf_size;  /**< allocated size */
+    uint32_t inspect_buf_len;   /**< data len in the buffer */
+    uint64_t inspect_offset;    /**< stream offset of the buffer start */
+    /** detection pass that built the buffer (det_ctx->inspect_pass) */
+    uint64_t inspect_pass;
 } HtpBody;
 
 #define HTP_CONTENTTYPE_SET     0x01    /**< We have the content type */
@@ -211,6 +223,15 @@ typedef struct HtpTxUserData_ {
     uint32_t request_headers_raw_len;
     uint32_t response_headers_raw_len;
 
+    /* normalized header buffers for the detection engine, built on first
+     * use. The generation tells if the header table changed since. */
+    uint8_t *request_headers_buf;
+    uint8_t *response_headers_buf;
+    uint32_t request_headers_buf_len;
+    uint32_t response_headers_buf_len;
+    uint32_t request_headers_buf_gen;
+    uint32_t response_headers_buf_gen;
+
     AppLayerDecoderEvents *decoder_events;          /**< per tx events */
 
     /** Holds the boundary identificator string if any (used on
@@ -442,6 +442,13 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
         SCPerfTVRegisterCounter("defrag.max_frag_hits", tv,
             SC_PERF_TYPE_UINT64, "NULL");
 
+    dtv->counter_flow_bypassed_pkts =
+        SCPerfTVRegisterCounter("flow.bypassed_pkts", tv,
+            SC_PERF_TYPE_UINT64, "NULL");
+    dtv->counter_flow_bypassed_bytes =
+        SCPerfTVRegisterCounter("flow.bypassed_bytes", tv,
+            SC_PERF_TYPE_UINT64, "NULL");
+
     return;
 }
 
@@ -420,6 +420,9 @@ typedef struct Packet_
     /** The release function for packet structure and data */
     void (*ReleasePacket)(struct Packet_ *);
 
+    /** packet pool this packet belongs to, NULL if it was alloc'd */
+    struct PktPool_ *pool;
+
     /* pkt vars */
     PktVar *pktvar;
 
@@ -601,6 +604,10 @@ typedef struct DecodeThreadVars_
     uint16_t counter_defrag_ipv6_timeouts;
     uint16_t counter_defrag_max_hit;
 
+    /** packets and bytes of locally bypassed flows */
+    uint16_t counter_flow_bypassed_pkts;
+    uint16_t counter_flow_bypassed_bytes;
+
 #ifdef __SC_CUDA_SUPPORT__
     CudaThreadVars cuda_vars;
 #endif
@@ -956,6 +963,7 @@ void AddressDebugPrint(Address *);
 #define PKT_IS_FRAGMENT                 (1<<19)     /**< Packet is a fragment */
 #define PKT_IS_INVALID                  (1<<20)
 #define PKT_PROFILE                     (1<<21)
+#define PKT_BYPASSED                    (1<<22)     /**< Packet belongs to a locally bypassed flow, skip stream and detect */
 
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) ((p)->flags & PKT_PSEUDO_STREAM_END)
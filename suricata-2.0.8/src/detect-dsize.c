@@ -52,6 +52,7 @@ int DetectDsizeMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectDsizeSetup (DetectEngineCtx *, Signature *s, char *str);
 void DsizeRegisterTests(void);
 static void DetectDsizeFree(void *);
+static int DetectDsizePrefilterCompare(const SigMatch *, const SigMatch *);
 
 /**
  * \brief Registration function for dsize: keyword
@@ -64,6 +65,7 @@ void DetectDsizeRegister (void) {
     sigmatch_table[DETECT_DSIZE].Setup = DetectDsizeSetup;
     sigmatch_table[DETECT_DSIZE].Free  = DetectDsizeFree;
     sigmatch_table[DETECT_DSIZE].RegisterTests = DsizeRegisterTests;
+    sigmatch_table[DETECT_DSIZE].PrefilterCompare = DetectDsizePrefilterCompare;
 
     const char *eb;
     int eo;
@@ -127,6 +129,16 @@ int DetectDsizeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     SCReturnInt(ret);
 }
 
+/** \brief see if two dsize sigmatches are the same prefilter */
+static int DetectDsizePrefilterCompare(const SigMatch *a, const SigMatch *b)
+{
+    const DetectDsizeData *da = (const DetectDsizeData *)a->ctx;
+    const DetectDsizeData *db = (const DetectDsizeData *)b->ctx;
+
+    return (da->mode == db->mode && da->dsize == db->dsize &&
+            da->dsize2 == db->dsize2);
+}
+
 /**
  * \internal
  * \brief This function is used to parse dsize options passed via dsize: keyword
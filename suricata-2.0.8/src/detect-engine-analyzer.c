@@ -38,6 +38,12 @@
 static int rule_warnings_only = 0;
 static FILE *rule_engine_analysis_FD = NULL;
 static FILE *fp_engine_analysis_FD = NULL;
+static FILE *mpm_engine_analysis_FD = NULL;
+static uint32_t mpm_engine_analysis_sgh_cnt = 0;
+static uint64_t mpm_engine_analysis_ctx_cnt = 0;
+static uint64_t mpm_engine_analysis_memory = 0;
+/* mpm ctxs listed so far, shared ones are listed once per sgh */
+static HashListTable *mpm_engine_analysis_seen = NULL;
 static pcre *percent_re = NULL;
 static pcre_extra *percent_re_study = NULL;
 static char log_path[PATH_MAX];
@@ -303,6 +309,193 @@ void CleanupRuleAnalyzer(void) {
     }
 }
 
+static uint32_t EngineAnalysisMpmSeenHash(HashListTable *ht, void *data,
+                                          uint16_t datalen)
+{
+    return (uint32_t)(((uintptr_t)data >> 4) % ht->array_size);
+}
+
+static char EngineAnalysisMpmSeenCompare(void *data1, uint16_t len1,
+                                         void *data2, uint16_t len2)
+{
+    return data1 == data2;
+}
+
+/**
+ * \brief Sets up the mpm analyzer according to the config.
+ *
+ * \retval 1 If mpm analyzer successfully enabled.
+ * \retval 0 If not enabled.
+ */
+int SetupMpmAnalyzer(void)
+{
+    int mpm_engine_analysis_set = 0;
+
+    if ((ConfGetBool("engine-analysis.mpm",
+                     &mpm_engine_analysis_set)) == 0) {
+        return 0;
+    }
+
+    if (mpm_engine_analysis_set == 0)
+        return 0;
+
+    char *log_dir;
+    char path[PATH_MAX];
+    log_dir = ConfigGetLogDirectory();
+    snprintf(path, sizeof(path), "%s/%s", log_dir, "mpm_analysis.txt");
+
+    mpm_engine_analysis_FD = fopen(path, "w");
+    if (mpm_engine_analysis_FD == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path,
+                   strerror(errno));
+        return 0;
+    }
+
+    SCLogInfo("Engine-Analysis for mpm printed to file - %s", path);
+
+    struct timeval tval;
+    struct tm *tms;
+    gettimeofday(&tval, NULL);
+    struct tm local_tm;
+    tms = SCLocalTime(tval.tv_sec, &local_tm);
+    fprintf(mpm_engine_analysis_FD, "----------------------------------------------"
+            "---------------------\n");
+    fprintf(mpm_engine_analysis_FD, "Date: %" PRId32 "/%" PRId32 "/%04d -- "
+            "%02d:%02d:%02d\n",
+            tms->tm_mday, tms->tm_mon + 1, tms->tm_year + 1900, tms->tm_hour,
+            tms->tm_min, tms->tm_sec);
+    fprintf(mpm_engine_analysis_FD, "----------------------------------------------"
+            "---------------------\n");
+
+    mpm_engine_analysis_sgh_cnt = 0;
+    mpm_engine_analysis_ctx_cnt = 0;
+    mpm_engine_analysis_memory = 0;
+    mpm_engine_analysis_seen = HashListTableInit(4096, EngineAnalysisMpmSeenHash,
+                                                 EngineAnalysisMpmSeenCompare, NULL);
+    return 1;
+}
+
+static void EngineAnalysisMpmCtx(DetectEngineCtx *de_ctx, const char *name,
+                                 MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx == NULL)
+        return;
+
+    /* "single" ctxs have mpm_type 0, they use the default matcher */
+    uint16_t mpm_type = mpm_ctx->mpm_type ? mpm_ctx->mpm_type : de_ctx->mpm_matcher;
+
+    fprintf(mpm_engine_analysis_FD, "    %-20s %-10s patterns %5" PRIu32
+            " minlen %3" PRIu16 " maxlen %3" PRIu16 " allocs %6" PRIu32
+            " memory %10" PRIu32, name,
+            mpm_table[mpm_type].name ? mpm_table[mpm_type].name : "<none>",
+            mpm_ctx->pattern_cnt, mpm_ctx->minlen, mpm_ctx->maxlen,
+            mpm_ctx->memory_cnt, mpm_ctx->memory_size);
+    if (mpm_ctx->shared_cnt > 0) {
+        fprintf(mpm_engine_analysis_FD, " shared by %" PRIu32,
+                mpm_ctx->shared_cnt + 1);
+    }
+    fprintf(mpm_engine_analysis_FD, "\n");
+
+    if (mpm_engine_analysis_seen != NULL) {
+        if (HashListTableLookup(mpm_engine_analysis_seen, mpm_ctx, 0) != NULL)
+            return;
+        (void)HashListTableAdd(mpm_engine_analysis_seen, mpm_ctx, 0);
+    }
+    mpm_engine_analysis_ctx_cnt++;
+    mpm_engine_analysis_memory += mpm_ctx->memory_size;
+}
+
+/**
+ * \brief Print the (not shared) mpm contexts of a signature group and
+ *        their memory use. Noop if the mpm analyzer is disabled.
+ */
+void EngineAnalysisMpm(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    if (mpm_engine_analysis_FD == NULL || sgh == NULL)
+        return;
+
+    struct {
+        const char *name;
+        MpmCtx *mpm_ctx;
+    } ctxs[] = {
+        { "proto_other", sgh->mpm_proto_other_ctx },
+        { "proto_tcp_ts", sgh->mpm_proto_tcp_ctx_ts },
+        { "proto_udp_ts", sgh->mpm_proto_udp_ctx_ts },
+        { "stream_ts", sgh->mpm_stream_ctx_ts },
+        { "uri_ts", sgh->mpm_uri_ctx_ts },
+        { "hcbd_ts", sgh->mpm_hcbd_ctx_ts },
+        { "hhd_ts", sgh->mpm_hhd_ctx_ts },
+        { "hrhd_ts", sgh->mpm_hrhd_ctx_ts },
+        { "hmd_ts", sgh->mpm_hmd_ctx_ts },
+        { "hcd_ts", sgh->mpm_hcd_ctx_ts },
+        { "hrud_ts", sgh->mpm_hrud_ctx_ts },
+        { "huad_ts", sgh->mpm_huad_ctx_ts },
+        { "hhhd_ts", sgh->mpm_hhhd_ctx_ts },
+        { "hrhhd_ts", sgh->mpm_hrhhd_ctx_ts },
+        { "dnsquery_ts", sgh->mpm_dnsquery_ctx_ts },
+        { "proto_tcp_tc", sgh->mpm_proto_tcp_ctx_tc },
+        { "proto_udp_tc", sgh->mpm_proto_udp_ctx_tc },
+        { "stream_tc", sgh->mpm_stream_ctx_tc },
+        { "hsbd_tc", sgh->mpm_hsbd_ctx_tc },
+        { "hhd_tc", sgh->mpm_hhd_ctx_tc },
+        { "hrhd_tc", sgh->mpm_hrhd_ctx_tc },
+        { "hcd_tc", sgh->mpm_hcd_ctx_tc },
+        { "hsmd_tc", sgh->mpm_hsmd_ctx_tc },
+        { "hscd_tc", sgh->mpm_hscd_ctx_tc },
+    };
+    int header = 0;
+    uint32_t u;
+
+    for (u = 0; u < sizeof(ctxs) / sizeof(ctxs[0]); u++) {
+        /* global ones are printed once by CleanupMpmAnalyzer */
+        if (ctxs[u].mpm_ctx == NULL || ctxs[u].mpm_ctx->global)
+            continue;
+
+        if (!header) {
+            fprintf(mpm_engine_analysis_FD, "== Signature group %" PRIu32
+                    ": %" PRIu32 " signatures\n", mpm_engine_analysis_sgh_cnt++,
+                    (uint32_t)sgh->sig_cnt);
+            header = 1;
+        }
+        EngineAnalysisMpmCtx(de_ctx, ctxs[u].name, ctxs[u].mpm_ctx);
+    }
+}
+
+/**
+ * \brief Print the shared mpm contexts and the totals, and close the
+ *        mpm analyzer file.
+ */
+void CleanupMpmAnalyzer(DetectEngineCtx *de_ctx)
+{
+    if (mpm_engine_analysis_FD == NULL)
+        return;
+
+    MpmCtxFactoryContainer *c = de_ctx->mpm_ctx_factory_container;
+    if (c != NULL) {
+        int32_t i;
+        fprintf(mpm_engine_analysis_FD, "== Global mpm contexts\n");
+        for (i = 0; i < c->no_of_items; i++) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s_ts", c->items[i].name);
+            EngineAnalysisMpmCtx(de_ctx, name, c->items[i].mpm_ctx_ts);
+            snprintf(name, sizeof(name), "%s_tc", c->items[i].name);
+            EngineAnalysisMpmCtx(de_ctx, name, c->items[i].mpm_ctx_tc);
+        }
+    }
+
+    fprintf(mpm_engine_analysis_FD, "== Total: %" PRIu64 " unique mpm contexts, %"
+            PRIu64 " bytes\n", mpm_engine_analysis_ctx_cnt,
+            mpm_engine_analysis_memory);
+
+    if (mpm_engine_analysis_seen != NULL) {
+        HashListTableFree(mpm_engine_analysis_seen);
+        mpm_engine_analysis_seen = NULL;
+    }
+
+    fclose(mpm_engine_analysis_FD);
+    mpm_engine_analysis_FD = NULL;
+}
+
 /**
  * \brief Compiles regex for rule analysis
  * \retval 1 if successful
@@ -32,6 +32,10 @@ void CleanupFPAnalyzer(void);
 int SetupRuleAnalyzer(void);
 void CleanupRuleAnalyzer (void);
 
+int SetupMpmAnalyzer(void);
+void CleanupMpmAnalyzer(DetectEngineCtx *de_ctx);
+void EngineAnalysisMpm(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+
 int PerCentEncodingSetup ();
 int PerCentEncodingMatch (uint8_t *content, uint8_t content_len);
 
@@ -37,7 +37,6 @@ int DetectEngineInspectHttpClientBody(ThreadVars *tv,
                                       Signature *s, Flow *f, uint8_t flags,
                                       void *alstate,
                                       void *tx, uint64_t tx_id);
-void DetectEngineCleanHCBDBuffers(DetectEngineThreadCtx *);
 
 void DetectEngineHttpClientBodyRegisterTests(void);
 
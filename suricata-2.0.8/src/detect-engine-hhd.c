@@ -58,100 +58,59 @@
 #include "app-layer-htp.h"
 #include "app-layer-protos.h"
 
-#define BUFFER_STEP 50
-
-static inline int HHDCreateSpace(DetectEngineThreadCtx *det_ctx, uint16_t size) {
-    void *ptmp;
-    if (size > det_ctx->hhd_buffers_size) {
-        ptmp = SCRealloc(det_ctx->hhd_buffers,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint8_t *));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers);
-            det_ctx->hhd_buffers = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers = ptmp;
-
-        memset(det_ctx->hhd_buffers + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint8_t *));
-        ptmp = SCRealloc(det_ctx->hhd_buffers_len,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint32_t));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers_len);
-            det_ctx->hhd_buffers_len = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers_len = ptmp;
+/** set in the generation once the transaction is complete in that direction,
+ *  no more headers (trailers) can be added after that */
+#define HHD_GEN_FINAL   0x80000000U
 
-        memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint32_t));
-        det_ctx->hhd_buffers_size += BUFFER_STEP;
-    }
-    memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_list_len, 0, (size - det_ctx->hhd_buffers_list_len) * sizeof(uint32_t));
-
-    return 0;
-}
-
-static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
-                                              DetectEngineCtx *de_ctx,
-                                              DetectEngineThreadCtx *det_ctx,
-                                              Flow *f, HtpState *htp_state,
-                                              uint8_t flags,
-                                              uint32_t *buffer_len)
+/**
+ *  \internal
+ *  \brief Build the normalized "name: value\r\n" header buffer, skipping the
+ *         cookies which have their own buffer.
+ *
+ *  \retval 0 ok, *buffer is NULL if there was nothing to add
+ *  \retval -1 memcap or allocation error
+ */
+static int HHDBuildBuffer(htp_table_t *headers, uint8_t flags,
+                          uint8_t **buffer, uint32_t *buffer_len)
 {
-    uint8_t *headers_buffer = NULL;
-    int index = 0;
+    size_t no_of_headers = htp_table_size(headers);
+    size_t headers_buffer_len = 0;
+    htp_header_t *h = NULL;
+    size_t i = 0;
+
+    *buffer = NULL;
     *buffer_len = 0;
 
-    if (det_ctx->hhd_buffers_list_len == 0) {
-        if (HHDCreateSpace(det_ctx, 1) < 0)
-            goto end;
-        index = 0;
+    /* first pass: size the buffer so we only need one allocation */
+    for (i = 0; i < no_of_headers; i++) {
+        h = htp_table_get_index(headers, i, NULL);
+        size_t size1 = bstr_size(h->name);
 
-        if (det_ctx->hhd_buffers_list_len == 0) {
-            det_ctx->hhd_start_tx_id = tx_id;
-        }
-        det_ctx->hhd_buffers_list_len++;
-    } else {
-        if ((tx_id - det_ctx->hhd_start_tx_id) < det_ctx->hhd_buffers_list_len) {
-            if (det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)] != 0) {
-                *buffer_len = det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)];
-                return det_ctx->hhd_buffers[(tx_id - det_ctx->hhd_start_tx_id)];
+        if (flags & STREAM_TOSERVER) {
+            if (size1 == 6 &&
+                SCMemcmpLowercase("cookie", bstr_ptr(h->name), 6) == 0) {
+                continue;
             }
         } else {
-            if (HHDCreateSpace(det_ctx, (tx_id - det_ctx->hhd_start_tx_id) + 1) < 0)
-                goto end;
-
-            if (det_ctx->hhd_buffers_list_len == 0) {
-                det_ctx->hhd_start_tx_id = tx_id;
+            if (size1 == 10 &&
+                SCMemcmpLowercase("set-cookie", bstr_ptr(h->name), 10) == 0) {
+                continue;
             }
-            det_ctx->hhd_buffers_list_len++;
         }
-        index = (tx_id - det_ctx->hhd_start_tx_id);
-    }
-
-    htp_table_t *headers;
-    if (flags & STREAM_TOSERVER) {
-        if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, STREAM_TOSERVER) <= HTP_REQUEST_HEADERS)
-            goto end;
-        headers = tx->request_headers;
-    } else {
-        if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, STREAM_TOCLIENT) <= HTP_RESPONSE_HEADERS)
-            goto end;
-        headers = tx->response_headers;
+        /* the extra 4 bytes if for ": " and "\r\n" */
+        headers_buffer_len += size1 + bstr_size(h->value) + 4;
     }
-    if (headers == NULL)
-        goto end;
+    if (headers_buffer_len == 0)
+        return 0;
+    if (headers_buffer_len > UINT32_MAX)
+        return -1;
 
-    htp_header_t *h = NULL;
-    headers_buffer = det_ctx->hhd_buffers[index];
-    size_t headers_buffer_len = 0;
-    size_t i = 0;
+    uint8_t *headers_buffer = HTPMalloc(headers_buffer_len);
+    if (unlikely(headers_buffer == NULL))
+        return -1;
 
-    size_t no_of_headers = htp_table_size(headers);
-    for (; i < no_of_headers; i++) {
+    uint8_t *ptr = headers_buffer;
+    for (i = 0; i < no_of_headers; i++) {
         h = htp_table_get_index(headers, i, NULL);
         size_t size1 = bstr_size(h->name);
         size_t size2 = bstr_size(h->value);
@@ -168,39 +127,123 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
             }
         }
 
-        /* the extra 4 bytes if for ": " and "\r\n" */
-        uint8_t *new_headers_buffer = SCRealloc(headers_buffer, headers_buffer_len + size1 + size2 + 4);
-        if (unlikely(new_headers_buffer == NULL)) {
-            if (headers_buffer != NULL) {
-                SCFree(headers_buffer);
-                headers_buffer = NULL;
-            }
-            det_ctx->hhd_buffers[index] = NULL;
-            det_ctx->hhd_buffers_len[index] = 0;
-            goto end;
-        }
-        headers_buffer = new_headers_buffer;
+        memcpy(ptr, bstr_ptr(h->name), size1);
+        ptr += size1;
+        *ptr++ = ':';
+        *ptr++ = ' ';
+        memcpy(ptr, bstr_ptr(h->value), size2);
+        ptr += size2;
+        *ptr++ = '\r';
+        *ptr++ = '\n';
+    }
+
+    *buffer = headers_buffer;
+    *buffer_len = (uint32_t)headers_buffer_len;
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief generation of a header table, changes whenever a header is added
+ *         and when a repeated header is merged into an existing one.
+ *
+ *  libhtp merges a repeated name ("v1, v2") without growing the table, so
+ *  the table size alone misses it. Values only grow, so the total length
+ *  of the names and values changes on every update.
+ *
+ *  \retval gen never 0 and without the HHD_GEN_FINAL bit
+ */
+static uint32_t HHDHeadersGen(htp_table_t *headers)
+{
+    size_t no_of_headers = htp_table_size(headers);
+    uint64_t total = no_of_headers;
+    size_t i;
+
+    for (i = 0; i < no_of_headers; i++) {
+        htp_header_t *h = htp_table_get_index(headers, i, NULL);
+        total += bstr_len(h->name) + bstr_len(h->value);
+    }
+    return (uint32_t)(total % (HHD_GEN_FINAL - 1)) + 1;
+}
+
+/**
+ *  \brief Get the normalized header buffer of a transaction.
+ *
+ *  The buffer is built on first use and cached in the tx user data, so
+ *  that later packets, signatures and detect threads inspecting the same
+ *  transaction use it without copying. It's rebuilt only if headers were
+ *  added or merged (trailers) since it was built.
+ */
+static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
+                                              DetectEngineCtx *de_ctx,
+                                              DetectEngineThreadCtx *det_ctx,
+                                              Flow *f, HtpState *htp_state,
+                                              uint8_t flags,
+                                              uint32_t *buffer_len)
+{
+    *buffer_len = 0;
+
+    htp_table_t *headers;
+    int complete;
+    if (flags & STREAM_TOSERVER) {
+        int progress = AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, STREAM_TOSERVER);
+        if (progress <= HTP_REQUEST_HEADERS)
+            return NULL;
+        complete = (progress >= HTP_REQUEST_COMPLETE);
+        headers = tx->request_headers;
+    } else {
+        int progress = AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, STREAM_TOCLIENT);
+        if (progress <= HTP_RESPONSE_HEADERS)
+            return NULL;
+        complete = (progress >= HTP_RESPONSE_COMPLETE);
+        headers = tx->response_headers;
+    }
+    if (headers == NULL)
+        return NULL;
+
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    if (htud == NULL) {
+        htud = HTPMalloc(sizeof(HtpTxUserData));
+        if (unlikely(htud == NULL))
+            return NULL;
+        memset(htud, 0, sizeof(HtpTxUserData));
+        htp_tx_set_user_data(tx, htud);
+    }
 
-        memcpy(headers_buffer + headers_buffer_len, bstr_ptr(h->name), size1);
-        headers_buffer_len += size1;
-        headers_buffer[headers_buffer_len] = ':';
-        headers_buffer[headers_buffer_len + 1] = ' ';
-        headers_buffer_len += 2;
-        memcpy(headers_buffer + headers_buffer_len, bstr_ptr(h->value), size2);
-        headers_buffer_len += size2 + 2;
-        /* \r */
-        headers_buffer[headers_buffer_len - 2] = '\r';
-        /* \n */
-        headers_buffer[headers_buffer_len - 1] = '\n';
+    uint8_t **buf;
+    uint32_t *len;
+    uint32_t *gen;
+    if (flags & STREAM_TOSERVER) {
+        buf = &htud->request_headers_buf;
+        len = &htud->request_headers_buf_len;
+        gen = &htud->request_headers_buf_gen;
+    } else {
+        buf = &htud->response_headers_buf;
+        len = &htud->response_headers_buf_len;
+        gen = &htud->response_headers_buf_gen;
     }
 
-    /* store the buffers.  We will need it for further inspection */
-    det_ctx->hhd_buffers[index] = headers_buffer;
-    det_ctx->hhd_buffers_len[index] = headers_buffer_len;
+    if (!(*gen & HHD_GEN_FINAL)) {
+        uint32_t cur_gen = HHDHeadersGen(headers) |
+                           (complete ? HHD_GEN_FINAL : 0);
+        if ((cur_gen & ~HHD_GEN_FINAL) != (*gen & ~HHD_GEN_FINAL)) {
+            SCLogDebug("building header buffer for tx %"PRIu64, tx_id);
+            if (*buf != NULL) {
+                HTPFree(*buf, *len);
+                *buf = NULL;
+                *len = 0;
+            }
+            if (HHDBuildBuffer(headers, flags, buf, len) < 0) {
+                /* try again on the next call */
+                *gen = 0;
+                return NULL;
+            }
+        }
+        *gen = cur_gen;
+    }
 
-    *buffer_len = (uint32_t)headers_buffer_len;
- end:
-    return headers_buffer;
+    *buffer_len = *len;
+    return *buf;
 }
 
 int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
@@ -263,20 +306,6 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
     return DETECT_ENGINE_INSPECT_SIG_NO_MATCH;
 }
 
-void DetectEngineCleanHHDBuffers(DetectEngineThreadCtx *det_ctx)
-{
-    if (det_ctx->hhd_buffers_list_len != 0) {
-        int i;
-        for (i = 0; i < det_ctx->hhd_buffers_list_len; i++) {
-            det_ctx->hhd_buffers_len[i] = 0;
-        }
-        det_ctx->hhd_buffers_list_len = 0;
-    }
-    det_ctx->hhd_start_tx_id = 0;
-
-    return;
-}
-
 /***********************************Unittests**********************************/
 
 #ifdef UNITTESTS
@@ -3810,6 +3839,238 @@ end:
     return result;
 }
 
+/**
+ *\test Test that the header buffer is built once and cached on the
+ *      transaction, without the cookie.
+ */
+static int DetectEngineHttpHeaderTest34(void)
+{
+    TcpSession ssn;
+    Packet *p = NULL;
+    ThreadVars th_v;
+    DetectEngineCtx *de_ctx = NULL;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    HtpState *http_state = NULL;
+    Flow f;
+    uint8_t http_buf[] =
+        "GET /index.html HTTP/1.0\r\n"
+        "Host: www.onetwothreefourfivesixseven.org\r\n"
+        "Cookie: nine\r\n\r\n";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    char expect[] = "Host: www.onetwothreefourfivesixseven.org\r\n";
+    int result = 0;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    p->flow = &f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->flowflags |= FLOW_PKT_ESTABLISHED;
+    p->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx,"alert http any any -> any any "
+                               "(msg:\"http header test\"; "
+                               "content:\"one\"; http_header; "
+                               "sid:1;)");
+    if (de_ctx->sig_list == NULL)
+        goto end;
+    de_ctx->sig_list->next = SigInit(de_ctx,"alert http any any -> any any "
+                               "(msg:\"http header test\"; "
+                               "content:\"nine\"; http_header; "
+                               "sid:2;)");
+    if (de_ctx->sig_list->next == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf, http_len);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    http_state = f.alstate;
+    if (http_state == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+
+    /* do detect */
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+
+    if (!(PacketAlertCheck(p, 1))) {
+        printf("sid 1 didn't match but should have: ");
+        goto end;
+    }
+    if (PacketAlertCheck(p, 2)) {
+        printf("sid 2 matched but shouldn't have: ");
+        goto end;
+    }
+
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    HtpTxUserData *htud = tx ? (HtpTxUserData *)htp_tx_get_user_data(tx) : NULL;
+    if (htud == NULL || htud->request_headers_buf == NULL) {
+        printf("no cached header buffer: ");
+        goto end;
+    }
+    if (htud->request_headers_buf_len != sizeof(expect) - 1 ||
+        memcmp(htud->request_headers_buf, expect, sizeof(expect) - 1) != 0) {
+        printf("unexpected header buffer: ");
+        goto end;
+    }
+    uint8_t *buf = htud->request_headers_buf;
+    uint32_t gen = htud->request_headers_buf_gen;
+
+    /* a new packet on the same tx uses the same buffer */
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+
+    if (htud->request_headers_buf != buf ||
+        htud->request_headers_buf_gen != gen) {
+        printf("header buffer was rebuilt: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL)
+        SigGroupCleanup(de_ctx);
+    if (de_ctx != NULL)
+        SigCleanSignatures(de_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p, 1);
+    return result;
+}
+
+/**
+ *\test Test that a trailer repeating a header, which libhtp merges into
+ *      the existing header without growing the table, rebuilds the cached
+ *      header buffer.
+ */
+static int DetectEngineHttpHeaderTest35(void)
+{
+    Flow f;
+    TcpSession ssn;
+    HtpState *http_state = NULL;
+    uint8_t http_buf1[] =
+        "POST /index.html HTTP/1.1\r\n"
+        "Host: www.example.org\r\n"
+        "X-A: one\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n"
+        "3\r\nabc\r\n";
+    uint32_t http_len1 = sizeof(http_buf1) - 1;
+    uint8_t http_buf2[] =
+        "0\r\n"
+        "X-A: two\r\n\r\n";
+    uint32_t http_len2 = sizeof(http_buf2) - 1;
+    char expect1[] = "Host: www.example.org\r\n"
+        "X-A: one\r\n"
+        "Transfer-Encoding: chunked\r\n";
+    char expect2[] = "Host: www.example.org\r\n"
+        "X-A: one, two\r\n"
+        "Transfer-Encoding: chunked\r\n";
+    uint8_t *buf;
+    uint32_t buf_len = 0;
+    int result = 0;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf1, http_len1);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    http_state = f.alstate;
+    if (http_state == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    if (tx == NULL)
+        goto end;
+
+    buf = DetectEngineHHDGetBufferForTX(tx, 0, NULL, NULL, &f, http_state,
+                                        STREAM_TOSERVER, &buf_len);
+    if (buf == NULL || buf_len != sizeof(expect1) - 1 ||
+        memcmp(buf, expect1, buf_len) != 0) {
+        printf("unexpected header buffer before the trailer: ");
+        goto end;
+    }
+    size_t headers = htp_table_size(tx->request_headers);
+
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf2, http_len2);
+    if (r != 0) {
+        printf("toserver chunk 2 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    if (htp_table_size(tx->request_headers) != headers) {
+        printf("trailer wasn't merged into the existing header: ");
+        goto end;
+    }
+
+    buf = DetectEngineHHDGetBufferForTX(tx, 0, NULL, NULL, &f, http_state,
+                                        STREAM_TOSERVER, &buf_len);
+    if (buf == NULL || buf_len != sizeof(expect2) - 1 ||
+        memcmp(buf, expect2, buf_len) != 0) {
+        printf("header buffer wasn't rebuilt after the trailer: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineHttpHeaderRegisterTests(void)
@@ -3886,6 +4147,10 @@ void DetectEngineHttpHeaderRegisterTests(void)
                    DetectEngineHttpHeaderTest32, 1);
     UtRegisterTest("DetectEngineHttpHeaderTest33",
                    DetectEngineHttpHeaderTest33, 1);
+    UtRegisterTest("DetectEngineHttpHeaderTest34",
+                   DetectEngineHttpHeaderTest34, 1);
+    UtRegisterTest("DetectEngineHttpHeaderTest35",
+                   DetectEngineHttpHeaderTest35, 1);
 
 #endif /* UNITTESTS */
 
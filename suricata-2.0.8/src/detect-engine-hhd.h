@@ -34,7 +34,6 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
 int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *tx, uint64_t idx);
-void DetectEngineCleanHHDBuffers(DetectEngineThreadCtx *det_ctx);
 
 void DetectEngineHttpHeaderRegisterTests(void);
 
@@ -61,98 +61,55 @@
 #include "conf.h"
 #include "conf-yaml-loader.h"
 
-#define BUFFER_STEP 50
-
-static inline int HSBDCreateSpace(DetectEngineThreadCtx *det_ctx, uint16_t size)
-{
-    void *ptmp;
-    if (size > det_ctx->hsbd_buffers_size) {
-        ptmp = SCRealloc(det_ctx->hsbd,
-                         (det_ctx->hsbd_buffers_size + BUFFER_STEP) * sizeof(HttpReassembledBody));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hsbd);
-            det_ctx->hsbd = NULL;
-            det_ctx->hsbd_buffers_size = 0;
-            det_ctx->hsbd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hsbd = ptmp;
-
-        memset(det_ctx->hsbd + det_ctx->hsbd_buffers_size, 0, BUFFER_STEP * sizeof(HttpReassembledBody));
-        det_ctx->hsbd_buffers_size += BUFFER_STEP;
-    }
-    for (int i = det_ctx->hsbd_buffers_list_len; i < (size); i++) {
-        det_ctx->hsbd[i].buffer_len = 0;
-        det_ctx->hsbd[i].offset = 0;
-    }
-
-    return 0;
-}
-
-
+/**
+ *  \brief Get the reassembled response body inspection buffer of a transaction.
+ *
+ *  The buffer lives in the tx user data and is reused between packets. It's
+ *  built at most once per detection pass (det_ctx->inspect_pass): all
+ *  signatures and the mpm of the pass share it, the next pass only rebuilds
+ *  it if new body data arrived.
+ */
 static uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
                                                DetectEngineCtx *de_ctx,
                                                DetectEngineThreadCtx *det_ctx,
                                                Flow *f, HtpState *htp_state,
                                                uint8_t flags,
                                                uint32_t *buffer_len,
-                                               uint32_t *stream_start_offset)
+                                               uint64_t *stream_start_offset)
 {
-    int index = 0;
-    uint8_t *buffer = NULL;
     *buffer_len = 0;
     *stream_start_offset = 0;
 
-    if (det_ctx->hsbd_buffers_list_len == 0) {
-        if (HSBDCreateSpace(det_ctx, 1) < 0)
-            goto end;
-        index = 0;
-
-        if (det_ctx->hsbd_buffers_list_len == 0) {
-            det_ctx->hsbd_start_tx_id = tx_id;
-        }
-        det_ctx->hsbd_buffers_list_len++;
-    } else {
-        if ((tx_id - det_ctx->hsbd_start_tx_id) < det_ctx->hsbd_buffers_list_len) {
-            if (det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].buffer_len != 0) {
-                *buffer_len = det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].buffer_len;
-                *stream_start_offset = det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].offset;
-                return det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].buffer;
-            }
-        } else {
-            if (HSBDCreateSpace(det_ctx, (tx_id - det_ctx->hsbd_start_tx_id) + 1) < 0)
-                goto end;
-
-            if (det_ctx->hsbd_buffers_list_len == 0) {
-                det_ctx->hsbd_start_tx_id = tx_id;
-            }
-            det_ctx->hsbd_buffers_list_len++;
-        }
-        index = (tx_id - det_ctx->hsbd_start_tx_id);
-    }
-
     HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
     if (htud == NULL) {
         SCLogDebug("no htud");
-        goto end;
+        return NULL;
+    }
+    HtpBody *body = &htud->response_body;
+
+    /* built earlier in this pass */
+    if (body->inspect_pass == det_ctx->inspect_pass) {
+        *buffer_len = body->inspect_buf_len;
+        *stream_start_offset = body->inspect_offset;
+        return body->inspect_buf;
     }
 
     /* no new data */
-    if (htud->response_body.body_inspected == htud->response_body.content_len_so_far) {
+    if (body->body_inspected == body->content_len_so_far) {
         SCLogDebug("no new data");
-        goto end;
+        return NULL;
     }
 
-    HtpBodyChunk *cur = htud->response_body.first;
+    HtpBodyChunk *cur = body->first;
     if (cur == NULL) {
         SCLogDebug("No http chunks to inspect for this transacation");
-        goto end;
+        return NULL;
     }
 
     SCLogDebug("response_body_limit %u response_body.content_len_so_far %"PRIu64
                ", response_inspect_min_size %"PRIu32", EOF %s, progress > body? %s",
               htp_state->cfg->response_body_limit,
-              htud->response_body.content_len_so_far,
+              body->content_len_so_far,
               htp_state->cfg->response_inspect_min_size,
               flags & STREAM_EOF ? "true" : "false",
                (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, STREAM_TOCLIENT) > HTP_RESPONSE_BODY) ? "true" : "false");
@@ -160,65 +117,55 @@ static uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
     /* inspect the body if the transfer is complete or we have hit
      * our body size limit */
     if ((htp_state->cfg->response_body_limit == 0 ||
-         htud->response_body.content_len_so_far < htp_state->cfg->response_body_limit) &&
-        htud->response_body.content_len_so_far < htp_state->cfg->response_inspect_min_size &&
+         body->content_len_so_far < htp_state->cfg->response_body_limit) &&
+        body->content_len_so_far < htp_state->cfg->response_inspect_min_size &&
         !(AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, STREAM_TOCLIENT) > HTP_RESPONSE_BODY) &&
         !(flags & STREAM_EOF)) {
         SCLogDebug("we still haven't seen the entire response body.  "
                    "Let's defer body inspection till we see the "
                    "entire body.");
-        goto end;
+        return NULL;
     }
 
-    int first = 1;
-    while (cur != NULL) {
-        /* see if we can filter out chunks */
-        if (htud->response_body.body_inspected > 0) {
-            if (cur->stream_offset < htud->response_body.body_inspected) {
-                if ((htud->response_body.body_inspected - cur->stream_offset) > htp_state->cfg->response_inspect_window) {
-                    cur = cur->next;
-                    continue;
-                } else {
-                    /* include this one */
-                }
-            } else {
-                /* include this one */
-            }
-        }
-
-        if (first) {
-            det_ctx->hsbd[index].offset = cur->stream_offset;
-            first = 0;
-        }
-
-        /* see if we need to grow the buffer */
-        if (det_ctx->hsbd[index].buffer == NULL || (det_ctx->hsbd[index].buffer_len + cur->len) > det_ctx->hsbd[index].buffer_size) {
-            void *ptmp;
-            det_ctx->hsbd[index].buffer_size += cur->len * 2;
-
-            if ((ptmp = SCRealloc(det_ctx->hsbd[index].buffer, det_ctx->hsbd[index].buffer_size)) == NULL) {
-                SCFree(det_ctx->hsbd[index].buffer);
-                det_ctx->hsbd[index].buffer = NULL;
-                det_ctx->hsbd[index].buffer_size = 0;
-                det_ctx->hsbd[index].buffer_len = 0;
-                goto end;
-            }
-            det_ctx->hsbd[index].buffer = ptmp;
-        }
-        memcpy(det_ctx->hsbd[index].buffer + det_ctx->hsbd[index].buffer_len, cur->data, cur->len);
-        det_ctx->hsbd[index].buffer_len += cur->len;
-
+    /* skip the chunks we inspected before, except for the last part of
+     * them we keep as a window for the matches crossing chunks */
+    while (cur != NULL && body->body_inspected > 0 &&
+           cur->stream_offset < body->body_inspected &&
+           (body->body_inspected - cur->stream_offset) > htp_state->cfg->response_inspect_window) {
         cur = cur->next;
     }
+    if (cur == NULL)
+        return NULL;
+
+    uint64_t len = 0;
+    HtpBodyChunk *c;
+    for (c = cur; c != NULL; c = c->next)
+        len += c->len;
+    if (len == 0 || len > UINT32_MAX)
+        return NULL;
+
+    if (len > body->inspect_buf_size) {
+        void *ptmp = HTPRealloc(body->inspect_buf, body->inspect_buf_size, len);
+        if (ptmp == NULL)
+            return NULL;
+        body->inspect_buf = ptmp;
+        body->inspect_buf_size = (uint32_t)len;
+    }
+
+    body->inspect_offset = cur->stream_offset;
+    body->inspect_buf_len = 0;
+    for (c = cur; c != NULL; c = c->next) {
+        memcpy(body->inspect_buf + body->inspect_buf_len, c->data, c->len);
+        body->inspect_buf_len += c->len;
+    }
+    body->inspect_pass = det_ctx->inspect_pass;
 
     /* update inspected tracker */
-    htud->response_body.body_inspected = htud->response_body.last->stream_offset + htud->response_body.last->len;
+    body->body_inspected = body->last->stream_offset + body->last->len;
 
-    buffer = det_ctx->hsbd[index].buffer;
-    *buffer_len = det_ctx->hsbd[index].buffer_len;
-    *stream_start_offset = det_ctx->hsbd[index].offset;
- end:
-    return buffer;
+    *buffer_len = body->inspect_buf_len;
+    *stream_start_offset = body->inspect_offset;
+    return body->inspect_buf;
 }
 
 int DetectEngineRunHttpServerBodyMpm(DetectEngineCtx *de_ctx,
@@ -228,7 +175,7 @@ int DetectEngineRunHttpServerBodyMpm(DetectEngineCtx *de_ctx,
 {
     uint32_t cnt = 0;
     uint32_t buffer_len = 0;
-    uint32_t stream_start_offset = 0;
+    uint64_t stream_start_offset = 0;
     uint8_t *buffer = DetectEngineHSBDGetBufferForTX(tx, idx,
                                                      de_ctx, det_ctx,
                                                      f, htp_state,
@@ -238,7 +185,11 @@ int DetectEngineRunHttpServerBodyMpm(DetectEngineCtx *de_ctx,
     if (buffer_len == 0)
         goto end;
 
-    cnt = HttpServerBodyPatternSearch(det_ctx, buffer, buffer_len, flags);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    cnt = HttpServerBodyPatternSearch(det_ctx, buffer, buffer_len,
+                                      stream_start_offset,
+                                      htud ? &htud->response_body.mpm_state : NULL,
+                                      flags);
 
  end:
     return cnt;
@@ -253,7 +204,7 @@ int DetectEngineInspectHttpServerBody(ThreadVars *tv,
 {
     HtpState *htp_state = (HtpState *)alstate;
     uint32_t buffer_len = 0;
-    uint32_t stream_start_offset = 0;
+    uint64_t stream_start_offset = 0;
     uint8_t *buffer = DetectEngineHSBDGetBufferForTX(tx, tx_id,
                                                      de_ctx, det_ctx,
                                                      f, htp_state,
@@ -282,20 +233,6 @@ int DetectEngineInspectHttpServerBody(ThreadVars *tv,
         return DETECT_ENGINE_INSPECT_SIG_NO_MATCH;
 }
 
-void DetectEngineCleanHSBDBuffers(DetectEngineThreadCtx *det_ctx)
-{
-    if (det_ctx->hsbd_buffers_list_len > 0) {
-        for (int i = 0; i < det_ctx->hsbd_buffers_list_len; i++) {
-            det_ctx->hsbd[i].buffer_len = 0;
-            det_ctx->hsbd[i].offset = 0;
-        }
-    }
-    det_ctx->hsbd_buffers_list_len = 0;
-    det_ctx->hsbd_start_tx_id = 0;
-
-    return;
-}
-
 /***********************************Unittests**********************************/
 
 #ifdef UNITTESTS
@@ -3630,6 +3567,146 @@ end:
     return result;
 }
 
+/**
+ *\test Test that the reassembled response body buffer on the tx is shared
+ *      within a detection pass, only rebuilt on new body data and that its
+ *      allocation is reused.
+ */
+static int DetectEngineHttpServerBodyTest23(void)
+{
+    Flow f;
+    TcpSession ssn;
+    HtpState *http_state = NULL;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint8_t http_buf1[] =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: www.example.org\r\n"
+        "\r\n";
+    uint32_t http_len1 = sizeof(http_buf1) - 1;
+    uint8_t http_buf2[] =
+        "HTTP/1.1 200 ok\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "abcde";
+    uint32_t http_len2 = sizeof(http_buf2) - 1;
+    uint8_t http_body2[] = "fghij";
+    uint32_t http_body2_len = sizeof(http_body2) - 1;
+    uint8_t *buf, *first_buf;
+    uint32_t buf_len = 0;
+    uint64_t offset = 0;
+    uint32_t min_size = 0, window = 0;
+    int result = 0;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+    AppLayerHtpEnableResponseBodyCallback();
+
+    det_ctx = SCMalloc(sizeof(DetectEngineThreadCtx));
+    if (det_ctx == NULL)
+        goto end;
+    memset(det_ctx, 0, sizeof(DetectEngineThreadCtx));
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf1, http_len1);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOCLIENT, http_buf2, http_len2);
+    if (r != 0) {
+        printf("toclient chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    http_state = f.alstate;
+    if (http_state == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    if (tx == NULL)
+        goto end;
+
+    /* inspect as soon as we have 4 bytes, keep 4 bytes as window */
+    min_size = http_state->cfg->response_inspect_min_size;
+    window = http_state->cfg->response_inspect_window;
+    http_state->cfg->response_inspect_min_size = 4;
+    http_state->cfg->response_inspect_window = 4;
+
+    det_ctx->inspect_pass = 1;
+    first_buf = DetectEngineHSBDGetBufferForTX(tx, 0, NULL, det_ctx, &f, http_state,
+                                               STREAM_TOCLIENT, &buf_len, &offset);
+    if (first_buf == NULL || buf_len != 5 || offset != 0 ||
+        memcmp(first_buf, "abcde", 5) != 0) {
+        printf("unexpected body buffer: ");
+        goto end;
+    }
+
+    /* same pass: the mpm and the other signatures get the same buffer,
+     * even though the data is inspected by now */
+    buf = DetectEngineHSBDGetBufferForTX(tx, 0, NULL, det_ctx, &f, http_state,
+                                         STREAM_TOCLIENT, &buf_len, &offset);
+    if (buf != first_buf || buf_len != 5 || offset != 0) {
+        printf("body buffer not shared within the pass: ");
+        goto end;
+    }
+
+    /* next pass without new data: nothing to inspect */
+    det_ctx->inspect_pass = 2;
+    buf = DetectEngineHSBDGetBufferForTX(tx, 0, NULL, det_ctx, &f, http_state,
+                                         STREAM_TOCLIENT, &buf_len, &offset);
+    if (buf != NULL || buf_len != 0) {
+        printf("body buffer without new data: ");
+        goto end;
+    }
+
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOCLIENT, http_body2, http_body2_len);
+    if (r != 0) {
+        printf("toclient chunk 2 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    /* new data: the old chunk is out of the window, the buffer is rebuilt
+     * in the same allocation */
+    det_ctx->inspect_pass = 3;
+    buf = DetectEngineHSBDGetBufferForTX(tx, 0, NULL, det_ctx, &f, http_state,
+                                         STREAM_TOCLIENT, &buf_len, &offset);
+    if (buf != first_buf || buf_len != 5 || offset != 5 ||
+        memcmp(buf, "fghij", 5) != 0) {
+        printf("body buffer not rebuilt for the new data: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (http_state != NULL && min_size != 0) {
+        http_state->cfg->response_inspect_min_size = min_size;
+        http_state->cfg->response_inspect_window = window;
+    }
+    if (det_ctx != NULL)
+        SCFree(det_ctx);
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineHttpServerBodyRegisterTests(void)
@@ -3687,6 +3764,8 @@ void DetectEngineHttpServerBodyRegisterTests(void)
                    DetectEngineHttpServerBodyFileDataTest02, 1);
     UtRegisterTest("DetectEngineHttpServerBodyFileDataTest03",
                    DetectEngineHttpServerBodyFileDataTest03, 1);
+    UtRegisterTest("DetectEngineHttpServerBodyTest23",
+                   DetectEngineHttpServerBodyTest23, 1);
 #endif /* UNITTESTS */
 
     return;
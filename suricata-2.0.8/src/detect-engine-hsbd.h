@@ -37,7 +37,6 @@ int DetectEngineInspectHttpServerBody(ThreadVars *tv,
                                       Signature *s, Flow *f, uint8_t flags,
                                       void *alstate,
                                       void *tx, uint64_t tx_id);
-void DetectEngineCleanHSBDBuffers(DetectEngineThreadCtx *det_ctx);
 
 void DetectEngineHttpServerBodyRegisterTests(void);
 
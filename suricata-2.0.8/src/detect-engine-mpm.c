@@ -285,14 +285,19 @@ uint32_t UriPatternSearch(DetectEngineThreadCtx *det_ctx,
 /** \brief Http client body pattern match -- searches for one pattern per
  *         signature.
  *
- *  \param det_ctx  Detection engine thread ctx.
- *  \param body     The request body to inspect.
- *  \param body_len Body length.
+ *  \param det_ctx     Detection engine thread ctx.
+ *  \param body        The request body to inspect.
+ *  \param body_len    Body length.
+ *  \param body_offset Offset of the buffer in the body.
+ *  \param st          Saved mpm state of the body, or NULL to scan the
+ *                     whole buffer.
  *
  *  \retval ret Number of matches.
  */
 uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
-                                     uint8_t *body, uint32_t body_len, uint8_t flags)
+                                     uint8_t *body, uint32_t body_len,
+                                     uint64_t body_offset, MpmStreamState *st,
+                                     uint8_t flags)
 {
     SCEnter();
 
@@ -301,9 +306,15 @@ uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
         if (det_ctx->sgh->mpm_hcbd_ctx_ts == NULL)
             SCReturnUInt(0);
 
-        ret = mpm_table[det_ctx->sgh->mpm_hcbd_ctx_ts->mpm_type].
-            Search(det_ctx->sgh->mpm_hcbd_ctx_ts, &det_ctx->mtcu,
-                   &det_ctx->pmq, body, body_len);
+        if (st != NULL && det_ctx->body_pmq.pattern_id_bitarray != NULL) {
+            ret = MpmSearchStream(det_ctx->sgh->mpm_hcbd_ctx_ts, &det_ctx->mtcu,
+                                  &det_ctx->pmq, &det_ctx->body_pmq, st,
+                                  body, body_len, body_offset);
+        } else {
+            ret = mpm_table[det_ctx->sgh->mpm_hcbd_ctx_ts->mpm_type].
+                Search(det_ctx->sgh->mpm_hcbd_ctx_ts, &det_ctx->mtcu,
+                       &det_ctx->pmq, body, body_len);
+        }
     } else {
         BUG_ON(1);
     }
@@ -314,14 +325,19 @@ uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
 /** \brief Http server body pattern match -- searches for one pattern per
  *         signature.
  *
- *  \param det_ctx  Detection engine thread ctx.
- *  \param body     The request body to inspect.
- *  \param body_len Body length.
+ *  \param det_ctx     Detection engine thread ctx.
+ *  \param body        The response body to inspect.
+ *  \param body_len    Body length.
+ *  \param body_offset Offset of the buffer in the body.
+ *  \param st          Saved mpm state of the body, or NULL to scan the
+ *                     whole buffer.
  *
  *  \retval ret Number of matches.
  */
 uint32_t HttpServerBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
-                                     uint8_t *body, uint32_t body_len, uint8_t flags)
+                                     uint8_t *body, uint32_t body_len,
+                                     uint64_t body_offset, MpmStreamState *st,
+                                     uint8_t flags)
 {
     SCEnter();
 
@@ -332,9 +348,15 @@ uint32_t HttpServerBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
         if (det_ctx->sgh->mpm_hsbd_ctx_tc == NULL)
             SCReturnUInt(0);
 
-        ret = mpm_table[det_ctx->sgh->mpm_hsbd_ctx_tc->mpm_type].
-            Search(det_ctx->sgh->mpm_hsbd_ctx_tc, &det_ctx->mtcu,
-                   &det_ctx->pmq, body, body_len);
+        if (st != NULL && det_ctx->body_pmq.pattern_id_bitarray != NULL) {
+            ret = MpmSearchStream(det_ctx->sgh->mpm_hsbd_ctx_tc, &det_ctx->mtcu,
+                                  &det_ctx->pmq, &det_ctx->body_pmq, st,
+                                  body, body_len, body_offset);
+        } else {
+            ret = mpm_table[det_ctx->sgh->mpm_hsbd_ctx_tc->mpm_type].
+                Search(det_ctx->sgh->mpm_hsbd_ctx_tc, &det_ctx->mtcu,
+                       &det_ctx->pmq, body, body_len);
+        }
     }
 
     SCReturnUInt(ret);
@@ -802,6 +824,330 @@ void PatternMatchPrepare(MpmCtx *mpm_ctx, uint16_t mpm_matcher) {
     MpmInitCtx(mpm_ctx, mpm_matcher);
 }
 
+static uint64_t PatternMatchUsec(struct timeval *start, struct timeval *end)
+{
+    return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000 +
+        (end->tv_usec - start->tv_usec);
+}
+
+/**
+ * \brief Prepare a mpm ctx, or queue it for PatternMatchPrepareQueued()
+ *        if the engine is built by multiple threads.
+ */
+void PatternMatchPrepareMpmCtx(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx,
+        uint16_t mpm_matcher)
+{
+    /* a shared ctx is only prepared once */
+    if (mpm_ctx->prepared)
+        return;
+    mpm_ctx->prepared = 1;
+
+    if (de_ctx->build_threads <= 1) {
+        struct timeval tv_start, tv_end;
+        gettimeofday(&tv_start, NULL);
+        mpm_table[mpm_matcher].Prepare(mpm_ctx);
+        gettimeofday(&tv_end, NULL);
+
+        de_ctx->mpm_prepare_cnt++;
+        de_ctx->mpm_prepare_usec += PatternMatchUsec(&tv_start, &tv_end);
+        return;
+    }
+
+    if (de_ctx->mpm_prepare_queue_cnt == de_ctx->mpm_prepare_queue_size) {
+        uint32_t size = de_ctx->mpm_prepare_queue_size ?
+            de_ctx->mpm_prepare_queue_size * 2 : 64;
+        MpmPrepareItem *queue = SCRealloc(de_ctx->mpm_prepare_queue,
+                size * sizeof(MpmPrepareItem));
+        if (unlikely(queue == NULL)) {
+            /* no room to queue it, so do it right away */
+            mpm_table[mpm_matcher].Prepare(mpm_ctx);
+            return;
+        }
+        de_ctx->mpm_prepare_queue = queue;
+        de_ctx->mpm_prepare_queue_size = size;
+    }
+
+    MpmPrepareItem *item = &de_ctx->mpm_prepare_queue[de_ctx->mpm_prepare_queue_cnt++];
+    item->mpm_ctx = mpm_ctx;
+    item->mpm_matcher = mpm_matcher;
+}
+
+typedef struct MpmPrepareJob_ {
+    MpmPrepareItem *queue;
+    uint32_t cnt;
+    SC_ATOMIC_DECLARE(uint32_t, next);
+} MpmPrepareJob;
+
+static void *PatternMatchPrepareWorker(void *data)
+{
+    MpmPrepareJob *job = (MpmPrepareJob *)data;
+
+    while (1) {
+        uint32_t idx = SC_ATOMIC_ADD(job->next, 1) - 1;
+        if (idx >= job->cnt)
+            break;
+
+        MpmPrepareItem *item = &job->queue[idx];
+        mpm_table[item->mpm_matcher].Prepare(item->mpm_ctx);
+    }
+    return NULL;
+}
+
+static int PatternMatchPrepareCmp(const void *a, const void *b)
+{
+    const MpmCtx *ma = ((const MpmPrepareItem *)a)->mpm_ctx;
+    const MpmCtx *mb = ((const MpmPrepareItem *)b)->mpm_ctx;
+
+    if (ma->pattern_cnt > mb->pattern_cnt)
+        return -1;
+    else if (ma->pattern_cnt < mb->pattern_cnt)
+        return 1;
+    return 0;
+}
+
+/**
+ * \brief Prepare all queued mpm contexts using de_ctx->build_threads
+ *        threads. The calling thread is one of them.
+ *
+ * Each mpm ctx is only touched by the thread preparing it, so no locking
+ * is needed beyond the index into the queue.
+ *
+ * \retval 0 on success, -1 if no threads could be created. The queue is
+ *         fully prepared in both cases.
+ */
+int PatternMatchPrepareQueued(DetectEngineCtx *de_ctx)
+{
+    uint32_t cnt = de_ctx->mpm_prepare_queue_cnt;
+    int r = 0;
+
+    if (cnt == 0)
+        return 0;
+
+    struct timeval tv_start, tv_end;
+    gettimeofday(&tv_start, NULL);
+
+    /* biggest contexts first, so a single large one doesn't end up
+     * being started last */
+    qsort(de_ctx->mpm_prepare_queue, cnt, sizeof(MpmPrepareItem),
+            PatternMatchPrepareCmp);
+
+    MpmPrepareJob job;
+    memset(&job, 0, sizeof(job));
+    job.queue = de_ctx->mpm_prepare_queue;
+    job.cnt = cnt;
+    SC_ATOMIC_INIT(job.next);
+
+    uint32_t nthreads = de_ctx->build_threads;
+    if (nthreads > cnt)
+        nthreads = cnt;
+
+    pthread_t *threads = NULL;
+    uint32_t started = 0;
+    if (nthreads > 1) {
+        threads = SCMalloc((nthreads - 1) * sizeof(pthread_t));
+        if (threads != NULL) {
+            for ( ; started < nthreads - 1; started++) {
+                if (pthread_create(&threads[started], NULL,
+                            PatternMatchPrepareWorker, &job) != 0) {
+                    SCLogWarning(SC_ERR_THREAD_CREATE, "could only start %u "
+                            "mpm build threads", started);
+                    break;
+                }
+            }
+        }
+        if (started == 0)
+            r = -1;
+    }
+
+    /* the calling thread works the queue as well */
+    (void)PatternMatchPrepareWorker(&job);
+
+    uint32_t i;
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (threads != NULL)
+        SCFree(threads);
+
+    gettimeofday(&tv_end, NULL);
+    uint64_t usec = PatternMatchUsec(&tv_start, &tv_end);
+    de_ctx->mpm_prepare_cnt += cnt;
+    de_ctx->mpm_prepare_usec += usec;
+
+    SCLogDebug("prepared %u mpm contexts with %u threads in %"PRIu64" us",
+            cnt, started + 1, usec);
+
+    SC_ATOMIC_DESTROY(job.next);
+    de_ctx->mpm_prepare_queue_cnt = 0;
+    return r;
+}
+
+/** \internal
+ *  \brief Get the addresses of all mpm ctx pointers of a sgh.
+ *
+ *  \retval cnt number of pointers stored in ctxs, at most
+ *          SGH_MPM_CTX_MAX */
+#define SGH_MPM_CTX_MAX 32
+static uint32_t PatternMatchGroupCtxs(SigGroupHead *sh, MpmCtx ***ctxs)
+{
+    uint32_t cnt = 0;
+
+    ctxs[cnt++] = &sh->mpm_proto_other_ctx;
+    ctxs[cnt++] = &sh->mpm_proto_tcp_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_proto_udp_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_stream_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_uri_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hcbd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hhd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hrhd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hmd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hcd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hrud_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_huad_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hhhd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_hrhhd_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_dnsquery_ctx_ts;
+    ctxs[cnt++] = &sh->mpm_proto_tcp_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_proto_udp_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_stream_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_hsbd_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_hhd_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_hrhd_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_hcd_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_hsmd_ctx_tc;
+    ctxs[cnt++] = &sh->mpm_hscd_ctx_tc;
+
+    BUG_ON(cnt > SGH_MPM_CTX_MAX);
+    return cnt;
+}
+
+static uint32_t PatternMatchDedupHashFunc(HashListTable *ht, void *data,
+                                          uint16_t datalen)
+{
+    return MpmCtxRecordsHash((MpmCtx *)data) % ht->array_size;
+}
+
+static char PatternMatchDedupCompareFunc(void *data1, uint16_t len1,
+                                         void *data2, uint16_t len2)
+{
+    return (char)MpmCtxRecordsEqual((MpmCtx *)data1, (MpmCtx *)data2);
+}
+
+/** \internal
+ *  \brief Start recording the patterns added to the (unique) mpm ctxs
+ *         of a sgh, so identical ones can be found later. */
+static void PatternMatchGroupRecordPatterns(SigGroupHead *sh)
+{
+    MpmCtx **ctxs[SGH_MPM_CTX_MAX];
+    uint32_t cnt = PatternMatchGroupCtxs(sh, ctxs);
+    uint32_t i;
+
+    for (i = 0; i < cnt; i++) {
+        MpmCtx *mpm_ctx = *ctxs[i];
+        if (mpm_ctx != NULL && !mpm_ctx->global)
+            MpmCtxRecordPatterns(mpm_ctx);
+    }
+}
+
+/** \internal
+ *  \brief Replace the mpm ctxs of a sgh by an earlier mpm ctx with the
+ *         same pattern set, if there is one. Otherwise the ctx is
+ *         stored so later sghs can share it.
+ *
+ *  Needs to run after the patterns are added, before the ctxs are
+ *  prepared. */
+static void PatternMatchGroupDedup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
+{
+    MpmCtx **ctxs[SGH_MPM_CTX_MAX];
+    uint32_t cnt = PatternMatchGroupCtxs(sh, ctxs);
+    uint32_t i;
+
+    if (de_ctx->mpm_dedup_table == NULL) {
+        de_ctx->mpm_dedup_table = HashListTableInit(4096,
+                PatternMatchDedupHashFunc, PatternMatchDedupCompareFunc, NULL);
+        if (de_ctx->mpm_dedup_table == NULL)
+            return;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        MpmCtx *mpm_ctx = *ctxs[i];
+        if (mpm_ctx == NULL || mpm_ctx->global || mpm_ctx->pattern_cnt == 0 ||
+            !mpm_ctx->record_patterns || mpm_ctx->prepared)
+            continue;
+
+        de_ctx->mpm_dedup_ctx_cnt++;
+
+        MpmCtx *shared = HashListTableLookup(de_ctx->mpm_dedup_table, mpm_ctx, 0);
+        if (shared == NULL) {
+            if (HashListTableAdd(de_ctx->mpm_dedup_table, mpm_ctx, 0) != 0) {
+                mpm_ctx->record_patterns = 0;
+                MpmCtxFreeRecords(mpm_ctx);
+            }
+            continue;
+        }
+
+        SCLogDebug("sgh %p: mpm_ctx %p replaced by %p", sh, mpm_ctx, shared);
+        mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
+        MpmCtxFreeRecords(mpm_ctx);
+        SCFree(mpm_ctx);
+
+        shared->shared_cnt++;
+        *ctxs[i] = shared;
+        de_ctx->mpm_dedup_shared_cnt++;
+    }
+}
+
+/**
+ * \brief Log how many signature group mpm ctxs were shared and how
+ *        much memory that saved, and free the dedup data. Needs to
+ *        run after the ctxs are prepared.
+ */
+void PatternMatchDedupReport(DetectEngineCtx *de_ctx)
+{
+    uint64_t saved = 0;
+    uint32_t unique = 0;
+
+    if (de_ctx->mpm_dedup_table == NULL)
+        return;
+
+    HashListTableBucket *b = HashListTableGetListHead(de_ctx->mpm_dedup_table);
+    for ( ; b != NULL; b = HashListTableGetListNext(b)) {
+        MpmCtx *mpm_ctx = (MpmCtx *)HashListTableGetListData(b);
+
+        saved += (uint64_t)mpm_ctx->shared_cnt * mpm_ctx->memory_size;
+        unique++;
+    }
+
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogInfo("%u signature group mpm contexts, %u unique: %u shared, "
+                  "saving %"PRIu64" bytes", de_ctx->mpm_dedup_ctx_cnt, unique,
+                  de_ctx->mpm_dedup_shared_cnt, saved);
+    }
+
+    PatternMatchDedupFree(de_ctx);
+}
+
+/**
+ * \brief Free the dedup data, the mpm ctxs themselves stay with their
+ *        signature groups.
+ */
+void PatternMatchDedupFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_dedup_table == NULL)
+        return;
+
+    HashListTableBucket *b = HashListTableGetListHead(de_ctx->mpm_dedup_table);
+    for ( ; b != NULL; b = HashListTableGetListNext(b)) {
+        MpmCtx *mpm_ctx = (MpmCtx *)HashListTableGetListData(b);
+
+        mpm_ctx->record_patterns = 0;
+        MpmCtxFreeRecords(mpm_ctx);
+    }
+
+    HashListTableFree(de_ctx->mpm_dedup_table);
+    de_ctx->mpm_dedup_table = NULL;
+}
+
 void PatternMatchThreadPrint(MpmThreadCtx *mpm_thread_ctx, uint16_t mpm_matcher) {
     SCLogDebug("mpm_thread_ctx %p, mpm_matcher %"PRIu16" defunct", mpm_thread_ctx, mpm_matcher);
     //mpm_table[mpm_matcher].PrintThreadCtx(mpm_thread_ctx);
@@ -823,7 +1169,8 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         SCLogDebug("destroying mpm_ctx %p (sh %p)",
                    sh->mpm_proto_tcp_ctx_ts, sh);
         if (sh->mpm_proto_tcp_ctx_ts != NULL &&
-            !sh->mpm_proto_tcp_ctx_ts->global) {
+            !sh->mpm_proto_tcp_ctx_ts->global &&
+            MpmCtxUnref(sh->mpm_proto_tcp_ctx_ts)) {
             mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].
                 DestroyCtx(sh->mpm_proto_tcp_ctx_ts);
             SCFree(sh->mpm_proto_tcp_ctx_ts);
@@ -834,7 +1181,8 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         SCLogDebug("destroying mpm_ctx %p (sh %p)",
                    sh->mpm_proto_tcp_ctx_tc, sh);
         if (sh->mpm_proto_tcp_ctx_tc != NULL &&
-            !sh->mpm_proto_tcp_ctx_tc->global) {
+            !sh->mpm_proto_tcp_ctx_tc->global &&
+            MpmCtxUnref(sh->mpm_proto_tcp_ctx_tc)) {
             mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].
                 DestroyCtx(sh->mpm_proto_tcp_ctx_tc);
             SCFree(sh->mpm_proto_tcp_ctx_tc);
@@ -845,7 +1193,8 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         SCLogDebug("destroying mpm_ctx %p (sh %p)",
                    sh->mpm_proto_udp_ctx_ts, sh);
         if (sh->mpm_proto_udp_ctx_ts != NULL &&
-            !sh->mpm_proto_udp_ctx_ts->global) {
+            !sh->mpm_proto_udp_ctx_ts->global &&
+            MpmCtxUnref(sh->mpm_proto_udp_ctx_ts)) {
             mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].
                 DestroyCtx(sh->mpm_proto_udp_ctx_ts);
             SCFree(sh->mpm_proto_udp_ctx_ts);
@@ -856,7 +1205,8 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         SCLogDebug("destroying mpm_ctx %p (sh %p)",
                    sh->mpm_proto_udp_ctx_tc, sh);
         if (sh->mpm_proto_udp_ctx_tc != NULL &&
-            !sh->mpm_proto_udp_ctx_tc->global) {
+            !sh->mpm_proto_udp_ctx_tc->global &&
+            MpmCtxUnref(sh->mpm_proto_udp_ctx_tc)) {
             mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].
                 DestroyCtx(sh->mpm_proto_udp_ctx_tc);
             SCFree(sh->mpm_proto_udp_ctx_tc);
@@ -867,7 +1217,8 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         SCLogDebug("destroying mpm_ctx %p (sh %p)",
                    sh->mpm_proto_other_ctx, sh);
         if (sh->mpm_proto_other_ctx != NULL &&
-            !sh->mpm_proto_other_ctx->global) {
+            !sh->mpm_proto_other_ctx->global &&
+            MpmCtxUnref(sh->mpm_proto_other_ctx)) {
             mpm_table[sh->mpm_proto_other_ctx->mpm_type].
                 DestroyCtx(sh->mpm_proto_other_ctx);
             SCFree(sh->mpm_proto_other_ctx);
@@ -880,7 +1231,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
     if ((sh->mpm_uri_ctx_ts != NULL) && !(sh->flags & SIG_GROUP_HEAD_MPM_URI_COPY)) {
         if (sh->mpm_uri_ctx_ts != NULL) {
             SCLogDebug("destroying mpm_uri_ctx %p (sh %p)", sh->mpm_uri_ctx_ts, sh);
-            if (!sh->mpm_uri_ctx_ts->global) {
+            if (!sh->mpm_uri_ctx_ts->global && MpmCtxUnref(sh->mpm_uri_ctx_ts)) {
                 mpm_table[sh->mpm_uri_ctx_ts->mpm_type].DestroyCtx(sh->mpm_uri_ctx_ts);
                 SCFree(sh->mpm_uri_ctx_ts);
             }
@@ -894,7 +1245,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         !(sh->flags & SIG_GROUP_HEAD_MPM_STREAM_COPY)) {
         if (sh->mpm_stream_ctx_ts != NULL) {
             SCLogDebug("destroying mpm_stream_ctx %p (sh %p)", sh->mpm_stream_ctx_ts, sh);
-            if (!sh->mpm_stream_ctx_ts->global) {
+            if (!sh->mpm_stream_ctx_ts->global && MpmCtxUnref(sh->mpm_stream_ctx_ts)) {
                 mpm_table[sh->mpm_stream_ctx_ts->mpm_type].DestroyCtx(sh->mpm_stream_ctx_ts);
                 SCFree(sh->mpm_stream_ctx_ts);
             }
@@ -903,7 +1254,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         }
         if (sh->mpm_stream_ctx_tc != NULL) {
             SCLogDebug("destroying mpm_stream_ctx %p (sh %p)", sh->mpm_stream_ctx_tc, sh);
-            if (!sh->mpm_stream_ctx_tc->global) {
+            if (!sh->mpm_stream_ctx_tc->global && MpmCtxUnref(sh->mpm_stream_ctx_tc)) {
                 mpm_table[sh->mpm_stream_ctx_tc->mpm_type].DestroyCtx(sh->mpm_stream_ctx_tc);
                 SCFree(sh->mpm_stream_ctx_tc);
             }
@@ -914,7 +1265,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hcbd_ctx_ts != NULL) {
         if (sh->mpm_hcbd_ctx_ts != NULL) {
-            if (!sh->mpm_hcbd_ctx_ts->global) {
+            if (!sh->mpm_hcbd_ctx_ts->global && MpmCtxUnref(sh->mpm_hcbd_ctx_ts)) {
                 mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hcbd_ctx_ts);
                 SCFree(sh->mpm_hcbd_ctx_ts);
             }
@@ -924,7 +1275,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hsbd_ctx_tc != NULL) {
         if (sh->mpm_hsbd_ctx_tc != NULL) {
-            if (!sh->mpm_hsbd_ctx_tc->global) {
+            if (!sh->mpm_hsbd_ctx_tc->global && MpmCtxUnref(sh->mpm_hsbd_ctx_tc)) {
                 mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hsbd_ctx_tc);
                 SCFree(sh->mpm_hsbd_ctx_tc);
             }
@@ -934,14 +1285,14 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hhd_ctx_ts != NULL || sh->mpm_hhd_ctx_tc != NULL) {
         if (sh->mpm_hhd_ctx_ts != NULL) {
-            if (!sh->mpm_hhd_ctx_ts->global) {
+            if (!sh->mpm_hhd_ctx_ts->global && MpmCtxUnref(sh->mpm_hhd_ctx_ts)) {
                 mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hhd_ctx_ts);
                 SCFree(sh->mpm_hhd_ctx_ts);
             }
             sh->mpm_hhd_ctx_ts = NULL;
         }
         if (sh->mpm_hhd_ctx_tc != NULL) {
-            if (!sh->mpm_hhd_ctx_tc->global) {
+            if (!sh->mpm_hhd_ctx_tc->global && MpmCtxUnref(sh->mpm_hhd_ctx_tc)) {
                 mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hhd_ctx_tc);
                 SCFree(sh->mpm_hhd_ctx_tc);
             }
@@ -951,14 +1302,14 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hrhd_ctx_ts != NULL || sh->mpm_hrhd_ctx_tc != NULL) {
         if (sh->mpm_hrhd_ctx_ts != NULL) {
-            if (!sh->mpm_hrhd_ctx_ts->global) {
+            if (!sh->mpm_hrhd_ctx_ts->global && MpmCtxUnref(sh->mpm_hrhd_ctx_ts)) {
                 mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hrhd_ctx_ts);
                 SCFree(sh->mpm_hrhd_ctx_ts);
             }
             sh->mpm_hrhd_ctx_ts = NULL;
         }
         if (sh->mpm_hrhd_ctx_tc != NULL) {
-            if (!sh->mpm_hrhd_ctx_tc->global) {
+            if (!sh->mpm_hrhd_ctx_tc->global && MpmCtxUnref(sh->mpm_hrhd_ctx_tc)) {
                 mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hrhd_ctx_tc);
                 SCFree(sh->mpm_hrhd_ctx_tc);
             }
@@ -968,7 +1319,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hmd_ctx_ts != NULL) {
         if (sh->mpm_hmd_ctx_ts != NULL) {
-            if (!sh->mpm_hmd_ctx_ts->global) {
+            if (!sh->mpm_hmd_ctx_ts->global && MpmCtxUnref(sh->mpm_hmd_ctx_ts)) {
                 mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hmd_ctx_ts);
                 SCFree(sh->mpm_hmd_ctx_ts);
             }
@@ -978,14 +1329,14 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hcd_ctx_ts != NULL || sh->mpm_hcd_ctx_tc != NULL) {
         if (sh->mpm_hcd_ctx_ts != NULL) {
-            if (!sh->mpm_hcd_ctx_ts->global) {
+            if (!sh->mpm_hcd_ctx_ts->global && MpmCtxUnref(sh->mpm_hcd_ctx_ts)) {
                 mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hcd_ctx_ts);
                 SCFree(sh->mpm_hcd_ctx_ts);
             }
             sh->mpm_hcd_ctx_ts = NULL;
         }
         if (sh->mpm_hcd_ctx_tc != NULL) {
-            if (!sh->mpm_hcd_ctx_tc->global) {
+            if (!sh->mpm_hcd_ctx_tc->global && MpmCtxUnref(sh->mpm_hcd_ctx_tc)) {
                 mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hcd_ctx_tc);
                 SCFree(sh->mpm_hcd_ctx_tc);
             }
@@ -995,7 +1346,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hrud_ctx_ts != NULL) {
         if (sh->mpm_hrud_ctx_ts != NULL) {
-            if (!sh->mpm_hrud_ctx_ts->global) {
+            if (!sh->mpm_hrud_ctx_ts->global && MpmCtxUnref(sh->mpm_hrud_ctx_ts)) {
                 mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hrud_ctx_ts);
                 SCFree(sh->mpm_hrud_ctx_ts);
             }
@@ -1005,7 +1356,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hsmd_ctx_tc != NULL) {
         if (sh->mpm_hsmd_ctx_tc != NULL) {
-            if (!sh->mpm_hsmd_ctx_tc->global) {
+            if (!sh->mpm_hsmd_ctx_tc->global && MpmCtxUnref(sh->mpm_hsmd_ctx_tc)) {
                 mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hsmd_ctx_tc);
                 SCFree(sh->mpm_hsmd_ctx_tc);
             }
@@ -1015,7 +1366,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_hscd_ctx_tc != NULL) {
         if (sh->mpm_hscd_ctx_tc != NULL) {
-            if (!sh->mpm_hscd_ctx_tc->global) {
+            if (!sh->mpm_hscd_ctx_tc->global && MpmCtxUnref(sh->mpm_hscd_ctx_tc)) {
                 mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hscd_ctx_tc);
                 SCFree(sh->mpm_hscd_ctx_tc);
             }
@@ -1025,7 +1376,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     if (sh->mpm_huad_ctx_ts != NULL) {
         if (sh->mpm_huad_ctx_ts != NULL) {
-            if (!sh->mpm_huad_ctx_ts->global) {
+            if (!sh->mpm_huad_ctx_ts->global && MpmCtxUnref(sh->mpm_huad_ctx_ts)) {
                 mpm_table[sh->mpm_huad_ctx_ts->mpm_type].DestroyCtx(sh->mpm_huad_ctx_ts);
                 SCFree(sh->mpm_huad_ctx_ts);
             }
@@ -1035,7 +1386,7 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
 
     /* dns query */
     if (sh->mpm_dnsquery_ctx_ts != NULL) {
-        if (!sh->mpm_dnsquery_ctx_ts->global) {
+        if (!sh->mpm_dnsquery_ctx_ts->global && MpmCtxUnref(sh->mpm_dnsquery_ctx_ts)) {
             mpm_table[sh->mpm_dnsquery_ctx_ts->mpm_type].DestroyCtx(sh->mpm_dnsquery_ctx_ts);
             SCFree(sh->mpm_dnsquery_ctx_ts);
         }
@@ -2290,8 +2641,15 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
         has_co_hrhhd ||
         has_co_dnsquery) {
 
+        /* identical mpm ctxs are shared between sghs */
+        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL)
+            PatternMatchGroupRecordPatterns(sh);
+
         PatternMatchPreparePopulateMpm(de_ctx, sh);
 
+        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL)
+            PatternMatchGroupDedup(de_ctx, sh);
+
         //if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
          if (sh->mpm_proto_tcp_ctx_ts != NULL) {
              if (sh->mpm_proto_tcp_ctx_ts->pattern_cnt == 0) {
@@ -2300,8 +2658,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].
-                             Prepare(sh->mpm_proto_tcp_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_tcp_ctx_ts, sh->mpm_proto_tcp_ctx_ts->mpm_type);
                      }
                  }
              }
@@ -2313,8 +2670,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].
-                             Prepare(sh->mpm_proto_tcp_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_tcp_ctx_tc, sh->mpm_proto_tcp_ctx_tc->mpm_type);
                      }
                  }
              }
@@ -2327,8 +2683,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].
-                             Prepare(sh->mpm_proto_udp_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_udp_ctx_ts, sh->mpm_proto_udp_ctx_ts->mpm_type);
                      }
                  }
              }
@@ -2340,8 +2695,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].
-                             Prepare(sh->mpm_proto_udp_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_udp_ctx_tc, sh->mpm_proto_udp_ctx_tc->mpm_type);
                      }
                  }
              }
@@ -2354,8 +2708,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_proto_other_ctx->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_other_ctx->mpm_type].
-                             Prepare(sh->mpm_proto_other_ctx);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_other_ctx, sh->mpm_proto_other_ctx->mpm_type);
                      }
                  }
              }
@@ -2368,7 +2721,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_stream_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_stream_ctx_ts->mpm_type].Prepare(sh->mpm_stream_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_stream_ctx_ts, sh->mpm_stream_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2379,7 +2732,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_stream_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_stream_ctx_tc->mpm_type].Prepare(sh->mpm_stream_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_stream_ctx_tc, sh->mpm_stream_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2391,7 +2744,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_uri_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_uri_ctx_ts->mpm_type].Prepare(sh->mpm_uri_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_uri_ctx_ts, sh->mpm_uri_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2403,7 +2756,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].Prepare(sh->mpm_hcbd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcbd_ctx_ts, sh->mpm_hcbd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2415,7 +2768,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].Prepare(sh->mpm_hsbd_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hsbd_ctx_tc, sh->mpm_hsbd_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2427,7 +2780,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].Prepare(sh->mpm_hhd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhd_ctx_ts, sh->mpm_hhd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2438,7 +2791,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].Prepare(sh->mpm_hhd_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhd_ctx_tc, sh->mpm_hhd_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2450,7 +2803,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].Prepare(sh->mpm_hrhd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhd_ctx_ts, sh->mpm_hrhd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2461,7 +2814,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].Prepare(sh->mpm_hrhd_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhd_ctx_tc, sh->mpm_hrhd_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2473,7 +2826,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].Prepare(sh->mpm_hmd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hmd_ctx_ts, sh->mpm_hmd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2485,7 +2838,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].Prepare(sh->mpm_hcd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcd_ctx_ts, sh->mpm_hcd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2496,7 +2849,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].Prepare(sh->mpm_hcd_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcd_ctx_tc, sh->mpm_hcd_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2508,7 +2861,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].Prepare(sh->mpm_hrud_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrud_ctx_ts, sh->mpm_hrud_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2520,7 +2873,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].Prepare(sh->mpm_hsmd_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hsmd_ctx_tc, sh->mpm_hsmd_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2532,7 +2885,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].Prepare(sh->mpm_hscd_ctx_tc);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hscd_ctx_tc, sh->mpm_hscd_ctx_tc->mpm_type);
                  }
              }
          }
@@ -2544,7 +2897,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_huad_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_huad_ctx_ts->mpm_type].Prepare(sh->mpm_huad_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_huad_ctx_ts, sh->mpm_huad_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2556,7 +2909,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hhhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhhd_ctx_ts->mpm_type].Prepare(sh->mpm_hhhd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhhd_ctx_ts, sh->mpm_hhhd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2568,7 +2921,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_hrhhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhhd_ctx_ts->mpm_type].Prepare(sh->mpm_hrhhd_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhhd_ctx_ts, sh->mpm_hrhhd_ctx_ts->mpm_type);
                  }
              }
          }
@@ -2580,7 +2933,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
                      if (mpm_table[sh->mpm_dnsquery_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_dnsquery_ctx_ts->mpm_type].Prepare(sh->mpm_dnsquery_ctx_ts);
+                         PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_dnsquery_ctx_ts, sh->mpm_dnsquery_ctx_ts->mpm_type);
                  }
              }
          }
@@ -39,8 +39,8 @@ uint32_t PacketPatternSearchWithStreamCtx(DetectEngineThreadCtx *, Packet *);
 uint32_t PacketPatternSearch(DetectEngineThreadCtx *, Packet *);
 uint32_t UriPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint16_t, uint8_t);
 uint32_t StreamPatternSearch(DetectEngineThreadCtx *, Packet *, StreamMsg *, uint8_t);
-uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint8_t);
-uint32_t HttpServerBodyPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint8_t);
+uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint64_t, MpmStreamState *, uint8_t);
+uint32_t HttpServerBodyPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint64_t, MpmStreamState *, uint8_t);
 uint32_t HttpHeaderPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint8_t);
 uint32_t HttpRawHeaderPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint8_t);
 uint32_t HttpMethodPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t, uint8_t);
@@ -63,7 +63,17 @@ void PatternMatchDestroy(MpmCtx *, uint16_t);
 void PatternMatchThreadDestroy(MpmThreadCtx *mpm_thread_ctx, uint16_t);
 void PatternMatchThreadPrint(MpmThreadCtx *, uint16_t);
 
+/** mpm ctx queued for preparation, see PatternMatchPrepareMpmCtx() */
+typedef struct MpmPrepareItem_ {
+    MpmCtx *mpm_ctx;
+    uint16_t mpm_matcher;
+} MpmPrepareItem;
+
 int PatternMatchPrepareGroup(DetectEngineCtx *, SigGroupHead *);
+void PatternMatchPrepareMpmCtx(DetectEngineCtx *, MpmCtx *, uint16_t);
+int PatternMatchPrepareQueued(DetectEngineCtx *);
+void PatternMatchDedupReport(DetectEngineCtx *);
+void PatternMatchDedupFree(DetectEngineCtx *);
 void DetectEngineThreadCtxInfo(ThreadVars *, DetectEngineThreadCtx *);
 void PatternMatchDestroyGroup(SigGroupHead *);
 
@@ -0,0 +1,582 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Packet prefilters for the non content parts of the signatures.
+ *
+ * Keywords of which the Match function only looks at the packet and its
+ * flow register PrefilterCompare (and optionally SupportsPrefilter) in
+ * their sigmatch_table entry. For each signature group, the packet match
+ * list keywords of those and the source and destination port lists of
+ * the signatures are turned into conditions. Signatures using the same
+ * condition share it, so it is evaluated once per packet. If it fails,
+ * the bits of its signatures are cleared from the group bitmap, which
+ * SigMatchSignaturesBuildMatchArray() then uses to skip them.
+ *
+ * Conditions are only created for signatures without a mpm pattern, as
+ * the others are filtered by the mpm already. Signatures with a pattern
+ * do join the conditions that exist, that is free at runtime.
+ *
+ * The detection loop still runs the keywords of the signatures that are
+ * left: the prefilter only removes signatures that can't match.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-port.h"
+#include "detect-engine-prefilter.h"
+#include "detect-parse.h"
+
+#include "flow-util.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** \internal
+ *  \brief clear the bits of src from dst */
+static inline void PrefilterBitsClear(uint64_t *dst, const uint64_t *src,
+                                      uint32_t words)
+{
+#if defined(__SSE2__)
+    for ( ; words >= 2; words -= 2, dst += 2, src += 2) {
+        __m128i d = _mm_loadu_si128((const __m128i *)dst);
+        __m128i s = _mm_loadu_si128((const __m128i *)src);
+        _mm_storeu_si128((__m128i *)dst, _mm_andnot_si128(s, d));
+    }
+#endif
+    for ( ; words > 0; words--, dst++, src++) {
+        *dst &= ~(*src);
+    }
+}
+
+/** \internal
+ *  \brief check if any of the bits of src is still set in dst */
+static inline int PrefilterBitsAny(const uint64_t *dst, const uint64_t *src,
+                                   uint32_t words)
+{
+    uint64_t r = 0;
+    uint32_t u;
+
+    for (u = 0; u < words; u++) {
+        r |= dst[u] & src[u];
+    }
+    return (r != 0);
+}
+
+static int PrefilterPortListsEqual(const DetectPort *a, const DetectPort *b)
+{
+    for ( ; a != NULL && b != NULL; a = a->next, b = b->next) {
+        if (a->port != b->port || a->port2 != b->port2)
+            return 0;
+    }
+    return (a == NULL && b == NULL);
+}
+
+/** \internal
+ *  \brief does the signature get filtered by the mpm
+ *
+ *  Same logic as SigMatchSignaturesBuildMatchArrayAddSignature().
+ */
+static int PrefilterSigHasMpm(const Signature *s)
+{
+    if (s->flags & SIG_FLAG_MPM_PACKET)
+        return !(s->flags & SIG_FLAG_MPM_PACKET_NEG);
+    if (s->flags & SIG_FLAG_MPM_STREAM)
+        return !(s->flags & SIG_FLAG_MPM_STREAM_NEG);
+    if (s->flags & SIG_FLAG_MPM_APPLAYER)
+        return !(s->flags & SIG_FLAG_MPM_APPLAYER_NEG);
+    return 0;
+}
+
+/** \internal
+ *  \brief evaluate a condition against the packet
+ *
+ *  The port checks are the ones of the detection loop in
+ *  SigMatchSignatures().
+ *
+ *  \retval 1 the signatures using it might match
+ *  \retval 0 they can't
+ */
+static inline int PrefilterConditionMatch(ThreadVars *tv,
+        DetectEngineThreadCtx *det_ctx, Packet *p, const PrefilterCondition *c)
+{
+    switch (c->type) {
+        case PREFILTER_SIGMATCH:
+            return (sigmatch_table[c->sm->type].Match(tv, det_ctx, p,
+                        c->s, c->sm) > 0);
+        case PREFILTER_SP:
+        case PREFILTER_DP:
+            if (p->proto != IPPROTO_TCP && p->proto != IPPROTO_UDP &&
+                p->proto != IPPROTO_SCTP)
+                return 0;
+            if (p->flags & PKT_IS_FRAGMENT)
+                return 0;
+            return (DetectPortLookupGroup(c->ports,
+                        c->type == PREFILTER_SP ? p->sp : p->dp) != NULL);
+    }
+    return 1;
+}
+
+/**
+ *  \brief run the prefilters of the current signature group
+ *
+ *  \retval bits bitmap by head_array index, signatures without a bit
+ *               can't match the packet
+ *  \retval NULL the group has no prefilter
+ */
+const uint64_t *DetectPrefilterRun(ThreadVars *tv,
+        DetectEngineThreadCtx *det_ctx, Packet *p)
+{
+    const SigGroupHeadPrefilter *pf = det_ctx->sgh->prefilter;
+    uint32_t u;
+
+    if (pf == NULL)
+        return NULL;
+
+    uint64_t *bits = det_ctx->prefilter_bits;
+    memset(bits, 0xff, pf->words * sizeof(uint64_t));
+
+    for (u = 0; u < pf->cnt; u++) {
+        const PrefilterCondition *c = &pf->conds[u];
+        uint64_t *dst = bits + c->first_word;
+
+        /* no need to look at the packet if all its sigs are out already */
+        if (!PrefilterBitsAny(dst, c->bits, c->words))
+            continue;
+
+        if (PrefilterConditionMatch(tv, det_ctx, p, c) == 0) {
+            SCLogDebug("condition %u failed, clearing its sigs", u);
+            PrefilterBitsClear(dst, c->bits, c->words);
+        }
+    }
+
+    return bits;
+}
+
+/** \internal
+ *  \brief add the signature at head_array index idx to a condition
+ *
+ *  If there is no matching condition yet, one is created if create is set.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int PrefilterAddCondition(SigGroupHeadPrefilter *pf, uint32_t *size,
+        const SigGroupHead *sgh, uint8_t type, Signature *s, SigMatch *sm,
+        DetectPort *ports, uint32_t idx, int create)
+{
+    PrefilterCondition *c = NULL;
+    uint32_t u;
+
+    for (u = 0; u < pf->cnt; u++) {
+        PrefilterCondition *t = &pf->conds[u];
+        if (t->type != type)
+            continue;
+
+        if (type == PREFILTER_SIGMATCH) {
+            if (t->sm->type == sm->type &&
+                sigmatch_table[sm->type].PrefilterCompare(t->sm, sm))
+            {
+                c = t;
+                break;
+            }
+        } else if (PrefilterPortListsEqual(t->ports, ports)) {
+            c = t;
+            break;
+        }
+    }
+
+    if (c == NULL) {
+        /* past the limit (usable and unusable ones together) we stop
+         * creating them, PrefilterFinalize() enforces the real limit */
+        if (!create || pf->cnt >= 2 * PREFILTER_MAX_CONDITIONS)
+            return 0;
+
+        /* conditions that can't be used are kept without bits, so we
+         * don't ask the keyword again for every signature using it */
+        int usable = 1;
+        if (type == PREFILTER_SIGMATCH &&
+            sigmatch_table[sm->type].SupportsPrefilter != NULL &&
+            !sigmatch_table[sm->type].SupportsPrefilter(sgh, sm))
+        {
+            usable = 0;
+        }
+
+        if (pf->cnt == *size) {
+            uint32_t new_size = *size ? *size * 2 : 16;
+            PrefilterCondition *conds = SCRealloc(pf->conds,
+                    new_size * sizeof(PrefilterCondition));
+            if (conds == NULL)
+                return -1;
+            pf->conds = conds;
+            *size = new_size;
+        }
+
+        c = &pf->conds[pf->cnt];
+        memset(c, 0, sizeof(*c));
+        c->type = type;
+        c->s = s;
+        c->sm = sm;
+        c->ports = ports;
+        if (usable) {
+            c->bits = SCMalloc(pf->words * sizeof(uint64_t));
+            if (c->bits == NULL)
+                return -1;
+            memset(c->bits, 0, pf->words * sizeof(uint64_t));
+            c->words = pf->words;
+        }
+        pf->cnt++;
+    }
+
+    if (c->bits != NULL)
+        c->bits[idx / 64] |= ((uint64_t)1 << (idx % 64));
+    return 0;
+}
+
+static void PrefilterFree(SigGroupHeadPrefilter *pf)
+{
+    uint32_t u;
+
+    if (pf == NULL)
+        return;
+
+    for (u = 0; u < pf->cnt; u++) {
+        if (pf->conds[u].bits != NULL)
+            SCFree(pf->conds[u].bits);
+    }
+    if (pf->conds != NULL)
+        SCFree(pf->conds);
+    SCFree(pf);
+}
+
+/** \internal
+ *  \brief drop the unusable conditions, limit the number of conditions
+ *         and shrink the bitmaps to the words that have bits set */
+static int PrefilterFinalize(SigGroupHeadPrefilter *pf)
+{
+    uint32_t u, cnt = 0;
+
+    for (u = 0; u < pf->cnt; u++) {
+        PrefilterCondition c = pf->conds[u];
+
+        if (c.bits == NULL)
+            continue;
+        if (cnt == PREFILTER_MAX_CONDITIONS) {
+            SCFree(c.bits);
+            continue;
+        }
+
+        uint32_t first = 0, last = c.words - 1;
+        while (first < last && c.bits[first] == 0)
+            first++;
+        while (last > first && c.bits[last] == 0)
+            last--;
+
+        uint64_t *bits = SCMalloc((last - first + 1) * sizeof(uint64_t));
+        if (bits == NULL) {
+            SCFree(c.bits);
+            pf->conds[u].bits = NULL;
+            pf->cnt = cnt;
+            return -1;
+        }
+        memcpy(bits, c.bits + first, (last - first + 1) * sizeof(uint64_t));
+        SCFree(c.bits);
+
+        c.bits = bits;
+        c.first_word = first;
+        c.words = last - first + 1;
+        pf->conds[cnt++] = c;
+    }
+
+    pf->cnt = cnt;
+    return 0;
+}
+
+/**
+ *  \brief build the prefilter conditions of a signature group
+ *
+ *  Needs the head_array, see SigGroupHeadBuildHeadArray().
+ *
+ *  \retval 0 ok, sgh->prefilter is NULL if there is nothing to prefilter
+ *  \retval -1 error
+ */
+int SigGroupHeadBuildPrefilter(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    SigGroupHeadPrefilter *pf = NULL;
+    uint32_t size = 0;
+    uint32_t idx;
+    int pass;
+
+    if (sgh == NULL || sgh->head_array == NULL || sgh->sig_cnt == 0)
+        return 0;
+    if (!de_ctx->prefilter)
+        return 0;
+
+    BUG_ON(sgh->prefilter != NULL);
+
+    pf = SCMalloc(sizeof(SigGroupHeadPrefilter));
+    if (pf == NULL)
+        return -1;
+    memset(pf, 0, sizeof(*pf));
+    pf->words = (sgh->sig_cnt + 63) / 64;
+
+    /* first the sigs without mpm pattern create conditions, then the
+     * others join them */
+    for (pass = 0; pass < 2; pass++) {
+        for (idx = 0; idx < sgh->sig_cnt; idx++) {
+            Signature *s = sgh->head_array[idx].full_sig;
+            if (s == NULL)
+                continue;
+
+            int has_mpm = PrefilterSigHasMpm(s);
+            if (pass == 0 && has_mpm)
+                continue;
+            if (pass == 1 && !has_mpm)
+                continue;
+            int create = (pass == 0);
+
+            SigMatch *sm = s->sm_lists[DETECT_SM_LIST_MATCH];
+            for ( ; sm != NULL; sm = sm->next) {
+                if (sigmatch_table[sm->type].PrefilterCompare == NULL)
+                    continue;
+                if (PrefilterAddCondition(pf, &size, sgh, PREFILTER_SIGMATCH,
+                            s, sm, NULL, idx, create) < 0)
+                    goto error;
+            }
+
+            if (!(s->flags & SIG_FLAG_SP_ANY) && s->sp != NULL) {
+                if (PrefilterAddCondition(pf, &size, sgh, PREFILTER_SP,
+                            s, NULL, s->sp, idx, create) < 0)
+                    goto error;
+            }
+            if (!(s->flags & SIG_FLAG_DP_ANY) && s->dp != NULL) {
+                if (PrefilterAddCondition(pf, &size, sgh, PREFILTER_DP,
+                            s, NULL, s->dp, idx, create) < 0)
+                    goto error;
+            }
+        }
+    }
+
+    if (PrefilterFinalize(pf) < 0)
+        goto error;
+
+    if (pf->cnt == 0) {
+        PrefilterFree(pf);
+        return 0;
+    }
+
+    SCLogDebug("sgh %p: %u prefilter conditions", sgh, pf->cnt);
+    de_ctx->prefilter_sgh_cnt++;
+    de_ctx->prefilter_cond_cnt += pf->cnt;
+    sgh->prefilter = pf;
+    return 0;
+
+error:
+    PrefilterFree(pf);
+    return -1;
+}
+
+void SigGroupHeadFreePrefilter(SigGroupHead *sgh)
+{
+    if (sgh == NULL)
+        return;
+
+    PrefilterFree(sgh->prefilter);
+    sgh->prefilter = NULL;
+}
+
+void PrefilterReport(DetectEngineCtx *de_ctx)
+{
+    if (!de_ctx->prefilter || (de_ctx->flags & DE_QUIET))
+        return;
+
+    SCLogInfo("%u prefilter conditions in %u signature groups",
+              de_ctx->prefilter_cond_cnt, de_ctx->prefilter_sgh_cnt);
+}
+
+#ifdef UNITTESTS
+
+/** \test sigs without content share their conditions, and sigs with
+ *        content join them */
+static int DetectPrefilterTest01(void)
+{
+    int result = 0;
+    Packet *p[2] = { NULL, NULL };
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    uint8_t payload[] = "xxAAAxxx";
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    p[0] = UTHBuildPacketReal(payload, sizeof(payload) - 2, IPPROTO_TCP,
+                              "1.2.3.4", "5.6.7.8", 1024, 80);
+    p[1] = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+                              "1.2.3.4", "5.6.7.8", 1024, 80);
+    if (p[0] == NULL || p[1] == NULL)
+        goto end;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->prefilter = 1;
+
+    if (DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(dsize:7; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(dsize:7; flags:S; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(dsize:8; sid:3;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"AAA\"; dsize:7; sid:4;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"AAA\"; dsize:6; sid:5;)") == NULL) {
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p[0]);
+
+    /* dsize:7, dsize:8, flags:S and port 80. The dsize:6 sig has
+     * content, so it doesn't create one. */
+    if (det_ctx->sgh == NULL || det_ctx->sgh->prefilter == NULL ||
+        det_ctx->sgh->prefilter->cnt != 4) {
+        printf("expected 4 prefilter conditions: ");
+        goto end;
+    }
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p[1]);
+    if (!PacketAlertCheck(p[0], 1) || PacketAlertCheck(p[0], 2) ||
+        PacketAlertCheck(p[0], 3) || !PacketAlertCheck(p[0], 4) ||
+        PacketAlertCheck(p[0], 5)) {
+        printf("p[0] should only alert on sids 1 and 4: ");
+        goto end;
+    }
+    if (PacketAlertCheck(p[1], 1) || PacketAlertCheck(p[1], 2) ||
+        !PacketAlertCheck(p[1], 3) || PacketAlertCheck(p[1], 4) ||
+        PacketAlertCheck(p[1], 5)) {
+        printf("p[1] should only alert on sid 3: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    if (de_ctx != NULL)
+        SigGroupCleanup(de_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    UTHFreePackets(p, 2);
+    return result;
+}
+
+/** \test flowbits:isset can't be a prefilter if a sig of the group sets
+ *        the bit, as it would then miss a match on the same packet */
+static int DetectPrefilterTest02(void)
+{
+    int result = 0;
+    Packet *p = NULL;
+    Flow f;
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    uint8_t payload[] = "xxAAAxx";
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&f, 0, sizeof(Flow));
+    FLOW_INITIALIZE(&f);
+
+    p = UTHBuildPacket(payload, sizeof(payload) - 1, IPPROTO_TCP);
+    if (p == NULL)
+        goto end;
+    p->flow = &f;
+    p->flags |= PKT_HAS_FLOW;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    f.proto = IPPROTO_TCP;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->prefilter = 1;
+
+    /* sigs are prepended, so sid 1 is inspected first */
+    if (DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(flowbits:isset,y; sid:3;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(flowbits:isset,x; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"AAA\"; flowbits:set,x; sid:1;)") == NULL) {
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p);
+
+    /* only isset,y */
+    if (det_ctx->sgh == NULL || det_ctx->sgh->prefilter == NULL ||
+        det_ctx->sgh->prefilter->cnt != 1) {
+        printf("expected 1 prefilter condition: ");
+        goto end;
+    }
+    if (!PacketAlertCheck(p, 1) || !PacketAlertCheck(p, 2) ||
+        PacketAlertCheck(p, 3)) {
+        printf("sids 1 and 2 should alert, 3 not: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    if (de_ctx != NULL)
+        SigGroupCleanup(de_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    if (p != NULL)
+        UTHFreePacket(p);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void DetectPrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectPrefilterTest01", DetectPrefilterTest01, 1);
+    UtRegisterTest("DetectPrefilterTest02", DetectPrefilterTest02, 1);
+#endif /* UNITTESTS */
+}
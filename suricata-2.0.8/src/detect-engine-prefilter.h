@@ -0,0 +1,68 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Packet prefilters for the non content parts of the signatures in a
+ * signature group. See detect-engine-prefilter.c.
+ */
+
+#ifndef __DETECT_ENGINE_PREFILTER_H__
+#define __DETECT_ENGINE_PREFILTER_H__
+
+/** max number of different conditions per signature group */
+#define PREFILTER_MAX_CONDITIONS    128
+
+enum {
+    PREFILTER_SIGMATCH = 0,     /**< keyword in the packet match list */
+    PREFILTER_SP,               /**< source port list */
+    PREFILTER_DP,               /**< destination port list */
+};
+
+/** \brief condition shared by one or more signatures of a group */
+typedef struct PrefilterCondition_ {
+    uint8_t type;
+
+    /** PREFILTER_SIGMATCH: the sigmatch of the first signature using it */
+    SigMatch *sm;
+    Signature *s;
+    /** PREFILTER_SP, PREFILTER_DP */
+    DetectPort *ports;
+
+    /** the signatures (head_array index) that need the condition, as
+     *  words first_word up to first_word + words of the group bitmap */
+    uint32_t first_word;
+    uint32_t words;
+    uint64_t *bits;
+} PrefilterCondition;
+
+typedef struct SigGroupHeadPrefilter_ {
+    /** size of the bitmap of the group in 64 bit words */
+    uint32_t words;
+    uint32_t cnt;
+    PrefilterCondition *conds;
+} SigGroupHeadPrefilter;
+
+int SigGroupHeadBuildPrefilter(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadFreePrefilter(SigGroupHead *);
+void PrefilterReport(DetectEngineCtx *);
+const uint64_t *DetectPrefilterRun(ThreadVars *, DetectEngineThreadCtx *, Packet *);
+
+void DetectPrefilterRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_PREFILTER_H__ */
@@ -36,6 +36,7 @@
 #include "detect-engine-address.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
@@ -180,14 +181,29 @@ void SigGroupHeadFree(SigGroupHead *sgh)
     SCLogDebug("sgh %p", sgh);
 
     PatternMatchDestroyGroup(sgh);
+    SigGroupHeadFreePrefilter(sgh);
 
-#if defined(__SSE3__) || defined(__tile__)
+    /* the batch filter arrays are aligned */
     if (sgh->mask_array != NULL) {
-        /* mask is aligned */
         SCFreeAligned(sgh->mask_array);
         sgh->mask_array = NULL;
     }
-#endif
+    if (sgh->alproto_array != NULL) {
+        SCFreeAligned(sgh->alproto_array);
+        sgh->alproto_array = NULL;
+    }
+    if (sgh->ipproto_array != NULL) {
+        SCFreeAligned(sgh->ipproto_array);
+        sgh->ipproto_array = NULL;
+    }
+    if (sgh->mpm_id_div8_array != NULL) {
+        SCFreeAligned(sgh->mpm_id_div8_array);
+        sgh->mpm_id_div8_array = NULL;
+    }
+    if (sgh->mpm_id_mod8_array != NULL) {
+        SCFreeAligned(sgh->mpm_id_mod8_array);
+        sgh->mpm_id_mod8_array = NULL;
+    }
 
     if (sgh->head_array != NULL) {
         SCFree(sgh->head_array);
@@ -1686,6 +1702,50 @@ void SigGroupHeadSetFilestoreCount(DetectEngineCtx *de_ctx, SigGroupHead *sgh) {
     return;
 }
 
+/** \internal
+ *  \brief the only ip protocol a signature is for
+ *
+ *  \retval proto the protocol, or 0 if the sig is for more than one
+ */
+static uint8_t SigGroupHeadSigIPProto(const Signature *s)
+{
+    uint8_t proto = 0;
+    int cnt = 0;
+    int i;
+
+    if (s->proto.flags & DETECT_PROTO_ANY)
+        return 0;
+
+    for (i = 0; i < 256; i++) {
+        if (s->proto.proto[i / 8] & (1 << (i % 8))) {
+            proto = (uint8_t)i;
+            if (++cnt > 1)
+                return 0;
+        }
+    }
+    return proto;
+}
+
+/** \internal
+ *  \brief the mpm bit a signature needs, see
+ *          SigMatchSignaturesBuildMatchArrayAddSignature()
+ *
+ *  \retval mod8 the bit, or 0 if the sig isn't filtered by the mpm
+ */
+static uint8_t SigGroupHeadSigMpmBit(const Signature *s)
+{
+    int need = 0;
+
+    if (s->flags & SIG_FLAG_MPM_PACKET)
+        need = !(s->flags & SIG_FLAG_MPM_PACKET_NEG);
+    else if (s->flags & SIG_FLAG_MPM_STREAM)
+        need = !(s->flags & SIG_FLAG_MPM_STREAM_NEG);
+    else if (s->flags & SIG_FLAG_MPM_APPLAYER)
+        need = !(s->flags & SIG_FLAG_MPM_APPLAYER_NEG);
+
+    return need ? s->mpm_pattern_id_mod_8 : 0;
+}
+
 int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 {
     Signature *s = NULL;
@@ -1696,28 +1756,30 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         return 0;
 
     BUG_ON(sgh->head_array != NULL);
-#if defined(__SSE3__) || defined(__tile__)
     BUG_ON(sgh->mask_array != NULL);
 
-    /* mask array is 16 byte aligned for SIMD checking, also we always
-     * alloc a multiple of 32/64 bytes */
-    int cnt = sgh->sig_cnt;
-#if __WORDSIZE == 32
-    if (cnt % 32 != 0) {
-        cnt += (32 - (cnt % 32));
-    }
-#elif __WORDSIZE == 64
+    /* the arrays for the batch filter are 64 byte aligned and hold a
+     * multiple of 64 sigs, so the vector code never needs a tail */
+    uint32_t cnt = sgh->sig_cnt;
     if (cnt % 64 != 0) {
         cnt += (64 - (cnt % 64));
     }
-#endif /* __WORDSIZE */
 
-    sgh->mask_array = (SignatureMask *)SCMallocAligned((cnt * sizeof(SignatureMask)), 16);
-    if (sgh->mask_array == NULL)
+    sgh->mask_array = (SignatureMask *)SCMallocAligned((cnt * sizeof(SignatureMask)), 64);
+    sgh->alproto_array = (AppProto *)SCMallocAligned((cnt * sizeof(AppProto)), 64);
+    sgh->ipproto_array = (uint8_t *)SCMallocAligned(cnt, 64);
+    sgh->mpm_id_div8_array = (uint16_t *)SCMallocAligned((cnt * sizeof(uint16_t)), 64);
+    sgh->mpm_id_mod8_array = (uint8_t *)SCMallocAligned(cnt, 64);
+    if (sgh->mask_array == NULL || sgh->alproto_array == NULL ||
+        sgh->ipproto_array == NULL || sgh->mpm_id_div8_array == NULL ||
+        sgh->mpm_id_mod8_array == NULL)
         return -1;
 
     memset(sgh->mask_array, 0, (cnt * sizeof(SignatureMask)));
-#endif
+    memset(sgh->alproto_array, 0, (cnt * sizeof(AppProto)));
+    memset(sgh->ipproto_array, 0, cnt);
+    memset(sgh->mpm_id_div8_array, 0, (cnt * sizeof(uint16_t)));
+    memset(sgh->mpm_id_mod8_array, 0, cnt);
 
     sgh->head_array = SCMalloc(sgh->sig_cnt * sizeof(SignatureHeader));
     if (sgh->head_array == NULL)
@@ -1738,9 +1800,13 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         sgh->head_array[idx].hdr_copy3 = s->hdr_copy3;
         sgh->head_array[idx].full_sig = s;
 
-#if defined(__SSE3__) || defined(__tile__)
         sgh->mask_array[idx] = s->mask;
-#endif
+        if (s->flags & SIG_FLAG_APPLAYER)
+            sgh->alproto_array[idx] = s->alproto;
+        sgh->ipproto_array[idx] = SigGroupHeadSigIPProto(s);
+        sgh->mpm_id_mod8_array[idx] = SigGroupHeadSigMpmBit(s);
+        if (sgh->mpm_id_mod8_array[idx] != 0)
+            sgh->mpm_id_div8_array[idx] = s->mpm_pattern_id_div_8;
         idx++;
     }
 
@@ -79,6 +79,7 @@
 #include "util-action.h"
 #include "util-magic.h"
 #include "util-signal.h"
+#include "util-cpu.h"
 
 #include "util-var-name.h"
 
@@ -95,6 +96,9 @@
 
 static uint32_t detect_engine_ctx_id = 1;
 
+/** base for the det_ctx->inspect_pass ranges of the thread ctxs */
+SC_ATOMIC_DECLARE(uint32_t, detect_inspect_pass_base);
+
 static TmEcode DetectEngineThreadCtxInitForLiveRuleSwap(ThreadVars *, void *, void **);
 
 static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *);
@@ -411,6 +415,179 @@ void DetectEngineRegisterAppInspectionEngine(uint8_t ipproto,
     return;
 }
 
+static DetectEngineReloadStats reload_stats;
+static SCMutex reload_stats_lock = SCMUTEX_INITIALIZER;
+
+/** \internal
+ *  \brief get resident memory of the process
+ *  \retval bytes, 0 if unknown
+ */
+static uint64_t DetectEngineGetRss(void)
+{
+    uint64_t rss = 0;
+#if defined(__linux__)
+    unsigned long size = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%lu %lu", &size, &resident) == 2)
+            rss = (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+        fclose(fp);
+    }
+#endif
+    return rss;
+}
+
+/** \internal
+ *  \brief parse a "Key:    1234 kB" line of /proc/self/status
+ *  \retval 1 if the line is the one of key, with the value in *bytes */
+static int DetectEngineParseStatusLine(const char *line, const char *key,
+                                       uint64_t *bytes)
+{
+    size_t len = strlen(key);
+    unsigned long long kb = 0;
+
+    if (strncmp(line, key, len) != 0 || line[len] != ':')
+        return 0;
+    if (sscanf(line + len + 1, "%llu kB", &kb) != 1)
+        return 0;
+
+    *bytes = (uint64_t)kb * 1024;
+    return 1;
+}
+
+/** \internal
+ *  \brief get the peak resident memory (VmHWM) of the process
+ *  \retval bytes, 0 if unknown
+ */
+static uint64_t DetectEngineGetRssPeak(void)
+{
+    uint64_t peak = 0;
+#if defined(__linux__)
+    char line[256];
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (DetectEngineParseStatusLine(line, "VmHWM", &peak))
+                break;
+        }
+        fclose(fp);
+    }
+#endif
+    return peak;
+}
+
+/** \internal
+ *  \brief reset the peak resident memory of the process to its current
+ *         use, so that VmHWM covers only what follows. Needs Linux 4.0.
+ *  \retval 1 reset, 0 not supported
+ */
+static int DetectEngineResetRssPeak(void)
+{
+    int r = 0;
+#if defined(__linux__)
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp != NULL) {
+        r = (fputs("5", fp) >= 0);
+        /* the write only happens on close */
+        if (fclose(fp) != 0)
+            r = 0;
+    }
+#endif
+    return r;
+}
+
+static uint64_t DetectEngineMsecSince(const struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_usec - start->tv_usec) / 1000;
+}
+
+/** \internal
+ *  \brief sample memory use for the peak of the current reload, in case
+ *         VmHWM couldn't be reset */
+static void DetectEngineReloadSampleRss(void)
+{
+    uint64_t rss = DetectEngineGetRss();
+
+    SCMutexLock(&reload_stats_lock);
+    if (rss > reload_stats.rss_peak)
+        reload_stats.rss_peak = rss;
+    SCMutexUnlock(&reload_stats_lock);
+}
+
+static void DetectEngineReloadStatsStart(void)
+{
+    int reset = DetectEngineResetRssPeak();
+    uint64_t rss = DetectEngineGetRss();
+
+    SCMutexLock(&reload_stats_lock);
+    reload_stats.cnt++;
+    reload_stats.in_progress = 1;
+    reload_stats.result = 0;
+    reload_stats.start = time(NULL);
+    reload_stats.build_msec = 0;
+    reload_stats.swap_msec = 0;
+    reload_stats.total_msec = 0;
+    reload_stats.rss_start = rss;
+    reload_stats.rss_peak = rss;
+    reload_stats.rss_peak_sampled = !reset;
+    reload_stats.rss_end = 0;
+    reload_stats.sig_cnt = 0;
+    SCMutexUnlock(&reload_stats_lock);
+}
+
+static void DetectEngineReloadStatsEnd(const struct timeval *start, int result)
+{
+    uint64_t rss = DetectEngineGetRss();
+    uint64_t peak = DetectEngineGetRssPeak();
+
+    SCMutexLock(&reload_stats_lock);
+    reload_stats.in_progress = 0;
+    reload_stats.result = result;
+    reload_stats.total_msec = DetectEngineMsecSince(start);
+    reload_stats.rss_end = rss;
+    if (rss > reload_stats.rss_peak)
+        reload_stats.rss_peak = rss;
+    /* without the reset VmHWM is the peak since the start of the process */
+    if (!reload_stats.rss_peak_sampled && peak > reload_stats.rss_peak)
+        reload_stats.rss_peak = peak;
+    SCMutexUnlock(&reload_stats_lock);
+}
+
+/** \brief get a copy of the stats of the last live rule reload
+ *  \retval 0 no reload was done yet, 1 stats copied */
+int DetectEngineReloadGetStats(DetectEngineReloadStats *stats)
+{
+    SCMutexLock(&reload_stats_lock);
+    *stats = reload_stats;
+    SCMutexUnlock(&reload_stats_lock);
+    return (stats->cnt > 0);
+}
+
+/** \internal
+ *  \brief end the reload thread after a failure or shutdown */
+static void DetectEngineLiveRuleSwapExit(ThreadVars *tv_local,
+        const struct timeval *start)
+{
+    DetectEngineReloadStatsEnd(start, 0);
+    TmThreadsSetFlag(tv_local, THV_CLOSED);
+    UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
+    pthread_exit(NULL);
+}
+
+/**
+ *  \brief Live rule reload
+ *
+ *  The new engine is built in this thread while the detect threads keep
+ *  using the old one. When it's ready, a new det_ctx is set up for each
+ *  detect thread and published by atomically replacing the slot data.
+ *  The detect threads pick it up with their next packet, they are never
+ *  paused. Once every thread has used its new det_ctx, none of them can
+ *  still be inspecting a packet with the old one, so the old engine is
+ *  freed.
+ */
 static void *DetectEngineLiveRuleSwap(void *arg)
 {
     SCEnter();
@@ -419,6 +596,7 @@ static void *DetectEngineLiveRuleSwap(void *arg)
     int no_of_detect_tvs = 0;
     DetectEngineCtx *old_de_ctx = NULL;
     ThreadVars *tv = NULL;
+    struct timeval start;
 
     if (SCSetThreadName("LiveRuleSwap") < 0) {
         SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
@@ -437,6 +615,9 @@ static void *DetectEngineLiveRuleSwap(void *arg)
     /* release TmThreadSpawn */
     TmThreadsSetFlag(tv_local, THV_INIT_DONE);
 
+    gettimeofday(&start, NULL);
+    DetectEngineReloadStatsStart();
+
     ConfDeInit();
     ConfInit();
 
@@ -476,13 +657,10 @@ static void *DetectEngineLiveRuleSwap(void *arg)
             TmModule *tm = TmModuleGetById(slots->tm_id);
 
             if (suricata_ctl_flags != 0) {
-                TmThreadsSetFlag(tv_local, THV_CLOSED);
-
                 SCLogInfo("rule reload interupted by engine shutdown");
 
-                UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
                 SCMutexUnlock(&tv_root_lock);
-                pthread_exit(NULL);
+                DetectEngineLiveRuleSwapExit(tv_local, &start);
             }
 
             if (!(tm->flags & TM_FLAG_DETECT_TM)) {
@@ -496,21 +674,23 @@ static void *DetectEngineLiveRuleSwap(void *arg)
         tv = tv->next;
     }
 
+    SCMutexUnlock(&tv_root_lock);
+
     if (no_of_detect_tvs == 0) {
-        TmThreadsSetFlag(tv_local, THV_CLOSED);
-        UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
         SCLogInfo("===== Live rule swap FAILURE =====");
-        pthread_exit(NULL);
+        DetectEngineLiveRuleSwapExit(tv_local, &start);
     }
 
     DetectEngineThreadCtx *old_det_ctx[no_of_detect_tvs];
     DetectEngineThreadCtx *new_det_ctx[no_of_detect_tvs];
     ThreadVars *detect_tvs[no_of_detect_tvs];
+    TmSlot *detect_slots[no_of_detect_tvs];
+    int pseudo_pkt_inserted[no_of_detect_tvs];
     memset(old_det_ctx, 0x00, (no_of_detect_tvs * sizeof(DetectEngineThreadCtx *)));
     memset(new_det_ctx, 0x00, (no_of_detect_tvs * sizeof(DetectEngineThreadCtx *)));
     memset(detect_tvs, 0x00, (no_of_detect_tvs * sizeof(ThreadVars *)));
-
-    SCMutexUnlock(&tv_root_lock);
+    memset(detect_slots, 0x00, (no_of_detect_tvs * sizeof(TmSlot *)));
+    memset(pseudo_pkt_inserted, 0x00, (no_of_detect_tvs * sizeof(int)));
 
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
     if (de_ctx == NULL) {
@@ -534,104 +714,93 @@ static void *DetectEngineLiveRuleSwap(void *arg)
         SCLogError(SC_ERR_LIVE_RULE_SWAP,  "Failure encountered while "
                    "loading new ruleset with live swap.");
         SCLogError(SC_ERR_LIVE_RULE_SWAP, "rule reload failed");
-        TmThreadsSetFlag(tv_local, THV_CLOSED);
-        UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
-        pthread_exit(NULL);
+        DetectEngineLiveRuleSwapExit(tv_local, &start);
     }
 
     SCThresholdConfInitContext(de_ctx, NULL);
 
-    /* start the process of swapping detect threads ctxs */
+    SCMutexLock(&reload_stats_lock);
+    reload_stats.build_msec = DetectEngineMsecSince(&start);
+    reload_stats.sig_cnt = de_ctx->sig_cnt;
+    SCMutexUnlock(&reload_stats_lock);
+    DetectEngineReloadSampleRss();
 
+    /* collect the detect slots. The threads can only go away at
+     * shutdown, which we check for below. */
     SCMutexLock(&tv_root_lock);
 
     /* all receive threads are part of packet processing threads */
     tv = tv_root[TVT_PPT];
-    while (tv) {
+    while (tv && i < no_of_detect_tvs) {
         /* obtain the slots for this TV */
         TmSlot *slots = tv->tm_slots;
         while (slots != NULL) {
             TmModule *tm = TmModuleGetById(slots->tm_id);
-
-            if (suricata_ctl_flags != 0) {
-                TmThreadsSetFlag(tv_local, THV_CLOSED);
-
-                SCLogInfo("rule reload interupted by engine shutdown");
-
-                UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
-                SCMutexUnlock(&tv_root_lock);
-                pthread_exit(NULL);
-            }
-
             if (!(tm->flags & TM_FLAG_DETECT_TM)) {
                 slots = slots->slot_next;
                 continue;
             }
 
-            old_det_ctx[i] = SC_ATOMIC_GET(slots->slot_data);
             detect_tvs[i] = tv;
-            TmEcode r = DetectEngineThreadCtxInitForLiveRuleSwap(tv, (void *)de_ctx,
-                                                                 (void **)&new_det_ctx[i]);
+            detect_slots[i] = slots;
             i++;
-            if (r == TM_ECODE_FAILED) {
-                SCLogError(SC_ERR_LIVE_RULE_SWAP, "Detect engine thread init "
-                           "failure in live rule swap.  Let's get out of here");
-                SCMutexUnlock(&tv_root_lock);
-                goto error;
-            }
-            SCLogDebug("live rule swap created new det_ctx - %p and de_ctx "
-                       "- %p\n", new_det_ctx, de_ctx);
             break;
         }
 
         tv = tv->next;
     }
 
-    i = 0;
-    tv = tv_root[TVT_PPT];
-    while (tv) {
-        TmSlot *slots = tv->tm_slots;
-        while (slots != NULL) {
-            if (suricata_ctl_flags != 0) {
-                TmThreadsSetFlag(tv_local, THV_CLOSED);
-
-                SCLogInfo("rule reload interupted by engine shutdown");
+    SCMutexUnlock(&tv_root_lock);
 
-                UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
-                SCMutexUnlock(&tv_root_lock);
-                pthread_exit(NULL);
-            }
+    /* set up the new thread ctxs while the old ones are in use */
+    for (i = 0; i < no_of_detect_tvs; i++) {
+        if (suricata_ctl_flags != 0) {
+            SCLogInfo("rule reload interupted by engine shutdown");
+            goto error;
+        }
 
-            TmModule *tm = TmModuleGetById(slots->tm_id);
-            if (!(tm->flags & TM_FLAG_DETECT_TM)) {
-                slots = slots->slot_next;
-                continue;
-            }
-            SCLogDebug("swapping new det_ctx - %p with older one - %p",
-                       new_det_ctx[i], SC_ATOMIC_GET(slots->slot_data));
-            (void)SC_ATOMIC_SET(slots->slot_data, new_det_ctx[i++]);
-            break;
+        TmEcode r = DetectEngineThreadCtxInitForLiveRuleSwap(detect_tvs[i],
+                (void *)de_ctx, (void **)&new_det_ctx[i]);
+        if (r == TM_ECODE_FAILED) {
+            SCLogError(SC_ERR_LIVE_RULE_SWAP, "Detect engine thread init "
+                       "failure in live rule swap.  Let's get out of here");
+            goto error;
         }
-        tv = tv->next;
+        SCLogDebug("live rule swap created new det_ctx - %p and de_ctx "
+                   "- %p\n", new_det_ctx[i], de_ctx);
     }
+    DetectEngineReloadSampleRss();
 
-    SCMutexUnlock(&tv_root_lock);
+    /* publish them */
+    struct timeval swap_start;
+    gettimeofday(&swap_start, NULL);
+
+    for (i = 0; i < no_of_detect_tvs; i++) {
+        old_det_ctx[i] = SC_ATOMIC_GET(detect_slots[i]->slot_data);
+        SCLogDebug("swapping new det_ctx - %p with older one - %p",
+                   new_det_ctx[i], old_det_ctx[i]);
+        (void)SC_ATOMIC_SET(detect_slots[i]->slot_data, new_det_ctx[i]);
+    }
 
     SCLogInfo("Live rule swap has swapped %d old det_ctx's with new ones, "
               "along with the new de_ctx", no_of_detect_tvs);
 
-    for (i = 0; i < no_of_detect_tvs; i++) {
-        int break_out = 0;
-        int pseudo_pkt_inserted = 0;
+    /* grace period: wait until every thread has used its new det_ctx.
+     * Threads that get their packets from a queue are sent a pseudo
+     * packet so they don't need to wait for traffic. */
+    int break_out = 0;
+    while (1) {
+        int waiting = 0;
+
         usleep(1000);
-        while (SC_ATOMIC_GET(new_det_ctx[i]->so_far_used_by_detect) != 1) {
-            if (suricata_ctl_flags != 0) {
-                break_out = 1;
-                break;
-            }
 
-            if (pseudo_pkt_inserted == 0) {
-                pseudo_pkt_inserted = 1;
+        for (i = 0; i < no_of_detect_tvs; i++) {
+            if (SC_ATOMIC_GET(new_det_ctx[i]->so_far_used_by_detect) == 1)
+                continue;
+            waiting++;
+
+            if (pseudo_pkt_inserted[i] == 0) {
+                pseudo_pkt_inserted[i] = 1;
                 if (detect_tvs[i]->inq != NULL) {
                     Packet *p = PacketGetFromAlloc();
                     if (p != NULL) {
@@ -645,42 +814,35 @@ static void *DetectEngineLiveRuleSwap(void *arg)
                     }
                 }
             }
-            usleep(1000);
         }
-        if (break_out)
+
+        if (waiting == 0)
+            break;
+        if (suricata_ctl_flags != 0) {
+            break_out = 1;
             break;
-        SCLogDebug("new_det_ctx - %p used by detect engine", new_det_ctx[i]);
+        }
     }
 
+    SCMutexLock(&reload_stats_lock);
+    reload_stats.swap_msec = DetectEngineMsecSince(&swap_start);
+    SCMutexUnlock(&reload_stats_lock);
+
     /* this is to make sure that if someone initiated shutdown during a live
      * rule swap, the live rule swap won't clean up the old det_ctx and
      * de_ctx, till all detect threads have stopped working and sitting
      * silently after setting RUNNING_DONE flag and while waiting for
      * THV_DEINIT flag */
-    if (i != no_of_detect_tvs) {
-        ThreadVars *tv = tv_root[TVT_PPT];
-        while (tv) {
-            /* obtain the slots for this TV */
-            TmSlot *slots = tv->tm_slots;
-            while (slots != NULL) {
-                TmModule *tm = TmModuleGetById(slots->tm_id);
-
-                if (!(tm->flags & TM_FLAG_DETECT_TM)) {
-                    slots = slots->slot_next;
-                    continue;
-                }
-
-                while (!TmThreadsCheckFlag(tv, THV_RUNNING_DONE)) {
-                    usleep(100);
-                }
-
-                slots = slots->slot_next;
+    if (break_out) {
+        for (i = 0; i < no_of_detect_tvs; i++) {
+            while (!TmThreadsCheckFlag(detect_tvs[i], THV_RUNNING_DONE)) {
+                usleep(100);
             }
-
-            tv = tv->next;
         }
     }
 
+    DetectEngineReloadSampleRss();
+
     /* free all the ctxs */
     old_de_ctx = old_det_ctx[0]->de_ctx;
     for (i = 0; i < no_of_detect_tvs; i++) {
@@ -692,6 +854,8 @@ static void *DetectEngineLiveRuleSwap(void *arg)
 
     SRepReloadComplete();
 
+    DetectEngineReloadStatsEnd(&start, 1);
+
     /* reset the handler */
     UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
 
@@ -707,10 +871,9 @@ static void *DetectEngineLiveRuleSwap(void *arg)
             DetectEngineThreadCtxDeinit(NULL, new_det_ctx[i]);
     }
     DetectEngineCtxFree(de_ctx);
-    TmThreadsSetFlag(tv_local, THV_CLOSED);
-    UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
     SCLogInfo("===== Live rule swap FAILURE =====");
-    pthread_exit(NULL);
+    DetectEngineLiveRuleSwapExit(tv_local, &start);
+    return NULL;
 }
 
 void DetectEngineSpawnLiveRuleSwapMgmtThread(void)
@@ -906,6 +1069,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
     SCClassConfDeInitContext(de_ctx);
     SCRConfDeInitContext(de_ctx);
 
+    PatternMatchDedupFree(de_ctx);
     SigGroupCleanup(de_ctx);
 
     if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
@@ -913,6 +1077,8 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
     }
 
     DetectEngineCtxFreeThreadKeywordData(de_ctx);
+    if (de_ctx->mpm_prepare_queue != NULL)
+        SCFree(de_ctx->mpm_prepare_queue);
     SCFree(de_ctx);
     //DetectAddressGroupPrintMemory();
     //DetectSigGroupPrintMemory();
@@ -939,6 +1105,8 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
     const char *max_uniq_toserver_dp_groups_str = NULL;
 
     char *sgh_mpm_context = NULL;
+    char *build_threads = NULL;
+    char *prefilter = NULL;
 
     ConfNode *de_ctx_custom = ConfGetNode("detect-engine");
     ConfNode *opt = NULL;
@@ -949,6 +1117,10 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
                 de_ctx_profile = opt->head.tqh_first->val;
             } else if (strcmp(opt->val, "sgh-mpm-context") == 0) {
                 sgh_mpm_context = opt->head.tqh_first->val;
+            } else if (strcmp(opt->val, "build-threads") == 0) {
+                build_threads = opt->head.tqh_first->val;
+            } else if (strcmp(opt->val, "prefilter") == 0) {
+                prefilter = opt->head.tqh_first->val;
             }
         }
     }
@@ -1010,6 +1182,31 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
         de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
     }
 
+    /* detect-engine.build-threads option parsing */
+    if (build_threads == NULL || strcmp(build_threads, "auto") == 0) {
+        uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+        de_ctx->build_threads = ncpus > 0 ? ncpus : 1;
+    } else {
+        if (ByteExtractStringUint16(&de_ctx->build_threads, 10,
+                    strlen(build_threads), (const char *)build_threads) <= 0 ||
+                de_ctx->build_threads == 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value "
+                    "\"%s\" for detect-engine.build-threads, using 1",
+                    build_threads);
+            de_ctx->build_threads = 1;
+        }
+    }
+#ifdef __SC_CUDA_SUPPORT__
+    /* the cuda context is pushed for the calling thread only */
+    if (de_ctx->mpm_matcher == MPM_AC_CUDA)
+        de_ctx->build_threads = 1;
+#endif
+    SCLogDebug("de_ctx->build_threads %"PRIu16, de_ctx->build_threads);
+
+    /* detect-engine.prefilter option parsing, on by default */
+    de_ctx->prefilter = (prefilter == NULL || ConfValIsTrue(prefilter));
+    SCLogDebug("de_ctx->prefilter %d", de_ctx->prefilter);
+
     opt = NULL;
     switch (profile) {
         case ENGINE_PROFILE_LOW:
@@ -1255,6 +1452,7 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     for (i = 0; i < DETECT_SMSG_PMQ_NUM; i++) {
         PmqSetup(&det_ctx->smsg_pmq[i], de_ctx->max_fp_id);
     }
+    PmqSetup(&det_ctx->body_pmq, de_ctx->max_fp_id);
 
     /* IP-ONLY */
     DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
@@ -1276,6 +1474,12 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         }
         memset(det_ctx->match_array, 0,
                det_ctx->match_array_len * sizeof(Signature *));
+
+        det_ctx->prefilter_bits = SCMalloc(((de_ctx->sig_array_len + 63) / 64) *
+                                           sizeof(uint64_t));
+        if (det_ctx->prefilter_bits == NULL) {
+            return TM_ECODE_FAILED;
+        }
     }
 
     /* byte_extract storage */
@@ -1285,6 +1489,9 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         return TM_ECODE_FAILED;
     }
 
+    /* each thread ctx gets its own range of pass ids */
+    det_ctx->inspect_pass = (uint64_t)SC_ATOMIC_ADD(detect_inspect_pass_base, 1) << 40;
+
     DetectEngineThreadCtxInitKeywords(de_ctx, det_ctx);
 #ifdef PROFILING
     SCProfilingRuleThreadSetup(de_ctx->profile_ctx, det_ctx);
@@ -1409,48 +1616,19 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data) {
     for (i = 0; i < DETECT_SMSG_PMQ_NUM; i++) {
         PmqFree(&det_ctx->smsg_pmq[i]);
     }
+    PmqFree(&det_ctx->body_pmq);
 
     if (det_ctx->de_state_sig_array != NULL)
         SCFree(det_ctx->de_state_sig_array);
     if (det_ctx->match_array != NULL)
         SCFree(det_ctx->match_array);
 
+    if (det_ctx->prefilter_bits != NULL)
+        SCFree(det_ctx->prefilter_bits);
+
     if (det_ctx->bj_values != NULL)
         SCFree(det_ctx->bj_values);
 
-    /* HHD temp storage */
-    for (i = 0; i < det_ctx->hhd_buffers_size; i++) {
-        if (det_ctx->hhd_buffers[i] != NULL)
-            SCFree(det_ctx->hhd_buffers[i]);
-    }
-    if (det_ctx->hhd_buffers)
-        SCFree(det_ctx->hhd_buffers);
-    det_ctx->hhd_buffers = NULL;
-    if (det_ctx->hhd_buffers_len)
-        SCFree(det_ctx->hhd_buffers_len);
-    det_ctx->hhd_buffers_len = NULL;
-
-    /* HSBD */
-    if (det_ctx->hsbd != NULL) {
-        SCLogDebug("det_ctx hsbd %u", det_ctx->hsbd_buffers_size);
-        for (i = 0; i < det_ctx->hsbd_buffers_size; i++) {
-            if (det_ctx->hsbd[i].buffer != NULL)
-                SCFree(det_ctx->hsbd[i].buffer);
-        }
-        SCFree(det_ctx->hsbd);
-    }
-
-    /* HSCB */
-    if (det_ctx->hcbd != NULL) {
-        SCLogDebug("det_ctx hcbd %u", det_ctx->hcbd_buffers_size);
-        for (i = 0; i < det_ctx->hcbd_buffers_size; i++) {
-            if (det_ctx->hcbd[i].buffer != NULL)
-                SCFree(det_ctx->hcbd[i].buffer);
-            SCLogDebug("det_ctx->hcbd[i].buffer_size %u", det_ctx->hcbd[i].buffer_size);
-        }
-        SCFree(det_ctx->hcbd);
-    }
-
     DetectEngineThreadCtxDeinitKeywords(det_ctx->de_ctx, det_ctx);
     SCFree(det_ctx);
 
@@ -2170,6 +2348,81 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test parsing of the /proc/self/status lines */
+static int DetectEngineReloadStatsTest01(void)
+{
+    uint64_t bytes = 0;
+
+    if (DetectEngineParseStatusLine("VmHWM:\t   1234 kB\n", "VmHWM", &bytes) != 1 ||
+        bytes != 1234 * 1024)
+        return 0;
+    bytes = 0;
+    if (DetectEngineParseStatusLine("VmRSS:\t   1234 kB\n", "VmHWM", &bytes) != 0 ||
+        DetectEngineParseStatusLine("VmHWMx:\t  1234 kB\n", "VmHWM", &bytes) != 0 ||
+        DetectEngineParseStatusLine("VmHWM:\n", "VmHWM", &bytes) != 0 ||
+        bytes != 0)
+        return 0;
+
+#if defined(__linux__)
+    if (DetectEngineGetRssPeak() == 0 ||
+        DetectEngineGetRssPeak() < DetectEngineGetRss())
+        return 0;
+#endif
+    return 1;
+}
+
+/** \test the reload stats record the peak memory use of a reload, even
+ *        if it's gone again by the end */
+static int DetectEngineReloadStatsTest02(void)
+{
+    DetectEngineReloadStats backup, stats;
+    struct timeval start;
+    size_t size = 32 * 1024 * 1024;
+    int result = 0;
+
+    SCMutexLock(&reload_stats_lock);
+    backup = reload_stats;
+    SCMutexUnlock(&reload_stats_lock);
+
+    gettimeofday(&start, NULL);
+    DetectEngineReloadStatsStart();
+
+    if (DetectEngineReloadGetStats(&stats) != 1 ||
+        stats.cnt != backup.cnt + 1 || !stats.in_progress)
+        goto end;
+
+    /* the new engine, freed before the end */
+    char *mem = SCMalloc(size);
+    if (mem == NULL)
+        goto end;
+    memset(mem, 0x01, size);
+    if (stats.rss_peak_sampled)
+        DetectEngineReloadSampleRss();
+    SCFree(mem);
+
+    DetectEngineReloadStatsEnd(&start, 1);
+
+    if (DetectEngineReloadGetStats(&stats) != 1 || stats.in_progress ||
+        stats.result != 1)
+        goto end;
+#if defined(__linux__)
+    if (stats.rss_start == 0 || stats.rss_end == 0 ||
+        stats.rss_peak < stats.rss_end ||
+        stats.rss_peak < stats.rss_start + size / 2) {
+        printf("rss start %"PRIu64" peak %"PRIu64" end %"PRIu64": ",
+                stats.rss_start, stats.rss_peak, stats.rss_end);
+        goto end;
+    }
+#endif
+
+    result = 1;
+end:
+    SCMutexLock(&reload_stats_lock);
+    reload_stats = backup;
+    SCMutexUnlock(&reload_stats_lock);
+    return result;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -2185,6 +2438,10 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest07", DetectEngineTest07, 1);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08, 1);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09, 1);
+    UtRegisterTest("DetectEngineReloadStatsTest01",
+                   DetectEngineReloadStatsTest01, 1);
+    UtRegisterTest("DetectEngineReloadStatsTest02",
+                   DetectEngineReloadStatsTest02, 1);
 #endif
 
     return;
@@ -53,9 +53,27 @@ typedef struct DetectEngineAppInspectionEngine_ {
 
 extern DetectEngineAppInspectionEngine *app_inspection_engine[FLOW_PROTO_DEFAULT][ALPROTO_MAX][2];
 
+/** stats of the last live rule reload */
+typedef struct DetectEngineReloadStats_ {
+    uint32_t cnt;               /**< reloads started */
+    int result;                 /**< 1 ok, 0 failed */
+    int in_progress;
+    time_t start;               /**< wall clock start of the last reload */
+    uint64_t build_msec;        /**< loading rules and building the engine */
+    uint64_t swap_msec;         /**< swap until all threads use the new engine */
+    uint64_t total_msec;
+    uint64_t rss_start;         /**< resident memory before the reload */
+    uint64_t rss_peak;          /**< peak resident memory during it (VmHWM) */
+    int rss_peak_sampled;       /**< VmHWM couldn't be reset, so rss_peak is
+                                     the highest of a few samples */
+    uint64_t rss_end;           /**< resident memory after the old engine is freed */
+    uint32_t sig_cnt;           /**< signatures in the new engine */
+} DetectEngineReloadStats;
+
 /* prototypes */
 void DetectEngineRegisterAppInspectionEngines(void);
 void DetectEngineSpawnLiveRuleSwapMgmtThread(void);
+int DetectEngineReloadGetStats(DetectEngineReloadStats *);
 DetectEngineCtx *DetectEngineCtxInit(void);
 DetectEngineCtx *DetectEngineGetGlobalDeCtx(void);
 void DetectEngineCtxFree(DetectEngineCtx *);
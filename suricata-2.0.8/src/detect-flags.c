@@ -59,6 +59,7 @@ static pcre_extra *parse_regex_study;
 static int DetectFlagsMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, SigMatch *);
 static int DetectFlagsSetup (DetectEngineCtx *, Signature *, char *);
 static void DetectFlagsFree(void *);
+static int DetectFlagsPrefilterCompare(const SigMatch *, const SigMatch *);
 
 /**
  * \brief Registration function for flags: keyword
@@ -70,6 +71,7 @@ void DetectFlagsRegister (void) {
     sigmatch_table[DETECT_FLAGS].Setup = DetectFlagsSetup;
     sigmatch_table[DETECT_FLAGS].Free  = DetectFlagsFree;
     sigmatch_table[DETECT_FLAGS].RegisterTests = FlagsRegisterTests;
+    sigmatch_table[DETECT_FLAGS].PrefilterCompare = DetectFlagsPrefilterCompare;
 
     const char *eb;
     int opts = 0;
@@ -159,6 +161,16 @@ static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Pack
     SCReturnInt(0);
 }
 
+/** \brief see if two flags sigmatches are the same prefilter */
+static int DetectFlagsPrefilterCompare(const SigMatch *a, const SigMatch *b)
+{
+    const DetectFlagsData *fa = (const DetectFlagsData *)a->ctx;
+    const DetectFlagsData *fb = (const DetectFlagsData *)b->ctx;
+
+    return (fa->flags == fb->flags && fa->modifier == fb->modifier &&
+            fa->ignored_flags == fb->ignored_flags);
+}
+
 /**
  * \internal
  * \brief This function is used to parse flags options passed via flags: keyword
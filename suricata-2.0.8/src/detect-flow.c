@@ -52,6 +52,8 @@ int DetectFlowMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectFlowSetup (DetectEngineCtx *, Signature *, char *);
 void DetectFlowRegisterTests(void);
 void DetectFlowFree(void *);
+static int DetectFlowPrefilterCompare(const SigMatch *, const SigMatch *);
+static int DetectFlowSupportsPrefilter(const SigGroupHead *, const SigMatch *);
 
 /**
  * \brief Registration function for flow: keyword
@@ -64,6 +66,8 @@ void DetectFlowRegister (void) {
     sigmatch_table[DETECT_FLOW].Setup = DetectFlowSetup;
     sigmatch_table[DETECT_FLOW].Free  = DetectFlowFree;
     sigmatch_table[DETECT_FLOW].RegisterTests = DetectFlowRegisterTests;
+    sigmatch_table[DETECT_FLOW].PrefilterCompare = DetectFlowPrefilterCompare;
+    sigmatch_table[DETECT_FLOW].SupportsPrefilter = DetectFlowSupportsPrefilter;
 
     const char *eb;
     int eo;
@@ -153,6 +157,24 @@ int DetectFlowMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, S
     SCReturnInt(ret);
 }
 
+/** \brief see if two flow sigmatches are the same prefilter */
+static int DetectFlowPrefilterCompare(const SigMatch *a, const SigMatch *b)
+{
+    const DetectFlowData *fa = (const DetectFlowData *)a->ctx;
+    const DetectFlowData *fb = (const DetectFlowData *)b->ctx;
+
+    return (fa->flags == fb->flags && fa->match_cnt == fb->match_cnt);
+}
+
+/** \brief only_stream and no_stream depend on the stream match of the
+ *         signature itself, so those can't be a prefilter */
+static int DetectFlowSupportsPrefilter(const SigGroupHead *sgh, const SigMatch *sm)
+{
+    const DetectFlowData *fd = (const DetectFlowData *)sm->ctx;
+
+    return !(fd->flags & (FLOW_PKT_ONLYSTREAM|FLOW_PKT_NOSTREAM));
+}
+
 /**
  * \brief This function is used to parse flow options passed via flow: keyword
  *
@@ -53,6 +53,8 @@ static pcre_extra *parse_regex_study;
 int DetectFlowbitMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, SigMatch *);
 static int DetectFlowbitSetup (DetectEngineCtx *, Signature *, char *);
 void DetectFlowbitFree (void *);
+static int DetectFlowbitPrefilterCompare(const SigMatch *, const SigMatch *);
+static int DetectFlowbitSupportsPrefilter(const SigGroupHead *, const SigMatch *);
 void FlowBitsRegisterTests(void);
 
 void DetectFlowbitsRegister (void) {
@@ -63,6 +65,8 @@ void DetectFlowbitsRegister (void) {
     sigmatch_table[DETECT_FLOWBITS].Setup = DetectFlowbitSetup;
     sigmatch_table[DETECT_FLOWBITS].Free  = DetectFlowbitFree;
     sigmatch_table[DETECT_FLOWBITS].RegisterTests = FlowBitsRegisterTests;
+    sigmatch_table[DETECT_FLOWBITS].PrefilterCompare = DetectFlowbitPrefilterCompare;
+    sigmatch_table[DETECT_FLOWBITS].SupportsPrefilter = DetectFlowbitSupportsPrefilter;
     /* this is compatible to ip-only signatures */
     sigmatch_table[DETECT_FLOWBITS].flags |= SIGMATCH_IPONLY_COMPAT;
 
@@ -160,6 +164,55 @@ int DetectFlowbitMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p
     return 0;
 }
 
+/** \brief see if two flowbits sigmatches are the same prefilter */
+static int DetectFlowbitPrefilterCompare(const SigMatch *a, const SigMatch *b)
+{
+    const DetectFlowbitsData *fa = (const DetectFlowbitsData *)a->ctx;
+    const DetectFlowbitsData *fb = (const DetectFlowbitsData *)b->ctx;
+
+    return (fa->idx == fb->idx && fa->cmd == fb->cmd);
+}
+
+/**
+ *  \brief isset and isnotset can be a prefilter, unless a signature of
+ *         the group can change the bit while the group is inspected.
+ */
+static int DetectFlowbitSupportsPrefilter(const SigGroupHead *sgh, const SigMatch *sm)
+{
+    const DetectFlowbitsData *fd = (const DetectFlowbitsData *)sm->ctx;
+    uint32_t sig;
+
+    if (fd->cmd != DETECT_FLOWBITS_CMD_ISSET &&
+        fd->cmd != DETECT_FLOWBITS_CMD_ISNOTSET)
+        return 0;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        const SigMatch *psm = s->sm_lists[DETECT_SM_LIST_POSTMATCH];
+        for ( ; psm != NULL; psm = psm->next) {
+            if (psm->type != DETECT_FLOWBITS)
+                continue;
+
+            const DetectFlowbitsData *pfd = (const DetectFlowbitsData *)psm->ctx;
+            if (pfd->idx != fd->idx)
+                continue;
+            if (pfd->cmd == DETECT_FLOWBITS_CMD_TOGGLE)
+                return 0;
+            if (fd->cmd == DETECT_FLOWBITS_CMD_ISSET &&
+                pfd->cmd == DETECT_FLOWBITS_CMD_SET)
+                return 0;
+            if (fd->cmd == DETECT_FLOWBITS_CMD_ISNOTSET &&
+                pfd->cmd == DETECT_FLOWBITS_CMD_UNSET)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
 int DetectFlowbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
 {
     DetectFlowbitsData *cd = NULL;
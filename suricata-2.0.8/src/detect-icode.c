@@ -49,6 +49,7 @@ int DetectICodeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectICodeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectICodeRegisterTests(void);
 void DetectICodeFree(void *);
+static int DetectICodePrefilterCompare(const SigMatch *, const SigMatch *);
 
 
 /**
@@ -62,6 +63,7 @@ void DetectICodeRegister (void) {
     sigmatch_table[DETECT_ICODE].Setup = DetectICodeSetup;
     sigmatch_table[DETECT_ICODE].Free = DetectICodeFree;
     sigmatch_table[DETECT_ICODE].RegisterTests = DetectICodeRegisterTests;
+    sigmatch_table[DETECT_ICODE].PrefilterCompare = DetectICodePrefilterCompare;
 
     const char *eb;
     int eo;
@@ -132,6 +134,16 @@ int DetectICodeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     return ret;
 }
 
+/** \brief see if two icode sigmatches are the same prefilter */
+static int DetectICodePrefilterCompare(const SigMatch *a, const SigMatch *b)
+{
+    const DetectICodeData *ia = (const DetectICodeData *)a->ctx;
+    const DetectICodeData *ib = (const DetectICodeData *)b->ctx;
+
+    return (ia->mode == ib->mode && ia->code1 == ib->code1 &&
+            ia->code2 == ib->code2);
+}
+
 /**
  * \brief This function is used to parse icode options passed via icode: keyword
  *
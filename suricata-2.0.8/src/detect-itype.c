@@ -49,6 +49,7 @@ int DetectITypeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectITypeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectITypeRegisterTests(void);
 void DetectITypeFree(void *);
+static int DetectITypePrefilterCompare(const SigMatch *, const SigMatch *);
 
 
 /**
@@ -62,6 +63,7 @@ void DetectITypeRegister (void) {
     sigmatch_table[DETECT_ITYPE].Setup = DetectITypeSetup;
     sigmatch_table[DETECT_ITYPE].Free = DetectITypeFree;
     sigmatch_table[DETECT_ITYPE].RegisterTests = DetectITypeRegisterTests;
+    sigmatch_table[DETECT_ITYPE].PrefilterCompare = DetectITypePrefilterCompare;
 
     const char *eb;
     int eo;
@@ -132,6 +134,16 @@ int DetectITypeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     return ret;
 }
 
+/** \brief see if two itype sigmatches are the same prefilter */
+static int DetectITypePrefilterCompare(const SigMatch *a, const SigMatch *b)
+{
+    const DetectITypeData *ia = (const DetectITypeData *)a->ctx;
+    const DetectITypeData *ib = (const DetectITypeData *)b->ctx;
+
+    return (ia->mode == ib->mode && ia->type1 == ib->type1 &&
+            ia->type2 == ib->type2);
+}
+
 /**
  * \brief This function is used to parse itype options passed via itype: keyword
  *
@@ -262,6 +262,107 @@ void SigMatchFree(SigMatch *sm) {
     SCFree(sm);
 }
 
+/** \internal
+ *  \brief check if a SigMatch lives in the compacted block of a signature */
+static inline int SigMatchInBlock(const Signature *s, const SigMatch *sm)
+{
+    return (s->sm_block != NULL && sm >= s->sm_block &&
+            sm < s->sm_block + s->sm_block_cnt);
+}
+
+/** \internal
+ *  \brief map a SigMatch pointer of the old lists to its copy in the block */
+static SigMatch *SigMatchListsCompactMap(SigMatch *sm, SigMatch **old, SigMatch *block,
+                                         uint32_t cnt)
+{
+    uint32_t i;
+
+    if (sm == NULL)
+        return NULL;
+    for (i = 0; i < cnt; i++) {
+        if (old[i] == sm)
+            return &block[i];
+    }
+    return sm;
+}
+
+/**
+ *  \brief Move all SigMatches of a signature into a single contiguous block.
+ *
+ *  The lists are parsed into individually allocated nodes. Once the
+ *  signature is complete they're copied list after list into one array,
+ *  in the order the engine walks them, so that inspecting a signature
+ *  touches a few adjacent cache lines instead of chasing pointers all
+ *  over the heap. Next and prev links are kept, so all list walking code
+ *  works on the block as is.
+ *
+ *  This only changes where the lists live, not how they're evaluated:
+ *  the keywords are still dispatched one by one by the Match functions
+ *  and DetectEngineContentInspection(). Compiling the lists into flat
+ *  (keyword, ctx) programs with fast paths for content chains, byte_test
+ *  and pcre is a separate step, which can be built from this block, as
+ *  each list is a range of it.
+ *
+ *  \retval 0 ok or nothing to do
+ *  \retval -1 allocation error, the lists are left untouched
+ */
+int SigMatchListsCompact(Signature *s)
+{
+    uint32_t cnt = 0, i = 0;
+    int list;
+    SigMatch *sm;
+
+    for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+        for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next)
+            cnt++;
+    }
+    if (cnt == 0)
+        return 0;
+
+    SigMatch *block = SCMallocAligned(cnt * sizeof(SigMatch), CLS);
+    if (unlikely(block == NULL))
+        return -1;
+    SigMatch **old = SCMalloc(cnt * sizeof(SigMatch *));
+    if (unlikely(old == NULL)) {
+        SCFreeAligned(block);
+        return -1;
+    }
+
+    for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+        SigMatch *prev = NULL;
+        for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next) {
+            old[i] = sm;
+            block[i] = *sm;
+            block[i].prev = prev;
+            block[i].next = NULL;
+            if (prev != NULL)
+                prev->next = &block[i];
+            else
+                s->sm_lists[list] = &block[i];
+            prev = &block[i];
+            i++;
+        }
+        s->sm_lists_tail[list] = prev;
+    }
+
+    s->filestore_sm = SigMatchListsCompactMap(s->filestore_sm, old, block, cnt);
+    s->dsize_sm = SigMatchListsCompactMap(s->dsize_sm, old, block, cnt);
+    s->mpm_sm = SigMatchListsCompactMap(s->mpm_sm, old, block, cnt);
+
+    /* the ctx moved along to the copies, only release the nodes */
+    for (i = 0; i < cnt; i++) {
+        if (!SigMatchInBlock(s, old[i]))
+            SCFree(old[i]);
+    }
+    SCFree(old);
+    if (s->sm_block != NULL)
+        SCFreeAligned(s->sm_block);
+
+    s->sm_block = block;
+    s->sm_block_cnt = cnt;
+    return 0;
+}
+
 /* Get the detection module by name */
 SigTableElmt *SigTableGet(char *name) {
     SigTableElmt *st = NULL;
@@ -938,10 +1039,17 @@ void SigFree(Signature *s) {
         SigMatch *sm = s->sm_lists[i], *nsm;
         while (sm != NULL) {
             nsm = sm->next;
-            SigMatchFree(sm);
+            if (SigMatchInBlock(s, sm)) {
+                if (sm->ctx != NULL && sigmatch_table[sm->type].Free != NULL)
+                    sigmatch_table[sm->type].Free(sm->ctx);
+            } else {
+                SigMatchFree(sm);
+            }
             sm = nsm;
         }
     }
+    if (s->sm_block != NULL)
+        SCFreeAligned(s->sm_block);
 
     DetectAddressHeadCleanup(&s->src);
     DetectAddressHeadCleanup(&s->dst);
@@ -3365,6 +3473,87 @@ end:
     return result;
 }
 
+/**
+ * \test sigmatch lists are compacted into one block by SigGroupBuild and
+ *       still inspect correctly.
+ */
+static int SigParseTestCompact01(void)
+{
+    int result = 0;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint8_t buf[] = "abc-xyz12 end";
+    Packet *p = UTHBuildPacket(buf, sizeof(buf) - 1, IPPROTO_TCP);
+    SigMatch *sm;
+    uint32_t i;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL || p == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(dsize:>5; content:\"abc\"; content:\"xyz\"; distance:1; within:10; "
+            "byte_test:1,=,0x31,0,relative; pcre:\"/^12/R\"; sid:1;)");
+    if (s == NULL)
+        goto end;
+    if (s->sm_block != NULL) {
+        printf("block before SigGroupBuild: ");
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+
+    if (s->sm_block == NULL || s->sm_block_cnt != 5) {
+        printf("expected a block of 5 sigmatches: ");
+        goto end;
+    }
+    if (s->sm_lists[DETECT_SM_LIST_MATCH] != &s->sm_block[0] ||
+        s->sm_lists_tail[DETECT_SM_LIST_MATCH] != &s->sm_block[0] ||
+        s->dsize_sm != &s->sm_block[0]) {
+        printf("match list not at the start of the block: ");
+        goto end;
+    }
+    if (s->sm_lists[DETECT_SM_LIST_PMATCH] != &s->sm_block[1] ||
+        s->sm_lists_tail[DETECT_SM_LIST_PMATCH] != &s->sm_block[4]) {
+        printf("pmatch list not in the block: ");
+        goto end;
+    }
+    for (i = 1, sm = s->sm_lists[DETECT_SM_LIST_PMATCH]; sm != NULL; sm = sm->next, i++) {
+        if (sm != &s->sm_block[i] ||
+            sm->prev != (i == 1 ? NULL : &s->sm_block[i - 1])) {
+            printf("pmatch list not contiguous at %u: ", i);
+            goto end;
+        }
+    }
+    if (s->mpm_sm == NULL || s->mpm_sm < &s->sm_block[1] ||
+        s->mpm_sm > &s->sm_block[2]) {
+        printf("mpm_sm not remapped: ");
+        goto end;
+    }
+
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (!PacketAlertCheck(p, 1)) {
+        printf("sig 1 didn't match: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL) {
+        SigGroupCleanup(de_ctx);
+        SigCleanSignatures(de_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    UTHFreePackets(&p, 1);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void SigParseRegisterTests(void) {
@@ -3418,5 +3607,6 @@ void SigParseRegisterTests(void) {
     UtRegisterTest("SigParseTestAppLayerTLS01", SigParseTestAppLayerTLS01, 1);
     UtRegisterTest("SigParseTestAppLayerTLS02", SigParseTestAppLayerTLS02, 1);
     UtRegisterTest("SigParseTestAppLayerTLS03", SigParseTestAppLayerTLS03, 1);
+    UtRegisterTest("SigParseTestCompact01", SigParseTestCompact01, 1);
 #endif /* UNITTESTS */
 }
@@ -32,156 +32,7 @@
 
 /* Included into detect.c */
 
-#if defined(__SSE3__)
-
-/**
- *  \brief SIMD implementation of mask prefiltering.
- *
- *  Mass mask matching is done creating a bitmap of signatures that need
- *  futher inspection.
- *
- *  On 32 bit systems we inspect in 32 sig batches, creating a u32 with flags.
- *  On 64 bit systems we inspect in 64 sig batches, creating a u64 with flags.
- *  The size of a register is leading here.
- */
-void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
-                                       Packet *p, SignatureMask mask, AppProto alproto)
-{
-    uint32_t u;
-    SigIntId x;
-    int bitno = 0;
-#if __WORDSIZE == 32
-    register uint32_t bm; /* bit mask, 32 bits used */
-
-    Vector pm, sm, r1, r2;
-    /* load the packet mask into each byte of the vector */
-    pm.v = _mm_set1_epi8(mask);
-
-    /* reset previous run */
-    det_ctx->match_array_cnt = 0;
-
-    for (u = 0; u < det_ctx->sgh->sig_cnt; u += 32) {
-        /* load a batch of masks */
-        sm.v = _mm_load_si128((const __m128i *)&det_ctx->sgh->mask_array[u]);
-        /* logical AND them with the packet's mask */
-        r1.v = _mm_and_si128(pm.v, sm.v);
-        /* compare the result with the original mask */
-        r2.v = _mm_cmpeq_epi8(sm.v, r1.v);
-        /* convert into a bitarray */
-        bm = ((uint32_t) _mm_movemask_epi8(r2.v));
-
-        SCLogDebug("bm1 %08x", bm);
-
-        /* load a batch of masks */
-        sm.v = _mm_load_si128((const __m128i *)&det_ctx->sgh->mask_array[u+16]);
-        /* logical AND them with the packet's mask */
-        r1.v = _mm_and_si128(pm.v, sm.v);
-        /* compare the result with the original mask */
-        r2.v = _mm_cmpeq_epi8(sm.v, r1.v);
-        /* convert into a bitarray */
-        bm |= ((uint32_t) _mm_movemask_epi8(r2.v) << 16);
-
-        SCLogDebug("bm2 %08x", bm);
-
-        if (bm == 0) {
-            continue;
-        }
-
-        /* Check each bit in the bit map. Little endian is assumed (SSE is x86),
-         * so the bits are in memory backwards, 0 is on the right edge,
-         * 31 on the left edge. This is why above we store the output of the
-         * _mm_movemask_epi8 in this order as well */
-        bitno = 0;
-        for (x = u; x < det_ctx->sgh->sig_cnt && bitno < 32; x++, bitno++) {
-            if (bm & (1 << bitno)) {
-                SignatureHeader *s = &det_ctx->sgh->head_array[x];
-
-                if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
-                    /* okay, store it */
-                    det_ctx->match_array[det_ctx->match_array_cnt] = s->full_sig;
-                    det_ctx->match_array_cnt++;
-                }
-            }
-        }
-    }
-#elif __WORDSIZE == 64
-    register uint64_t bm; /* bit mask, 64 bits used */
-
-    Vector pm, sm, r1, r2;
-    /* load the packet mask into each byte of the vector */
-    pm.v = _mm_set1_epi8(mask);
-
-    /* reset previous run */
-    det_ctx->match_array_cnt = 0;
-
-    for (u = 0; u < det_ctx->sgh->sig_cnt; u += 64) {
-        /* load a batch of masks */
-        sm.v = _mm_load_si128((const __m128i *)&det_ctx->sgh->mask_array[u]);
-        /* logical AND them with the packet's mask */
-        r1.v = _mm_and_si128(pm.v, sm.v);
-        /* compare the result with the original mask */
-        r2.v = _mm_cmpeq_epi8(sm.v, r1.v);
-        /* convert into a bitarray */
-        bm = ((uint64_t) _mm_movemask_epi8(r2.v));
-
-        SCLogDebug("bm1 %08"PRIx64, bm);
-
-        /* load a batch of masks */
-        sm.v = _mm_load_si128((const __m128i *)&det_ctx->sgh->mask_array[u+16]);
-        /* logical AND them with the packet's mask */
-        r1.v = _mm_and_si128(pm.v, sm.v);
-        /* compare the result with the original mask */
-        r2.v = _mm_cmpeq_epi8(sm.v, r1.v);
-        /* convert into a bitarray */
-        bm |= ((uint64_t) _mm_movemask_epi8(r2.v)) << 16;
-
-        /* load a batch of masks */
-        sm.v = _mm_load_si128((const __m128i *)&det_ctx->sgh->mask_array[u+32]);
-        /* logical AND them with the packet's mask */
-        r1.v = _mm_and_si128(pm.v, sm.v);
-        /* compare the result with the original mask */
-        r2.v = _mm_cmpeq_epi8(sm.v, r1.v);
-        /* convert into a bitarray */
-        bm |= ((uint64_t) _mm_movemask_epi8(r2.v)) << 32;
-
-        /* load a batch of masks */
-        sm.v = _mm_load_si128((const __m128i *)&det_ctx->sgh->mask_array[u+48]);
-        /* logical AND them with the packet's mask */
-        r1.v = _mm_and_si128(pm.v, sm.v);
-        /* compare the result with the original mask */
-        r2.v = _mm_cmpeq_epi8(sm.v, r1.v);
-        /* convert into a bitarray */
-        bm |= ((uint64_t) _mm_movemask_epi8(r2.v)) << 48;
-
-        SCLogDebug("bm2 %08"PRIx64, bm);
-
-        if (bm == 0) {
-            continue;
-        }
-
-        /* Check each bit in the bit map. Little endian is assumed (SSE is x86-64),
-         * so the bits are in memory backwards, 0 is on the right edge,
-         * 63 on the left edge. This is why above we store the output of the
-         * _mm_movemask_epi8 in this order as well */
-        bitno = 0;
-        for (x = u; x < det_ctx->sgh->sig_cnt && bitno < 64; x++, bitno++) {
-            if (bm & ((uint64_t)1 << bitno)) {
-                SignatureHeader *s = &det_ctx->sgh->head_array[x];
-
-                if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
-                    /* okay, store it */
-                    det_ctx->match_array[det_ctx->match_array_cnt] = s->full_sig;
-                    det_ctx->match_array_cnt++;
-                }
-            }
-        }
-    }
-#else
-#error Wordsize (__WORDSIZE) neither 32 or 64.
-#endif
-}
- /* end defined(__SSE3__) */
-#elif defined(__tile__)
+#if defined(__tile__)
 
 /**
  *  \brief SIMD implementation of mask prefiltering for TILE-Gx
@@ -190,7 +41,8 @@ void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
  *  futher inspection.
  */
 void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
-                                       Packet *p, SignatureMask mask, AppProto alproto)
+                                       Packet *p, SignatureMask mask,
+                                       const uint64_t *pf_bits, AppProto alproto)
 {
     uint32_t u;
     register uint64_t bm; /* bit mask, 64 bits used */
@@ -232,6 +84,9 @@ void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
             /* Clear the first bit set, so it is not found again. */
             bm -= (1UL << first_bit);
 
+            if (pf_bits != NULL && !(pf_bits[x / 64] & (1UL << (x % 64))))
+                continue;
+
             if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
                 /* okay, store it */
                 *match_array++ = s->full_sig;
@@ -241,6 +96,364 @@ void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
     }
     det_ctx->match_array_cnt = match_count;
 }
+#else /* !defined(__tile__) */
+
+/* Batch filter.
+ *
+ * The signatures of a group are checked 64 at a time against the cheap
+ * conditions of SigMatchSignaturesBuildMatchArrayAddSignature(): the
+ * mask, the app layer protocol, the ip protocol and the mpm pattern bit.
+ * The fields come from a structure of arrays copy of the head_array
+ * (SigGroupHead::mask_array and friends), so the vector versions load 16
+ * (SSE2), 32 (AVX2) or 64 (AVX-512) signatures per instruction and the
+ * mpm bits are fetched with gathers. The signatures that are left get
+ * the full scalar check.
+ *
+ * The implementation is picked at startup by DetectSimdSetup(), based on
+ * the cpu. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SIG_BATCH_X86 1
+#include <immintrin.h>
+#if defined(__clang__) || __GNUC__ >= 6
+#define SIG_BATCH_AVX512 1
+#endif
+#endif
+
+/** packet side of the batch filter */
+typedef struct SigBatchPacket_ {
+    /** pmq pattern id bitarray, read 4 bytes at a time */
+    const uint8_t *mpm_bits;
+    AppProto alproto;
+    /** ALPROTO_DCERPC for SMB and SMB2, as dcerpc sigs match on those */
+    AppProto alproto_alias;
+    SignatureMask mask;
+    uint8_t ipproto;
+} SigBatchPacket;
+
+typedef uint64_t (*SigBatchFilterFunc)(const SigGroupHead *, uint32_t,
+                                       const SigBatchPacket *);
+
+enum {
+    SIG_BATCH_IMPL_GENERIC = 0,
+    SIG_BATCH_IMPL_SSE2,
+    SIG_BATCH_IMPL_AVX2,
+    SIG_BATCH_IMPL_AVX512,
+    SIG_BATCH_IMPL_MAX,
+};
+
+static const char *sig_batch_impl_names[SIG_BATCH_IMPL_MAX] = {
+    "generic", "sse2", "avx2", "avx512",
+};
+
+/** implementations the cpu supports, set by DetectSimdSetup() */
+static int sig_batch_supported[SIG_BATCH_IMPL_MAX] = { 1, 0, 0, 0 };
+static int sig_batch_impl = SIG_BATCH_IMPL_GENERIC;
+
+/**
+ *  \internal
+ *  \brief check sigs u up to u + 63 of the group
+ *
+ *  \retval bm bit x is set if sig u + x might match
+ */
+static uint64_t SigBatchFilterGeneric(const SigGroupHead *sgh, uint32_t u,
+                                      const SigBatchPacket *bp)
+{
+    uint64_t bm = 0;
+    uint32_t x;
+
+    for (x = 0; x < 64; x++) {
+        const uint32_t i = u + x;
+        const SignatureMask sm = sgh->mask_array[i];
+        const AppProto ap = sgh->alproto_array[i];
+        const uint8_t proto = sgh->ipproto_array[i];
+        const uint8_t need = sgh->mpm_id_mod8_array[i];
+
+        if ((bp->mask & sm) != sm)
+            continue;
+        if (proto != 0 && proto != bp->ipproto)
+            continue;
+        if (ap != ALPROTO_UNKNOWN && ap != bp->alproto && ap != bp->alproto_alias)
+            continue;
+        if (need != 0 && !(bp->mpm_bits[sgh->mpm_id_div8_array[i]] & need))
+            continue;
+
+        bm |= ((uint64_t)1 << x);
+    }
+
+    return bm;
+}
+
+#ifdef SIG_BATCH_X86
+
+/**
+ *  \internal
+ *  \brief 16 sigs per round. There is no gather, so the mpm bits are
+ *         checked one by one for the sigs that are left.
+ */
+__attribute__((target("sse2")))
+static uint64_t SigBatchFilterSSE2(const SigGroupHead *sgh, uint32_t u,
+                                   const SigBatchPacket *bp)
+{
+    const __m128i pm = _mm_set1_epi8((char)bp->mask);
+    const __m128i pp = _mm_set1_epi8((char)bp->ipproto);
+    const __m128i pa = _mm_set1_epi16((short)bp->alproto);
+    const __m128i pal = _mm_set1_epi16((short)bp->alproto_alias);
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t bm = 0;
+    uint32_t x;
+
+    for (x = 0; x < 64; x += 16) {
+        const uint32_t i = u + x;
+
+        __m128i sm = _mm_load_si128((const __m128i *)&sgh->mask_array[i]);
+        __m128i ok = _mm_cmpeq_epi8(_mm_and_si128(sm, pm), sm);
+
+        __m128i pr = _mm_load_si128((const __m128i *)&sgh->ipproto_array[i]);
+        ok = _mm_and_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(pr, zero),
+                                            _mm_cmpeq_epi8(pr, pp)));
+
+        __m128i a0 = _mm_load_si128((const __m128i *)&sgh->alproto_array[i]);
+        __m128i a1 = _mm_load_si128((const __m128i *)&sgh->alproto_array[i + 8]);
+        __m128i ok0 = _mm_or_si128(_mm_cmpeq_epi16(a0, zero),
+                _mm_or_si128(_mm_cmpeq_epi16(a0, pa), _mm_cmpeq_epi16(a0, pal)));
+        __m128i ok1 = _mm_or_si128(_mm_cmpeq_epi16(a1, zero),
+                _mm_or_si128(_mm_cmpeq_epi16(a1, pa), _mm_cmpeq_epi16(a1, pal)));
+        ok = _mm_and_si128(ok, _mm_packs_epi16(ok0, ok1));
+
+        bm |= ((uint64_t)(uint32_t)_mm_movemask_epi8(ok)) << x;
+    }
+
+    uint64_t todo = bm;
+    while (todo != 0) {
+        const uint32_t x = __builtin_ctzll(todo);
+        const uint8_t need = sgh->mpm_id_mod8_array[u + x];
+        todo &= todo - 1;
+
+        if (need != 0 && !(bp->mpm_bits[sgh->mpm_id_div8_array[u + x]] & need))
+            bm &= ~((uint64_t)1 << x);
+    }
+
+    return bm;
+}
+
+/**
+ *  \internal
+ *  \brief 32 sigs per round, the mpm bits of 8 sigs per gather
+ */
+__attribute__((target("avx2")))
+static uint64_t SigBatchFilterAVX2(const SigGroupHead *sgh, uint32_t u,
+                                   const SigBatchPacket *bp)
+{
+    const __m256i pm = _mm256_set1_epi8((char)bp->mask);
+    const __m256i pp = _mm256_set1_epi8((char)bp->ipproto);
+    const __m256i pa = _mm256_set1_epi16((short)bp->alproto);
+    const __m256i pal = _mm256_set1_epi16((short)bp->alproto_alias);
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t bm = 0;
+    uint32_t x, y;
+
+    for (x = 0; x < 64; x += 32) {
+        const uint32_t i = u + x;
+
+        __m256i sm = _mm256_load_si256((const __m256i *)&sgh->mask_array[i]);
+        __m256i ok = _mm256_cmpeq_epi8(_mm256_and_si256(sm, pm), sm);
+
+        __m256i pr = _mm256_load_si256((const __m256i *)&sgh->ipproto_array[i]);
+        ok = _mm256_and_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(pr, zero),
+                                                  _mm256_cmpeq_epi8(pr, pp)));
+
+        __m256i a0 = _mm256_load_si256((const __m256i *)&sgh->alproto_array[i]);
+        __m256i a1 = _mm256_load_si256((const __m256i *)&sgh->alproto_array[i + 16]);
+        __m256i ok0 = _mm256_or_si256(_mm256_cmpeq_epi16(a0, zero),
+                _mm256_or_si256(_mm256_cmpeq_epi16(a0, pa), _mm256_cmpeq_epi16(a0, pal)));
+        __m256i ok1 = _mm256_or_si256(_mm256_cmpeq_epi16(a1, zero),
+                _mm256_or_si256(_mm256_cmpeq_epi16(a1, pa), _mm256_cmpeq_epi16(a1, pal)));
+        /* packs works per 128 bit lane, put the quadwords back in order */
+        ok = _mm256_and_si256(ok, _mm256_permute4x64_epi64(
+                    _mm256_packs_epi16(ok0, ok1), 0xd8));
+
+        uint32_t b = (uint32_t)_mm256_movemask_epi8(ok);
+
+        for (y = 0; y < 32 && b != 0; y += 8) {
+            if (((b >> y) & 0xff) == 0)
+                continue;
+
+            __m256i need = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                        (const __m128i *)&sgh->mpm_id_mod8_array[i + y]));
+            __m256i needm = _mm256_xor_si256(_mm256_cmpeq_epi32(need, zero),
+                                             _mm256_set1_epi32(-1));
+            if (_mm256_testz_si256(needm, needm))
+                continue;
+
+            __m256i idx = _mm256_cvtepu16_epi32(_mm_load_si128(
+                        (const __m128i *)&sgh->mpm_id_div8_array[i + y]));
+            __m256i got = _mm256_mask_i32gather_epi32(zero,
+                    (const int *)bp->mpm_bits, idx, needm, 1);
+            __m256i fail = _mm256_and_si256(needm, _mm256_cmpeq_epi32(
+                        _mm256_and_si256(got, need), zero));
+
+            b &= ~((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(fail)) << y);
+        }
+
+        bm |= ((uint64_t)b) << x;
+    }
+
+    return bm;
+}
+
+#ifdef SIG_BATCH_AVX512
+/**
+ *  \internal
+ *  \brief all 64 sigs at once, the mpm bits of 16 sigs per gather
+ */
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t SigBatchFilterAVX512(const SigGroupHead *sgh, uint32_t u,
+                                     const SigBatchPacket *bp)
+{
+    const __m512i pm = _mm512_set1_epi8((char)bp->mask);
+    const __m512i pp = _mm512_set1_epi8((char)bp->ipproto);
+    const __m512i pa = _mm512_set1_epi16((short)bp->alproto);
+    const __m512i pal = _mm512_set1_epi16((short)bp->alproto_alias);
+    const __m512i zero = _mm512_setzero_si512();
+    uint32_t y;
+
+    __m512i sm = _mm512_load_si512((const void *)&sgh->mask_array[u]);
+    uint64_t ok = _mm512_cmpeq_epi8_mask(_mm512_and_si512(sm, pm), sm);
+
+    __m512i pr = _mm512_load_si512((const void *)&sgh->ipproto_array[u]);
+    ok &= (_mm512_cmpeq_epi8_mask(pr, zero) | _mm512_cmpeq_epi8_mask(pr, pp));
+
+    __m512i a0 = _mm512_load_si512((const void *)&sgh->alproto_array[u]);
+    __m512i a1 = _mm512_load_si512((const void *)&sgh->alproto_array[u + 32]);
+    uint64_t ok0 = _mm512_cmpeq_epi16_mask(a0, zero) |
+        _mm512_cmpeq_epi16_mask(a0, pa) | _mm512_cmpeq_epi16_mask(a0, pal);
+    uint64_t ok1 = _mm512_cmpeq_epi16_mask(a1, zero) |
+        _mm512_cmpeq_epi16_mask(a1, pa) | _mm512_cmpeq_epi16_mask(a1, pal);
+    ok &= (ok0 | (ok1 << 32));
+
+    for (y = 0; y < 64 && ok != 0; y += 16) {
+        __mmask16 live = (__mmask16)(ok >> y);
+        if (live == 0)
+            continue;
+
+        __m512i need = _mm512_cvtepu8_epi32(_mm_load_si128(
+                    (const __m128i *)&sgh->mpm_id_mod8_array[u + y]));
+        __mmask16 needm = _mm512_mask_test_epi32_mask(live, need, need);
+        if (needm == 0)
+            continue;
+
+        __m512i idx = _mm512_cvtepu16_epi32(_mm256_load_si256(
+                    (const __m256i *)&sgh->mpm_id_div8_array[u + y]));
+        __m512i got = _mm512_mask_i32gather_epi32(zero, needm, idx,
+                (const void *)bp->mpm_bits, 1);
+        __mmask16 fail = needm & ~_mm512_test_epi32_mask(got, need);
+
+        ok &= ~((uint64_t)fail << y);
+    }
+
+    return ok;
+}
+#endif /* SIG_BATCH_AVX512 */
+
+#endif /* SIG_BATCH_X86 */
+
+static const SigBatchFilterFunc sig_batch_filters[SIG_BATCH_IMPL_MAX] = {
+    SigBatchFilterGeneric,
+#ifdef SIG_BATCH_X86
+    SigBatchFilterSSE2,
+    SigBatchFilterAVX2,
+#else
+    NULL,
+    NULL,
+#endif
+#ifdef SIG_BATCH_AVX512
+    SigBatchFilterAVX512,
+#else
+    NULL,
+#endif
+};
+
+/**
+ *  \brief pick the best batch filter the cpu supports
+ */
+void DetectSimdSetup(void)
+{
+#ifdef SIG_BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        sig_batch_supported[SIG_BATCH_IMPL_SSE2] = 1;
+    if (__builtin_cpu_supports("avx2"))
+        sig_batch_supported[SIG_BATCH_IMPL_AVX2] = 1;
+#ifdef SIG_BATCH_AVX512
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        sig_batch_supported[SIG_BATCH_IMPL_AVX512] = 1;
+#endif
+#endif
+
+    int impl;
+    for (impl = 0; impl < SIG_BATCH_IMPL_MAX; impl++) {
+        if (sig_batch_supported[impl] && sig_batch_filters[impl] != NULL)
+            sig_batch_impl = impl;
+    }
+    SCLogDebug("signature batch filter uses the %s version",
+               sig_batch_impl_names[sig_batch_impl]);
+}
+
+/**
+ *  \brief build an array of signatures that will be inspected
+ *
+ *  All signatures that can be filtered out on forehand are not added to it.
+ *
+ *  \param det_ctx detection engine thread ctx -- array is stored here
+ *  \param p packet
+ *  \param mask Packets mask
+ *  \param pf_bits prefilter bitmap from DetectPrefilterRun(), or NULL
+ *  \param alproto application layer protocol
+ */
+void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
+                                       Packet *p, SignatureMask mask,
+                                       const uint64_t *pf_bits, AppProto alproto)
+{
+    const SigGroupHead *sgh = det_ctx->sgh;
+    const SigBatchFilterFunc filter = sig_batch_filters[sig_batch_impl];
+    SigBatchPacket bp;
+    uint32_t u;
+
+    bp.mpm_bits = det_ctx->pmq.pattern_id_bitarray;
+    bp.alproto = alproto;
+    bp.alproto_alias = (alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2) ?
+        ALPROTO_DCERPC : ALPROTO_UNKNOWN;
+    bp.mask = mask;
+    bp.ipproto = IP_GET_IPPROTO(p);
+
+    /* reset previous run */
+    det_ctx->match_array_cnt = 0;
+
+    for (u = 0; u < sgh->sig_cnt; u += 64) {
+        uint64_t bm = filter(sgh, u, &bp);
+
+        /* drop the sigs the prefilter ruled out, and the padding */
+        if (pf_bits != NULL)
+            bm &= pf_bits[u / 64];
+        if (sgh->sig_cnt - u < 64)
+            bm &= ((uint64_t)1 << (sgh->sig_cnt - u)) - 1;
+
+        while (bm != 0) {
+            const uint32_t x = u + __builtin_ctzll(bm);
+            bm &= bm - 1;
+
+            SignatureHeader *s = &sgh->head_array[x];
+            if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
+                /* okay, store it */
+                det_ctx->match_array[det_ctx->match_array_cnt] = s->full_sig;
+                det_ctx->match_array_cnt++;
+            }
+        }
+    }
+}
+
 #endif /* defined(__tile__) */
 
 
@@ -562,6 +775,179 @@ static int SigTestSIMDMask04(void)
     return 1;
 #endif
 }
+
+#if !defined(__tile__)
+#define SIG_BATCH_TEST_SIGS 4096
+
+static uint32_t SigBatchTestRand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+/**
+ *  \internal
+ *  \brief fill a group with random signature headers
+ */
+static int SigBatchTestSetup(SigGroupHead *sgh, uint8_t *mpm_bits, uint32_t mpm_bytes)
+{
+    const AppProto protos[] = { ALPROTO_HTTP, ALPROTO_TLS, ALPROTO_DNS,
+                                ALPROTO_DCERPC, ALPROTO_SMB };
+    uint32_t seed = 1;
+    uint32_t i;
+
+    memset(sgh, 0, sizeof(*sgh));
+    sgh->sig_cnt = SIG_BATCH_TEST_SIGS;
+    sgh->mask_array = SCMallocAligned(SIG_BATCH_TEST_SIGS * sizeof(SignatureMask), 64);
+    sgh->alproto_array = SCMallocAligned(SIG_BATCH_TEST_SIGS * sizeof(AppProto), 64);
+    sgh->ipproto_array = SCMallocAligned(SIG_BATCH_TEST_SIGS, 64);
+    sgh->mpm_id_div8_array = SCMallocAligned(SIG_BATCH_TEST_SIGS * sizeof(uint16_t), 64);
+    sgh->mpm_id_mod8_array = SCMallocAligned(SIG_BATCH_TEST_SIGS, 64);
+    if (sgh->mask_array == NULL || sgh->alproto_array == NULL ||
+        sgh->ipproto_array == NULL || sgh->mpm_id_div8_array == NULL ||
+        sgh->mpm_id_mod8_array == NULL)
+        return 0;
+
+    for (i = 0; i < SIG_BATCH_TEST_SIGS; i++) {
+        sgh->mask_array[i] = (SignatureMask)(1 << (SigBatchTestRand(&seed) % 8));
+        if (SigBatchTestRand(&seed) % 4 == 0)
+            sgh->mask_array[i] = 0;
+        sgh->alproto_array[i] = (SigBatchTestRand(&seed) % 3 == 0) ?
+            protos[SigBatchTestRand(&seed) % 5] : ALPROTO_UNKNOWN;
+        sgh->ipproto_array[i] = (SigBatchTestRand(&seed) % 2 == 0) ? 0 :
+            ((SigBatchTestRand(&seed) % 2) ? IPPROTO_TCP : IPPROTO_UDP);
+        sgh->mpm_id_mod8_array[i] = (SigBatchTestRand(&seed) % 2 == 0) ? 0 :
+            (uint8_t)(1 << (SigBatchTestRand(&seed) % 8));
+        sgh->mpm_id_div8_array[i] = (sgh->mpm_id_mod8_array[i] == 0) ? 0 :
+            (uint16_t)(SigBatchTestRand(&seed) % (mpm_bytes - 3));
+    }
+    for (i = 0; i < mpm_bytes; i++)
+        mpm_bits[i] = (uint8_t)SigBatchTestRand(&seed);
+    return 1;
+}
+
+static void SigBatchTestFree(SigGroupHead *sgh)
+{
+    SCFreeAligned(sgh->mask_array);
+    SCFreeAligned(sgh->alproto_array);
+    SCFreeAligned(sgh->ipproto_array);
+    SCFreeAligned(sgh->mpm_id_div8_array);
+    SCFreeAligned(sgh->mpm_id_mod8_array);
+}
+#endif /* !defined(__tile__) */
+
+/**
+ *  \test all batch filter versions the cpu supports give the same result
+ *        as the generic one.
+ */
+static int SigTestBatchFilter01(void)
+{
+#if !defined(__tile__)
+    SigGroupHead sgh;
+    uint8_t mpm_bits[64 + 3];
+    const AppProto protos[] = { ALPROTO_UNKNOWN, ALPROTO_HTTP, ALPROTO_SMB,
+                                ALPROTO_DNS };
+    const uint8_t ipprotos[] = { IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP };
+    int result = 0;
+    uint32_t m, a, ip, u;
+    int impl;
+
+    if (SigBatchTestSetup(&sgh, mpm_bits, sizeof(mpm_bits)) == 0)
+        goto end;
+
+    DetectSimdSetup();
+
+    for (impl = 1; impl < SIG_BATCH_IMPL_MAX; impl++) {
+        if (!sig_batch_supported[impl] || sig_batch_filters[impl] == NULL)
+            continue;
+
+        for (m = 0; m < 256; m += 17) {
+            for (a = 0; a < sizeof(protos) / sizeof(protos[0]); a++) {
+                for (ip = 0; ip < sizeof(ipprotos); ip++) {
+                    SigBatchPacket bp;
+                    bp.mpm_bits = mpm_bits;
+                    bp.alproto = protos[a];
+                    bp.alproto_alias = (protos[a] == ALPROTO_SMB) ?
+                        ALPROTO_DCERPC : ALPROTO_UNKNOWN;
+                    bp.mask = (SignatureMask)m;
+                    bp.ipproto = ipprotos[ip];
+
+                    for (u = 0; u < sgh.sig_cnt; u += 64) {
+                        uint64_t r0 = SigBatchFilterGeneric(&sgh, u, &bp);
+                        uint64_t r1 = sig_batch_filters[impl](&sgh, u, &bp);
+                        if (r0 != r1) {
+                            printf("%s: sigs %u: %016"PRIx64" != %016"PRIx64": ",
+                                   sig_batch_impl_names[impl], u, r1, r0);
+                            goto end;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    result = 1;
+end:
+    SigBatchTestFree(&sgh);
+    return result;
+#else
+    return 1;
+#endif
+}
+
+/**
+ *  \test microbenchmark of the batch filter versions, the time per 64
+ *        signatures is logged.
+ */
+static int SigTestBatchFilter02(void)
+{
+#if !defined(__tile__)
+    SigGroupHead sgh;
+    uint8_t mpm_bits[64 + 3];
+    const uint32_t rounds = 200;
+    volatile uint64_t sink = 0;
+    SigBatchPacket bp;
+    int impl;
+
+    if (SigBatchTestSetup(&sgh, mpm_bits, sizeof(mpm_bits)) == 0) {
+        SigBatchTestFree(&sgh);
+        return 0;
+    }
+
+    DetectSimdSetup();
+
+    bp.mpm_bits = mpm_bits;
+    bp.alproto = ALPROTO_HTTP;
+    bp.alproto_alias = ALPROTO_UNKNOWN;
+    bp.mask = 0x5f;
+    bp.ipproto = IPPROTO_TCP;
+
+    for (impl = 0; impl < SIG_BATCH_IMPL_MAX; impl++) {
+        struct timespec start, stop;
+        uint32_t r, u;
+
+        if (!sig_batch_supported[impl] || sig_batch_filters[impl] == NULL)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < rounds; r++) {
+            for (u = 0; u < sgh.sig_cnt; u += 64)
+                sink += sig_batch_filters[impl](&sgh, u, &bp);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        uint64_t ns = (uint64_t)(stop.tv_sec - start.tv_sec) * 1000000000ULL +
+            (uint64_t)stop.tv_nsec - (uint64_t)start.tv_nsec;
+        SCLogInfo("batch filter %s: %.2f ns per 64 signatures%s",
+                  sig_batch_impl_names[impl],
+                  (double)ns / (double)(rounds * (sgh.sig_cnt / 64)),
+                  impl == sig_batch_impl ? " (in use)" : "");
+    }
+
+    SigBatchTestFree(&sgh);
+#endif
+    return 1;
+}
 #endif /* UNITTESTS */
 
 void DetectSimdRegisterTests(void)
@@ -571,5 +957,7 @@ void DetectSimdRegisterTests(void)
     UtRegisterTest("SigTestSIMDMask02", SigTestSIMDMask02, 1);
     UtRegisterTest("SigTestSIMDMask03", SigTestSIMDMask03, 1);
     UtRegisterTest("SigTestSIMDMask04", SigTestSIMDMask04, 1);
+    UtRegisterTest("SigTestBatchFilter01", SigTestBatchFilter01, 1);
+    UtRegisterTest("SigTestBatchFilter02", SigTestBatchFilter02, 1);
 #endif /* UNITTESTS */
 }
@@ -40,6 +40,7 @@
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-threshold.h"
 
@@ -209,6 +210,7 @@ static void PacketCreateMask(Packet *, SignatureMask *, uint16_t, int, StreamMsg
 
 /* tm module api functions */
 TmEcode Detect(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+TmEcode DetectBatch(ThreadVars *, Packet **, uint32_t, void *);
 TmEcode DetectThreadInit(ThreadVars *, void *, void **);
 TmEcode DetectThreadDeinit(ThreadVars *, void *);
 
@@ -216,6 +218,7 @@ void TmModuleDetectRegister (void) {
     tmm_modules[TMM_DETECT].name = "Detect";
     tmm_modules[TMM_DETECT].ThreadInit = DetectThreadInit;
     tmm_modules[TMM_DETECT].Func = Detect;
+    tmm_modules[TMM_DETECT].FuncBatch = DetectBatch;
     tmm_modules[TMM_DETECT].ThreadExitPrintStats = DetectExitPrintStats;
     tmm_modules[TMM_DETECT].ThreadDeinit = DetectThreadDeinit;
     tmm_modules[TMM_DETECT].RegisterTests = SigRegisterTests;
@@ -387,6 +390,7 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
     if (RunmodeGetCurrent() == RUNMODE_ENGINE_ANALYSIS) {
         fp_engine_analysis_set = SetupFPAnalyzer();
         rule_engine_analysis_set = SetupRuleAnalyzer();
+        (void)SetupMpmAnalyzer();
     }
 
     /* ok, let's load signature files from the general config */
@@ -474,6 +478,7 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
         if (fp_engine_analysis_set) {
             CleanupFPAnalyzer();
         }
+        CleanupMpmAnalyzer(de_ctx);
     }
 
     DetectParseDupSigHashFree(de_ctx);
@@ -559,42 +564,7 @@ int SigMatchSignaturesBuildMatchArrayAddSignature(DetectEngineThreadCtx *det_ctx
     return 1;
 }
 
-#if defined(__SSE3__) || defined(__tile__)
-/* SIMD implementations are in detect-simd.c */
-#else
-/* Non-SIMD implementation */
-/**
- *  \brief build an array of signatures that will be inspected
- *
- *  All signatures that can be filtered out on forehand are not added to it.
- *
- *  \param de_ctx detection engine ctx
- *  \param det_ctx detection engine thread ctx -- array is stored here
- *  \param p packet
- *  \param mask Packets mask
- *  \param alproto application layer protocol
- */
-void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
-                                       Packet *p, SignatureMask mask,
-                                       AppProto alproto)
-{
-    uint32_t u;
-
-    /* reset previous run */
-    det_ctx->match_array_cnt = 0;
-
-    for (u = 0; u < det_ctx->sgh->sig_cnt; u++) {
-        SignatureHeader *s = &det_ctx->sgh->head_array[u];
-        if ((mask & s->mask) == s->mask) {
-            if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
-                /* okay, store it */
-                det_ctx->match_array[det_ctx->match_array_cnt] = s->full_sig;
-                det_ctx->match_array_cnt++;
-            }
-        }
-    }
-}
-#endif /* No SIMD implementation */
+/* SigMatchSignaturesBuildMatchArray() is in detect-simd.c */
 
 int SigMatchSignaturesRunPostMatch(ThreadVars *tv,
                                    DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx, Packet *p,
@@ -1126,6 +1096,8 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 
     p->alerts.cnt = 0;
     det_ctx->filestore_cnt = 0;
+    /* new pass: invalidates the http body buffers built by the previous one */
+    det_ctx->inspect_pass++;
 
     /* No need to perform any detection on this packet, if the the given flag is set.*/
     if (p->flags & PKT_NOPACKET_INSPECTION) {
@@ -1324,8 +1296,10 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM);
 
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_PREFILTER);
+    /* run the non content prefilters of the sgh */
+    const uint64_t *pf_bits = DetectPrefilterRun(th_v, det_ctx, p);
     /* build the match array */
-    SigMatchSignaturesBuildMatchArray(det_ctx, p, mask, alproto);
+    SigMatchSignaturesBuildMatchArray(det_ctx, p, mask, pf_bits, alproto);
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PREFILTER);
 
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_RULES);
@@ -1595,10 +1569,6 @@ end:
     /* cleanup pkt specific part of the patternmatcher */
     PacketPatternCleanup(th_v, det_ctx);
 
-    DetectEngineCleanHCBDBuffers(det_ctx);
-    DetectEngineCleanHSBDBuffers(det_ctx);
-    DetectEngineCleanHHDBuffers(det_ctx);
-
     /* store the found sgh (or NULL) in the flow to save us from looking it
      * up again for the next packet. Also return any stream chunk we processed
      * to the pool. */
@@ -1740,6 +1710,75 @@ error:
     return TM_ECODE_FAILED;
 }
 
+/**
+ *  \brief Detect on a vector of packets
+ *
+ *  Each packet still takes the full Detect() path, with its own mpm and
+ *  rule inspection. The vector only changes the order: packets are run
+ *  grouped by the signature group their flow used last, so packets using
+ *  the same mpm and signatures follow each other while those are still
+ *  in the cache. The packets of a flow keep their order, as they all get
+ *  the key of the first one. While a packet is inspected, the flow and
+ *  payload of the next one are prefetched.
+ *
+ *  \param pkts packets, in the order the slots before us handled them
+ *  \param cnt number of packets, max TM_BATCH_MAX
+ */
+TmEcode DetectBatch(ThreadVars *tv, Packet **pkts, uint32_t cnt, void *data)
+{
+    const SigGroupHead *keys[TM_BATCH_MAX];
+    uint8_t order[TM_BATCH_MAX];
+    uint32_t i, j;
+
+    BUG_ON(cnt > TM_BATCH_MAX);
+
+    for (i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+        Flow *f = p->flow;
+
+        keys[i] = NULL;
+        if (f == NULL || (p->flags & PKT_BYPASSED))
+            continue;
+
+        for (j = 0; j < i; j++) {
+            if (pkts[j]->flow == f)
+                break;
+        }
+        if (j < i) {
+            keys[i] = keys[j];
+            continue;
+        }
+
+        /* only used as a sort key */
+        FLOWLOCK_RDLOCK(f);
+        keys[i] = (p->flowflags & FLOW_PKT_TOSERVER) ? f->sgh_toserver : f->sgh_toclient;
+        FLOWLOCK_UNLOCK(f);
+    }
+
+    /* stable insertion sort on the key */
+    for (i = 0; i < cnt; i++) {
+        uint8_t o = (uint8_t)i;
+        for (j = i; j > 0 && (uintptr_t)keys[order[j - 1]] > (uintptr_t)keys[o]; j--)
+            order[j] = order[j - 1];
+        order[j] = o;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        if (i + 1 < cnt) {
+            const Packet *np = pkts[order[i + 1]];
+            if (np->flow != NULL)
+                __builtin_prefetch(np->flow);
+            if (np->payload != NULL)
+                __builtin_prefetch(np->payload);
+        }
+
+        if (Detect(tv, pkts[order[i]], data, NULL, NULL) == TM_ECODE_FAILED)
+            return TM_ECODE_FAILED;
+    }
+
+    return TM_ECODE_OK;
+}
+
 TmEcode DetectThreadInit(ThreadVars *t, void *initdata, void **data)
 {
     return DetectEngineThreadCtxInit(t,initdata,data);
@@ -3960,15 +3999,23 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx) {
             continue;
 
         SigGroupHeadBuildHeadArray(de_ctx, sgh);
+        if (SigGroupHeadBuildPrefilter(de_ctx, sgh) < 0) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "building the prefilter of a "
+                    "signature group failed, it will run without");
+        }
         SigGroupHeadSetFilemagicFlag(de_ctx, sgh);
         SigGroupHeadSetFileMd5Flag(de_ctx, sgh);
         SigGroupHeadSetFilesizeFlag(de_ctx, sgh);
         SigGroupHeadSetFilestoreCount(de_ctx, sgh);
         SCLogDebug("filestore count %u", sgh->filestore_cnt);
+
+        if (RunmodeGetCurrent() == RUNMODE_ENGINE_ANALYSIS)
+            EngineAnalysisMpm(de_ctx, sgh);
     }
 
     if (de_ctx->decoder_event_sgh != NULL) {
         SigGroupHeadBuildHeadArray(de_ctx, de_ctx->decoder_event_sgh);
+        (void)SigGroupHeadBuildPrefilter(de_ctx, de_ctx->decoder_event_sgh);
         /* no need to set filestore count here as that would make a
          * signature not decode event only. */
     }
@@ -4291,6 +4338,19 @@ int SigAddressPrepareStage5(DetectEngineCtx *de_ctx) {
     return 0;
 }
 
+/** \internal
+ *  \brief ms since *tv, which is moved to the current time */
+static uint64_t SigGroupBuildLap(struct timeval *tv)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    uint64_t msec = (uint64_t)(now.tv_sec - tv->tv_sec) * 1000 +
+        (now.tv_usec - tv->tv_usec) / 1000;
+    *tv = now;
+    return msec;
+}
+
 /**
  * \brief Convert the signature list into the runtime match structure.
  *
@@ -4313,6 +4373,10 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
     while (s != NULL) {
         s->num = de_ctx->signum++;
 
+        /* the sigs are final now, lay out their sigmatches contiguously.
+         * On alloc failure the sig just keeps its lists. */
+        (void)SigMatchListsCompact(s);
+
         s = s->next;
     }
 
@@ -4325,24 +4389,44 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
         SigInitStandardMpmFactoryContexts(de_ctx);
     }
 
+    /* ms spent in stage 1-4, the mpm contexts queued by stage 3 and the
+     * factory contexts. With one build thread the group contexts are
+     * prepared inline, so their time is part of stage 3. */
+    uint64_t stage_msec[6] = { 0, 0, 0, 0, 0, 0 };
+    struct timeval tv_start, tv_lap;
+    gettimeofday(&tv_start, NULL);
+    tv_lap = tv_start;
+    de_ctx->mpm_prepare_cnt = 0;
+    de_ctx->mpm_prepare_usec = 0;
+
     if (SigAddressPrepareStage1(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
     }
+    stage_msec[0] = SigGroupBuildLap(&tv_lap);
 //exit(0);
     if (SigAddressPrepareStage2(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
     }
+    stage_msec[1] = SigGroupBuildLap(&tv_lap);
 
     if (SigAddressPrepareStage3(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
     }
+    stage_msec[2] = SigGroupBuildLap(&tv_lap);
+    /* mpm contexts of the signature groups queued by stage 3 */
+    (void)PatternMatchPrepareQueued(de_ctx);
+    PatternMatchDedupReport(de_ctx);
+    stage_msec[3] = SigGroupBuildLap(&tv_lap);
+
     if (SigAddressPrepareStage4(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
     }
+    PrefilterReport(de_ctx);
+    stage_msec[4] = SigGroupBuildLap(&tv_lap);
 
     if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
         MpmCtx *mpm_ctx = NULL;
@@ -4368,177 +4452,179 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("packet- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("packet- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_other_packet, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("packet- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_uri, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_uri, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("uri- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcbd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcbd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hcbd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hsbd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hsbd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hsbd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hrhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hmd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hmd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hmd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hcd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrud, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrud, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hrud- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("stream- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hsmd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hsmd- %d\n", mpm_ctx->pattern_cnt);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hsmd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hsmd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hscd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hscd- %d\n", mpm_ctx->pattern_cnt);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hscd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hscd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_huad, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("huad- %d\n", mpm_ctx->pattern_cnt);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_huad, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("huad- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhhd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hhhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhhd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hhhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhhd, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hrhhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhhd, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         }
         //printf("hrhhd- %d\n", mpm_ctx->pattern_cnt);
 
+        (void)PatternMatchPrepareQueued(de_ctx);
+
 #ifdef __SC_CUDA_SUPPORT__
         if (PatternMatchDefaultMatcher() == MPM_AC_CUDA) {
             int r = SCCudaCtxPopCurrent(NULL);
@@ -4555,6 +4641,19 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
 
     }
 
+    stage_msec[5] = SigGroupBuildLap(&tv_lap);
+    if (!(de_ctx->flags & DE_QUIET)) {
+        uint64_t msec = SigGroupBuildLap(&tv_start);
+        SCLogInfo("signature groups built in %"PRIu64" ms using %u "
+                "mpm build thread(s)", msec, de_ctx->build_threads);
+        SCLogInfo("build stages: stage1 %"PRIu64" ms, stage2 %"PRIu64" ms, "
+                "stage3 %"PRIu64" ms, group mpm %"PRIu64" ms, stage4 %"PRIu64
+                " ms, factory mpm %"PRIu64" ms", stage_msec[0], stage_msec[1],
+                stage_msec[2], stage_msec[3], stage_msec[4], stage_msec[5]);
+        SCLogInfo("%u mpm contexts prepared in %"PRIu64" ms",
+                de_ctx->mpm_prepare_cnt, de_ctx->mpm_prepare_usec / 1000);
+    }
+
 //    SigAddressPrepareStage5(de_ctx);
 //    DetectAddressPrintMemory();
 //    DetectSigGroupPrintMemory();
@@ -4775,6 +4874,9 @@ void SigTableSetup(void) {
     DetectIPRepRegister();
     DetectDnsQueryRegister();
     DetectAppLayerProtocolRegister();
+
+    /* pick the batch filter for the cpu */
+    DetectSimdSetup();
 }
 
 void SigTableRegisterTests(void)
@@ -11374,6 +11476,239 @@ end:
     return result;
 }
 
+/** \test sghs with the same content share their mpm ctx */
+static int SigTestMpmDedup01(void)
+{
+    int result = 0;
+    Packet *p[2] = { NULL, NULL };
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    uint8_t payload[] = "xxAAAxx";
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    p[0] = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+                              "1.2.3.4", "5.6.7.8", 1024, 80);
+    p[1] = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+                              "1.2.3.4", "5.6.7.8", 1024, 81);
+    if (p[0] == NULL || p[1] == NULL)
+        goto end;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        goto end;
+    }
+    de_ctx->mpm_matcher = MPM_B2G;
+    de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
+    de_ctx->flags |= DE_QUIET;
+
+    /* port 80 and 81 get different sghs, but the same patterns */
+    if (DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"AAA\"; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 81 "
+                "(content:\"AAA\"; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 81 "
+                "(dsize:>1000; sid:3;)") == NULL) {
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    if (de_ctx->mpm_dedup_shared_cnt == 0 || de_ctx->mpm_dedup_table != NULL) {
+        printf("%u of %u mpm ctxs shared: ", de_ctx->mpm_dedup_shared_cnt,
+               de_ctx->mpm_dedup_ctx_cnt);
+        goto end;
+    }
+
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p[0]);
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p[1]);
+    if (!PacketAlertCheck(p[0], 1) || PacketAlertCheck(p[0], 2)) {
+        printf("sid 1 should alert on p[0], sid 2 not: ");
+        goto end;
+    }
+    if (!PacketAlertCheck(p[1], 2) || PacketAlertCheck(p[1], 1)) {
+        printf("sid 2 should alert on p[1], sid 1 not: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    if (de_ctx != NULL)
+        SigGroupCleanup(de_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    UTHFreePackets(p, 2);
+    return result;
+}
+
+/** \test DetectBatch keeps the packets of a flow in order while it groups
+ *        the vector on signature group */
+static int SigTestDetectBatch01(void)
+{
+    int result = 0;
+    Packet *p[4] = { NULL, NULL, NULL, NULL };
+    Flow fa, fb;
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    uint8_t set[] = "xxsetxx";
+    uint8_t chk[] = "xxchkxx";
+    uint8_t none[] = "xxxxxxx";
+    int i;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&fa, 0, sizeof(Flow));
+    memset(&fb, 0, sizeof(Flow));
+    FLOW_INITIALIZE(&fa);
+    FLOW_INITIALIZE(&fb);
+    fa.proto = fb.proto = IPPROTO_TCP;
+
+    p[0] = UTHBuildPacket(set, sizeof(set) - 1, IPPROTO_TCP);
+    p[1] = UTHBuildPacket(none, sizeof(none) - 1, IPPROTO_TCP);
+    p[2] = UTHBuildPacket(chk, sizeof(chk) - 1, IPPROTO_TCP);
+    p[3] = UTHBuildPacket(chk, sizeof(chk) - 1, IPPROTO_TCP);
+    if (p[0] == NULL || p[1] == NULL || p[2] == NULL || p[3] == NULL)
+        goto end;
+
+    /* flow a: setter to server, checker to client. Flow b has no bit. */
+    for (i = 0; i < 4; i++) {
+        p[i]->flow = (i == 0 || i == 2) ? &fa : &fb;
+        p[i]->flags |= PKT_HAS_FLOW;
+        p[i]->flowflags |= (i == 2) ? FLOW_PKT_TOCLIENT : FLOW_PKT_TOSERVER;
+    }
+    /* sort keys that would put the checker before the setter if it
+     * didn't inherit the key of the first packet of its flow */
+    fa.sgh_toserver = (SigGroupHead *)&fa;
+    fa.sgh_toclient = NULL;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+
+    if (DetectEngineAppendSig(de_ctx, "alert tcp any any <> any any "
+                "(content:\"set\"; flowbits:set,x; flowbits:noalert; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any <> any any "
+                "(content:\"chk\"; flowbits:isset,x; sid:2;)") == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+
+    if (DetectBatch(&tv, p, 4, det_ctx) != TM_ECODE_OK)
+        goto end;
+
+    if (!PacketAlertCheck(p[2], 2)) {
+        printf("flow a checker should alert: ");
+        goto end;
+    }
+    if (PacketAlertCheck(p[3], 2) || PacketAlertCheck(p[0], 1)) {
+        printf("only the flow a checker should alert: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    if (de_ctx != NULL)
+        SigGroupCleanup(de_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    UTHFreePackets(p, 4);
+    FLOW_DESTROY(&fa);
+    FLOW_DESTROY(&fb);
+    return result;
+}
+
+/** \test preparing the mpm contexts with several threads builds the same
+ *        engine as preparing them one by one */
+static int SigTestBuildThreads01(void)
+{
+    DetectEngineCtx *de_ctx[2] = { NULL, NULL };
+    DetectEngineThreadCtx *det_ctx[2] = { NULL, NULL };
+    ThreadVars tv;
+    char sig[128];
+    char payload[64];
+    int result = 0;
+    int e, i, k;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    for (e = 0; e < 2; e++) {
+        de_ctx[e] = DetectEngineCtxInit();
+        if (de_ctx[e] == NULL)
+            goto end;
+        de_ctx[e]->flags |= DE_QUIET;
+        de_ctx[e]->build_threads = (e == 0) ? 1 : 4;
+
+        /* 8 port groups, each with its own patterns */
+        for (i = 0; i < 64; i++) {
+            snprintf(sig, sizeof(sig), "alert tcp any any -> any %d "
+                    "(content:\"pattern%02d\"; sid:%d;)", 1000 + i % 8, i, i + 1);
+            if (DetectEngineAppendSig(de_ctx[e], sig) == NULL)
+                goto end;
+        }
+
+        SigGroupBuild(de_ctx[e]);
+        DetectEngineThreadCtxInit(&tv, (void *)de_ctx[e], (void *)&det_ctx[e]);
+        if (det_ctx[e] == NULL)
+            goto end;
+    }
+
+    if (de_ctx[0]->mpm_prepare_cnt == 0 ||
+        de_ctx[0]->mpm_prepare_cnt != de_ctx[1]->mpm_prepare_cnt) {
+        printf("prepared %u mpm contexts serial, %u parallel: ",
+                de_ctx[0]->mpm_prepare_cnt, de_ctx[1]->mpm_prepare_cnt);
+        goto end;
+    }
+
+    for (k = 0; k < 8; k++) {
+        /* k and k + 8 are in the group of the port, k + 17 is not */
+        snprintf(payload, sizeof(payload), "xx pattern%02d pattern%02d "
+                "pattern%02d xx", k, k + 8, k + 17);
+
+        for (e = 0; e < 2; e++) {
+            Packet *p = UTHBuildPacketSrcDstPorts((uint8_t *)payload,
+                    strlen(payload), IPPROTO_TCP, 4000, 1000 + k);
+            if (p == NULL)
+                goto end;
+
+            SigMatchSignatures(&tv, de_ctx[e], det_ctx[e], p);
+
+            for (i = 0; i < 64; i++) {
+                int expect = (i == k || i == k + 8);
+                if ((PacketAlertCheck(p, i + 1) != 0) != expect) {
+                    printf("%s engine: sid %d on port %d %s alert: ",
+                            e == 0 ? "serial" : "parallel", i + 1, 1000 + k,
+                            expect ? "should" : "shouldn't");
+                    UTHFreePacket(p);
+                    goto end;
+                }
+            }
+            UTHFreePacket(p);
+        }
+    }
+
+    result = 1;
+end:
+    for (e = 0; e < 2; e++) {
+        if (det_ctx[e] != NULL)
+            DetectEngineThreadCtxDeinit(&tv, det_ctx[e]);
+        if (de_ctx[e] != NULL) {
+            SigGroupCleanup(de_ctx[e]);
+            DetectEngineCtxFree(de_ctx[e]);
+        }
+    }
+    return result;
+}
+
 static const char *dummy_conf_string2 =
     "%YAML 1.1\n"
     "---\n"
@@ -11773,6 +12108,9 @@ void SigRegisterTests(void) {
     UtRegisterTest("DetectAddressYamlParsing04", DetectAddressYamlParsing04, 1);
 
     UtRegisterTest("SigTestPorts01", SigTestPorts01, 1);
+    UtRegisterTest("SigTestMpmDedup01", SigTestMpmDedup01, 1);
+    UtRegisterTest("SigTestDetectBatch01", SigTestDetectBatch01, 1);
+    UtRegisterTest("SigTestBuildThreads01", SigTestBuildThreads01, 1);
 
     DetectSimdRegisterTests();
 #endif /* UNITTESTS */
@@ -442,6 +442,10 @@ typedef struct Signature_ {
     struct SigMatch_ *sm_lists[DETECT_SM_LIST_MAX];
     /* holds all sm lists' tails */
     struct SigMatch_ *sm_lists_tail[DETECT_SM_LIST_MAX];
+    /* contiguous storage of all the sm lists once the sig is final, each
+     * list is a range of it, see SigMatchListsCompact() */
+    struct SigMatch_ *sm_block;
+    uint32_t sm_block_cnt;
 
     SigMatch *filestore_sm;
 
@@ -671,6 +675,29 @@ typedef struct DetectEngineCtx_ {
 
     MpmCtxFactoryContainer *mpm_ctx_factory_container;
 
+    /** threads used to prepare the mpm contexts in SigGroupBuild */
+    uint16_t build_threads;
+    /** mpm contexts waiting for PatternMatchPrepareQueued() */
+    struct MpmPrepareItem_ *mpm_prepare_queue;
+    uint32_t mpm_prepare_queue_cnt;
+    uint32_t mpm_prepare_queue_size;
+    /** mpm contexts prepared by SigGroupBuild and the time spent on it */
+    uint32_t mpm_prepare_cnt;
+    uint64_t mpm_prepare_usec;
+
+    /** signature group mpm contexts by pattern set, to share identical
+     *  ones. Only used while building. */
+    HashListTable *mpm_dedup_table;
+    /** non empty signature group mpm contexts */
+    uint32_t mpm_dedup_ctx_cnt;
+    /** of those, the ones replaced by an identical one */
+    uint32_t mpm_dedup_shared_cnt;
+
+    /** build packet prefilters for the signature groups */
+    int prefilter;
+    uint32_t prefilter_sgh_cnt;
+    uint32_t prefilter_cond_cnt;
+
     /* maximum recursion depth for content inspection */
     int inspection_recursion_limit;
 
@@ -754,13 +781,6 @@ enum {
     ENGINE_SGH_MPM_FACTORY_CONTEXT_AUTO
 };
 
-typedef struct HttpReassembledBody_ {
-    uint8_t *buffer;
-    uint32_t buffer_size;   /**< size of the buffer itself */
-    uint32_t buffer_len;    /**< data len in the buffer */
-    uint64_t offset;        /**< data offset */
-} HttpReassembledBody;
-
 #define DETECT_FILESTORE_MAX 15
 /** \todo review how many we actually need here */
 #define DETECT_SMSG_PMQ_NUM 256
@@ -783,21 +803,9 @@ typedef struct DetectionEngineThreadCtx_ {
     /* counter for the filestore array below -- up here for cache reasons. */
     uint16_t filestore_cnt;
 
-    HttpReassembledBody *hsbd;
-    uint64_t hsbd_start_tx_id;
-    uint16_t hsbd_buffers_size;
-    uint16_t hsbd_buffers_list_len;
-
-    HttpReassembledBody *hcbd;
-    uint64_t hcbd_start_tx_id;
-    uint16_t hcbd_buffers_size;
-    uint16_t hcbd_buffers_list_len;
-
-    uint8_t **hhd_buffers;
-    uint32_t *hhd_buffers_len;
-    uint16_t hhd_buffers_size;
-    uint16_t hhd_buffers_list_len;
-    uint64_t hhd_start_tx_id;
+    /** current detection pass, unique over all detect threads. Used to
+     *  reuse the http body inspection buffers within a pass. */
+    uint64_t inspect_pass;
 
     /** id for alert counter */
     uint16_t counter_alerts;
@@ -823,6 +831,9 @@ typedef struct DetectionEngineThreadCtx_ {
     /** size in use */
     SigIntId match_array_cnt;
 
+    /** prefilter bitmap of the current sgh, see DetectPrefilterRun() */
+    uint64_t *prefilter_bits;
+
     /** Array of sigs that had a state change */
     SigIntId de_state_sig_array_len;
     uint8_t *de_state_sig_array;
@@ -836,6 +847,8 @@ typedef struct DetectionEngineThreadCtx_ {
     MpmThreadCtx mtcs;  /**< thread ctx for stream mpm */
     PatternMatcherQueue pmq;
     PatternMatcherQueue smsg_pmq[DETECT_SMSG_PMQ_NUM];
+    /** scratch pmq for the streaming http body mpm */
+    PatternMatcherQueue body_pmq;
 
     /** ip only rules ctx */
     DetectEngineIPOnlyThreadCtx io_ctx;
@@ -865,6 +878,8 @@ typedef struct DetectionEngineThreadCtx_ {
 #ifdef PROFILING
     struct SCProfileData_ *rule_perf_data;
     int rule_perf_data_size;
+    /** reset generation the counters belong to */
+    uint32_t rule_perf_gen;
     struct SCProfileKeywordData_ *keyword_perf_data;
     struct SCProfileKeywordData_ *keyword_perf_data_per_list[DETECT_SM_LIST_MAX];
     int keyword_perf_list; /**< list we're currently inspecting, DETECT_SM_LIST_* */
@@ -896,6 +911,13 @@ typedef struct SigTableElmt_ {
     void (*Free)(void *);
     void (*RegisterTests)(void);
 
+    /** optional: compare two sigmatches of this keyword. Set by keywords
+     *  of which the Match only depends on the packet and its flow, so it
+     *  can be used as a signature group prefilter. */
+    int (*PrefilterCompare)(const SigMatch *, const SigMatch *);
+    /** optional: can this sigmatch be a prefilter for the group */
+    int (*SupportsPrefilter)(const struct SigGroupHead_ *, const SigMatch *);
+
     uint8_t flags;
     char *name;     /**< keyword name alias */
     char *alias;    /**< name alias */
@@ -960,11 +982,17 @@ typedef struct SigGroupHead_ {
 
     uint16_t mpm_content_maxlen;
 
-    /** array of masks, used to check multiple masks against
-     *  a packet using SIMD. */
-#if defined(__SSE3__) || defined(__tile__)
+    /** structure of arrays copy of the head_array fields checked by the
+     *  batch filter in detect-simd.c, to check 16 to 64 signatures at
+     *  once. Aligned to 64 bytes and padded to a multiple of 64 sigs. */
     SignatureMask *mask_array;
-#endif
+    /** alproto of app layer sigs, ALPROTO_UNKNOWN for the others */
+    AppProto *alproto_array;
+    /** the only ip protocol of the sig, 0 if it has more */
+    uint8_t *ipproto_array;
+    uint16_t *mpm_id_div8_array;
+    /** 0 if the sig isn't filtered by the mpm */
+    uint8_t *mpm_id_mod8_array;
     /** chunk of memory containing the "header" part of each
      *  signature ordered as an array. Used to pre-filter the
      *  signatures to be inspected in a cache efficient way. */
@@ -1007,6 +1035,9 @@ typedef struct SigGroupHead_ {
     /** Array with sig ptrs... size is sig_cnt * sizeof(Signature *) */
     Signature **match_array;
 
+    /** packet prefilters for the non content keywords, NULL if none */
+    struct SigGroupHeadPrefilter_ *prefilter;
+
     /* ptr to our init data we only use at... init :) */
     SigGroupHeadInitData *init;
 } SigGroupHead;
@@ -1156,7 +1187,7 @@ SigMatch *SigMatchAlloc(void);
 Signature *SigFindSignatureBySidGid(DetectEngineCtx *, uint32_t, uint32_t);
 void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *,
                                        Packet *, SignatureMask,
-                                       uint16_t);
+                                       const uint64_t *, uint16_t);
 int SigMatchSignaturesBuildMatchArrayAddSignature(DetectEngineThreadCtx *,
                                                   Packet *, SignatureHeader *,
                                                   uint16_t);
@@ -1165,6 +1196,7 @@ void SigCleanSignatures(DetectEngineCtx *);
 
 void SigTableRegisterTests(void);
 void SigRegisterTests(void);
+void DetectSimdSetup(void);
 void DetectSimdRegisterTests(void);
 void TmModuleDetectRegister (void);
 
@@ -63,6 +63,7 @@
 
 #include "host-timeout.h"
 #include "defrag-timeout.h"
+#include "util-logopenfile.h"
 
 /* Run mode selected at suricata.c */
 extern int run_mode;
@@ -77,10 +78,17 @@ SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 #define FLOW_EMERG_MODE_UPDATE_DELAY_NSEC 100000
 #define NEW_FLOW_COUNT_COND 10
 
+/** number of flow manager threads. Each of them handles its own slice
+ *  of the flow hash rows. */
+static uint32_t flowmgr_number = 1;
+/** used to hand out the instance numbers to the flow manager threads */
+SC_ATOMIC_DECLARE(uint32_t, flowmgr_cnt);
+
 typedef struct FlowTimeoutCounters_ {
     uint32_t new;
     uint32_t est;
     uint32_t clo;
+    uint32_t byp;
 } FlowTimeoutCounters;
 
 /**
@@ -94,7 +102,7 @@ void FlowKillFlowManagerThread(void)
     ThreadVars *tv = NULL;
     int cnt = 0;
 
-    SCCtrlCondSignal(&flow_manager_ctrl_cond);
+    SCCtrlCondBroadcast(&flow_manager_ctrl_cond);
 
     SCMutexLock(&tv_root_lock);
 
@@ -102,7 +110,7 @@ void FlowKillFlowManagerThread(void)
     tv = tv_root[TVT_MGMT];
 
     while (tv != NULL) {
-        if (strcasecmp(tv->name, "FlowManagerThread") == 0) {
+        if (strncasecmp(tv->name, "FlowManagerThread", 17) == 0) {
             TmThreadsSetFlag(tv, THV_KILL);
             TmThreadsSetFlag(tv, THV_DEINIT);
 
@@ -130,9 +138,14 @@ void FlowKillFlowManagerThread(void)
  *
  *  \param f flow
  *
- *  \retval state either FLOW_STATE_NEW, FLOW_STATE_ESTABLISHED or FLOW_STATE_CLOSED
+ *  \retval state either FLOW_STATE_NEW, FLOW_STATE_ESTABLISHED,
+ *                FLOW_STATE_CLOSED or FLOW_STATE_LOCAL_BYPASSED
  */
 static inline int FlowGetFlowState(Flow *f) {
+    /* the protocol state isn't updated anymore once bypassed */
+    if (f->flags & FLOW_BYPASSED)
+        return FLOW_STATE_LOCAL_BYPASSED;
+
     if (flow_proto[f->protomap].GetProtoState != NULL) {
         return flow_proto[f->protomap].GetProtoState(f->protoctx);
     } else {
@@ -167,6 +180,11 @@ static inline uint32_t FlowGetFlowTimeout(Flow *f, int state, int emergency) {
             case FLOW_STATE_CLOSED:
                 timeout = flow_proto[f->protomap].emerg_closed_timeout;
                 break;
+            case FLOW_STATE_LOCAL_BYPASSED:
+                timeout = flow_proto[f->protomap].bypassed_timeout;
+                if (timeout > flow_proto[f->protomap].emerg_est_timeout)
+                    timeout = flow_proto[f->protomap].emerg_est_timeout;
+                break;
         }
     } else { /* implies no emergency */
         switch(state) {
@@ -180,6 +198,9 @@ static inline uint32_t FlowGetFlowTimeout(Flow *f, int state, int emergency) {
             case FLOW_STATE_CLOSED:
                 timeout = flow_proto[f->protomap].closed_timeout;
                 break;
+            case FLOW_STATE_LOCAL_BYPASSED:
+                timeout = flow_proto[f->protomap].bypassed_timeout;
+                break;
         }
     }
 
@@ -313,6 +334,9 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
                 case FLOW_STATE_CLOSED:
                     counters->clo++;
                     break;
+                case FLOW_STATE_LOCAL_BYPASSED:
+                    counters->byp++;
+                    break;
             }
         } else {
             FLOWLOCK_UNLOCK(f);
@@ -329,11 +353,14 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
  *
  *  \param ts timestamp
  *  \param try_cnt number of flows to time out max (0 is unlimited)
+ *  \param hash_min first hash row to check
+ *  \param hash_max hash row to stop at (not checked itself)
  *  \param counters ptr to FlowTimeoutCounters structure
  *
  *  \retval cnt number of timed out flow
  */
-uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt, FlowTimeoutCounters *counters) {
+uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
+        uint32_t hash_min, uint32_t hash_max, FlowTimeoutCounters *counters) {
     uint32_t idx = 0;
     uint32_t cnt = 0;
     int emergency = 0;
@@ -341,7 +368,7 @@ uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt, FlowTimeoutCounte
     if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
         emergency = 1;
 
-    for (idx = 0; idx < flow_config.hash_size; idx++) {
+    for (idx = hash_min; idx < hash_max; idx++) {
         FlowBucket *fb = &flow_hash[idx];
 
         if (FBLOCK_TRYLOCK(fb) != 0)
@@ -367,11 +394,28 @@ next:
 
 extern int g_detect_disabled;
 
+/** \internal
+ *  \brief Get the hash rows [min, max) of a flow manager instance.
+ *
+ *  The rows are split as evenly as possible, together the instances
+ *  cover the whole hash.
+ */
+static void FlowManagerHashSlice(uint32_t instance, uint32_t number,
+        uint32_t hash_size, uint32_t *hash_min, uint32_t *hash_max)
+{
+    *hash_min = (uint32_t)((uint64_t)hash_size * instance / number);
+    *hash_max = (uint32_t)((uint64_t)hash_size * (instance + 1) / number);
+}
+
 /** \brief Thread that manages the flow table and times out flows.
  *
  *  \param td ThreadVars casted to void ptr
  *
  *  Keeps an eye on the spare list, alloc flows if needed...
+ *
+ *  With multiple flow manager threads each thread times out the flows
+ *  of its own slice of the hash rows. The first thread also handles
+ *  the spare queue, the defrag and host tables and the global counters.
  */
 void *FlowManagerThread(void *td)
 {
@@ -387,6 +431,14 @@ void *FlowManagerThread(void *td)
     struct timespec cond_time;
     int flow_update_delay_sec = FLOW_NORMAL_MODE_UPDATE_DELAY_SEC;
     int flow_update_delay_nsec = FLOW_NORMAL_MODE_UPDATE_DELAY_NSEC;
+
+    /* get our slice of the hash */
+    uint32_t instance = SC_ATOMIC_ADD(flowmgr_cnt, 1) - 1;
+    uint32_t hash_min, hash_max;
+    FlowManagerHashSlice(instance, flowmgr_number, flow_config.hash_size,
+            &hash_min, &hash_max);
+    SCLogDebug("%s: instance %u handles hash rows %u-%u", th_v->name,
+            instance, hash_min, hash_max);
 /* VJ leaving disabled for now, as hosts are only used by tags and the numbers
  * are really low. Might confuse ppl
     uint16_t flow_mgr_host_prune = SCPerfTVRegisterCounter("hosts.pruned", th_v,
@@ -402,21 +454,30 @@ void *FlowManagerThread(void *td)
     uint16_t flow_mgr_cnt_clo = SCPerfTVRegisterCounter("flow_mgr.closed_pruned", th_v,
             SC_PERF_TYPE_UINT64,
             "NULL");
-    uint16_t flow_mgr_cnt_new = SCPerfTVRegisterCounter("flow_mgr.new_pruned", th_v,
-            SC_PERF_TYPE_UINT64,
-            "NULL");
-    uint16_t flow_mgr_cnt_est = SCPerfTVRegisterCounter("flow_mgr.est_pruned", th_v,
-            SC_PERF_TYPE_UINT64,
-            "NULL");
-    uint16_t flow_mgr_memuse = SCPerfTVRegisterCounter("flow.memuse", th_v,
+    uint16_t flow_mgr_cnt_byp = SCPerfTVRegisterCounter("flow_mgr.bypassed_pruned", th_v,
             SC_PERF_TYPE_UINT64,
             "NULL");
-    uint16_t flow_mgr_spare = SCPerfTVRegisterCounter("flow.spare", th_v,
+    uint16_t flow_mgr_cnt_new = SCPerfTVRegisterCounter("flow_mgr.new_pruned", th_v,
             SC_PERF_TYPE_UINT64,
             "NULL");
-    uint16_t flow_emerg_mode_enter = SCPerfTVRegisterCounter("flow.emerg_mode_entered", th_v,
+    uint16_t flow_mgr_cnt_est = SCPerfTVRegisterCounter("flow_mgr.est_pruned", th_v,
             SC_PERF_TYPE_UINT64,
             "NULL");
+    /* global counters, only reported by the first instance */
+    uint16_t flow_mgr_memuse = 0;
+    uint16_t flow_mgr_spare = 0;
+    uint16_t flow_emerg_mode_enter = 0;
+    if (instance == 0) {
+        flow_mgr_memuse = SCPerfTVRegisterCounter("flow.memuse", th_v,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+        flow_mgr_spare = SCPerfTVRegisterCounter("flow.spare", th_v,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+        flow_emerg_mode_enter = SCPerfTVRegisterCounter("flow.emerg_mode_entered", th_v,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+    }
     uint16_t flow_emerg_mode_over = SCPerfTVRegisterCounter("flow.emerg_mode_over", th_v,
             SC_PERF_TYPE_UINT64,
             "NULL");
@@ -461,7 +522,9 @@ void *FlowManagerThread(void *td)
 
                 SCLogDebug("Flow emergency mode entered...");
 
-                SCPerfCounterIncr(flow_emerg_mode_enter, th_v->sc_perf_pca);
+                /* every instance sees the emergency, count it once */
+                if (instance == 0)
+                    SCPerfCounterIncr(flow_emerg_mode_enter, th_v->sc_perf_pca);
             }
         }
 
@@ -476,16 +539,20 @@ void *FlowManagerThread(void *td)
         }
 
         /* see if we still have enough spare flows */
-        FlowUpdateSpareFlows();
+        if (instance == 0)
+            FlowUpdateSpareFlows();
 
         /* try to time out flows */
-        FlowTimeoutCounters counters = { 0, 0, 0, };
-        FlowTimeoutHash(&ts, 0 /* check all */, &counters);
-
-
-        DefragTimeoutHash(&ts);
-        //uint32_t hosts_pruned =
-        HostTimeoutHash(&ts);
+        FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+        FlowTimeoutHash(&ts, 0 /* check all */, hash_min, hash_max, &counters);
+
+        if (instance == 0) {
+            DefragTimeoutHash(&ts);
+            //uint32_t hosts_pruned =
+            HostTimeoutHash(&ts);
+            /* log records of threads that have gone quiet */
+            LogFileBatchFlushIdle(time(NULL));
+        }
 /*
         SCPerfCounterAddUI64(flow_mgr_host_prune, th_v->sc_perf_pca, (uint64_t)hosts_pruned);
         uint32_t hosts_active = HostGetActiveCount();
@@ -494,16 +561,29 @@ void *FlowManagerThread(void *td)
         SCPerfCounterSetUI64(flow_mgr_host_spare, th_v->sc_perf_pca, (uint64_t)hosts_spare);
 */
         SCPerfCounterAddUI64(flow_mgr_cnt_clo, th_v->sc_perf_pca, (uint64_t)counters.clo);
+        SCPerfCounterAddUI64(flow_mgr_cnt_byp, th_v->sc_perf_pca, (uint64_t)counters.byp);
         SCPerfCounterAddUI64(flow_mgr_cnt_new, th_v->sc_perf_pca, (uint64_t)counters.new);
         SCPerfCounterAddUI64(flow_mgr_cnt_est, th_v->sc_perf_pca, (uint64_t)counters.est);
-        long long unsigned int flow_memuse = SC_ATOMIC_GET(flow_memuse);
-        SCPerfCounterSetUI64(flow_mgr_memuse, th_v->sc_perf_pca, (uint64_t)flow_memuse);
-
         uint32_t len = 0;
         FQLOCK_LOCK(&flow_spare_q);
         len = flow_spare_q.len;
         FQLOCK_UNLOCK(&flow_spare_q);
-        SCPerfCounterSetUI64(flow_mgr_spare, th_v->sc_perf_pca, (uint64_t)len);
+
+        /* global stats only need to be reported by one thread */
+        if (instance == 0) {
+            long long unsigned int flow_memuse = SC_ATOMIC_GET(flow_memuse);
+            SCPerfCounterSetUI64(flow_mgr_memuse, th_v->sc_perf_pca, (uint64_t)flow_memuse);
+            SCPerfCounterSetUI64(flow_mgr_spare, th_v->sc_perf_pca, (uint64_t)len);
+        }
+
+        /* another flow manager thread may have ended the emergency */
+        if (emerg == TRUE && !(SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)) {
+            emerg = FALSE;
+            prev_emerg = FALSE;
+
+            flow_update_delay_sec = FLOW_NORMAL_MODE_UPDATE_DELAY_SEC;
+            flow_update_delay_nsec = FLOW_NORMAL_MODE_UPDATE_DELAY_NSEC;
+        }
 
         /* Don't fear, FlowManagerThread is here...
          * clear emergency bit if we have at least xx flows pruned. */
@@ -565,26 +645,63 @@ void *FlowManagerThread(void *td)
     return NULL;
 }
 
-/** \brief spawn the flow manager thread */
+/** \brief spawn the flow manager thread(s)
+ *
+ *  The number of threads is set by "flow.managers", default 1.
+ */
 void FlowManagerThreadSpawn()
 {
-    ThreadVars *tv_flowmgr = NULL;
+    intmax_t setting = 1;
+    uint32_t u;
+
+    if (ConfGetInt("flow.managers", &setting) == 1) {
+        if (setting < 1 || setting > 1024) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                    "invalid flow.managers setting %"PRIdMAX, setting);
+            exit(EXIT_FAILURE);
+        }
+    }
+    flowmgr_number = (uint32_t)setting;
+    /* every thread needs at least one hash row */
+    if (flowmgr_number > flow_config.hash_size)
+        flowmgr_number = flow_config.hash_size;
+
+    SCLogInfo("using %u flow manager threads", flowmgr_number);
 
     SCCtrlCondInit(&flow_manager_ctrl_cond, NULL);
     SCCtrlMutexInit(&flow_manager_ctrl_mutex, NULL);
 
-    tv_flowmgr = TmThreadCreateMgmtThread("FlowManagerThread",
-                                          FlowManagerThread, 0);
+    SC_ATOMIC_INIT(flowmgr_cnt);
 
-    TmThreadSetCPU(tv_flowmgr, MANAGEMENT_CPU_SET);
+    for (u = 0; u < flowmgr_number; u++) {
+        ThreadVars *tv_flowmgr = NULL;
+        char *name = "FlowManagerThread";
 
-    if (tv_flowmgr == NULL) {
-        printf("ERROR: TmThreadsCreate failed\n");
-        exit(1);
-    }
-    if (TmThreadSpawn(tv_flowmgr) != TM_ECODE_OK) {
-        printf("ERROR: TmThreadSpawn failed\n");
-        exit(1);
+        /* keep the old name if there is just one */
+        if (flowmgr_number > 1) {
+            char tname[32];
+            snprintf(tname, sizeof(tname), "FlowManagerThread%02u", u+1);
+
+            name = SCStrdup(tname);
+            if (unlikely(name == NULL)) {
+                SCLogError(SC_ERR_MEM_ALLOC, "failed to strdup thread name");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        tv_flowmgr = TmThreadCreateMgmtThread(name,
+                                              FlowManagerThread, 0);
+
+        if (tv_flowmgr == NULL) {
+            printf("ERROR: TmThreadsCreate failed\n");
+            exit(1);
+        }
+        TmThreadSetCPU(tv_flowmgr, MANAGEMENT_CPU_SET);
+
+        if (TmThreadSpawn(tv_flowmgr) != TM_ECODE_OK) {
+            printf("ERROR: TmThreadSpawn failed\n");
+            exit(1);
+        }
     }
 
     return;
@@ -839,8 +956,8 @@ static int FlowMgrTest05 (void) {
     struct timeval ts;
     TimeGet(&ts);
     /* try to time out flows */
-    FlowTimeoutCounters counters = { 0, 0, 0, };
-    FlowTimeoutHash(&ts, 0 /* check all */, &counters);
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    FlowTimeoutHash(&ts, 0 /* check all */, 0, flow_config.hash_size, &counters);
 
     if (flow_spare_q.len > 0) {
         result = 1;
@@ -851,6 +968,86 @@ static int FlowMgrTest05 (void) {
 
     return result;
 }
+
+/**
+ *  \test   Test that the hash slices of the flow managers cover the
+ *          whole hash without overlap.
+ */
+static int FlowMgrTest06 (void) {
+    uint32_t sizes[] = { 1, 7, 100, 4096, 65536, 65537 };
+    uint32_t s, number, i;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (number = 1; number <= 16 && number <= sizes[s]; number++) {
+            uint32_t next = 0;
+            uint32_t smallest = UINT32_MAX, largest = 0;
+
+            for (i = 0; i < number; i++) {
+                uint32_t hash_min, hash_max;
+                FlowManagerHashSlice(i, number, sizes[s], &hash_min, &hash_max);
+                if (hash_min != next || hash_max < hash_min) {
+                    printf("size %u, %u managers: instance %u has %u-%u, "
+                            "expected to start at %u: ", sizes[s], number, i,
+                            hash_min, hash_max, next);
+                    return 0;
+                }
+                next = hash_max;
+
+                if (hash_max - hash_min < smallest)
+                    smallest = hash_max - hash_min;
+                if (hash_max - hash_min > largest)
+                    largest = hash_max - hash_min;
+            }
+            if (next != sizes[s] || smallest == 0 || largest - smallest > 1) {
+                printf("size %u, %u managers: slices up to %u, %u-%u rows: ",
+                        sizes[s], number, next, smallest, largest);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ *  \test   Test that timing out each slice of 4 flow managers times out
+ *          all flows of the hash.
+ */
+static int FlowMgrTest07 (void) {
+    int result = 0;
+    uint32_t i;
+
+    FlowInitConfig(FLOW_QUIET);
+    uint32_t spare = flow_spare_q.len;
+
+    UTHBuildPacketOfFlows(0, 100, 0);
+    if (flow_spare_q.len != spare - 100)
+        goto end;
+
+    TimeSetIncrementTime(2000);
+    struct timeval ts;
+    TimeGet(&ts);
+
+    uint32_t timed_out = 0;
+    for (i = 0; i < 4; i++) {
+        uint32_t hash_min, hash_max;
+        FlowManagerHashSlice(i, 4, flow_config.hash_size, &hash_min, &hash_max);
+
+        FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+        FlowTimeoutHash(&ts, 0 /* check all */, hash_min, hash_max, &counters);
+        timed_out += counters.new + counters.est + counters.clo + counters.byp;
+    }
+
+    if (timed_out != 100 || flow_spare_q.len != spare) {
+        printf("timed out %u flows, spare queue %u of %u: ", timed_out,
+                flow_spare_q.len, spare);
+        goto end;
+    }
+
+    result = 1;
+end:
+    FlowShutdown();
+    return result;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -863,5 +1060,7 @@ void FlowMgrRegisterTests (void) {
     UtRegisterTest("FlowMgrTest03 -- Timeout a flow in emergency having fresh TcpSession", FlowMgrTest03, 1);
     UtRegisterTest("FlowMgrTest04 -- Timeout a flow in emergency having TcpSession with segments", FlowMgrTest04, 1);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap", FlowMgrTest05, 1);
+    UtRegisterTest("FlowMgrTest06 -- Test the hash slices of multiple flow managers", FlowMgrTest06, 1);
+    UtRegisterTest("FlowMgrTest07 -- Timeout all flows over the slices of 4 flow managers", FlowMgrTest07, 1);
 #endif /* UNITTESTS */
 }
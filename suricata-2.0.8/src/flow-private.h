@@ -46,6 +46,7 @@
 #define FLOW_IPPROTO_UDP_EST_TIMEOUT 300
 #define FLOW_IPPROTO_ICMP_NEW_TIMEOUT 30
 #define FLOW_IPPROTO_ICMP_EST_TIMEOUT 300
+#define FLOW_DEFAULT_BYPASSED_TIMEOUT 100
 
 #define FLOW_DEFAULT_EMERG_NEW_TIMEOUT 10
 #define FLOW_DEFAULT_EMERG_EST_TIMEOUT 100
@@ -27,6 +27,7 @@
 #include "conf.h"
 #include "threadvars.h"
 #include "tm-threads.h"
+#include "tm-queuehandlers.h"
 #include "runmodes.h"
 
 #include "util-random.h"
@@ -227,8 +228,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
             p->tcph->th_ack = htonl(ssn->server.last_ack);
         } else {
             p->tcph->th_seq = htonl(ssn->client.next_seq);
-            p->tcph->th_ack = htonl(ssn->server.seg_list_tail->seq +
-                                    ssn->server.seg_list_tail->payload_len);
+            p->tcph->th_ack = htonl(StreamTcpStreamDataEndSeq(&ssn->server));
         }
 
         /* to client */
@@ -241,8 +241,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
             p->tcph->th_ack = htonl(ssn->client.last_ack);
         } else {
             p->tcph->th_seq = htonl(ssn->server.next_seq);
-            p->tcph->th_ack = htonl(ssn->client.seg_list_tail->seq +
-                                    ssn->client.seg_list_tail->payload_len);
+            p->tcph->th_ack = htonl(StreamTcpStreamDataEndSeq(&ssn->client));
         }
     }
 
@@ -557,8 +556,7 @@ static inline void FlowForceReassemblyForHash(void)
             if (client_ok == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY) {
                 StreamTcpThread *stt = SC_ATOMIC_GET(stream_pseudo_pkt_stream_tm_slot->slot_data);
 
-                ssn->client.last_ack = (ssn->client.seg_list_tail->seq +
-                        ssn->client.seg_list_tail->payload_len);
+                ssn->client.last_ack = StreamTcpStreamDataEndSeq(&ssn->client);
 
                 FlowForceReassemblyPseudoPacketSetup(reassemble_p, 1, f, ssn, 1);
                 StreamTcpReassembleHandleSegment(stream_pseudo_pkt_stream_TV,
@@ -570,8 +568,7 @@ static inline void FlowForceReassemblyForHash(void)
             if (server_ok == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY) {
                 StreamTcpThread *stt = SC_ATOMIC_GET(stream_pseudo_pkt_stream_tm_slot->slot_data);
 
-                ssn->server.last_ack = (ssn->server.seg_list_tail->seq +
-                        ssn->server.seg_list_tail->payload_len);
+                ssn->server.last_ack = StreamTcpStreamDataEndSeq(&ssn->server);
 
                 FlowForceReassemblyPseudoPacketSetup(reassemble_p, 0, f, ssn, 1);
                 StreamTcpReassembleHandleSegment(stream_pseudo_pkt_stream_TV,
@@ -681,14 +678,15 @@ void FlowForceReassembly(void)
 
     /* we are doing this in order receive -> decode -> ... -> log */
     while (tv != NULL) {
-        if (tv->inq != NULL) {
+        /* threads that decode were disabled together with the receive
+         * threads, e.g. the pcap-file workers. They are idle already. */
+        if (tv->inq != NULL && !TmThreadsCheckFlag(tv, THV_RUNNING_DONE)) {
             /* we wait till we dry out all the inq packets, before we
              * kill this thread.  Do note that you should have disabled
              * packet acquire by now using TmThreadDisableReceiveThreads()*/
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                   strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                PacketQueue *q = &trans_q[tv->inq->id];
-                while (q->len != 0) {
+                while (TmqhInputQueueLen(tv) != 0) {
                     usleep(100);
                 }
                 TmThreadsSetFlag(tv, THV_PAUSE);
@@ -234,7 +234,7 @@ static inline int FlowUpdateSeenFlag(const Packet *p)
  *  \param tv threadvars
  *  \param p packet to handle flow for
  */
-void FlowHandlePacket(ThreadVars *tv, Packet *p)
+void FlowHandlePacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
 {
     /* Get this packet's flow from the hash. FlowHandlePacket() will setup
      * a new flow if nescesary. If we get NULL, we're out of flow memory.
@@ -254,28 +254,37 @@ void FlowHandlePacket(ThreadVars *tv, Packet *p)
         if (FlowUpdateSeenFlag(p)) {
             f->flags |= FLOW_TO_DST_SEEN;
         }
-#ifdef DEBUG
         f->todstpktcnt++;
-#endif
+        f->todstbytecnt += GET_PKT_LEN(p);
         p->flowflags |= FLOW_PKT_TOSERVER;
     } else {
         if (FlowUpdateSeenFlag(p)) {
             f->flags |= FLOW_TO_SRC_SEEN;
         }
-#ifdef DEBUG
         f->tosrcpktcnt++;
-#endif
+        f->tosrcbytecnt += GET_PKT_LEN(p);
         p->flowflags |= FLOW_PKT_TOCLIENT;
     }
-#ifdef DEBUG
-    f->bytecnt += GET_PKT_LEN(p);
-#endif
 
     if ((f->flags & FLOW_TO_DST_SEEN) && (f->flags & FLOW_TO_SRC_SEEN)) {
         SCLogDebug("pkt %p FLOW_PKT_ESTABLISHED", p);
         p->flowflags |= FLOW_PKT_ESTABLISHED;
     }
 
+    /* locally bypassed flow: the packet only needs the flow update above,
+     * stream tracking and detection will skip it */
+    if (f->flags & FLOW_BYPASSED) {
+        SCLogDebug("pkt %p of bypassed flow %p", p, f);
+        p->flags |= (PKT_BYPASSED|PKT_STREAM_NOPCAPLOG);
+        DecodeSetNoPacketInspectionFlag(p);
+        DecodeSetNoPayloadInspectionFlag(p);
+        if (tv != NULL && dtv != NULL) {
+            SCPerfCounterIncr(dtv->counter_flow_bypassed_pkts, tv->sc_perf_pca);
+            SCPerfCounterAddUI64(dtv->counter_flow_bypassed_bytes, tv->sc_perf_pca,
+                    GET_PKT_LEN(p));
+        }
+    }
+
     /*set the detection bypass flags*/
     if (f->flags & FLOW_NOPACKET_INSPECTION) {
         SCLogDebug("setting FLOW_NOPACKET_INSPECTION flag on flow %p", f);
@@ -495,6 +504,8 @@ void FlowInitFlowProto(void)
         FLOW_DEFAULT_EMERG_EST_TIMEOUT;
     flow_proto[FLOW_PROTO_DEFAULT].emerg_closed_timeout =
         FLOW_DEFAULT_EMERG_CLOSED_TIMEOUT;
+    flow_proto[FLOW_PROTO_DEFAULT].bypassed_timeout =
+        FLOW_DEFAULT_BYPASSED_TIMEOUT;
     flow_proto[FLOW_PROTO_DEFAULT].Freefunc = NULL;
     flow_proto[FLOW_PROTO_DEFAULT].GetProtoState = NULL;
     /*TCP*/
@@ -507,6 +518,8 @@ void FlowInitFlowProto(void)
         FLOW_IPPROTO_TCP_EMERG_EST_TIMEOUT;
     flow_proto[FLOW_PROTO_TCP].emerg_closed_timeout =
         FLOW_DEFAULT_EMERG_CLOSED_TIMEOUT;
+    flow_proto[FLOW_PROTO_TCP].bypassed_timeout =
+        FLOW_DEFAULT_BYPASSED_TIMEOUT;
     flow_proto[FLOW_PROTO_TCP].Freefunc = NULL;
     flow_proto[FLOW_PROTO_TCP].GetProtoState = NULL;
     /*UDP*/
@@ -519,6 +532,8 @@ void FlowInitFlowProto(void)
         FLOW_IPPROTO_UDP_EMERG_EST_TIMEOUT;
     flow_proto[FLOW_PROTO_UDP].emerg_closed_timeout =
         FLOW_DEFAULT_EMERG_CLOSED_TIMEOUT;
+    flow_proto[FLOW_PROTO_UDP].bypassed_timeout =
+        FLOW_DEFAULT_BYPASSED_TIMEOUT;
     flow_proto[FLOW_PROTO_UDP].Freefunc = NULL;
     flow_proto[FLOW_PROTO_UDP].GetProtoState = NULL;
     /*ICMP*/
@@ -531,6 +546,8 @@ void FlowInitFlowProto(void)
         FLOW_IPPROTO_ICMP_EMERG_EST_TIMEOUT;
     flow_proto[FLOW_PROTO_ICMP].emerg_closed_timeout =
         FLOW_DEFAULT_EMERG_CLOSED_TIMEOUT;
+    flow_proto[FLOW_PROTO_ICMP].bypassed_timeout =
+        FLOW_DEFAULT_BYPASSED_TIMEOUT;
     flow_proto[FLOW_PROTO_ICMP].Freefunc = NULL;
     flow_proto[FLOW_PROTO_ICMP].GetProtoState = NULL;
 
@@ -541,6 +558,7 @@ void FlowInitFlowProto(void)
     const char *emergency_new = NULL;
     const char *emergency_established = NULL;
     const char *emergency_closed = NULL;
+    const char *bypassed = NULL;
 
     ConfNode *flow_timeouts = ConfGetNode("flow-timeouts");
     if (flow_timeouts != NULL) {
@@ -609,6 +627,7 @@ void FlowInitFlowProto(void)
                 "emergency-established");
             emergency_closed = ConfNodeLookupChildValue(proto,
                 "emergency-closed");
+            bypassed = ConfNodeLookupChildValue(proto, "bypassed");
 
             if (new != NULL &&
                 ByteExtractStringUint32(&configval, 10, strlen(new), new) > 0) {
@@ -647,6 +666,12 @@ void FlowInitFlowProto(void)
 
                 flow_proto[FLOW_PROTO_TCP].emerg_closed_timeout = configval;
             }
+            if (bypassed != NULL &&
+                ByteExtractStringUint32(&configval, 10, strlen(bypassed),
+                                        bypassed) > 0) {
+
+                flow_proto[FLOW_PROTO_TCP].bypassed_timeout = configval;
+            }
         }
 
         /* UDP. */
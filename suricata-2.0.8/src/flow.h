@@ -69,6 +69,9 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** All packets in this flow should be dropped */
 #define FLOW_ACTION_DROP                  0x00000200
 
+/** Flow is locally bypassed: its packets skip stream tracking and detection */
+#define FLOW_BYPASSED                     0x00000400
+
 /** Sgh for toserver direction set (even if it's NULL) */
 #define FLOW_SGH_TOSERVER                 0x00000800
 /** Sgh for toclient direction set (even if it's NULL) */
@@ -380,17 +383,19 @@ typedef struct Flow_
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
     struct timeval startts;
-#ifdef DEBUG
+
+    /** packet and byte counters per direction, protected by the flow lock */
     uint32_t todstpktcnt;
     uint32_t tosrcpktcnt;
-    uint64_t bytecnt;
-#endif
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
 } Flow;
 
 enum {
     FLOW_STATE_NEW = 0,
     FLOW_STATE_ESTABLISHED,
     FLOW_STATE_CLOSED,
+    FLOW_STATE_LOCAL_BYPASSED,
 };
 
 typedef struct FlowProto_ {
@@ -400,11 +405,12 @@ typedef struct FlowProto_ {
     uint32_t emerg_new_timeout;
     uint32_t emerg_est_timeout;
     uint32_t emerg_closed_timeout;
+    uint32_t bypassed_timeout;
     void (*Freefunc)(void *);
     int (*GetProtoState)(void *);
 } FlowProto;
 
-void FlowHandlePacket (ThreadVars *, Packet *);
+void FlowHandlePacket (ThreadVars *, DecodeThreadVars *, Packet *);
 void FlowInitConfig (char);
 void FlowPrintQueueInfo (void);
 void FlowShutdown(void);
@@ -65,73 +65,82 @@
 typedef struct JsonAlertLogThread_ {
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     LogFileCtx* file_ctx;
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } JsonAlertLogThread;
 
+/** \brief add the "alert" object for a single alert */
+static void AlertJsonAlert(JsonBuilder *jb, const PacketAlert *pa)
+{
+    char *action = "allowed";
+    if (pa->action & (ACTION_REJECT|ACTION_REJECT_DST|ACTION_REJECT_BOTH)) {
+        action = "blocked";
+    } else if ((pa->action & ACTION_DROP) && EngineModeIsIPS()) {
+        action = "blocked";
+    }
+
+    JsonBuilderOpenObject(jb, "alert");
+    JsonBuilderSetString(jb, "action", action);
+    JsonBuilderSetUint(jb, "gid", pa->s->gid);
+    JsonBuilderSetUint(jb, "signature_id", pa->s->id);
+    JsonBuilderSetUint(jb, "rev", pa->s->rev);
+    JsonBuilderSetString(jb, "signature",
+                         (pa->s->msg) ? pa->s->msg : "");
+    JsonBuilderSetString(jb, "category",
+                         (pa->s->class_msg) ? pa->s->class_msg : "");
+    JsonBuilderSetInt(jb, "severity", pa->s->prio);
+    JsonBuilderClose(jb);
+}
+
+/** \brief add the "flow" object with the packet and byte counters */
+static void AlertJsonFlow(JsonBuilder *jb, Flow *f)
+{
+    FLOWLOCK_RDLOCK(f);
+    JsonBuilderOpenObject(jb, "flow");
+    JsonBuilderSetUint(jb, "pkts_toserver", f->todstpktcnt);
+    JsonBuilderSetUint(jb, "pkts_toclient", f->tosrcpktcnt);
+    JsonBuilderSetUint(jb, "bytes_toserver", f->todstbytecnt);
+    JsonBuilderSetUint(jb, "bytes_toclient", f->tosrcbytecnt);
+    JsonBuilderSetBool(jb, "bypassed", (f->flags & FLOW_BYPASSED) ? 1 : 0);
+    JsonBuilderClose(jb);
+    FLOWLOCK_UNLOCK(f);
+}
+
 /** Handle the case where no JSON support is compiled in.
  *
  */
 static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 {
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
     int i;
+    JsonBuilder jb;
 
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "alert");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
     for (i = 0; i < p->alerts.cnt; i++) {
         const PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
             continue;
         }
 
-        char *action = "allowed";
-        if (pa->action & (ACTION_REJECT|ACTION_REJECT_DST|ACTION_REJECT_BOTH)) {
-            action = "blocked";
-        } else if ((pa->action & ACTION_DROP) && EngineModeIsIPS()) {
-            action = "blocked";
-        }
-
-        json_t *ajs = json_object();
-        if (ajs == NULL) {
-            json_decref(js);
-            return TM_ECODE_OK;
-        }
-
-        MemBufferReset(buffer);
-
-        json_object_set_new(ajs, "action", json_string(action));
-        json_object_set_new(ajs, "gid", json_integer(pa->s->gid));
-        json_object_set_new(ajs, "signature_id", json_integer(pa->s->id));
-        json_object_set_new(ajs, "rev", json_integer(pa->s->rev));
-        json_object_set_new(ajs, "signature",
-                            json_string((pa->s->msg) ? pa->s->msg : ""));
-        json_object_set_new(ajs, "category",
-                            json_string((pa->s->class_msg) ? pa->s->class_msg : ""));
-        json_object_set_new(ajs, "severity", json_integer(pa->s->prio));
+        CreateJSONHeader(&jb, aft->batch, p, 0, "alert");
 
         /* alert */
-        json_object_set_new(js, "alert", ajs);
+        AlertJsonAlert(&jb, pa);
 
-        OutputJSONBuffer(js, aft->file_ctx, aft->buffer);
-        json_object_del(js, "alert");
+        if (p->flow != NULL)
+            AlertJsonFlow(&jb, p->flow);
+
+        OutputJSONBuffer(&jb, aft->file_ctx, aft->batch);
     }
-    json_object_clear(js);
-    json_decref(js);
 
     return TM_ECODE_OK;
 }
 
 static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 {
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
     int i;
     char timebuf[64];
-    json_t *js;
+    JsonBuilder jb;
 
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
@@ -139,58 +148,23 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
     CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
 
     for (i = 0; i < p->alerts.cnt; i++) {
-        MemBufferReset(buffer);
-
         const PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
             continue;
         }
 
-        char *action = "allowed";
-        if (pa->action & (ACTION_REJECT|ACTION_REJECT_DST|ACTION_REJECT_BOTH)) {
-            action = "blocked";
-        } else if ((pa->action & ACTION_DROP) && EngineModeIsIPS()) {
-            action = "blocked";
-        }
-
-        char buf[(32 * 3) + 1];
-        PrintRawLineHexBuf(buf, sizeof(buf), GET_PKT_DATA(p), GET_PKT_LEN(p) < 32 ? GET_PKT_LEN(p) : 32);
-
-        js = json_object();
-        if (js == NULL)
-            return TM_ECODE_OK;
-
-        json_t *ajs = json_object();
-        if (ajs == NULL) {
-            json_decref(js);
-            return TM_ECODE_OK;
-        }
+        JsonBuilderStart(&jb, aft->batch->buffer);
 
         /* time & tx */
-        json_object_set_new(js, "timestamp", json_string(timebuf));
-
-        /* tuple */
-        //json_object_set_new(js, "srcip", json_string(srcip));
-        //json_object_set_new(js, "sp", json_integer(p->sp));
-        //json_object_set_new(js, "dstip", json_string(dstip));
-        //json_object_set_new(js, "dp", json_integer(p->dp));
-        //json_object_set_new(js, "proto", json_integer(proto));
-
-        json_object_set_new(ajs, "action", json_string(action));
-        json_object_set_new(ajs, "gid", json_integer(pa->s->gid));
-        json_object_set_new(ajs, "signature_id", json_integer(pa->s->id));
-        json_object_set_new(ajs, "rev", json_integer(pa->s->rev));
-        json_object_set_new(ajs, "signature",
-                            json_string((pa->s->msg) ? pa->s->msg : ""));
-        json_object_set_new(ajs, "category",
-                            json_string((pa->s->class_msg) ? pa->s->class_msg : ""));
-        json_object_set_new(ajs, "severity", json_integer(pa->s->prio));
+        JsonBuilderSetString(&jb, "timestamp", timebuf);
 
         /* alert */
-        json_object_set_new(js, "alert", ajs);
-        OutputJSONBuffer(js, aft->file_ctx, buffer);
-        json_object_clear(js);
-        json_decref(js);
+        AlertJsonAlert(&jb, pa);
+
+        if (p->flow != NULL)
+            AlertJsonFlow(&jb, p->flow);
+
+        OutputJSONBuffer(&jb, aft->file_ctx, aft->batch);
     }
 
     return TM_ECODE_OK;
@@ -227,15 +201,15 @@ static TmEcode JsonAlertLogThreadInit(ThreadVars *t, void *initdata, void **data
         return TM_ECODE_FAILED;
     }
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    /** Use the Ouptut Context (file pointer and mutex) */
+    aft->file_ctx = ((OutputCtx *)initdata)->data;
+
+    aft->batch = LogFileBatchNew(t, aft->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
 
-    /** Use the Ouptut Context (file pointer and mutex) */
-    aft->file_ctx = ((OutputCtx *)initdata)->data;
-
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -247,7 +221,7 @@ static TmEcode JsonAlertLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->file_ctx, aft->batch);
 
     /* clear memory */
     memset(aft, 0, sizeof(JsonAlertLogThread));
@@ -67,129 +67,108 @@ typedef struct LogDnsLogThread_ {
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     uint32_t dns_cnt;
 
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } LogDnsLogThread;
 
-static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, DNSQueryEntry *entry) {
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
-
+static void LogQuery(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx, DNSQueryEntry *entry) {
     SCLogDebug("got a DNS request and now logging !!");
 
-    json_t *djs = json_object();
-    if (djs == NULL) {
-        return;
-    }
+    JsonBuilder jb;
+    CreateJSONHeader(&jb, aft->batch, p, 1, "dns");
 
-    /* reset */
-    MemBufferReset(buffer);
+    JsonBuilderOpenObject(&jb, "dns");
 
     /* type */
-    json_object_set_new(djs, "type", json_string("query"));
+    JsonBuilderSetString(&jb, "type", "query");
 
     /* id */
-    json_object_set_new(djs, "id", json_integer(tx->tx_id));
+    JsonBuilderSetUint(&jb, "id", tx->tx_id);
 
     /* query */
-    char *c;
-    c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
-    if (c != NULL) {
-        json_object_set_new(djs, "rrname", json_string(c));
-        SCFree(c);
-    }
+    JsonBuilderSetStringN(&jb, "rrname",
+            (uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
 
     /* name */
     char record[16] = "";
     DNSCreateTypeString(entry->type, record, sizeof(record));
-    json_object_set_new(djs, "rrtype", json_string(record));
+    JsonBuilderSetString(&jb, "rrtype", record);
 
     /* dns */
-    json_object_set_new(js, "dns", djs);
-    OutputJSONBuffer(js, aft->dnslog_ctx->file_ctx, buffer);
-    json_object_del(js, "dns");
+    JsonBuilderClose(&jb);
+    OutputJSONBuffer(&jb, aft->dnslog_ctx->file_ctx, aft->batch);
 }
 
-static void OutputAnswer(LogDnsLogThread *aft, json_t *djs, DNSTransaction *tx, DNSAnswerEntry *entry) {
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+static void OutputAnswer(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx, DNSAnswerEntry *entry) {
+    JsonBuilder jb;
+    CreateJSONHeader(&jb, aft->batch, p, 0, "dns");
+
+    JsonBuilderOpenObject(&jb, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonBuilderSetString(&jb, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonBuilderSetUint(&jb, "id", tx->tx_id);
 
     if (entry != NULL) {
         /* query */
         if (entry->fqdn_len > 0) {
-            char *c;
-            c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
+            JsonBuilderSetStringN(&jb, "rrname",
+                    (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
                     entry->fqdn_len);
-            if (c != NULL) {
-                json_object_set_new(js, "rrname", json_string(c));
-                SCFree(c);
-            }
         }
 
         /* name */
         char record[16] = "";
         DNSCreateTypeString(entry->type, record, sizeof(record));
-        json_object_set_new(js, "rrtype", json_string(record));
+        JsonBuilderSetString(&jb, "rrtype", record);
 
         /* ttl */
-        json_object_set_new(js, "ttl", json_integer(entry->ttl));
+        JsonBuilderSetUint(&jb, "ttl", entry->ttl);
 
         uint8_t *ptr = (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)+ entry->fqdn_len);
         if (entry->type == DNS_RECORD_TYPE_A) {
             char a[16] = "";
             PrintInet(AF_INET, (const void *)ptr, a, sizeof(a));
-            json_object_set_new(js, "rdata", json_string(a));
+            JsonBuilderSetString(&jb, "rdata", a);
         } else if (entry->type == DNS_RECORD_TYPE_AAAA) {
             char a[46] = "";
             PrintInet(AF_INET6, (const void *)ptr, a, sizeof(a));
-            json_object_set_new(js, "rdata", json_string(a));
+            JsonBuilderSetString(&jb, "rdata", a);
         } else if (entry->data_len == 0) {
-            json_object_set_new(js, "rdata", json_string(""));
+            JsonBuilderSetString(&jb, "rdata", "");
         } else if (entry->type == DNS_RECORD_TYPE_TXT) {
-            if (entry->data_len != 0) {
-                char buffer[256] = "";
-                uint16_t copy_len = entry->data_len < (sizeof(buffer) - 1) ?
-                    entry->data_len : sizeof(buffer) - 1;
-                memcpy(buffer, ptr, copy_len);
-                buffer[copy_len] = '\0';
-                json_object_set_new(js, "rdata", json_string(buffer));
-            } else {
-                json_object_set_new(js, "rdata", json_string(""));
-            }
+            /* stop at the first NUL byte and at 255 bytes, like before */
+            uint16_t copy_len = entry->data_len < 255 ? entry->data_len : 255;
+            uint8_t *nul = memchr(ptr, '\0', copy_len);
+            if (nul != NULL)
+                copy_len = nul - ptr;
+            JsonBuilderSetStringN(&jb, "rdata", ptr, copy_len);
         }
     }
 
-    /* reset */
-    MemBufferReset(buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, buffer);
-    json_object_del(djs, "dns");
+    JsonBuilderClose(&jb);
+    OutputJSONBuffer(&jb, aft->dnslog_ctx->file_ctx, aft->batch);
 
     return;
 }
 
-static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx) {
+static void LogAnswers(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx) {
 
     SCLogDebug("got a DNS response and now logging !!");
 
     if (tx->no_such_name) {
-        OutputAnswer(aft, js, tx, NULL);
+        OutputAnswer(aft, p, tx, NULL);
     }
 
     DNSAnswerEntry *entry = NULL;
     TAILQ_FOREACH(entry, &tx->answer_list, next) {
-        OutputAnswer(aft, js, tx, entry);
+        OutputAnswer(aft, p, tx, entry);
     }
 
     entry = NULL;
     TAILQ_FOREACH(entry, &tx->authority_list, next) {
-        OutputAnswer(aft, js, tx, entry);
+        OutputAnswer(aft, p, tx, entry);
     }
 
 }
@@ -200,26 +179,13 @@ static int JsonDnsLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flo
 
     LogDnsLogThread *td = (LogDnsLogThread *)thread_data;
     DNSTransaction *tx = txptr;
-    json_t *js;
 
     DNSQueryEntry *query = NULL;
     TAILQ_FOREACH(query, &tx->query_list, next) {
-        js = CreateJSONHeader((Packet *)p, 1, "dns");
-        if (unlikely(js == NULL))
-            return TM_ECODE_OK;
-
-        LogQuery(td, js, tx, query);
-
-        json_decref(js);
+        LogQuery(td, p, tx, query);
     }
 
-    js = CreateJSONHeader((Packet *)p, 0, "dns");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    LogAnswers(td, js, tx);
-
-    json_decref(js);
+    LogAnswers(td, p, tx);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -239,15 +205,15 @@ static TmEcode LogDnsLogThreadInit(ThreadVars *t, void *initdata, void **data)
         return TM_ECODE_FAILED;
     }
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    /* Use the Ouptut Context (file pointer and mutex) */
+    aft->dnslog_ctx= ((OutputCtx *)initdata)->data;
+
+    aft->batch = LogFileBatchNew(t, aft->dnslog_ctx->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
 
-    /* Use the Ouptut Context (file pointer and mutex) */
-    aft->dnslog_ctx= ((OutputCtx *)initdata)->data;
-
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -259,7 +225,7 @@ static TmEcode LogDnsLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->dnslog_ctx->file_ctx, aft->batch);
     /* clear memory */
     memset(aft, 0, sizeof(LogDnsLogThread));
 
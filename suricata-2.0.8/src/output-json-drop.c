@@ -63,7 +63,7 @@
 typedef struct JsonDropLogThread_ {
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     LogFileCtx* file_ctx;
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } JsonDropLogThread;
 
 /**
@@ -78,65 +78,53 @@ typedef struct JsonDropLogThread_ {
 static int DropLogJSON (JsonDropLogThread *aft, const Packet *p)
 {
     uint16_t proto = 0;
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "drop");//TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    JsonBuilder jb;
+    CreateJSONHeader(&jb, aft->batch, p, 0, "drop");
 
-    json_t *djs = json_object();
-    if (unlikely(djs == NULL)) {
-        json_decref(js);
-        return TM_ECODE_OK;
-    }
-
-    /* reset */
-    MemBufferReset(buffer);
+    JsonBuilderOpenObject(&jb, "drop");
 
     if (PKT_IS_IPV4(p)) {
-        json_object_set_new(djs, "len", json_integer(IPV4_GET_IPLEN(p)));
-        json_object_set_new(djs, "tos", json_integer(IPV4_GET_IPTOS(p)));
-        json_object_set_new(djs, "ttl", json_integer(IPV4_GET_IPTTL(p)));
-        json_object_set_new(djs, "ipid", json_integer(IPV4_GET_IPID(p)));
+        JsonBuilderSetUint(&jb, "len", IPV4_GET_IPLEN(p));
+        JsonBuilderSetUint(&jb, "tos", IPV4_GET_IPTOS(p));
+        JsonBuilderSetUint(&jb, "ttl", IPV4_GET_IPTTL(p));
+        JsonBuilderSetUint(&jb, "ipid", IPV4_GET_IPID(p));
         proto = IPV4_GET_IPPROTO(p);
     } else if (PKT_IS_IPV6(p)) {
-        json_object_set_new(djs, "len", json_integer(IPV6_GET_PLEN(p)));
-        json_object_set_new(djs, "tc", json_integer(IPV6_GET_CLASS(p)));
-        json_object_set_new(djs, "hoplimit", json_integer(IPV6_GET_HLIM(p)));
-        json_object_set_new(djs, "flowlbl", json_integer(IPV6_GET_FLOW(p)));
+        JsonBuilderSetUint(&jb, "len", IPV6_GET_PLEN(p));
+        JsonBuilderSetUint(&jb, "tc", IPV6_GET_CLASS(p));
+        JsonBuilderSetUint(&jb, "hoplimit", IPV6_GET_HLIM(p));
+        JsonBuilderSetUint(&jb, "flowlbl", IPV6_GET_FLOW(p));
         proto = IPV6_GET_L4PROTO(p);
     }
     switch (proto) {
         case IPPROTO_TCP:
-            json_object_set_new(djs, "tcpseq", json_integer(TCP_GET_SEQ(p)));
-            json_object_set_new(djs, "tcpack", json_integer(TCP_GET_ACK(p)));
-            json_object_set_new(djs, "tcpwin", json_integer(TCP_GET_WINDOW(p)));
-            json_object_set_new(djs, "syn", TCP_ISSET_FLAG_SYN(p) ? json_true() : json_false());
-            json_object_set_new(djs, "ack", TCP_ISSET_FLAG_ACK(p) ? json_true() : json_false());
-            json_object_set_new(djs, "psh", TCP_ISSET_FLAG_PUSH(p) ? json_true() : json_false());
-            json_object_set_new(djs, "rst", TCP_ISSET_FLAG_RST(p) ? json_true() : json_false());
-            json_object_set_new(djs, "urg", TCP_ISSET_FLAG_URG(p) ? json_true() : json_false());
-            json_object_set_new(djs, "fin", TCP_ISSET_FLAG_FIN(p) ? json_true() : json_false());
-            json_object_set_new(djs, "tcpres", json_integer(TCP_GET_RAW_X2(p->tcph)));
-            json_object_set_new(djs, "tcpurgp", json_integer(TCP_GET_URG_POINTER(p)));
+            JsonBuilderSetUint(&jb, "tcpseq", TCP_GET_SEQ(p));
+            JsonBuilderSetUint(&jb, "tcpack", TCP_GET_ACK(p));
+            JsonBuilderSetUint(&jb, "tcpwin", TCP_GET_WINDOW(p));
+            JsonBuilderSetBool(&jb, "syn", TCP_ISSET_FLAG_SYN(p));
+            JsonBuilderSetBool(&jb, "ack", TCP_ISSET_FLAG_ACK(p));
+            JsonBuilderSetBool(&jb, "psh", TCP_ISSET_FLAG_PUSH(p));
+            JsonBuilderSetBool(&jb, "rst", TCP_ISSET_FLAG_RST(p));
+            JsonBuilderSetBool(&jb, "urg", TCP_ISSET_FLAG_URG(p));
+            JsonBuilderSetBool(&jb, "fin", TCP_ISSET_FLAG_FIN(p));
+            JsonBuilderSetUint(&jb, "tcpres", TCP_GET_RAW_X2(p->tcph));
+            JsonBuilderSetUint(&jb, "tcpurgp", TCP_GET_URG_POINTER(p));
             break;
         case IPPROTO_UDP:
-            json_object_set_new(djs, "udplen", json_integer(UDP_GET_LEN(p)));
+            JsonBuilderSetUint(&jb, "udplen", UDP_GET_LEN(p));
             break;
         case IPPROTO_ICMP:
             if (PKT_IS_ICMPV4(p)) {
-                json_object_set_new(djs, "icmp_id", json_integer(ICMPV4_GET_ID(p)));
-                json_object_set_new(djs, "icmp_seq", json_integer(ICMPV4_GET_SEQ(p)));
+                JsonBuilderSetUint(&jb, "icmp_id", ICMPV4_GET_ID(p));
+                JsonBuilderSetUint(&jb, "icmp_seq", ICMPV4_GET_SEQ(p));
             } else if(PKT_IS_ICMPV6(p)) {
-                json_object_set_new(djs, "icmp_id", json_integer(ICMPV6_GET_ID(p)));
-                json_object_set_new(djs, "icmp_seq", json_integer(ICMPV6_GET_SEQ(p)));
+                JsonBuilderSetUint(&jb, "icmp_id", ICMPV6_GET_ID(p));
+                JsonBuilderSetUint(&jb, "icmp_seq", ICMPV6_GET_SEQ(p));
             }
             break;
     }
-    json_object_set_new(js, "drop", djs);
-    OutputJSONBuffer(js, aft->file_ctx, buffer);
-    json_object_del(js, "drop");
-    json_object_clear(js);
-    json_decref(js);
+    JsonBuilderClose(&jb);
+    OutputJSONBuffer(&jb, aft->file_ctx, aft->batch);
 
     return TM_ECODE_OK;
 }
@@ -155,15 +143,15 @@ static TmEcode JsonDropLogThreadInit(ThreadVars *t, void *initdata, void **data)
         return TM_ECODE_FAILED;
     }
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    /** Use the Ouptut Context (file pointer and mutex) */
+    aft->file_ctx = ((OutputCtx *)initdata)->data;
+
+    aft->batch = LogFileBatchNew(t, aft->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
 
-    /** Use the Ouptut Context (file pointer and mutex) */
-    aft->file_ctx = ((OutputCtx *)initdata)->data;
-
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -175,7 +163,7 @@ static TmEcode JsonDropLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->file_ctx, aft->batch);
 
     /* clear memory */
     memset(aft, 0, sizeof(*aft));
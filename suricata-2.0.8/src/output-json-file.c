@@ -71,53 +71,38 @@ typedef struct OutputFileCtx_ {
 
 typedef struct JsonFileLogThread_ {
     OutputFileCtx *filelog_ctx;
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } JsonFileLogThread;
 
-static json_t *LogFileMetaGetUri(const Packet *p, const File *ff) {
+static void LogFileMetaGetUri(JsonBuilder *jb, const Packet *p, const File *ff) {
     HtpState *htp_state = (HtpState *)p->flow->alstate;
-    json_t *js = NULL;
     if (htp_state != NULL) {
         htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, ff->txid);
         if (tx != NULL) {
             HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
             if (tx_ud != NULL && tx_ud->request_uri_normalized != NULL) {
-                char *s = bstr_util_strdup_to_c(tx_ud->request_uri_normalized);
-                if (s != NULL) {
-                    js = json_string(s);
-                    SCFree(s);
-                    if (js != NULL)
-                        return js;
-                }
+                JsonBuilderSetStringN(jb, "url",
+                        bstr_ptr(tx_ud->request_uri_normalized),
+                        bstr_len(tx_ud->request_uri_normalized));
             }
         }
     }
-
-    return NULL;
 }
 
-static json_t *LogFileMetaGetHost(const Packet *p, const File *ff) {
+static void LogFileMetaGetHost(JsonBuilder *jb, const Packet *p, const File *ff) {
     HtpState *htp_state = (HtpState *)p->flow->alstate;
-    json_t *js = NULL;
     if (htp_state != NULL) {
         htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, ff->txid);
         if (tx != NULL && tx->request_hostname != NULL) {
-            char *s = bstr_util_strdup_to_c(tx->request_hostname);
-            if (s != NULL) {
-                js = json_string(s);
-                SCFree(s);
-                if (js != NULL)
-                    return js;
-            }
+            JsonBuilderSetStringN(jb, "hostname",
+                    bstr_ptr(tx->request_hostname),
+                    bstr_len(tx->request_hostname));
         }
     }
-
-    return NULL;
 }
 
-static json_t *LogFileMetaGetReferer(const Packet *p, const File *ff) {
+static void LogFileMetaGetReferer(JsonBuilder *jb, const Packet *p, const File *ff) {
     HtpState *htp_state = (HtpState *)p->flow->alstate;
-    json_t *js = NULL;
     if (htp_state != NULL) {
         htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, ff->txid);
         if (tx != NULL) {
@@ -125,23 +110,15 @@ static json_t *LogFileMetaGetReferer(const Packet *p, const File *ff) {
             h = (htp_header_t *)htp_table_get_c(tx->request_headers,
                                                 "Referer");
             if (h != NULL) {
-                char *s = bstr_util_strdup_to_c(h->value);
-                if (s != NULL) {
-                    js = json_string(s);
-                    SCFree(s);
-                    if (js != NULL)
-                        return js;
-                }
+                JsonBuilderSetStringN(jb, "http_refer",
+                        bstr_ptr(h->value), bstr_len(h->value));
             }
         }
     }
-
-    return NULL;
 }
 
-static json_t *LogFileMetaGetUserAgent(const Packet *p, const File *ff) {
+static void LogFileMetaGetUserAgent(JsonBuilder *jb, const Packet *p, const File *ff) {
     HtpState *htp_state = (HtpState *)p->flow->alstate;
-    json_t *js = NULL;
     if (htp_state != NULL) {
         htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, ff->txid);
         if (tx != NULL) {
@@ -149,18 +126,11 @@ static json_t *LogFileMetaGetUserAgent(const Packet *p, const File *ff) {
             h = (htp_header_t *)htp_table_get_c(tx->request_headers,
                                                 "User-Agent");
             if (h != NULL) {
-                char *s = bstr_util_strdup_to_c(h->value);
-                if (s != NULL) {
-                    js = json_string(s);
-                    SCFree(s);
-                    if (js != NULL)
-                        return js;
-                }
+                JsonBuilderSetStringN(jb, "http_user_agent",
+                        bstr_ptr(h->value), bstr_len(h->value));
             }
         }
     }
-
-    return NULL;
 }
 
 /**
@@ -168,79 +138,52 @@ static json_t *LogFileMetaGetUserAgent(const Packet *p, const File *ff) {
  *  \brief Write meta data on a single line json record
  */
 static void FileWriteJsonRecord(JsonFileLogThread *aft, const Packet *p, const File *ff) {
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "fileinfo"); //TODO const
-    if (unlikely(js == NULL))
-        return;
-
-    /* reset */
-    MemBufferReset(buffer);
-
-    json_t *hjs = json_object();
-    if (unlikely(hjs == NULL)) {
-        json_decref(js);
-        return;
-    }
+    JsonBuilder jb;
+    CreateJSONHeader(&jb, aft->batch, p, 0, "fileinfo");
 
-    json_object_set_new(hjs, "url", LogFileMetaGetUri(p, ff));
-    json_object_set_new(hjs, "hostname", LogFileMetaGetHost(p, ff));
-    json_object_set_new(hjs, "http_refer", LogFileMetaGetReferer(p, ff));
-    json_object_set_new(hjs, "http_user_agent", LogFileMetaGetUserAgent(p, ff));
-    json_object_set_new(js, "http", hjs);
-
-    json_t *fjs = json_object();
-    if (unlikely(fjs == NULL)) {
-        json_decref(hjs);
-        json_decref(js);
-        return;
-    }
+    JsonBuilderOpenObject(&jb, "http");
+    LogFileMetaGetUri(&jb, p, ff);
+    LogFileMetaGetHost(&jb, p, ff);
+    LogFileMetaGetReferer(&jb, p, ff);
+    LogFileMetaGetUserAgent(&jb, p, ff);
+    JsonBuilderClose(&jb);
 
-    char *s = BytesToString(ff->name, ff->name_len);
-    json_object_set_new(fjs, "filename", json_string(s));
-    if (s != NULL)
-        SCFree(s);
+    /* originally just 'file', but due to bug 1127 naming it fileinfo */
+    JsonBuilderOpenObject(&jb, "fileinfo");
+
+    JsonBuilderSetStringN(&jb, "filename", ff->name, ff->name_len);
     if (ff->magic)
-        json_object_set_new(fjs, "magic", json_string((char *)ff->magic));
+        JsonBuilderSetString(&jb, "magic", (char *)ff->magic);
     switch (ff->state) {
         case FILE_STATE_CLOSED:
-            json_object_set_new(fjs, "state", json_string("CLOSED"));
+            JsonBuilderSetString(&jb, "state", "CLOSED");
 #ifdef HAVE_NSS
             if (ff->flags & FILE_MD5) {
                 size_t x;
                 int i;
-                char *s = SCMalloc(256);
-                if (likely(s != NULL)) {
-                    for (i = 0, x = 0; x < sizeof(ff->md5); x++) {
-                        i += snprintf(&s[i], 255-i, "%02x", ff->md5[x]);
-                    }
-                    json_object_set_new(fjs, "md5", json_string(s));
-                    SCFree(s);
+                char s[256];
+                for (i = 0, x = 0; x < sizeof(ff->md5); x++) {
+                    i += snprintf(&s[i], 255-i, "%02x", ff->md5[x]);
                 }
+                JsonBuilderSetString(&jb, "md5", s);
             }
 #endif
             break;
         case FILE_STATE_TRUNCATED:
-            json_object_set_new(fjs, "state", json_string("TRUNCATED"));
+            JsonBuilderSetString(&jb, "state", "TRUNCATED");
             break;
         case FILE_STATE_ERROR:
-            json_object_set_new(fjs, "state", json_string("ERROR"));
+            JsonBuilderSetString(&jb, "state", "ERROR");
             break;
         default:
-            json_object_set_new(fjs, "state", json_string("UNKNOWN"));
+            JsonBuilderSetString(&jb, "state", "UNKNOWN");
             break;
     }
-    json_object_set_new(fjs, "stored",
-                        (ff->flags & FILE_STORED) ? json_true() : json_false());
-    json_object_set_new(fjs, "size", json_integer(ff->size));
-
-    /* originally just 'file', but due to bug 1127 naming it fileinfo */
-    json_object_set_new(js, "fileinfo", fjs);
-    OutputJSONBuffer(js, aft->filelog_ctx->file_ctx, buffer);
-    json_object_del(js, "fileinfo");
-    json_object_del(js, "http");
+    JsonBuilderSetBool(&jb, "stored", (ff->flags & FILE_STORED));
+    JsonBuilderSetUint(&jb, "size", ff->size);
+    JsonBuilderClose(&jb);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJSONBuffer(&jb, aft->filelog_ctx->file_ctx, aft->batch);
 }
 
 static int JsonFileLogger(ThreadVars *tv, void *thread_data, const Packet *p, const File *ff)
@@ -275,8 +218,8 @@ static TmEcode JsonFileLogThreadInit(ThreadVars *t, void *initdata, void **data)
     /* Use the Ouptut Context (file pointer and mutex) */
     aft->filelog_ctx = ((OutputCtx *)initdata)->data;
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    aft->batch = LogFileBatchNew(t, aft->filelog_ctx->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
@@ -292,7 +235,7 @@ static TmEcode JsonFileLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->filelog_ctx->file_ctx, aft->batch);
     /* clear memory */
     memset(aft, 0, sizeof(JsonFileLogThread));
 
@@ -63,7 +63,7 @@ typedef struct JsonHttpLogThread_ {
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     uint32_t uri_cnt;
 
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } JsonHttpLogThread;
 
 
@@ -179,34 +179,28 @@ struct {
 };
 
 
+static inline void JsonHttpLogBstr(JsonBuilder *jb, const char *key, bstr *b)
+{
+    JsonBuilderSetStringN(jb, key, bstr_ptr(b), bstr_len(b));
+}
+
 /* JSON format logging */
-static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx)
+static void JsonHttpLogJSON(JsonHttpLogThread *aft, JsonBuilder *jb, htp_tx_t *tx)
 {
     LogHttpFileCtx *http_ctx = aft->httplog_ctx;
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
 
-    char *c;
+    JsonBuilderOpenObject(jb, "http");
+
     /* hostname */
     if (tx->request_hostname != NULL)
     {
-        c = bstr_util_strdup_to_c(tx->request_hostname);
-        if (c != NULL) {
-            json_object_set_new(hjs, "hostname", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpLogBstr(jb, "hostname", tx->request_hostname);
     }
 
     /* uri */
     if (tx->request_uri != NULL)
     {
-        c = bstr_util_strdup_to_c(tx->request_uri);
-        if (c != NULL) {
-            json_object_set_new(hjs, "url", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpLogBstr(jb, "url", tx->request_uri);
     }
 
     /* user agent */
@@ -215,11 +209,7 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx)
         h_user_agent = htp_table_get_c(tx->request_headers, "user-agent");
     }
     if (h_user_agent != NULL) {
-        c = bstr_util_strdup_to_c(h_user_agent->value);
-        if (c != NULL) {
-            json_object_set_new(hjs, "http_user_agent", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpLogBstr(jb, "http_user_agent", h_user_agent->value);
     }
 
     /* x-forwarded-for */
@@ -228,11 +218,7 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx)
         h_x_forwarded_for = htp_table_get_c(tx->request_headers, "x-forwarded-for");
     }
     if (h_x_forwarded_for != NULL) {
-        c = bstr_util_strdup_to_c(h_x_forwarded_for->value);
-        if (c != NULL) {
-            json_object_set_new(hjs, "xff", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpLogBstr(jb, "xff", h_x_forwarded_for->value);
     }
 
     /* content-type */
@@ -241,15 +227,13 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx)
         h_content_type = htp_table_get_c(tx->response_headers, "content-type");
     }
     if (h_content_type != NULL) {
-        char *p;
-        c = bstr_util_strdup_to_c(h_content_type->value);
-        if (c != NULL) {
-            p = strchr(c, ';');
-            if (p != NULL)
-                *p = '\0';
-            json_object_set_new(hjs, "http_content_type", json_string(c));
-            SCFree(c);
-        }
+        /* only up to the parameters */
+        uint8_t *c = bstr_ptr(h_content_type->value);
+        uint32_t c_len = bstr_len(h_content_type->value);
+        uint8_t *p = memchr(c, ';', c_len);
+        if (p != NULL)
+            c_len = p - c;
+        JsonBuilderSetStringN(jb, "http_content_type", c, c_len);
     }
 
     /* log custom fields if configured */
@@ -280,13 +264,8 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx)
                         }
                     }
                     if (h_field != NULL) {
-                        c = bstr_util_strdup_to_c(h_field->value);
-                        if (c != NULL) {
-                            json_object_set_new(hjs,
-                                    http_fields[f].config_field,
-                                    json_string(c));
-                            SCFree(c);
-                        }
+                        JsonHttpLogBstr(jb, http_fields[f].config_field,
+                                h_field->value);
                     }
                 }
             }
@@ -301,54 +280,34 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx)
             h_referer = htp_table_get_c(tx->request_headers, "referer");
         }
         if (h_referer != NULL) {
-            c = bstr_util_strdup_to_c(h_referer->value);
-            if (c != NULL) {
-                json_object_set_new(hjs, "http_refer", json_string(c));
-                SCFree(c);
-            }
+            JsonHttpLogBstr(jb, "http_refer", h_referer->value);
         }
 
         /* method */
         if (tx->request_method != NULL) {
-            c = bstr_util_strdup_to_c(tx->request_method);
-            if (c != NULL) {
-                json_object_set_new(hjs, "http_method", json_string(c));
-                SCFree(c);
-            }
+            JsonHttpLogBstr(jb, "http_method", tx->request_method);
         }
 
         /* protocol */
         if (tx->request_protocol != NULL) {
-            c = bstr_util_strdup_to_c(tx->request_protocol);
-            if (c != NULL) {
-                json_object_set_new(hjs, "protocol", json_string(c));
-                SCFree(c);
-            }
+            JsonHttpLogBstr(jb, "protocol", tx->request_protocol);
         }
 
         /* response status */
         if (tx->response_status != NULL) {
-            c = bstr_util_strdup_to_c(tx->response_status);
-            if (c != NULL) {
-                json_object_set_new(hjs, "status", json_string(c));
-                SCFree(c);
-            }
+            JsonHttpLogBstr(jb, "status", tx->response_status);
 
             htp_header_t *h_location = htp_table_get_c(tx->response_headers, "location");
             if (h_location != NULL) {
-                c = bstr_util_strdup_to_c(h_location->value);
-                if (c != NULL) {
-                    json_object_set_new(hjs, "redirect", json_string(c));
-                    SCFree(c);
-                }
+                JsonHttpLogBstr(jb, "redirect", h_location->value);
             }
         }
 
         /* length */
-        json_object_set_new(hjs, "length", json_integer(tx->response_message_len));
+        JsonBuilderSetInt(jb, "length", tx->response_message_len);
     }
 
-    json_object_set_new(js, "http", hjs);
+    JsonBuilderClose(jb);
 }
 
 static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow *f, void *alstate, void *txptr, uint64_t tx_id)
@@ -357,24 +316,15 @@ static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Fl
 
     htp_tx_t *tx = txptr;
     JsonHttpLogThread *jhl = (JsonHttpLogThread *)thread_data;
-    MemBuffer *buffer = (MemBuffer *)jhl->buffer;
+    JsonBuilder jb;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 1, "http"); //TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    CreateJSONHeader(&jb, jhl->batch, p, 1, "http");
 
     SCLogDebug("got a HTTP request and now logging !!");
 
-    /* reset */
-    MemBufferReset(buffer);
-
-    JsonHttpLogJSON(jhl, js, tx);
-
-    OutputJSONBuffer(js, jhl->httplog_ctx->file_ctx, buffer);
-    json_object_del(js, "http");
+    JsonHttpLogJSON(jhl, &jb, tx);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJSONBuffer(&jb, jhl->httplog_ctx->file_ctx, jhl->batch);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -520,8 +470,8 @@ static TmEcode JsonHttpLogThreadInit(ThreadVars *t, void *initdata, void **data)
     /* Use the Ouptut Context (file pointer and mutex) */
     aft->httplog_ctx = ((OutputCtx *)initdata)->data; //TODO
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    aft->batch = LogFileBatchNew(t, aft->httplog_ctx->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
@@ -537,7 +487,7 @@ static TmEcode JsonHttpLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->httplog_ctx->file_ctx, aft->batch);
     /* clear memory */
     memset(aft, 0, sizeof(JsonHttpLogThread));
 
@@ -62,12 +62,11 @@ typedef struct OutputSshCtx_ {
 
 typedef struct JsonSshLogThread_ {
     OutputSshCtx *sshlog_ctx;
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } JsonSshLogThread;
 
 static int JsonSshLogger(ThreadVars *tv, void *thread_data, const Packet *p) {
     JsonSshLogThread *aft = (JsonSshLogThread *)thread_data;
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
     OutputSshCtx *ssh_ctx = aft->sshlog_ctx;
 
     if (unlikely(p->flow == NULL)) {
@@ -88,44 +87,30 @@ static int JsonSshLogger(ThreadVars *tv, void *thread_data, const Packet *p) {
     if (ssh_state->cli_hdr.software_version == NULL || ssh_state->srv_hdr.software_version == NULL)
         goto end;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 1, "ssh");//TODO
-    if (unlikely(js == NULL))
-        goto end;
-
-    json_t *tjs = json_object();
-    if (tjs == NULL) {
-        free(js);
-        goto end;
-    }
+    JsonBuilder jb;
+    CreateJSONHeader(&jb, aft->batch, p, 1, "ssh");
 
-    /* reset */
-    MemBufferReset(buffer);
+    JsonBuilderOpenObject(&jb, "ssh");
 
-    json_t *cjs = json_object();
-    if (cjs != NULL) {
-        json_object_set_new(cjs, "proto_version",
-                json_string((char *)ssh_state->cli_hdr.proto_version));
+    JsonBuilderOpenObject(&jb, "client");
+    if (ssh_state->cli_hdr.proto_version != NULL)
+        JsonBuilderSetString(&jb, "proto_version",
+                (char *)ssh_state->cli_hdr.proto_version);
+    JsonBuilderSetString(&jb, "software_version",
+            (char *)ssh_state->cli_hdr.software_version);
+    JsonBuilderClose(&jb);
 
-        json_object_set_new(cjs, "software_version",
-                json_string((char *)ssh_state->cli_hdr.software_version));
-    }
-    json_object_set_new(tjs, "client", cjs);
-
-    json_t *sjs = json_object();
-    if (sjs != NULL) {
-        json_object_set_new(sjs, "proto_version",
-                json_string((char *)ssh_state->srv_hdr.proto_version));
-
-        json_object_set_new(sjs, "software_version",
-                json_string((char *)ssh_state->srv_hdr.software_version));
-    }
-    json_object_set_new(tjs, "server", sjs);
+    JsonBuilderOpenObject(&jb, "server");
+    if (ssh_state->srv_hdr.proto_version != NULL)
+        JsonBuilderSetString(&jb, "proto_version",
+                (char *)ssh_state->srv_hdr.proto_version);
+    JsonBuilderSetString(&jb, "software_version",
+            (char *)ssh_state->srv_hdr.software_version);
+    JsonBuilderClose(&jb);
 
-    json_object_set_new(js, "ssh", tjs);
+    JsonBuilderClose(&jb);
 
-    OutputJSONBuffer(js, ssh_ctx->file_ctx, buffer);
-    json_object_clear(js);
-    json_decref(js);
+    OutputJSONBuffer(&jb, ssh_ctx->file_ctx, aft->batch);
 
     /* we only log the state once */
     ssh_state->cli_hdr.flags |= SSH_FLAG_STATE_LOGGED;
@@ -152,8 +137,8 @@ static TmEcode JsonSshLogThreadInit(ThreadVars *t, void *initdata, void **data)
     /* Use the Ouptut Context (file pointer and mutex) */
     aft->sshlog_ctx = ((OutputCtx *)initdata)->data;
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    aft->batch = LogFileBatchNew(t, aft->sshlog_ctx->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
@@ -169,7 +154,7 @@ static TmEcode JsonSshLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->sshlog_ctx->file_ctx, aft->batch);
     /* clear memory */
     memset(aft, 0, sizeof(JsonSshLogThread));
 
@@ -67,18 +67,19 @@ typedef struct OutputTlsCtx_ {
 
 typedef struct JsonTlsLogThread_ {
     OutputTlsCtx *tlslog_ctx;
-    MemBuffer *buffer;
+    LogFileBatch *batch;
 } JsonTlsLogThread;
 
 #define SSL_VERSION_LENGTH 13
 
-static void LogTlsLogExtendedJSON(json_t *tjs, SSLState * state)
+static void LogTlsLogExtendedJSON(JsonBuilder *jb, SSLState * state)
 {
     char ssl_version[SSL_VERSION_LENGTH + 1];
 
     /* tls.fingerprint */
-    json_object_set_new(tjs, "fingerprint",
-                        json_string(state->server_connp.cert0_fingerprint));
+    if (state->server_connp.cert0_fingerprint != NULL)
+        JsonBuilderSetString(jb, "fingerprint",
+                             state->server_connp.cert0_fingerprint);
 
     /* tls.version */
     switch (state->server_connp.version) {
@@ -105,12 +106,11 @@ static void LogTlsLogExtendedJSON(json_t *tjs, SSLState * state)
                      state->server_connp.version);
             break;
     }
-    json_object_set_new(tjs, "version", json_string(ssl_version));
+    JsonBuilderSetString(jb, "version", ssl_version);
 }
 
 static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p) {
     JsonTlsLogThread *aft = (JsonTlsLogThread *)thread_data;
-    MemBuffer *buffer = (MemBuffer *)aft->buffer;
     OutputTlsCtx *tls_ctx = aft->tlslog_ctx;
 
     if (unlikely(p->flow == NULL)) {
@@ -131,36 +131,24 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p) {
     if (ssl_state->server_connp.cert0_issuerdn == NULL || ssl_state->server_connp.cert0_subject == NULL)
         goto end;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "tls");//TODO
-    if (unlikely(js == NULL))
-        goto end;
-
-    json_t *tjs = json_object();
-    if (tjs == NULL) {
-        free(js);
-        goto end;
-    }
+    JsonBuilder jb;
+    CreateJSONHeader(&jb, aft->batch, p, 0, "tls");
 
-    /* reset */
-    MemBufferReset(buffer);
+    JsonBuilderOpenObject(&jb, "tls");
 
     /* tls.subject */
-    json_object_set_new(tjs, "subject",
-                        json_string(ssl_state->server_connp.cert0_subject));
+    JsonBuilderSetString(&jb, "subject", ssl_state->server_connp.cert0_subject);
 
     /* tls.issuerdn */
-    json_object_set_new(tjs, "issuerdn",
-                        json_string(ssl_state->server_connp.cert0_issuerdn));
+    JsonBuilderSetString(&jb, "issuerdn", ssl_state->server_connp.cert0_issuerdn);
 
     if (tls_ctx->flags & LOG_TLS_EXTENDED) {
-        LogTlsLogExtendedJSON(tjs, ssl_state);
+        LogTlsLogExtendedJSON(&jb, ssl_state);
     }
 
-    json_object_set_new(js, "tls", tjs);
+    JsonBuilderClose(&jb);
 
-    OutputJSONBuffer(js, tls_ctx->file_ctx, buffer);
-    json_object_clear(js);
-    json_decref(js);
+    OutputJSONBuffer(&jb, tls_ctx->file_ctx, aft->batch);
 
     /* we only log the state once */
     ssl_state->flags |= SSL_AL_FLAG_STATE_LOGGED;
@@ -187,8 +175,8 @@ static TmEcode JsonTlsLogThreadInit(ThreadVars *t, void *initdata, void **data)
     /* Use the Ouptut Context (file pointer and mutex) */
     aft->tlslog_ctx = ((OutputCtx *)initdata)->data;
 
-    aft->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
-    if (aft->buffer == NULL) {
+    aft->batch = LogFileBatchNew(t, aft->tlslog_ctx->file_ctx, OUTPUT_BUFFER_SIZE);
+    if (aft->batch == NULL) {
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
@@ -204,7 +192,7 @@ static TmEcode JsonTlsLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    MemBufferFree(aft->buffer);
+    LogFileBatchFree(aft->tlslog_ctx->file_ctx, aft->batch);
     /* clear memory */
     memset(aft, 0, sizeof(JsonTlsLogThread));
 
@@ -57,6 +57,7 @@
 #include "util-optimize.h"
 #include "util-buffer.h"
 #include "util-logopenfile.h"
+#include "util-conf.h"
 
 
 #ifndef HAVE_LIBJANSSON
@@ -147,15 +148,23 @@ static enum JsonOutput json_out = ALERT_FILE;
 
 static enum JsonFormat format = COMPACT;
 
-json_t *CreateJSONHeader(Packet *p, int direction_sensitive, char *event_type)
+/** \brief start a new eve record in the thread's batch and add the
+ *         common header fields to it
+ *
+ *  \param jb builder to use, is set up by this function
+ *  \param batch the thread's output batch the record is written to
+ *  \param p packet the record is about
+ *  \param direction_sensitive log the tuple in the to server direction
+ *  \param event_type value of the "event_type" field, can be NULL
+ */
+void CreateJSONHeader(JsonBuilder *jb, LogFileBatch *batch, const Packet *p,
+        int direction_sensitive, const char *event_type)
 {
     char timebuf[64];
     char srcip[46], dstip[46];
     Port sp, dp;
 
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
+    JsonBuilderStart(jb, batch->buffer);
 
     CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
 
@@ -203,38 +212,32 @@ json_t *CreateJSONHeader(Packet *p, int direction_sensitive, char *event_type)
     }
 
     /* time & tx */
-    json_object_set_new(js, "timestamp", json_string(timebuf));
+    JsonBuilderSetString(jb, "timestamp", timebuf);
 
     /* sensor id */
     if (sensor_id >= 0)
-        json_object_set_new(js, "sensor_id", json_integer(sensor_id));
+        JsonBuilderSetInt(jb, "sensor_id", sensor_id);
 
     /* pcap_cnt */
     if (p->pcap_cnt != 0) {
-        json_object_set_new(js, "pcap_cnt", json_integer(p->pcap_cnt));
+        JsonBuilderSetUint(jb, "pcap_cnt", p->pcap_cnt);
     }
 
     if (event_type) {
-        json_object_set_new(js, "event_type", json_string(event_type));
+        JsonBuilderSetString(jb, "event_type", event_type);
     }
 
     /* vlan */
     if (p->vlan_idx > 0) {
-        json_t *js_vlan;
         switch (p->vlan_idx) {
             case 1:
-                json_object_set_new(js, "vlan",
-                                    json_integer(VLAN_GET_ID1(p)));
+                JsonBuilderSetUint(jb, "vlan", VLAN_GET_ID1(p));
                 break;
             case 2:
-                js_vlan = json_array();
-                if (unlikely(js != NULL)) {
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID1(p)));
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID2(p)));
-                    json_object_set_new(js, "vlan", js_vlan);
-                }
+                JsonBuilderOpenArray(jb, "vlan");
+                JsonBuilderSetUint(jb, NULL, VLAN_GET_ID1(p));
+                JsonBuilderSetUint(jb, NULL, VLAN_GET_ID2(p));
+                JsonBuilderClose(jb);
                 break;
             default:
                 /* shouldn't get here */
@@ -243,71 +246,75 @@ json_t *CreateJSONHeader(Packet *p, int direction_sensitive, char *event_type)
     }
 
     /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
+    JsonBuilderSetString(jb, "src_ip", srcip);
     switch(p->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            JsonBuilderSetUint(jb, "src_port", sp);
             break;
     }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    JsonBuilderSetString(jb, "dest_ip", dstip);
     switch(p->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            JsonBuilderSetUint(jb, "dest_port", dp);
             break;
     }
-    json_object_set_new(js, "proto", json_string(proto));
+    JsonBuilderSetString(jb, "proto", proto);
     switch (p->proto) {
         case IPPROTO_ICMP:
             if (p->icmpv4h) {
-                json_object_set_new(js, "icmp_type",
-                                    json_integer(p->icmpv4h->type));
-                json_object_set_new(js, "icmp_code",
-                                    json_integer(p->icmpv4h->code));
+                JsonBuilderSetUint(jb, "icmp_type", p->icmpv4h->type);
+                JsonBuilderSetUint(jb, "icmp_code", p->icmpv4h->code);
             }
             break;
         case IPPROTO_ICMPV6:
             if (p->icmpv6h) {
-                json_object_set_new(js, "icmp_type",
-                                    json_integer(p->icmpv6h->type));
-                json_object_set_new(js, "icmp_code",
-                                    json_integer(p->icmpv6h->code));
+                JsonBuilderSetUint(jb, "icmp_type", p->icmpv6h->type);
+                JsonBuilderSetUint(jb, "icmp_code", p->icmpv6h->code);
             }
             break;
     }
-
-    return js;
 }
 
-int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer *buffer) {
-    char *js_s = json_dumps(js,
-                            JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
-#ifdef JSON_ESCAPE_SLASH
-                            JSON_ESCAPE_SLASH
-#else
-                            0
-#endif
-                            );
-    if (unlikely(js_s == NULL))
-        return TM_ECODE_OK;
+/** \brief finish the record and hand it to the output
+ *
+ *  For file and socket output the record stays in the thread's batch,
+ *  which is written out by LogFileBatchCommit() when it's full or when
+ *  it's been kept for too long.
+ *
+ *  \retval 0 ok
+ *  \retval -1 record was too big and is dropped
+ */
+int OutputJSONBuffer(JsonBuilder *jb, LogFileCtx *file_ctx, LogFileBatch *batch) {
+    MemBuffer *buffer = batch->buffer;
+
+    /* need room for the newline and the NUL */
+    if (JsonBuilderEnd(jb) < 0 || buffer->size - buffer->offset < 2) {
+        SCLogDebug("JSON record too big for the output buffer, dropped");
+        buffer->offset = jb->start;
+        buffer->buffer[buffer->offset] = '\0';
+        return -1;
+    }
 
-    SCMutexLock(&file_ctx->fp_mutex);
     if (json_out == ALERT_SYSLOG) {
-        syslog(alert_syslog_level, "%s", js_s);
+        SCMutexLock(&file_ctx->fp_mutex);
+        syslog(alert_syslog_level, "%s", JsonBuilderGetRecord(jb));
+        SCMutexUnlock(&file_ctx->fp_mutex);
+        /* record is not kept */
+        buffer->offset = jb->start;
+        buffer->buffer[buffer->offset] = '\0';
     } else if (json_out == ALERT_FILE || json_out == ALERT_UNIX_DGRAM || json_out == ALERT_UNIX_STREAM) {
-        MemBufferWriteString(buffer, "%s\n", js_s);
-        file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
-            MEMBUFFER_OFFSET(buffer), file_ctx);
+        buffer->buffer[buffer->offset++] = '\n';
+        buffer->buffer[buffer->offset] = '\0';
+        LogFileBatchCommit(file_ctx, batch);
     }
-    SCMutexUnlock(&file_ctx->fp_mutex);
-    free(js_s);
     return 0;
 }
 
@@ -405,6 +412,8 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
 
         if (json_ctx->json_out == ALERT_FILE || json_ctx->json_out == ALERT_UNIX_DGRAM || json_ctx->json_out == ALERT_UNIX_STREAM) {
 
+            /* all eve loggers use LogFileBatch, so "threaded" works */
+            json_ctx->file_ctx->flags |= LOGFILE_BATCHED;
             if (SCConfLogOpenGeneric(conf, json_ctx->file_ctx, DEFAULT_LOG_FILENAME) < 0) {
                 LogFileFreeCtx(json_ctx->file_ctx);
                 SCFree(json_ctx);
@@ -487,6 +496,136 @@ static void OutputJsonDeInitCtx(OutputCtx *output_ctx)
 
 #ifdef UNITTESTS
 
+static char json_test_out[1024];
+
+static int OutputJsonTestWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+{
+    strlcat(json_test_out, buffer, sizeof(json_test_out));
+    return 1;
+}
+
+/** \test header and record are written straight into the thread's
+ *        batch and handed to the LogFileCtx when it's full */
+static int OutputJsonTest01(void)
+{
+    int result = 0;
+    JsonBuilder jb;
+    LogFileBatch *batch = NULL;
+    Packet *p = NULL;
+
+    LogFileCtx *file_ctx = LogFileNewCtx();
+    if (file_ctx == NULL)
+        return 0;
+    file_ctx->Write = OutputJsonTestWrite;
+    file_ctx->batch_size = 512;
+    json_test_out[0] = '\0';
+
+    batch = LogFileBatchNew(NULL, file_ctx, 128);
+    if (batch == NULL)
+        goto end;
+
+    p = UTHBuildPacketReal((uint8_t *)"x", 1, IPPROTO_TCP,
+            "1.2.3.4", "5.6.7.8", 41424, 80);
+    if (p == NULL)
+        goto end;
+
+    CreateJSONHeader(&jb, batch, p, 0, "test");
+    JsonBuilderOpenObject(&jb, "test");
+    JsonBuilderSetString(&jb, "path", "/a\"b");
+    JsonBuilderClose(&jb);
+    if (OutputJSONBuffer(&jb, file_ctx, batch) != 0)
+        goto end;
+
+    /* below batch size, so nothing written yet */
+    if (json_test_out[0] != '\0' || MEMBUFFER_OFFSET(batch->buffer) == 0)
+        goto end;
+
+    LogFileBatchFlush(file_ctx, batch);
+
+    const char *expect = "\"event_type\":\"test\",\"src_ip\":\"1.2.3.4\","
+        "\"src_port\":41424,\"dest_ip\":\"5.6.7.8\",\"dest_port\":80,"
+        "\"proto\":\"TCP\",\"test\":{\"path\":\"\\/a\\\"b\"}}\n";
+    if (strncmp(json_test_out, "{\"timestamp\":\"", 14) != 0) {
+        printf("got \"%s\": ", json_test_out);
+        goto end;
+    }
+    char *s = strstr(json_test_out, "\"event_type\"");
+    if (s == NULL || strcmp(s, expect) != 0) {
+        printf("got \"%s\": ", json_test_out);
+        goto end;
+    }
+    if (MEMBUFFER_OFFSET(batch->buffer) != 0)
+        goto end;
+
+    result = 1;
+end:
+    if (p != NULL)
+        UTHFreePacket(p);
+    LogFileBatchFree(file_ctx, batch);
+    LogFileFreeCtx(file_ctx);
+    return result;
+}
+
+/** \test with a threaded LogFileCtx all batches of a thread share
+ *        the thread's own file, named after the thread */
+static int OutputJsonTest02(void)
+{
+    int result = 0;
+    LogFileBatch *batch1 = NULL, *batch2 = NULL;
+    char path[PATH_MAX], buf[64];
+    char tv_name[] = "W#01-eth0";
+    FILE *fp = NULL;
+    ThreadVars tv;
+
+    memset(&tv, 0, sizeof(tv));
+    tv.name = tv_name;
+
+    LogFileCtx *file_ctx = LogFileNewCtx();
+    if (file_ctx == NULL)
+        return 0;
+    snprintf(path, sizeof(path), "%s/suricata-ut-%d.json",
+            ConfigGetLogDirectory(), (int)getpid());
+    file_ctx->filename = SCStrdup(path);
+    if (file_ctx->filename == NULL)
+        goto end;
+    file_ctx->threaded = 1;
+    file_ctx->is_regular = 1;
+
+    batch1 = LogFileBatchNew(&tv, file_ctx, 64);
+    batch2 = LogFileBatchNew(&tv, file_ctx, 64);
+    if (batch1 == NULL || batch2 == NULL)
+        goto end;
+    if (file_ctx->thread_files_cnt != 1 ||
+        batch1->thread_ctx != batch2->thread_ctx)
+        goto end;
+
+    MemBufferWriteString(batch1->buffer, "one\n");
+    LogFileBatchCommit(file_ctx, batch1);
+    MemBufferWriteString(batch2->buffer, "two\n");
+    LogFileBatchCommit(file_ctx, batch2);
+
+    snprintf(path, sizeof(path), "%s.W_01-eth0", file_ctx->filename);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        goto end;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[len] = '\0';
+    if (strcmp(buf, "one\ntwo\n") != 0) {
+        printf("got \"%s\": ", buf);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (fp != NULL)
+        fclose(fp);
+    LogFileBatchFree(file_ctx, batch1);
+    LogFileBatchFree(file_ctx, batch2);
+    LogFileFreeCtx(file_ctx);
+    unlink(path);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -496,7 +635,8 @@ void OutputJsonRegisterTests(void)
 {
 
 #ifdef UNITTESTS
-
+    UtRegisterTest("OutputJsonTest01", OutputJsonTest01, 1);
+    UtRegisterTest("OutputJsonTest02", OutputJsonTest02, 1);
 #endif /* UNITTESTS */
 
 }
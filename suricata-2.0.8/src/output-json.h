@@ -31,10 +31,11 @@ void TmModuleOutputJsonRegister (void);
 #include "suricata-common.h"
 #include "util-buffer.h"
 #include "util-logopenfile.h"
+#include "util-json-builder.h"
 
-json_t *CreateJSONHeader(Packet *p, int direction_sensative, char *event_type);
-TmEcode OutputJSON(json_t *js, void *data, uint64_t *count);
-int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer *buffer);
+void CreateJSONHeader(JsonBuilder *jb, LogFileBatch *batch, const Packet *p,
+        int direction_sensitive, const char *event_type);
+int OutputJSONBuffer(JsonBuilder *jb, LogFileCtx *file_ctx, LogFileBatch *batch);
 OutputCtx *OutputJsonInitCtx(ConfNode *);
 
 enum JsonOutput { ALERT_FILE,
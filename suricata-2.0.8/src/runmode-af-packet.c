@@ -142,6 +142,8 @@ void *ParseAFPConfig(const char *iface)
     aconf->bpf_filter = NULL;
     aconf->out_iface = NULL;
     aconf->copy_mode = AFP_COPY_MODE_NONE;
+    aconf->block_size = AFP_BLOCK_SIZE_DEFAULT;
+    aconf->block_timeout = AFP_BLOCK_TIMEOUT_DEFAULT;
 
     if (ConfGet("bpf-filter", &bpf_filter) == 1) {
         if (strlen(bpf_filter) > 0) {
@@ -231,6 +233,29 @@ void *ParseAFPConfig(const char *iface)
         }
     }
 
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "tpacket-v3", (int *)&boolval);
+    if (boolval) {
+        if (!(aconf->flags & AFP_RING_MODE)) {
+            SCLogWarning(SC_ERR_AFP_CREATE, "tpacket-v3 needs use-mmap, "
+                         "using the socket capture on iface %s", aconf->iface);
+        } else if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            /* a block is only sent on when it is full or timed out, that
+             * latency is not acceptable inline */
+            SCLogWarning(SC_ERR_AFP_CREATE, "tpacket-v3 is not supported in "
+                         "IPS and TAP mode, using tpacket-v2 on iface %s", aconf->iface);
+        } else {
+#ifdef HAVE_TPACKET_V3
+            SCLogInfo("Enabling tpacket-v3 block capture on iface %s",
+                      aconf->iface);
+            aconf->flags |= AFP_TPACKET_V3;
+#else
+            SCLogWarning(SC_ERR_AFP_CREATE, "tpacket-v3 is not supported by "
+                         "this system, using tpacket-v2 on iface %s", aconf->iface);
+#endif
+        }
+    }
+
     SC_ATOMIC_RESET(aconf->ref);
     (void) SC_ATOMIC_ADD(aconf->ref, aconf->threads);
 
@@ -303,6 +328,26 @@ void *ParseAFPConfig(const char *iface)
         aconf->ring_size = max_pending_packets * 2 / aconf->threads;
     }
 
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "block-size", &value)) == 1) {
+        /* the kernel wants a power of two multiple of the page size */
+        if (value <= 0 || value > INT_MAX || value % getpagesize() != 0 ||
+                (value & (value - 1)) != 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "block-size %"PRIdMAX" is not a "
+                         "power of two multiple of the page size, using %d",
+                         value, AFP_BLOCK_SIZE_DEFAULT);
+        } else {
+            aconf->block_size = value;
+        }
+    }
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "block-timeout", &value)) == 1) {
+        if (value < 0 || value > INT_MAX) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "block-timeout %"PRIdMAX" is "
+                         "invalid, using %d", value, AFP_BLOCK_TIMEOUT_DEFAULT);
+        } else {
+            aconf->block_timeout = value;
+        }
+    }
+
     (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
     if (boolval) {
         SCLogInfo("Disabling promiscuous mode on iface %s",
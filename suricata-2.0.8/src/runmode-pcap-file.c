@@ -61,6 +61,14 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "workers",
+                              "Workers pcap file mode, the reader passes each "
+                              "flow to a single worker thread that does "
+                              "decode, stream, detect and outputs. IP "
+                              "fragments are passed on their addresses only, "
+                              "so they may reach another worker than the "
+                              "rest of their flow",
+                              RunModeFilePcapWorkers);
 
     return;
 }
@@ -358,7 +366,7 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
     ThreadVars *tv_receivepcap =
         TmThreadCreatePacketHandler("ReceivePcapFile",
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    queues, RunmodeAutoFpGetQueueHandler(),
                                     "pktacqloop");
     SCFree(queues);
 
@@ -402,7 +410,7 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpGetQueueHandler(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -450,3 +458,146 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 
     return 0;
 }
+
+/**
+ * \brief RunModeFilePcapWorkers set up the following thread packet handlers:
+ *        - Reader thread: reads the pcap file and passes each packet to a
+ *          worker, selected by hashing the packet's addresses and ports,
+ *          so all packets of a flow go to the same worker in file order.
+ *        - Worker threads: decode, stream, detect and outputs.
+ *        The engine time is set by the reader, so flow timeouts follow
+ *        the packet timestamps as in the other modes.
+ *
+ * \param de_ctx Pointer to the Detection Engine
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapWorkers(DetectEngineCtx *de_ctx)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    char qname[TM_QUEUE_NAME_MAX];
+    char *queues = NULL;
+    int thread;
+
+    RunModeInitialize();
+
+    char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    TimeModeSetOffline();
+
+    PcapFileGlobalInit();
+
+    /* the reader doesn't decode, so it can't use the flow */
+    char *inqh = RunmodeAutoFpGetQueueHandler();
+    char *outqh = (strcmp(inqh, "flow-ring") == 0) ?
+        "flow-tuple-ring" : "flow-tuple";
+
+    /* always create at least one thread */
+    int thread_max = TmThreadGetNbThreads(DETECT_CPU_SET);
+    if (thread_max == 0)
+        thread_max = UtilCpuGetNumProcessorsOnline() * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+
+    queues = RunmodeAutoFpCreatePickupQueuesString(thread_max);
+    if (queues == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "RunmodeAutoFpCreatePickupQueuesString failed");
+        exit(EXIT_FAILURE);
+    }
+
+    ThreadVars *tv_receivepcap =
+        TmThreadCreatePacketHandler("ReceivePcapFile",
+                                    "packetpool", "packetpool",
+                                    queues, outqh,
+                                    "pktacqloop");
+    SCFree(queues);
+
+    if (tv_receivepcap == NULL) {
+        SCLogError(SC_ERR_FATAL, "threading setup failed");
+        exit(EXIT_FAILURE);
+    }
+    TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
+        exit(EXIT_FAILURE);
+    }
+    TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+
+    TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+
+    if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "Worker%"PRIu16, thread+1);
+        snprintf(qname, sizeof(qname), "pickup%"PRIu16, thread+1);
+
+        SCLogDebug("tname %s, qname %s", tname, qname);
+
+        char *thread_name = SCStrdup(tname);
+        if (unlikely(thread_name == NULL)) {
+            SCLogError(SC_ERR_RUNMODE, "failed to strdup thread name");
+            exit(EXIT_FAILURE);
+        }
+
+        ThreadVars *tv_worker =
+            TmThreadCreatePacketHandler(thread_name,
+                                        qname, inqh,
+                                        "packetpool", "packetpool",
+                                        "varslot");
+        if (tv_worker == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_worker, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("StreamTcp");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName StreamTcp failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_worker, tm_module, NULL);
+
+        if (de_ctx) {
+            tm_module = TmModuleGetByName("Detect");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_worker, tm_module, (void *)de_ctx);
+        }
+
+        char *thread_group_name = SCStrdup("Worker");
+        if (unlikely(thread_group_name == NULL)) {
+            SCLogError(SC_ERR_RUNMODE, "error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        tv_worker->thread_group_name = thread_group_name;
+
+        SetupOutputs(tv_worker);
+
+        TmThreadSetCPU(tv_worker, DETECT_CPU_SET);
+
+        if (TmThreadSpawn(tv_worker) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
@@ -101,6 +101,9 @@
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
+#include "util-streaming-buffer.h"
+#include "util-json-builder.h"
+#include "util-logopenfile-async.h"
 
 #include "util-mpm-ac.h"
 #include "detect-engine-mpm.h"
@@ -110,8 +113,10 @@
 #include "conf.h"
 #include "conf-yaml-loader.h"
 #include "tmqh-flow.h"
+#include "tmqh-packetpool.h"
 #include "defrag.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 
 #endif /* UNITTESTS */
 
@@ -210,6 +215,7 @@ int RunUnittests(int list_unittests, char *regex_arg)
     ConfRegisterTests();
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
+    TmqhPacketpoolRegisterTests();
     FlowRegisterTests();
     SCSigRegisterSignatureOrderingTests();
     SCRadixRegisterTests();
@@ -249,6 +255,7 @@ int RunUnittests(int list_unittests, char *regex_arg)
     DetectEngineHttpHHRegisterTests();
     DetectEngineHttpHRHRegisterTests();
     DetectEngineRegisterTests();
+    DetectPrefilterRegisterTests();
     SCLogRegisterTests();
     SMTPParserRegisterTests();
     MagicRegisterTests();
@@ -258,6 +265,10 @@ int RunUnittests(int list_unittests, char *regex_arg)
     DetectPortTests();
     SCAtomicRegisterTests();
     MemrchrRegisterTests();
+    StreamingBufferRegisterTests();
+    JsonBuilderRegisterTests();
+    LogFileRegisterTests();
+    LogFileAsyncRegisterTests();
 #ifdef __SC_CUDA_SUPPORT__
     CudaBufferRegisterUnittests();
 #endif
@@ -748,6 +748,7 @@ void SetupOutputs(ThreadVars *tv)
 }
 
 float threading_detect_ratio = 1;
+int threading_detect_batch_size = 1;
 
 /**
  * Initialize multithreading settings.
@@ -769,4 +770,15 @@ void RunModeInitialize(void)
     }
 
     SCLogDebug("threading.detect-thread-ratio %f", threading_detect_ratio);
+
+    intmax_t batch_size = 1;
+    if ((ConfGetInt("threading.detect-batch-size", &batch_size)) != 1) {
+        batch_size = 1;
+    } else if (batch_size < 1 || batch_size > TM_BATCH_MAX) {
+        WarnInvalidConfEntry("threading.detect-batch-size", "%d", 1);
+        batch_size = 1;
+    }
+    threading_detect_batch_size = (int)batch_size;
+
+    SCLogDebug("threading.detect-batch-size %d", threading_detect_batch_size);
 }
@@ -92,6 +92,7 @@ int RunModeOutputFiledataEnabled(void);
 
 int threading_set_cpu_affinity;
 extern float threading_detect_ratio;
+extern int threading_detect_batch_size;
 
 extern int debuglog_enabled;
 
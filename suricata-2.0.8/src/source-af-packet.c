@@ -55,6 +55,7 @@
 #include "tmqh-packetpool.h"
 #include "source-af-packet.h"
 #include "runmodes.h"
+#include "util-unittest.h"
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -177,9 +178,26 @@ enum {
 
 union thdr {
     struct tpacket2_hdr *h2;
+#ifdef HAVE_TPACKET_V3
+    struct tpacket3_hdr *h3;
+#endif
     void *raw;
 };
 
+#ifdef HAVE_TPACKET_V3
+/**
+ * \brief tpacket-v3 ring block
+ *
+ * The block goes back to the kernel when the reader and all the packets
+ * pointing into it are done with it.
+ */
+typedef struct AFPBlock_ {
+    struct tpacket_block_desc *desc;
+    /** reader + packets using the block, 0 if it belongs to the kernel */
+    SC_ATOMIC_DECLARE(int, ref);
+} AFPBlock;
+#endif
+
 /**
  * \brief Structure to hold thread specific variables.
  */
@@ -241,6 +259,20 @@ typedef struct AFPThreadVars_
     unsigned int frame_offset;
     int ring_size;
 
+#ifdef HAVE_TPACKET_V3
+    struct tpacket_req3 req3;
+    AFPBlock *blocks;
+    unsigned int block_offset;
+    int block_size;
+    int block_timeout;
+    /* usecs to sleep when the next block is still in use */
+    int block_busy_wait;
+
+    uint16_t capture_blocks;
+    uint16_t capture_block_timeouts;
+    uint16_t capture_block_fill;
+    uint16_t capture_block_latency;
+#endif
 } AFPThreadVars;
 
 TmEcode ReceiveAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
@@ -259,9 +291,10 @@ static int AFPGetDevFlags(int fd, const char *ifname);
 static int AFPDerefSocket(AFPPeer* peer);
 static int AFPRefSocket(AFPPeer* peer);
 
+static void AFPRegisterTests(void);
+
 /**
  * \brief Registration Function for RecieveAFP.
- * \todo Unit tests are needed for this module.
  */
 void TmModuleReceiveAFPRegister (void) {
     tmm_modules[TMM_RECEIVEAFP].name = "ReceiveAFP";
@@ -270,7 +303,7 @@ void TmModuleReceiveAFPRegister (void) {
     tmm_modules[TMM_RECEIVEAFP].PktAcqLoop = ReceiveAFPLoop;
     tmm_modules[TMM_RECEIVEAFP].ThreadExitPrintStats = ReceiveAFPThreadExitStats;
     tmm_modules[TMM_RECEIVEAFP].ThreadDeinit = NULL;
-    tmm_modules[TMM_RECEIVEAFP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFP].RegisterTests = AFPRegisterTests;
     tmm_modules[TMM_RECEIVEAFP].cap_flags = SC_CAP_NET_RAW;
     tmm_modules[TMM_RECEIVEAFP].flags = TM_FLAG_RECEIVE_TM;
 }
@@ -682,6 +715,31 @@ TmEcode AFPWritePacket(Packet *p)
     return TM_ECODE_OK;
 }
 
+#ifdef HAVE_TPACKET_V3
+/**
+ * \brief Drop a reference to a tpacket-v3 block. The last one hands the
+ *        block back to the kernel.
+ *
+ * New references are only taken by the reader while it holds its own, so
+ * a count of 1 means we are the last user.
+ */
+static void AFPBlockRelease(AFPBlock *blk)
+{
+    while (1) {
+        int ref = SC_ATOMIC_GET(blk->ref);
+        if (ref == 1) {
+            blk->desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            /* the reader checks ref before the block status */
+            hw_barrier();
+            SC_ATOMIC_SET(blk->ref, 0);
+            return;
+        }
+        if (SC_ATOMIC_CAS(&blk->ref, ref, ref - 1))
+            return;
+    }
+}
+#endif
+
 void AFPReleaseDataFromRing(Packet *p)
 {
     /* Need to be in copy mode and need to detect early release
@@ -690,6 +748,14 @@ void AFPReleaseDataFromRing(Packet *p)
         AFPWritePacket(p);
     }
 
+#ifdef HAVE_TPACKET_V3
+    /* done while we still hold the socket, the blocks are only
+     * reallocated after all packets gave that reference back */
+    if (p->afp_v.relblk) {
+        AFPBlockRelease(p->afp_v.relblk);
+    }
+#endif
+
     if (AFPDerefSocket(p->afp_v.mpeer) == 0)
         goto cleanup;
 
@@ -887,6 +953,210 @@ next_frame:
     SCReturnInt(AFP_READ_OK);
 }
 
+#ifdef HAVE_TPACKET_V3
+/**
+ * \brief Set up and pass on one packet of a tpacket-v3 block
+ */
+static inline int AFPParsePacketV3(AFPThreadVars *ptv, AFPBlock *blk, struct tpacket3_hdr *ppd)
+{
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (p == NULL) {
+        return AFP_FAILURE;
+    }
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+
+    ptv->pkts++;
+    ptv->bytes += ppd->tp_len;
+    p->livedev = ptv->livedev;
+
+    /* add forged header */
+    if (ptv->cooked) {
+        SllHdr * hdrp = (SllHdr *)ptv->data;
+        struct sockaddr_ll *from = (void *)ppd + TPACKET_ALIGN(ptv->tp_hdrlen);
+        hdrp->sll_protocol = from->sll_protocol;
+    }
+
+    p->datalink = ptv->datalink;
+
+    /* get vlan id from header */
+    if ((!ptv->vlan_disabled) &&
+        (ppd->tp_status & TP_STATUS_VLAN_VALID || ppd->hv1.tp_vlan_tci)) {
+        p->vlan_id[0] = ppd->hv1.tp_vlan_tci;
+        p->vlan_idx = 1;
+        p->vlanh[0] = NULL;
+    }
+
+    if (ptv->flags & AFP_ZERO_COPY) {
+        if (PacketSetData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            return AFP_FAILURE;
+        }
+        (void)SC_ATOMIC_ADD(blk->ref, 1);
+        p->afp_v.relblk = blk;
+        p->ReleasePacket = AFPReleasePacket;
+        p->afp_v.mpeer = ptv->mpeer;
+        AFPRefSocket(ptv->mpeer);
+
+        /* no copy mode with tpacket-v3, see ParseAFPConfig */
+        p->afp_v.copy_mode = AFP_COPY_MODE_NONE;
+        p->afp_v.peer = NULL;
+    } else {
+        if (PacketCopyData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            return AFP_FAILURE;
+        }
+    }
+    /* Timestamp */
+    p->ts.tv_sec = ppd->tp_sec;
+    p->ts.tv_usec = ppd->tp_nsec/1000;
+    SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
+            GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+    /* We only check for checksum disable */
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ptv->livedev->ignore_checksum) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ChecksumAutoModeCheck(ptv->pkts,
+                    SC_ATOMIC_GET(ptv->livedev->pkts),
+                    SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            ptv->livedev->ignore_checksum = 1;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    } else {
+        if (ppd->tp_status & TP_STATUS_CSUMNOTREADY) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+
+    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+        TmqhOutputPacketpool(ptv->tv, p);
+        return AFP_FAILURE;
+    }
+    return AFP_READ_OK;
+}
+
+/**
+ * \brief Update the block fill and latency counters
+ */
+static inline void AFPBlockCounters(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
+{
+    struct timeval now;
+
+    SCPerfCounterIncr(ptv->capture_blocks, ptv->tv->sc_perf_pca);
+    if (pbd->hdr.bh1.block_status & TP_STATUS_BLK_TMO) {
+        SCPerfCounterIncr(ptv->capture_block_timeouts, ptv->tv->sc_perf_pca);
+    }
+    SCPerfCounterAddUI64(ptv->capture_block_fill, ptv->tv->sc_perf_pca,
+            (uint64_t)pbd->hdr.bh1.blk_len * 100 / ptv->req3.tp_block_size);
+
+    /* time from the first packet landing in the block till we get to it */
+    if (pbd->hdr.bh1.num_pkts > 0) {
+        gettimeofday(&now, NULL);
+        int64_t usec = ((int64_t)now.tv_sec - (int64_t)pbd->hdr.bh1.ts_first_pkt.ts_sec) * 1000000 +
+            (int64_t)now.tv_usec - (int64_t)pbd->hdr.bh1.ts_first_pkt.ts_nsec / 1000;
+        if (usec > 0) {
+            SCPerfCounterAddUI64(ptv->capture_block_latency, ptv->tv->sc_perf_pca, (uint64_t)usec);
+        }
+    }
+}
+
+/**
+ * \brief Wait for the packets still holding the next block
+ *
+ * The kernel filled the block so poll() keeps returning right away. Sleep
+ * instead of spinning on it, longer each time up to AFP_BLOCK_BUSY_WAIT_MAX.
+ */
+static void AFPBlockBusyWait(AFPThreadVars *ptv)
+{
+    if (ptv->block_busy_wait == 0) {
+        ptv->block_busy_wait = AFP_BLOCK_BUSY_WAIT_MIN;
+    } else if (ptv->block_busy_wait < AFP_BLOCK_BUSY_WAIT_MAX) {
+        ptv->block_busy_wait *= 2;
+        if (ptv->block_busy_wait > AFP_BLOCK_BUSY_WAIT_MAX)
+            ptv->block_busy_wait = AFP_BLOCK_BUSY_WAIT_MAX;
+    }
+    usleep(ptv->block_busy_wait);
+}
+
+/**
+ * \brief AF packet read function for a tpacket-v3 ring
+ *
+ * Process all the blocks the kernel handed over since the last wakeup.
+ * Each packet holds a reference to its block, so with zero copy a block
+ * only goes back to the kernel when the last of its packets is released.
+ *
+ * \param ptv pointer to AFPThreadVars
+ * \retval AFP_READ_OK, AFP_KERNEL_DROP or AFP_FAILURE
+ */
+static int AFPReadFromRingV3(AFPThreadVars *ptv)
+{
+    uint8_t emergency_flush = 0;
+    uint32_t blocks = 0;
+
+    while (1) {
+        if (unlikely(suricata_ctl_flags != 0)) {
+            break;
+        }
+
+        AFPBlock *blk = &ptv->blocks[ptv->block_offset];
+        /* packets from our last pass over the ring are still using it */
+        if (SC_ATOMIC_GET(blk->ref) != 0) {
+            if (blocks == 0)
+                AFPBlockBusyWait(ptv);
+            break;
+        }
+        hw_barrier();
+        struct tpacket_block_desc *pbd = blk->desc;
+        if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER)) {
+            break;
+        }
+
+        SC_ATOMIC_SET(blk->ref, 1);
+        ptv->block_busy_wait = 0;
+        blocks++;
+        AFPBlockCounters(ptv, pbd);
+
+        if ((ptv->flags & AFP_EMERGENCY_MODE) && (emergency_flush == 1)) {
+            AFPBlockRelease(blk);
+            goto next_block;
+        }
+        if (pbd->hdr.bh1.block_status & TP_STATUS_LOSING) {
+            emergency_flush = 1;
+            AFPDumpCounters(ptv);
+        }
+
+        uint32_t num_pkts = pbd->hdr.bh1.num_pkts;
+        uint8_t *ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
+        uint32_t i;
+        for (i = 0; i < num_pkts; i++) {
+            if (AFPParsePacketV3(ptv, blk, (struct tpacket3_hdr *)ppd) != AFP_READ_OK) {
+                AFPBlockRelease(blk);
+                if (++ptv->block_offset >= ptv->req3.tp_block_nr) {
+                    ptv->block_offset = 0;
+                }
+                SCReturnInt(AFP_FAILURE);
+            }
+            ppd += ((struct tpacket3_hdr *)ppd)->tp_next_offset;
+        }
+        AFPBlockRelease(blk);
+
+next_block:
+        if (++ptv->block_offset >= ptv->req3.tp_block_nr) {
+            ptv->block_offset = 0;
+            /* Get out of loop to be sure we will reach maintenance tasks */
+            break;
+        }
+    }
+
+    if ((emergency_flush) && (ptv->flags & AFP_EMERGENCY_MODE)) {
+        SCReturnInt(AFP_KERNEL_DROP);
+    }
+    SCReturnInt(AFP_READ_OK);
+}
+#endif /* HAVE_TPACKET_V3 */
+
 /**
  * \brief Reference socket
  *
@@ -1021,6 +1291,33 @@ static int AFPReadAndDiscardFromRing(AFPThreadVars *ptv, struct timeval *synctv)
     return 0;
 }
 
+#ifdef HAVE_TPACKET_V3
+static int AFPReadAndDiscardFromRingV3(AFPThreadVars *ptv, struct timeval *synctv)
+{
+    if (unlikely(suricata_ctl_flags != 0)) {
+        return 1;
+    }
+
+    struct tpacket_block_desc *pbd = ptv->blocks[ptv->block_offset].desc;
+    if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER)) {
+        return 0;
+    }
+
+    /* keep the block if it holds packets from after the sync point */
+    if (((time_t)pbd->hdr.bh1.ts_last_pkt.ts_sec > synctv->tv_sec) ||
+        ((time_t)pbd->hdr.bh1.ts_last_pkt.ts_sec == synctv->tv_sec &&
+        (suseconds_t) (pbd->hdr.bh1.ts_last_pkt.ts_nsec / 1000) > synctv->tv_usec)) {
+        return 1;
+    }
+
+    pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    if (++ptv->block_offset >= ptv->req3.tp_block_nr) {
+        ptv->block_offset = 0;
+    }
+    return 0;
+}
+#endif
+
 /** \brief wait for all afpacket threads to fully init
  *
  *  Discard packets before all threads are ready, as the cluster
@@ -1054,6 +1351,11 @@ static int AFPSynchronizeStart(AFPThreadVars *ptv)
             if (AFPPeersListStarted() && synctv.tv_sec == (time_t) 0xffffffff) {
                 gettimeofday(&synctv, NULL);
             }
+#ifdef HAVE_TPACKET_V3
+            if (ptv->flags & AFP_TPACKET_V3) {
+                r = AFPReadAndDiscardFromRingV3(ptv, &synctv);
+            } else
+#endif
             if (ptv->flags & AFP_RING_MODE) {
                 r = AFPReadAndDiscardFromRing(ptv, &synctv);
             } else {
@@ -1212,6 +1514,11 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
                 continue;
             }
         } else if (r > 0) {
+#ifdef HAVE_TPACKET_V3
+            if (ptv->flags & AFP_TPACKET_V3) {
+                r = AFPReadFromRingV3(ptv);
+            } else
+#endif
             if (ptv->flags & AFP_RING_MODE) {
                 r = AFPReadFromRing(ptv);
             } else {
@@ -1359,14 +1666,163 @@ frame size: TPACKET_ALIGN(snaplen + TPACKET_ALIGN(TPACKET_ALIGN(tp_hdrlen) + siz
     return 1;
 }
 
+static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
+{
+    int order;
+    int r;
+    unsigned int i;
+
+    /* Allocate RX ring */
+#define DEFAULT_ORDER 3
+    for (order = DEFAULT_ORDER; order >= 0; order--) {
+        if (AFPComputeRingParams(ptv, order) != 1) {
+            SCLogInfo("Ring parameter are incorrect. Please correct the devel");
+        }
+
+        r = setsockopt(ptv->socket, SOL_PACKET, PACKET_RX_RING, (void *) &ptv->req, sizeof(ptv->req));
+        if (r < 0) {
+            if (errno == ENOMEM) {
+                SCLogInfo("Memory issue with ring parameters. Retrying.");
+                continue;
+            }
+            SCLogError(SC_ERR_MEM_ALLOC,
+                    "Unable to allocate RX Ring for iface %s: (%d) %s",
+                    devname,
+                    errno,
+                    strerror(errno));
+            return -1;
+        } else {
+            break;
+        }
+    }
+
+    if (order < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC,
+                "Unable to allocate RX Ring for iface %s (order 0 failed)",
+                devname);
+        return -1;
+    }
+
+    /* Allocate the Ring */
+    ptv->ring_buflen = ptv->req.tp_block_nr * ptv->req.tp_block_size;
+    ptv->ring_buf = mmap(0, ptv->ring_buflen, PROT_READ|PROT_WRITE,
+            MAP_SHARED, ptv->socket, 0);
+    if (ptv->ring_buf == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to mmap");
+        return -1;
+    }
+    /* allocate a ring for each frame header pointer*/
+    ptv->frame_buf = SCMalloc(ptv->req.tp_frame_nr * sizeof (union thdr *));
+    if (ptv->frame_buf == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate frame buf");
+        return -1;
+    }
+    memset(ptv->frame_buf, 0, ptv->req.tp_frame_nr * sizeof (union thdr *));
+    /* fill the header ring with proper frame ptr*/
+    ptv->frame_offset = 0;
+    for (i = 0; i < ptv->req.tp_block_nr; ++i) {
+        void *base = &ptv->ring_buf[i * ptv->req.tp_block_size];
+        unsigned int j;
+        for (j = 0; j < ptv->req.tp_block_size / ptv->req.tp_frame_size; ++j, ++ptv->frame_offset) {
+            (((union thdr **)ptv->frame_buf)[ptv->frame_offset]) = base;
+            base += ptv->req.tp_frame_size;
+        }
+    }
+    ptv->frame_offset = 0;
+
+    return 0;
+}
+
+#ifdef HAVE_TPACKET_V3
+static int AFPComputeRingParamsV3(AFPThreadVars *ptv)
+{
+    /* same frame size as v2, the kernel only uses it to check the
+     * ring size but packets are packed in the blocks */
+    int tp_hdrlen = sizeof(struct tpacket3_hdr);
+    int snaplen = default_packet_size;
+
+    if (ptv->block_size <= 0 || ptv->block_timeout < 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "invalid block-size %d or "
+                   "block-timeout %d", ptv->block_size, ptv->block_timeout);
+        return -1;
+    }
+    ptv->req3.tp_block_size = ptv->block_size;
+    ptv->req3.tp_frame_size = TPACKET_ALIGN(snaplen +TPACKET_ALIGN(TPACKET_ALIGN(tp_hdrlen) + sizeof(struct sockaddr_ll) + ETH_HLEN) - ETH_HLEN);
+    if (ptv->req3.tp_block_size < ptv->req3.tp_frame_size) {
+        unsigned int block_size = ptv->req3.tp_block_size;
+        while (block_size < ptv->req3.tp_frame_size)
+            block_size <<= 1;
+        SCLogWarning(SC_ERR_INVALID_VALUE, "block-size %u is smaller than a "
+                     "frame (%u), using %u", ptv->req3.tp_block_size,
+                     ptv->req3.tp_frame_size, block_size);
+        ptv->req3.tp_block_size = block_size;
+    }
+    int frames_per_block = ptv->req3.tp_block_size / ptv->req3.tp_frame_size;
+    ptv->req3.tp_frame_nr = ptv->ring_size;
+    ptv->req3.tp_block_nr = ptv->req3.tp_frame_nr / frames_per_block + 1;
+    /* exact division */
+    ptv->req3.tp_frame_nr = ptv->req3.tp_block_nr * frames_per_block;
+    ptv->req3.tp_retire_blk_tov = ptv->block_timeout;
+    ptv->req3.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    SCLogInfo("AF_PACKET V3 RX Ring params: block_size=%d block_nr=%d frame_size=%d frame_nr=%d block_timeout=%dms",
+              ptv->req3.tp_block_size, ptv->req3.tp_block_nr,
+              ptv->req3.tp_frame_size, ptv->req3.tp_frame_nr,
+              ptv->req3.tp_retire_blk_tov);
+    return 1;
+}
+
+static int AFPSetupRingV3(AFPThreadVars *ptv, char *devname)
+{
+    unsigned int i;
+
+    if (AFPComputeRingParamsV3(ptv) != 1) {
+        return -1;
+    }
+
+    if (setsockopt(ptv->socket, SOL_PACKET, PACKET_RX_RING,
+                (void *) &ptv->req3, sizeof(ptv->req3)) < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC,
+                "Unable to allocate RX Ring for iface %s: (%d) %s",
+                devname,
+                errno,
+                strerror(errno));
+        return -1;
+    }
+
+    /* Allocate the Ring */
+    ptv->ring_buflen = ptv->req3.tp_block_nr * ptv->req3.tp_block_size;
+    ptv->ring_buf = mmap(0, ptv->ring_buflen, PROT_READ|PROT_WRITE,
+            MAP_SHARED, ptv->socket, 0);
+    if (ptv->ring_buf == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to mmap");
+        return -1;
+    }
+
+    /* no packet of the previous socket is left, see AFPTryReopen */
+    if (ptv->blocks != NULL) {
+        SCFree(ptv->blocks);
+    }
+    ptv->blocks = SCMalloc(ptv->req3.tp_block_nr * sizeof(AFPBlock));
+    if (ptv->blocks == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate block array");
+        return -1;
+    }
+    for (i = 0; i < ptv->req3.tp_block_nr; ++i) {
+        ptv->blocks[i].desc = (struct tpacket_block_desc *)
+            &ptv->ring_buf[i * ptv->req3.tp_block_size];
+        SC_ATOMIC_INIT(ptv->blocks[i].ref);
+    }
+    ptv->block_offset = 0;
+    return 0;
+}
+#endif /* HAVE_TPACKET_V3 */
+
 static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
 {
     int r;
     int ret = AFP_FATAL_ERROR;
     struct packet_mreq sock_params;
     struct sockaddr_ll bind_address;
-    int order;
-    unsigned int i;
     int if_idx;
 
     /* open socket */
@@ -1483,7 +1939,13 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
     }
 
     if (ptv->flags & AFP_RING_MODE) {
-        int val = TPACKET_V2;
+        int version = TPACKET_V2;
+#ifdef HAVE_TPACKET_V3
+        if (ptv->flags & AFP_TPACKET_V3) {
+            version = TPACKET_V3;
+        }
+#endif
+        int val = version;
         unsigned int len = sizeof(val);
         if (getsockopt(ptv->socket, SOL_PACKET, PACKET_HDRLEN, &val, &len) < 0) {
             if (errno == ENOPROTOOPT) {
@@ -1495,12 +1957,12 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
         }
         ptv->tp_hdrlen = val;
 
-        val = TPACKET_V2;
+        val = version;
         if (setsockopt(ptv->socket, SOL_PACKET, PACKET_VERSION, &val,
                     sizeof(val)) < 0) {
             SCLogError(SC_ERR_AFP_CREATE,
-                       "Can't activate TPACKET_V2 on packet socket: %s",
-                       strerror(errno));
+                       "Can't activate TPACKET_V%d on packet socket: %s",
+                       version == TPACKET_V2 ? 2 : 3, strerror(errno));
             goto socket_err;
         }
 
@@ -1509,63 +1971,16 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
                          "Using mmap mode with GRO or LRO activated can lead to capture problems");
         }
 
-        /* Allocate RX ring */
-#define DEFAULT_ORDER 3
-        for (order = DEFAULT_ORDER; order >= 0; order--) {
-            if (AFPComputeRingParams(ptv, order) != 1) {
-                SCLogInfo("Ring parameter are incorrect. Please correct the devel");
-            }
-
-            r = setsockopt(ptv->socket, SOL_PACKET, PACKET_RX_RING, (void *) &ptv->req, sizeof(ptv->req));
-            if (r < 0) {
-                if (errno == ENOMEM) {
-                    SCLogInfo("Memory issue with ring parameters. Retrying.");
-                    continue;
-                }
-                SCLogError(SC_ERR_MEM_ALLOC,
-                        "Unable to allocate RX Ring for iface %s: (%d) %s",
-                        devname,
-                        errno,
-                        strerror(errno));
+#ifdef HAVE_TPACKET_V3
+        if (ptv->flags & AFP_TPACKET_V3) {
+            if (AFPSetupRingV3(ptv, devname) != 0) {
                 goto socket_err;
-            } else {
-                break;
             }
-        }
-
-        if (order < 0) {
-            SCLogError(SC_ERR_MEM_ALLOC,
-                    "Unable to allocate RX Ring for iface %s (order 0 failed)",
-                    devname);
-            goto socket_err;
-        }
-
-        /* Allocate the Ring */
-        ptv->ring_buflen = ptv->req.tp_block_nr * ptv->req.tp_block_size;
-        ptv->ring_buf = mmap(0, ptv->ring_buflen, PROT_READ|PROT_WRITE,
-                MAP_SHARED, ptv->socket, 0);
-        if (ptv->ring_buf == MAP_FAILED) {
-            SCLogError(SC_ERR_MEM_ALLOC, "Unable to mmap");
+        } else
+#endif
+        if (AFPSetupRing(ptv, devname) != 0) {
             goto socket_err;
         }
-        /* allocate a ring for each frame header pointer*/
-        ptv->frame_buf = SCMalloc(ptv->req.tp_frame_nr * sizeof (union thdr *));
-        if (ptv->frame_buf == NULL) {
-            SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate frame buf");
-            goto mmap_err;
-        }
-        memset(ptv->frame_buf, 0, ptv->req.tp_frame_nr * sizeof (union thdr *));
-        /* fill the header ring with proper frame ptr*/
-        ptv->frame_offset = 0;
-        for (i = 0; i < ptv->req.tp_block_nr; ++i) {
-            void *base = &ptv->ring_buf[i * ptv->req.tp_block_size];
-            unsigned int j;
-            for (j = 0; j < ptv->req.tp_block_size / ptv->req.tp_frame_size; ++j, ++ptv->frame_offset) {
-                (((union thdr **)ptv->frame_buf)[ptv->frame_offset]) = base;
-                base += ptv->req.tp_frame_size;
-            }
-        }
-        ptv->frame_offset = 0;
     }
 
     SCLogInfo("Using interface '%s' via socket %d", (char *)devname, ptv->socket);
@@ -1593,7 +2008,6 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
 frame_err:
     if (ptv->frame_buf)
         SCFree(ptv->frame_buf);
-mmap_err:
     /* Packet mmap does the cleaning when socket is closed */
 socket_err:
     close(ptv->socket);
@@ -1689,6 +2103,10 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data) {
 
     ptv->buffer_size = afpconfig->buffer_size;
     ptv->ring_size = afpconfig->ring_size;
+#ifdef HAVE_TPACKET_V3
+    ptv->block_size = afpconfig->block_size;
+    ptv->block_timeout = afpconfig->block_timeout;
+#endif
 
     ptv->promisc = afpconfig->promisc;
     ptv->checksum_mode = afpconfig->checksum_mode;
@@ -1721,6 +2139,28 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data) {
             SC_PERF_TYPE_UINT64,
             "NULL");
 #endif
+#ifdef HAVE_TPACKET_V3
+    if (ptv->flags & AFP_TPACKET_V3) {
+        ptv->capture_blocks = SCPerfTVRegisterCounter("capture.afpv3_blocks",
+                ptv->tv,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+        ptv->capture_block_timeouts = SCPerfTVRegisterCounter("capture.afpv3_block_timeouts",
+                ptv->tv,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+        /* percentage of the block used when it was handed to us */
+        ptv->capture_block_fill = SCPerfTVRegisterAvgCounter("capture.afpv3_block_fill",
+                ptv->tv,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+        /* usec between the first packet of a block and us reading it */
+        ptv->capture_block_latency = SCPerfTVRegisterAvgCounter("capture.afpv3_block_latency",
+                ptv->tv,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+    }
+#endif
 
     char *active_runmode = RunmodeGetActive();
 
@@ -1825,6 +2265,13 @@ TmEcode ReceiveAFPThreadDeinit(ThreadVars *tv, void *data) {
     }
     ptv->datalen = 0;
 
+#ifdef HAVE_TPACKET_V3
+    if (ptv->blocks != NULL) {
+        SCFree(ptv->blocks);
+        ptv->blocks = NULL;
+    }
+#endif
+
     ptv->bpf_filter = NULL;
 
     SCReturnInt(TM_ECODE_OK);
@@ -1923,6 +2370,128 @@ TmEcode DecodeAFPThreadDeinit(ThreadVars *tv, void *data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+#ifdef UNITTESTS
+#ifdef HAVE_TPACKET_V3
+/** \test v3 ring layout: whole blocks of frames covering the ring size */
+static int AFPComputeRingParamsV3Test01(void)
+{
+    AFPThreadVars ptv;
+    int result = 0;
+
+    memset(&ptv, 0, sizeof(ptv));
+    ptv.block_size = AFP_BLOCK_SIZE_DEFAULT;
+    ptv.block_timeout = AFP_BLOCK_TIMEOUT_DEFAULT;
+    ptv.ring_size = 2048;
+
+    if (AFPComputeRingParamsV3(&ptv) != 1)
+        goto end;
+
+    unsigned int frames_per_block = ptv.req3.tp_block_size / ptv.req3.tp_frame_size;
+    if (ptv.req3.tp_block_size != AFP_BLOCK_SIZE_DEFAULT ||
+        ptv.req3.tp_frame_size == 0 || frames_per_block == 0 ||
+        ptv.req3.tp_frame_size % TPACKET_ALIGNMENT != 0 ||
+        ptv.req3.tp_frame_size < (unsigned int)default_packet_size) {
+        printf("bad block/frame size %u/%u: ", ptv.req3.tp_block_size,
+               ptv.req3.tp_frame_size);
+        goto end;
+    }
+    if (ptv.req3.tp_frame_nr != ptv.req3.tp_block_nr * frames_per_block ||
+        ptv.req3.tp_frame_nr < (unsigned int)ptv.ring_size ||
+        ptv.req3.tp_block_nr != ptv.ring_size / frames_per_block + 1) {
+        printf("bad block/frame nr %u/%u: ", ptv.req3.tp_block_nr,
+               ptv.req3.tp_frame_nr);
+        goto end;
+    }
+    if (ptv.req3.tp_retire_blk_tov != AFP_BLOCK_TIMEOUT_DEFAULT)
+        goto end;
+
+    result = 1;
+end:
+    return result;
+}
+
+/** \test a block smaller than a frame is grown to the next power of two */
+static int AFPComputeRingParamsV3Test02(void)
+{
+    AFPThreadVars ptv;
+    int result = 0;
+
+    memset(&ptv, 0, sizeof(ptv));
+    ptv.block_size = 1024;
+    ptv.block_timeout = 0;
+    ptv.ring_size = 10;
+
+    if (AFPComputeRingParamsV3(&ptv) != 1)
+        goto end;
+    if (ptv.req3.tp_block_size < ptv.req3.tp_frame_size ||
+        ptv.req3.tp_block_size / 2 >= ptv.req3.tp_frame_size ||
+        (ptv.req3.tp_block_size & (ptv.req3.tp_block_size - 1)) != 0) {
+        printf("block size %u for frame size %u: ", ptv.req3.tp_block_size,
+               ptv.req3.tp_frame_size);
+        goto end;
+    }
+    if (ptv.req3.tp_frame_nr < 10 || ptv.req3.tp_retire_blk_tov != 0)
+        goto end;
+
+    result = 1;
+end:
+    return result;
+}
+
+/** \test invalid block settings are refused instead of looping */
+static int AFPComputeRingParamsV3Test03(void)
+{
+    AFPThreadVars ptv;
+
+    memset(&ptv, 0, sizeof(ptv));
+    ptv.ring_size = 10;
+    ptv.block_timeout = AFP_BLOCK_TIMEOUT_DEFAULT;
+    if (AFPComputeRingParamsV3(&ptv) != -1)
+        return 0;
+    ptv.block_size = -4096;
+    if (AFPComputeRingParamsV3(&ptv) != -1)
+        return 0;
+    ptv.block_size = AFP_BLOCK_SIZE_DEFAULT;
+    ptv.block_timeout = -1;
+    if (AFPComputeRingParamsV3(&ptv) != -1)
+        return 0;
+    return 1;
+}
+
+/** \test the busy block wait doubles up to its maximum */
+static int AFPBlockBusyWaitTest01(void)
+{
+    AFPThreadVars ptv;
+    int i;
+
+    memset(&ptv, 0, sizeof(ptv));
+    AFPBlockBusyWait(&ptv);
+    if (ptv.block_busy_wait != AFP_BLOCK_BUSY_WAIT_MIN)
+        return 0;
+    AFPBlockBusyWait(&ptv);
+    if (ptv.block_busy_wait != AFP_BLOCK_BUSY_WAIT_MIN * 2)
+        return 0;
+    for (i = 0; i < 16; i++)
+        AFPBlockBusyWait(&ptv);
+    if (ptv.block_busy_wait != AFP_BLOCK_BUSY_WAIT_MAX)
+        return 0;
+    return 1;
+}
+#endif /* HAVE_TPACKET_V3 */
+#endif /* UNITTESTS */
+
+static void AFPRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef HAVE_TPACKET_V3
+    UtRegisterTest("AFPComputeRingParamsV3Test01", AFPComputeRingParamsV3Test01, 1);
+    UtRegisterTest("AFPComputeRingParamsV3Test02", AFPComputeRingParamsV3Test02, 1);
+    UtRegisterTest("AFPComputeRingParamsV3Test03", AFPComputeRingParamsV3Test03, 1);
+    UtRegisterTest("AFPBlockBusyWaitTest01", AFPBlockBusyWaitTest01, 1);
+#endif /* HAVE_TPACKET_V3 */
+#endif /* UNITTESTS */
+}
+
 #endif /* HAVE_AF_PACKET */
 /* eof */
 /**
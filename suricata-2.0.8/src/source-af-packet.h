@@ -38,17 +38,33 @@
 #endif /* HAVE_PACKET_FANOUT */
 #include "queue.h"
 
+#if defined(HAVE_AF_PACKET) && HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+/* TPACKET_V3 is an enum, its header length macro came with it */
+#ifdef TPACKET3_HDRLEN
+#define HAVE_TPACKET_V3 1
+#endif
+#endif
+
 /* value for flags */
 #define AFP_RING_MODE (1<<0)
 #define AFP_ZERO_COPY (1<<1)
 #define AFP_SOCK_PROTECT (1<<2)
 #define AFP_EMERGENCY_MODE (1<<3)
+#define AFP_TPACKET_V3 (1<<4)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
 #define AFP_COPY_MODE_IPS   2
 
 #define AFP_FILE_MAX_PKTS 256
+
+/* tpacket-v3 block size in bytes and retire timeout in ms */
+#define AFP_BLOCK_SIZE_DEFAULT 32768
+#define AFP_BLOCK_TIMEOUT_DEFAULT 10
+/* usecs to wait for the packets of a busy block */
+#define AFP_BLOCK_BUSY_WAIT_MIN 16
+#define AFP_BLOCK_BUSY_WAIT_MAX 1024
 #define AFP_IFACE_NAME_LENGTH 48
 
 typedef struct AFPIfaceConfig_
@@ -60,6 +76,9 @@ typedef struct AFPIfaceConfig_
     int buffer_size;
     /* ring size in number of packets */
     int ring_size;
+    /* tpacket-v3 block size and timeout */
+    int block_size;
+    int block_timeout;
     /* cluster param */
     int cluster_id;
     int cluster_type;
@@ -102,6 +121,8 @@ typedef struct AFPPeer_ {
 typedef struct AFPPacketVars_
 {
     void *relptr;
+    /** tpacket-v3 block the packet data lives in */
+    void *relblk;
     int copy_mode;
     AFPPeer *peer; /**< Sending peer for IPS/TAP mode */
     /** Pointer to ::AFPPeer used for capture. Field is used to be able
@@ -112,6 +133,7 @@ typedef struct AFPPacketVars_
 
 #define AFPV_CLEANUP(afpv) do {           \
     (afpv)->relptr = NULL;                \
+    (afpv)->relblk = NULL;                \
     (afpv)->copy_mode = 0;                \
     (afpv)->peer = NULL;                  \
     (afpv)->mpeer = NULL;                 \
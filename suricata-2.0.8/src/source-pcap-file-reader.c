@@ -0,0 +1,973 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Native pcap and pcapng file reader.
+ *
+ * Plain files are memory mapped and the packets point into the mapping,
+ * so they are not copied. The part of the mapping that was read long ago
+ * is given back to the kernel as we go, so even very large files don't
+ * pile up in memory. Files that can't be mapped and gzip compressed files
+ * are read into a large buffer, decompressing on the way, and the packets
+ * are copied out of that buffer.
+ */
+
+#include "suricata-common.h"
+#include "source-pcap-file-reader.h"
+
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-fmemopen.h"
+#include "util-unittest.h"
+
+#include <sys/mman.h>
+
+/** pcap magic as read on a host of the same byte order */
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_HEADER_LEN         24
+#define PCAP_REC_HEADER_LEN     16
+
+#define PCAPNG_BT_SHB           0x0A0D0D0A
+#define PCAPNG_BT_IDB           0x00000001
+#define PCAPNG_BT_OPB           0x00000002
+#define PCAPNG_BT_SPB           0x00000003
+#define PCAPNG_BT_EPB           0x00000006
+#define PCAPNG_BOM              0x1A2B3C4D
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+/** raw ip as stored in files, libpcap reports it as DLT_RAW */
+#define PCAP_LINKTYPE_RAW       101
+
+/** give the mapping back in steps of this size */
+#define PCAP_FILE_READER_RELEASE_SIZE   (64 * 1024 * 1024)
+
+extern int max_pending_packets;
+
+static inline uint16_t ReaderU16(const PcapFileReader *r, const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? SCByteSwap16(v) : v;
+}
+
+static inline uint32_t ReaderU32(const PcapFileReader *r, const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? SCByteSwap32(v) : v;
+}
+
+static void ReaderSetError(PcapFileReader *r, const char *msg)
+{
+    strlcpy(r->errbuf, msg, sizeof(r->errbuf));
+    r->error = 1;
+}
+
+/** \internal
+ *  \brief fill the read buffer from the file, decompressing if needed
+ *  \retval bytes added to the buffer, 0 at the end of the file */
+static uint32_t ReaderFill(PcapFileReader *r)
+{
+    uint8_t *out = r->buf + r->buf_len;
+    uint32_t space = PCAP_FILE_READER_BUF_SIZE - r->buf_len;
+
+#ifdef HAVE_LIBZ
+    if (r->zs != NULL) {
+        z_stream *zs = r->zs;
+        zs->next_out = out;
+        zs->avail_out = space;
+
+        while (zs->avail_out > 0) {
+            if (zs->avail_in == 0) {
+                size_t n = fread(r->zbuf, 1, PCAP_FILE_READER_BUF_SIZE / 4, r->fp);
+                if (n == 0)
+                    break;
+                zs->next_in = r->zbuf;
+                zs->avail_in = (uInt)n;
+            }
+
+            int ret = inflate(zs, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                /* gzip files may hold several members */
+                if (zs->avail_in == 0 && feof(r->fp))
+                    break;
+                if (inflateReset(zs) != Z_OK)
+                    break;
+            } else if (ret != Z_OK) {
+                SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcap file decompression "
+                        "error %d, ignoring the rest of the file", ret);
+                break;
+            }
+        }
+        r->buf_len += space - zs->avail_out;
+        return space - zs->avail_out;
+    }
+#endif
+
+    size_t n = fread(out, 1, space, r->fp);
+    r->buf_len += (uint32_t)n;
+    return (uint32_t)n;
+}
+
+/** \internal
+ *  \brief get the next len bytes of the file without consuming them
+ *
+ *  For a read file the pointer is only valid until the next call.
+ *
+ *  \retval ptr or NULL if the file has less than len bytes left
+ */
+static const uint8_t *ReaderPeek(PcapFileReader *r, uint32_t len)
+{
+    if (r->map != NULL) {
+        if (r->map_size - r->map_off < len)
+            return NULL;
+        return r->map + r->map_off;
+    }
+
+    if (len > PCAP_FILE_READER_BUF_SIZE)
+        return NULL;
+
+    while (r->buf_len - r->buf_off < len) {
+        if (r->eof)
+            return NULL;
+
+        if (r->buf_off > 0) {
+            memmove(r->buf, r->buf + r->buf_off, r->buf_len - r->buf_off);
+            r->buf_len -= r->buf_off;
+            r->buf_off = 0;
+        }
+        if (ReaderFill(r) == 0)
+            r->eof = 1;
+    }
+    return r->buf + r->buf_off;
+}
+
+static void ReaderSkip(PcapFileReader *r, uint32_t len)
+{
+    if (r->map == NULL) {
+        r->buf_off += len;
+        return;
+    }
+
+    r->map_off += len;
+
+    if (r->map_owned &&
+            r->map_off - r->map_released >= r->map_keep + PCAP_FILE_READER_RELEASE_SIZE) {
+        /* clean pages of a private file mapping are read from the file
+         * again if they are touched after this */
+        (void)madvise(r->map + r->map_released,
+                PCAP_FILE_READER_RELEASE_SIZE, MADV_DONTNEED);
+        r->map_released += PCAP_FILE_READER_RELEASE_SIZE;
+    }
+}
+
+/** \internal
+ *  \brief set the timestamp from a number of time units
+ *  \param ups time units per second */
+static void ReaderSetTime(struct timeval *ts, uint64_t t, uint64_t ups)
+{
+    uint64_t frac = t % ups;
+
+    ts->tv_sec = (time_t)(t / ups);
+    if (ups <= 1000000)
+        ts->tv_usec = (suseconds_t)(frac * 1000000 / ups);
+    else
+        ts->tv_usec = (suseconds_t)(frac / (ups / 1000000));
+}
+
+static int ReaderDatalink(uint32_t linktype)
+{
+    if (linktype == PCAP_LINKTYPE_RAW)
+        return DLT_RAW;
+    return (int)linktype;
+}
+
+static int PcapReadHeader(PcapFileReader *r)
+{
+    const uint8_t *hdr = ReaderPeek(r, PCAP_HEADER_LEN);
+    if (hdr == NULL) {
+        ReaderSetError(r, "pcap file header truncated");
+        return -1;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, hdr, sizeof(magic));
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        r->swapped = 0;
+    } else if (magic == SCByteSwap32(PCAP_MAGIC_USEC) ||
+               magic == SCByteSwap32(PCAP_MAGIC_NSEC)) {
+        r->swapped = 1;
+        magic = SCByteSwap32(magic);
+    }
+    r->nsec = (magic == PCAP_MAGIC_NSEC);
+
+    r->snaplen = ReaderU32(r, hdr + 16);
+    r->datalink = ReaderDatalink(ReaderU32(r, hdr + 20) & 0x0fffffff);
+    r->format = PCAP_FILE_FORMAT_PCAP;
+
+    ReaderSkip(r, PCAP_HEADER_LEN);
+    return 0;
+}
+
+static int PcapReadPacket(PcapFileReader *r, struct pcap_pkthdr *h,
+                          const uint8_t **data)
+{
+    const uint8_t *rec = ReaderPeek(r, PCAP_REC_HEADER_LEN);
+    if (rec == NULL)
+        return 0;
+
+    uint32_t sec = ReaderU32(r, rec);
+    uint32_t frac = ReaderU32(r, rec + 4);
+    h->caplen = ReaderU32(r, rec + 8);
+    h->len = ReaderU32(r, rec + 12);
+    h->ts.tv_sec = sec;
+    h->ts.tv_usec = r->nsec ? frac / 1000 : frac;
+
+    if (h->caplen > PCAP_FILE_READER_MAX_CAPLEN) {
+        ReaderSetError(r, "pcap file record too large, file corrupt?");
+        return -1;
+    }
+    ReaderSkip(r, PCAP_REC_HEADER_LEN);
+
+    *data = ReaderPeek(r, h->caplen);
+    if (*data == NULL) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcap file ends with a "
+                "truncated packet");
+        return 0;
+    }
+    ReaderSkip(r, h->caplen);
+    return 1;
+}
+
+/** \internal
+ *  \brief handle a pcapng interface description block */
+static int PcapNgReadIdb(PcapFileReader *r, const uint8_t *b, uint32_t blen)
+{
+    if (blen < 20) {
+        ReaderSetError(r, "pcapng interface block too short");
+        return -1;
+    }
+
+    /* the link type is fixed by the first interface of the file, later
+     * sections may not change it as the decoder is already chosen */
+    int datalink = ReaderDatalink(ReaderU16(r, b + 8));
+    if (r->datalink_set && datalink != r->datalink) {
+        ReaderSetError(r, "pcapng interfaces of different link types are "
+                "not supported");
+        return -1;
+    }
+    r->datalink = datalink;
+    r->datalink_set = 1;
+    r->snaplen = ReaderU32(r, b + 12);
+
+    uint64_t ups = 1000000;
+    uint32_t off = 16;
+    while (off + 4 <= blen - 4) {
+        uint16_t code = ReaderU16(r, b + off);
+        uint16_t olen = ReaderU16(r, b + off + 2);
+        if (code == 0 || off + 4 + olen > blen - 4)
+            break;
+        if (code == PCAPNG_OPT_IF_TSRESOL && olen >= 1) {
+            uint8_t res = b[off + 4];
+            if (res & 0x80) {
+                ups = 1ULL << ((res & 0x7f) > 63 ? 63 : (res & 0x7f));
+            } else {
+                ups = 1;
+                while (res-- > 0 && ups < 10000000000000000000ULL)
+                    ups *= 10;
+            }
+        }
+        off += 4 + ((olen + 3) & ~3);
+    }
+
+    uint64_t *ptmp = SCRealloc(r->ifaces, (r->ifaces_cnt + 1) * sizeof(uint64_t));
+    if (ptmp == NULL) {
+        ReaderSetError(r, "out of memory");
+        return -1;
+    }
+    r->ifaces = ptmp;
+    r->ifaces[r->ifaces_cnt++] = ups;
+    return 0;
+}
+
+/** \internal
+ *  \brief read pcapng blocks up to the next packet
+ *  \param stop_at_idb return 2 after the first interface block, used to
+ *         learn the link type before any packets are read */
+static int PcapNgReadBlock(PcapFileReader *r, struct pcap_pkthdr *h,
+                           const uint8_t **data, int stop_at_idb)
+{
+    while (1) {
+        const uint8_t *b = ReaderPeek(r, 12);
+        if (b == NULL)
+            return 0;
+
+        uint32_t type;
+        memcpy(&type, b, sizeof(type));
+        if (type == PCAPNG_BT_SHB) {
+            /* a new section may switch the byte order */
+            uint32_t bom;
+            memcpy(&bom, b + 8, sizeof(bom));
+            if (bom == PCAPNG_BOM) {
+                r->swapped = 0;
+            } else if (bom == SCByteSwap32(PCAPNG_BOM)) {
+                r->swapped = 1;
+            } else {
+                ReaderSetError(r, "pcapng section header corrupt");
+                return -1;
+            }
+            r->ifaces_cnt = 0;
+        }
+        type = ReaderU32(r, b);
+        uint32_t blen = ReaderU32(r, b + 4);
+        if (blen < 12 || (blen & 3) ||
+                blen > PCAP_FILE_READER_MAX_CAPLEN + 1024) {
+            ReaderSetError(r, "pcapng block length invalid, file corrupt?");
+            return -1;
+        }
+
+        b = ReaderPeek(r, blen);
+        if (b == NULL) {
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcapng file ends with a "
+                    "truncated block");
+            return 0;
+        }
+
+        uint32_t iface = 0;
+        uint32_t hdr_len = 0;
+        uint64_t t = 0;
+        int have_ts = 1;
+
+        switch (type) {
+            case PCAPNG_BT_IDB:
+                if (PcapNgReadIdb(r, b, blen) < 0)
+                    return -1;
+                ReaderSkip(r, blen);
+                if (stop_at_idb)
+                    return 2;
+                continue;
+            case PCAPNG_BT_EPB:
+                if (blen < 32)
+                    goto corrupt;
+                iface = ReaderU32(r, b + 8);
+                t = ((uint64_t)ReaderU32(r, b + 12) << 32) | ReaderU32(r, b + 16);
+                h->caplen = ReaderU32(r, b + 20);
+                h->len = ReaderU32(r, b + 24);
+                hdr_len = 28;
+                break;
+            case PCAPNG_BT_OPB:
+                if (blen < 32)
+                    goto corrupt;
+                iface = ReaderU16(r, b + 8);
+                t = ((uint64_t)ReaderU32(r, b + 12) << 32) | ReaderU32(r, b + 16);
+                h->caplen = ReaderU32(r, b + 20);
+                h->len = ReaderU32(r, b + 24);
+                hdr_len = 28;
+                break;
+            case PCAPNG_BT_SPB:
+                if (blen < 16)
+                    goto corrupt;
+                h->len = ReaderU32(r, b + 8);
+                h->caplen = h->len < blen - 16 ? h->len : blen - 16;
+                hdr_len = 12;
+                have_ts = 0;
+                break;
+            default:
+                ReaderSkip(r, blen);
+                continue;
+        }
+
+        if (stop_at_idb || iface >= r->ifaces_cnt) {
+            ReaderSetError(r, "pcapng packet for an unknown interface");
+            return -1;
+        }
+        /* blen is at least hdr_len + 4 here */
+        if (h->caplen > PCAP_FILE_READER_MAX_CAPLEN ||
+                h->caplen > blen - hdr_len - 4)
+            goto corrupt;
+
+        if (have_ts) {
+            ReaderSetTime(&h->ts, t, r->ifaces[iface]);
+            r->last_ts = h->ts;
+        } else {
+            /* simple packet blocks have no timestamp */
+            h->ts = r->last_ts;
+        }
+
+        *data = b + hdr_len;
+        ReaderSkip(r, blen);
+        return 1;
+    }
+
+corrupt:
+    ReaderSetError(r, "pcapng packet block corrupt");
+    return -1;
+}
+
+static int ReaderReadHeader(PcapFileReader *r)
+{
+    const uint8_t *b = ReaderPeek(r, 4);
+    if (b == NULL) {
+        ReaderSetError(r, "file too short for a pcap file");
+        return -1;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, b, sizeof(magic));
+    if (magic == PCAPNG_BT_SHB) {
+        struct pcap_pkthdr h;
+        const uint8_t *data;
+
+        r->format = PCAP_FILE_FORMAT_PCAPNG;
+        if (PcapNgReadBlock(r, &h, &data, 1) != 2) {
+            if (!r->error)
+                ReaderSetError(r, "pcapng file without interfaces");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+            magic == SCByteSwap32(PCAP_MAGIC_USEC) ||
+            magic == SCByteSwap32(PCAP_MAGIC_NSEC)) {
+        return PcapReadHeader(r);
+    }
+
+    ReaderSetError(r, "unknown file format");
+    return -1;
+}
+
+/** \internal
+ *  \brief set up a reader on a read stream */
+static int ReaderInitStream(PcapFileReader *r, FILE *fp, int gzip)
+{
+    r->fp = fp;
+    r->buf = SCMalloc(PCAP_FILE_READER_BUF_SIZE);
+    if (r->buf == NULL) {
+        ReaderSetError(r, "out of memory");
+        return -1;
+    }
+
+    if (gzip) {
+#ifdef HAVE_LIBZ
+        r->zs = SCMalloc(sizeof(z_stream));
+        r->zbuf = SCMalloc(PCAP_FILE_READER_BUF_SIZE / 4);
+        if (r->zs == NULL || r->zbuf == NULL) {
+            ReaderSetError(r, "out of memory");
+            return -1;
+        }
+        memset(r->zs, 0x00, sizeof(z_stream));
+        /* 32: detect the gzip or zlib header */
+        if (inflateInit2(r->zs, 15 + 32) != Z_OK) {
+            SCFree(r->zs);
+            r->zs = NULL;
+            ReaderSetError(r, "zlib init failed");
+            return -1;
+        }
+#else
+        ReaderSetError(r, "compressed pcap files need zlib support");
+        return -1;
+#endif
+    }
+    return 0;
+}
+
+/**
+ * \brief open a pcap or pcapng file, possibly gzip compressed
+ *
+ * \param errbuf set to the reason if the file can't be read. The caller
+ *        may still try it with libpcap.
+ *
+ * \retval reader or NULL
+ */
+PcapFileReader *PcapFileReaderOpen(const char *path, char *errbuf, size_t errbuf_size)
+{
+    struct stat st;
+    uint8_t magic[2] = { 0, 0 };
+
+    PcapFileReader *r = SCMalloc(sizeof(PcapFileReader));
+    if (unlikely(r == NULL)) {
+        strlcpy(errbuf, "out of memory", errbuf_size);
+        return NULL;
+    }
+    memset(r, 0x00, sizeof(PcapFileReader));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "%s", strerror(errno));
+        goto error;
+    }
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+        ReaderSetError(r, "file too short for a pcap file");
+        goto error;
+    }
+
+    int gzip = (magic[0] == 0x1f && magic[1] == 0x8b);
+    if (!gzip && S_ISREG(st.st_mode) && (uint64_t)st.st_size == (size_t)st.st_size) {
+        /* private and writable, so the engine may change packet data */
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            r->map = map;
+            r->map_size = (uint64_t)st.st_size;
+            r->map_owned = 1;
+            /* packets still in the engine point into the mapping, keep
+             * enough of it for all of them */
+            r->map_keep = (uint64_t)max_pending_packets *
+                (PCAP_FILE_READER_MAX_CAPLEN + 64);
+            if (r->map_keep < PCAP_FILE_READER_RELEASE_SIZE)
+                r->map_keep = PCAP_FILE_READER_RELEASE_SIZE;
+        } else {
+            SCLogDebug("mmap failed: %s", strerror(errno));
+        }
+    }
+
+    if (r->map == NULL) {
+        FILE *fp = fdopen(fd, "rb");
+        if (fp == NULL) {
+            snprintf(r->errbuf, sizeof(r->errbuf), "%s", strerror(errno));
+            goto error;
+        }
+        fd = -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+        (void)posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        if (ReaderInitStream(r, fp, gzip) < 0)
+            goto error;
+    } else {
+        close(fd);
+        fd = -1;
+    }
+
+    if (ReaderReadHeader(r) < 0)
+        goto error;
+
+    SCLogInfo("reading %s%s file %s (%s)",
+            r->format == PCAP_FILE_FORMAT_PCAPNG ? "pcapng" : "pcap",
+            gzip ? " (gzip)" : "", path,
+            r->map != NULL ? "memory mapped" : "buffered");
+    return r;
+
+error:
+    strlcpy(errbuf, r->errbuf, errbuf_size);
+    if (fd >= 0)
+        close(fd);
+    PcapFileReaderClose(r);
+    return NULL;
+}
+
+/**
+ * \brief get the next packet
+ *
+ * The data stays valid until the reader is closed if the file is mapped
+ * (PcapFileReaderZeroCopy), and until the next call otherwise.
+ *
+ * \retval 1 packet, 0 end of file, -1 error
+ */
+int PcapFileReaderNext(PcapFileReader *r, struct pcap_pkthdr *h,
+                       const uint8_t **data)
+{
+    if (r->error)
+        return -1;
+
+    if (r->format == PCAP_FILE_FORMAT_PCAPNG)
+        return PcapNgReadBlock(r, h, data, 0);
+    return PcapReadPacket(r, h, data);
+}
+
+void PcapFileReaderClose(PcapFileReader *r)
+{
+    if (r == NULL)
+        return;
+
+    if (r->map != NULL && r->map_owned)
+        munmap(r->map, (size_t)r->map_size);
+    if (r->fp != NULL)
+        fclose(r->fp);
+    if (r->buf != NULL)
+        SCFree(r->buf);
+#ifdef HAVE_LIBZ
+    if (r->zs != NULL) {
+        inflateEnd(r->zs);
+        SCFree(r->zs);
+    }
+    if (r->zbuf != NULL)
+        SCFree(r->zbuf);
+#endif
+    if (r->ifaces != NULL)
+        SCFree(r->ifaces);
+    SCFree(r);
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief reader on a buffer, like a mapped file */
+static PcapFileReader *ReaderOpenBuffer(uint8_t *buf, uint32_t len)
+{
+    PcapFileReader *r = SCMalloc(sizeof(PcapFileReader));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0x00, sizeof(PcapFileReader));
+    r->map = buf;
+    r->map_size = len;
+
+    if (ReaderReadHeader(r) < 0) {
+        PcapFileReaderClose(r);
+        return NULL;
+    }
+    return r;
+}
+
+/** \test pcap, swapped byte order and nanosecond timestamps, with a
+ *        truncated last record */
+static int PcapFileReaderTest01(void)
+{
+    uint8_t buf[] = {
+        0xa1, 0xb2, 0x3c, 0x4d, 0x00, 0x02, 0x00, 0x04,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0xff, 0xff, 0x00, 0x00, 0x00, 0x65,
+        /* 1.5s, 4 of 60 bytes */
+        0x00, 0x00, 0x00, 0x01, 0x1d, 0xcd, 0x65, 0x00,
+        0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x3c,
+        0x45, 0x00, 0x00, 0x3c,
+        /* truncated */
+        0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x3c,
+        0x45, 0x00 };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int result = 0;
+
+    PcapFileReader *r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+
+    if (r->format != PCAP_FILE_FORMAT_PCAP || r->datalink != DLT_RAW ||
+            r->snaplen != 65535)
+        goto end;
+
+    if (PcapFileReaderNext(r, &h, &data) != 1 || h.ts.tv_sec != 1 ||
+            h.ts.tv_usec != 500000 || h.caplen != 4 || h.len != 60 ||
+            data != buf + 40)
+        goto end;
+    if (PcapFileReaderNext(r, &h, &data) != 0)
+        goto end;
+
+    result = 1;
+end:
+    PcapFileReaderClose(r);
+    return result;
+}
+
+/** \test pcapng with an interface using 1/1000s timestamps and an
+ *        unknown block between the packets */
+static int PcapFileReaderTest02(void)
+{
+    uint8_t buf[] = {
+        /* shb */
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        /* idb, ethernet, if_tsresol 3 */
+        0x01, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+        0x09, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        /* epb, 2500ms, 3 bytes */
+        0x06, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xc4, 0x09, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x00, 0xaa, 0xbb, 0xcc, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+        /* unknown block */
+        0x99, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+        /* spb, 2 bytes */
+        0x03, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00,
+        0x02, 0x00, 0x00, 0x00, 0xdd, 0xee, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00 };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int result = 0;
+
+    PcapFileReader *r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+
+    if (r->format != PCAP_FILE_FORMAT_PCAPNG || r->datalink != 1 ||
+            r->ifaces_cnt != 1 || r->ifaces[0] != 1000)
+        goto end;
+
+    if (PcapFileReaderNext(r, &h, &data) != 1 || h.ts.tv_sec != 2 ||
+            h.ts.tv_usec != 500000 || h.caplen != 3 || data[0] != 0xaa)
+        goto end;
+    if (PcapFileReaderNext(r, &h, &data) != 1 || h.ts.tv_sec != 2 ||
+            h.caplen != 2 || h.len != 2 || data[1] != 0xee)
+        goto end;
+    if (PcapFileReaderNext(r, &h, &data) != 0)
+        goto end;
+
+    result = 1;
+end:
+    PcapFileReaderClose(r);
+    return result;
+}
+
+/** \test a packet of a pcapng interface that wasn't described */
+static int PcapFileReaderTest03(void)
+{
+    uint8_t buf[] = {
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+        /* epb on interface 1 */
+        0x06, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00 };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int result = 0;
+
+    PcapFileReader *r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+
+    if (PcapFileReaderNext(r, &h, &data) != -1 || !r->error)
+        goto end;
+    /* and stays in error */
+    if (PcapFileReaderNext(r, &h, &data) != -1)
+        goto end;
+
+    result = 1;
+end:
+    PcapFileReaderClose(r);
+    return result;
+}
+
+/** \test packet block with a captured length that doesn't fit the
+ *        block, on the mapped path where nothing else checks it */
+static int PcapFileReaderTest04(void)
+{
+    uint8_t buf[] = {
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+        /* epb, caplen 0xffffffe4 wraps hdr_len + caplen + 4 to 0 */
+        0x06, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0xe4, 0xff, 0xff, 0xff,
+        0x3c, 0x00, 0x00, 0x00, 0xaa, 0xbb, 0xcc, 0xdd,
+        0x24, 0x00, 0x00, 0x00 };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int result = 0;
+
+    PcapFileReader *r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+
+    if (PcapFileReaderNext(r, &h, &data) != -1 || !r->error)
+        goto end;
+
+    /* caplen one larger than the block has room for */
+    buf[68] = 0x05;
+    buf[69] = buf[70] = buf[71] = 0x00;
+    PcapFileReaderClose(r);
+    r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+    if (PcapFileReaderNext(r, &h, &data) != -1)
+        goto end;
+
+    /* and one that fits */
+    buf[68] = 0x04;
+    PcapFileReaderClose(r);
+    r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+    if (PcapFileReaderNext(r, &h, &data) != 1 || h.caplen != 4 ||
+            data != buf + 76)
+        goto end;
+
+    result = 1;
+end:
+    PcapFileReaderClose(r);
+    return result;
+}
+
+/** \test a later section may not change the link type */
+static int PcapFileReaderTest05(void)
+{
+    uint8_t buf[] = {
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        /* idb, ethernet */
+        0x01, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+        /* second section, big endian */
+        0x0a, 0x0d, 0x0d, 0x0a, 0x00, 0x00, 0x00, 0x1c,
+        0x1a, 0x2b, 0x3c, 0x4d, 0x00, 0x01, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x00, 0x00, 0x00, 0x1c,
+        /* idb, linux sll */
+        0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x14,
+        0x00, 0x71, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x14 };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int result = 0;
+
+    PcapFileReader *r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+    if (r->datalink != 1)
+        goto end;
+
+    if (PcapFileReaderNext(r, &h, &data) != -1 || r->datalink != 1)
+        goto end;
+
+    /* the same link type is fine */
+    buf[85] = 0x01;
+    PcapFileReaderClose(r);
+    r = ReaderOpenBuffer(buf, sizeof(buf));
+    if (r == NULL)
+        return 0;
+    if (PcapFileReaderNext(r, &h, &data) != 0 || r->ifaces_cnt != 1)
+        goto end;
+
+    result = 1;
+end:
+    PcapFileReaderClose(r);
+    return result;
+}
+
+#ifdef HAVE_LIBZ
+/** \test gzip compressed pcap read through the buffer, in two gzip
+ *        members, with packets crossing buffer refills */
+static int PcapFileReaderTest06(void)
+{
+    uint32_t pkts = 3000, i;
+    uint32_t plain_len = PCAP_HEADER_LEN + pkts * (PCAP_REC_HEADER_LEN + 1000);
+    uint8_t *plain = SCMalloc(plain_len);
+    uint8_t *gz = SCMalloc(plain_len + 1024);
+    uLong gz_len = 0;
+    PcapFileReader *r = NULL;
+    FILE *fp = NULL;
+    int result = 0;
+
+    if (plain == NULL || gz == NULL)
+        goto end;
+
+    uint32_t hdr[6] = { PCAP_MAGIC_USEC, 0x00040002, 0, 0, 65535, 1 };
+    memcpy(plain, hdr, sizeof(hdr));
+    uint8_t *p = plain + PCAP_HEADER_LEN;
+    for (i = 0; i < pkts; i++) {
+        uint32_t rec[4] = { i, 0, 1000, 1000 };
+        memcpy(p, rec, sizeof(rec));
+        memset(p + sizeof(rec), (uint8_t)i, 1000);
+        p += sizeof(rec) + 1000;
+    }
+
+    /* compress the first and the second half as separate members */
+    uint32_t half = plain_len / 2;
+    for (i = 0; i < 2; i++) {
+        z_stream zs;
+        memset(&zs, 0x00, sizeof(zs));
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+            goto end;
+        zs.next_in = plain + (i ? half : 0);
+        zs.avail_in = i ? plain_len - half : half;
+        zs.next_out = gz + gz_len;
+        zs.avail_out = plain_len + 1024 - gz_len;
+        int ret = deflate(&zs, Z_FINISH);
+        gz_len += zs.total_out;
+        deflateEnd(&zs);
+        if (ret != Z_STREAM_END)
+            goto end;
+    }
+
+    fp = SCFmemopen(gz, gz_len, "rb");
+    if (fp == NULL)
+        goto end;
+    r = SCMalloc(sizeof(PcapFileReader));
+    if (r == NULL)
+        goto end;
+    memset(r, 0x00, sizeof(PcapFileReader));
+    if (ReaderInitStream(r, fp, 1) < 0)
+        goto end;
+    fp = NULL;
+    if (ReaderReadHeader(r) < 0 || r->datalink != 1)
+        goto end;
+
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    for (i = 0; i < pkts; i++) {
+        if (PcapFileReaderNext(r, &h, &data) != 1 ||
+                h.ts.tv_sec != (time_t)i || h.caplen != 1000 ||
+                data[0] != (uint8_t)i || data[999] != (uint8_t)i)
+            goto end;
+    }
+    if (PcapFileReaderNext(r, &h, &data) != 0)
+        goto end;
+
+    result = 1;
+end:
+    if (fp != NULL)
+        fclose(fp);
+    PcapFileReaderClose(r);
+    if (plain != NULL)
+        SCFree(plain);
+    if (gz != NULL)
+        SCFree(gz);
+    return result;
+}
+#endif /* HAVE_LIBZ */
+
+#endif /* UNITTESTS */
+
+void PcapFileReaderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileReaderTest01", PcapFileReaderTest01, 1);
+    UtRegisterTest("PcapFileReaderTest02", PcapFileReaderTest02, 1);
+    UtRegisterTest("PcapFileReaderTest03", PcapFileReaderTest03, 1);
+    UtRegisterTest("PcapFileReaderTest04", PcapFileReaderTest04, 1);
+    UtRegisterTest("PcapFileReaderTest05", PcapFileReaderTest05, 1);
+#ifdef HAVE_LIBZ
+    UtRegisterTest("PcapFileReaderTest06", PcapFileReaderTest06, 1);
+#endif
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,86 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Native pcap and pcapng file reader. See source-pcap-file-reader.c.
+ */
+
+#ifndef __SOURCE_PCAP_FILE_READER_H__
+#define __SOURCE_PCAP_FILE_READER_H__
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/** largest record we accept, same as libpcap */
+#define PCAP_FILE_READER_MAX_CAPLEN     262144
+/** buffer for files that are read instead of mapped */
+#define PCAP_FILE_READER_BUF_SIZE       (1024 * 1024)
+
+enum {
+    PCAP_FILE_FORMAT_PCAP = 1,
+    PCAP_FILE_FORMAT_PCAPNG,
+};
+
+typedef struct PcapFileReader_ {
+    /** memory mapped file, packets point into the mapping */
+    uint8_t *map;
+    uint64_t map_size;
+    uint64_t map_off;
+    uint64_t map_released;  /**< mapping up to here was given back */
+    uint64_t map_keep;      /**< bytes kept mapped behind the read position */
+    int map_owned;
+
+    /** read (and decompressed) file */
+    FILE *fp;
+    uint8_t *buf;
+    uint32_t buf_len;
+    uint32_t buf_off;
+#ifdef HAVE_LIBZ
+    z_stream *zs;
+    uint8_t *zbuf;
+#endif
+    int eof;
+    int error;
+
+    int format;
+    int swapped;
+    int nsec;
+    int datalink;
+    int datalink_set;
+    uint32_t snaplen;
+
+    /** pcapng: time units per second of each interface */
+    uint64_t *ifaces;
+    uint32_t ifaces_cnt;
+    struct timeval last_ts;
+
+    char errbuf[128];
+} PcapFileReader;
+
+PcapFileReader *PcapFileReaderOpen(const char *, char *, size_t);
+int PcapFileReaderNext(PcapFileReader *, struct pcap_pkthdr *, const uint8_t **);
+void PcapFileReaderClose(PcapFileReader *);
+
+/** packets point into the mapping, which stays valid until close */
+#define PcapFileReaderZeroCopy(r)   ((r)->map != NULL)
+
+void PcapFileReaderRegisterTests(void);
+
+#endif /* __SOURCE_PCAP_FILE_READER_H__ */
@@ -31,6 +31,7 @@
 #include "threadvars.h"
 #include "tm-queuehandlers.h"
 #include "source-pcap-file.h"
+#include "source-pcap-file-reader.h"
 #include "util-time.h"
 #include "util-debug.h"
 #include "conf.h"
@@ -44,6 +45,7 @@
 #include "runmode-unix-socket.h"
 #include "util-checksum.h"
 #include "util-atomic.h"
+#include "util-unittest.h"
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -61,8 +63,16 @@ extern int max_pending_packets;
 
 //static int pcap_max_read_packets = 0;
 
+/** a packet passed to the engine, by pcap_cnt */
+typedef struct PcapFileInflight_ {
+    struct timeval ts;
+    SC_ATOMIC_DECLARE(int, decoded);
+} PcapFileInflight;
+
 typedef struct PcapFileGlobalVars_ {
     pcap_t *pcap_handle;
+    /** native reader, NULL if the file is read by libpcap */
+    PcapFileReader *reader;
     int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, u_int8_t *, u_int16_t, PacketQueue *);
     int datalink;
     struct bpf_program filter;
@@ -71,6 +81,13 @@ typedef struct PcapFileGlobalVars_ {
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
 
+    /** Packets read but not decoded yet. The engine time is that of the
+     *  oldest of them, so in the workers runmode the reader doesn't move
+     *  the time past packets waiting for a worker, whose flows the flow
+     *  manager could time out otherwise. */
+    PcapFileInflight *inflight;
+    uint32_t inflight_size;         /**< power of 2 */
+    uint64_t inflight_oldest;       /**< pcap_cnt of the oldest entry */
 } PcapFileGlobalVars;
 
 /** max packets < 65536 */
@@ -103,6 +120,7 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *, void *);
 TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 TmEcode DecodePcapFileThreadInit(ThreadVars *, void *, void **);
 TmEcode DecodePcapFileThreadDeinit(ThreadVars *tv, void *data);
+static void PcapFileRegisterTests(void);
 
 void TmModuleReceivePcapFileRegister (void) {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
@@ -113,7 +131,7 @@ void TmModuleReceivePcapFileRegister (void) {
     tmm_modules[TMM_RECEIVEPCAPFILE].PktAcqLoop = ReceivePcapFileLoop;
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadExitPrintStats = ReceivePcapFileThreadExitStats;
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadDeinit = ReceivePcapFileThreadDeinit;
-    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = PcapFileReaderRegisterTests;
     tmm_modules[TMM_RECEIVEPCAPFILE].cap_flags = 0;
     tmm_modules[TMM_RECEIVEPCAPFILE].flags = TM_FLAG_RECEIVE_TM;
 }
@@ -124,7 +142,7 @@ void TmModuleDecodePcapFileRegister (void) {
     tmm_modules[TMM_DECODEPCAPFILE].Func = DecodePcapFile;
     tmm_modules[TMM_DECODEPCAPFILE].ThreadExitPrintStats = NULL;
     tmm_modules[TMM_DECODEPCAPFILE].ThreadDeinit = DecodePcapFileThreadDeinit;
-    tmm_modules[TMM_DECODEPCAPFILE].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEPCAPFILE].RegisterTests = PcapFileRegisterTests;
     tmm_modules[TMM_DECODEPCAPFILE].cap_flags = 0;
     tmm_modules[TMM_DECODEPCAPFILE].flags = TM_FLAG_DECODE_TM;
 }
@@ -134,11 +152,97 @@ void PcapFileGlobalInit()
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
 }
 
-void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
+double prev_signaled_ts = 0;
+
+static int PcapFileInflightSetup(void)
+{
+    uint32_t size = 64;
+    uint32_t u;
+
+    /* the reader passes at most a packet pool's worth of packets */
+    while (size < (uint32_t)max_pending_packets * 2)
+        size <<= 1;
+
+    pcap_g.inflight = SCMalloc(size * sizeof(PcapFileInflight));
+    if (unlikely(pcap_g.inflight == NULL))
+        return -1;
+    memset(pcap_g.inflight, 0, size * sizeof(PcapFileInflight));
+    for (u = 0; u < size; u++)
+        SC_ATOMIC_INIT(pcap_g.inflight[u].decoded);
+    pcap_g.inflight_size = size;
+    pcap_g.inflight_oldest = pcap_g.cnt + 1;
+    return 0;
+}
+
+static void PcapFileInflightFree(void)
+{
+    if (pcap_g.inflight != NULL) {
+        SCFree(pcap_g.inflight);
+        pcap_g.inflight = NULL;
+    }
+}
+
+static inline PcapFileInflight *PcapFileInflightGet(uint64_t pcap_cnt)
+{
+    return &pcap_g.inflight[pcap_cnt & (pcap_g.inflight_size - 1)];
+}
+
+/** \brief drop the decoded packets at the start of the inflight list
+ *  \retval 1 there are packets still to be decoded, ts is set to the
+ *            time of the oldest
+ *  \retval 0 all packets are decoded */
+static int PcapFileInflightOldest(struct timeval *ts)
+{
+    while (pcap_g.inflight_oldest <= pcap_g.cnt) {
+        PcapFileInflight *e = PcapFileInflightGet(pcap_g.inflight_oldest);
+        if (SC_ATOMIC_GET(e->decoded) == 0) {
+            *ts = e->ts;
+            return 1;
+        }
+        pcap_g.inflight_oldest++;
+    }
+    return 0;
+}
+
+/** \brief number the packet and add it, waiting for the workers if the
+ *         list is full, which the packet pool should prevent */
+static void PcapFileInflightAdd(Packet *p)
+{
+    struct timeval ts;
+
+    while (pcap_g.cnt + 1 - pcap_g.inflight_oldest >= pcap_g.inflight_size) {
+        (void)PcapFileInflightOldest(&ts);
+        if (pcap_g.cnt + 1 - pcap_g.inflight_oldest < pcap_g.inflight_size)
+            break;
+        if (suricata_ctl_flags & SURICATA_KILL)
+            break;
+        usleep(100);
+    }
+
+    p->pcap_cnt = ++pcap_g.cnt;
+    PcapFileInflight *e = PcapFileInflightGet(p->pcap_cnt);
+    e->ts = p->ts;
+    (void)SC_ATOMIC_SET(e->decoded, 0);
+}
+
+/** \brief called by the decoder thread once the packet has its flow */
+static inline void PcapFileInflightDone(const Packet *p)
+{
+    if (p->pcap_cnt != 0 && pcap_g.inflight != NULL)
+        (void)SC_ATOMIC_SET(PcapFileInflightGet(p->pcap_cnt)->decoded, 1);
+}
+
+/**
+ *  \brief pass a packet read from the file to the engine
+ *
+ *  \param zero_copy pkt stays valid while the file is open, so the packet
+ *         can point to it instead of getting a copy
+ */
+static void PcapFileProcessPacket(PcapFileThreadVars *ptv,
+        const struct pcap_pkthdr *h, uint8_t *pkt, int zero_copy)
 {
     SCEnter();
 
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)user;
     Packet *p = PacketGetFromQueueOrAlloc();
 
     if (unlikely(p == NULL)) {
@@ -151,16 +255,22 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
     p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
 
     ptv->pkts++;
     ptv->bytes += h->caplen;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (zero_copy) {
+        if (unlikely(PacketSetData(p, pkt, h->caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+            SCReturn;
+        }
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
     }
+    PcapFileInflightAdd(p);
 
     /* We only check for checksum disable */
     if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
@@ -173,16 +283,93 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
         }
     }
 
+    /* update the engine time representation based on the timestamp of
+     * the oldest packet not decoded yet. That is this packet if it's
+     * decoded by this thread, or one waiting for a worker. */
+    struct timeval ts = p->ts;
+    (void)PcapFileInflightOldest(&ts);
+    double curr_ts = ts.tv_sec + ts.tv_usec / 1000.0;
+    if (curr_ts < prev_signaled_ts || (curr_ts - prev_signaled_ts) > 60.0) {
+        prev_signaled_ts = curr_ts;
+        FlowWakeupFlowManagerThread();
+    }
+    TimeSet(&ts);
+
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
+        if (pcap_g.reader == NULL)
+            pcap_breakloop(pcap_g.pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
+{
+    PcapFileProcessPacket((PcapFileThreadVars *)user, h, pkt, 0);
+}
+
+/**
+ *  \brief read up to cnt packets, like pcap_dispatch
+ *
+ *  \retval packets read, 0 at the end of the file, -1 on error
+ */
+static int PcapFileDispatch(PcapFileThreadVars *ptv, int cnt)
+{
+    if (pcap_g.reader == NULL) {
+        return pcap_dispatch(pcap_g.pcap_handle, cnt,
+                (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+    }
+
+    struct pcap_pkthdr h;
+    const uint8_t *pkt;
+    int zero_copy = PcapFileReaderZeroCopy(pcap_g.reader);
+    int n = 0;
+
+    while (n < cnt) {
+        int r = PcapFileReaderNext(pcap_g.reader, &h, &pkt);
+        if (r <= 0) {
+            /* report the end or error on the next call */
+            if (n > 0)
+                break;
+            return r;
+        }
+
+        if (pcap_g.filter.bf_insns != NULL &&
+                bpf_filter(pcap_g.filter.bf_insns, pkt, h.len, h.caplen) == 0)
+            continue;
+
+        PcapFileProcessPacket(ptv, &h, (uint8_t *)pkt, zero_copy);
+        n++;
+        if (ptv->cb_result == TM_ECODE_FAILED)
+            break;
+    }
+    return n;
+}
+
+static char *PcapFileGetError(void)
+{
+    if (pcap_g.reader != NULL)
+        return pcap_g.reader->errbuf;
+    return pcap_geterr(pcap_g.pcap_handle);
+}
+
+/**
+ *  \brief close the file at the end of reading it
+ *
+ *  The native reader is closed with the thread, as the packets still in
+ *  the engine may point into it.
+ */
+static void PcapFileClose(void)
+{
+    if (pcap_g.pcap_handle != NULL) {
+        pcap_close(pcap_g.pcap_handle);
+        pcap_g.pcap_handle = NULL;
+    }
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -213,18 +400,16 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         } while (packet_q_len == 0);
 
         /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, (int)packet_q_len,
-                          (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        r = PcapFileDispatch(ptv, (int)packet_q_len);
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+                       r, PcapFileGetError());
             if (! RunModeUnixSocketIsActive()) {
                 /* in the error state we just kill the engine */
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose();
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -233,8 +418,7 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
             if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose();
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -245,8 +429,7 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose();
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -274,8 +457,24 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
     memset(ptv, 0, sizeof(PcapFileThreadVars));
 
     char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
+    int native = 1;
+    if (ConfGet("pcap-file.native-reader", &tmpstring) == 1)
+        native = ConfValIsTrue(tmpstring);
+    /* stdin is left to libpcap */
+    if (native && strcmp((char *)initdata, "-") != 0) {
+        pcap_g.reader = PcapFileReaderOpen((char *)initdata, errbuf, sizeof(errbuf));
+        if (pcap_g.reader == NULL) {
+            SCLogInfo("native reader can't read %s: %s, trying libpcap",
+                    (char *)initdata, errbuf);
+        } else {
+            /* for compiling the bpf */
+            pcap_g.pcap_handle = pcap_open_dead(pcap_g.reader->datalink,
+                    pcap_g.reader->snaplen ? (int)pcap_g.reader->snaplen : 65535);
+        }
+    }
+    if (pcap_g.reader == NULL)
+        pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
+    if (pcap_g.reader == NULL && pcap_g.pcap_handle == NULL) {
         SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
         SCFree(ptv);
         if (! RunModeUnixSocketIsActive()) {
@@ -291,20 +490,31 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
     } else {
         SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
 
+        if (pcap_g.pcap_handle == NULL) {
+            SCLogError(SC_ERR_BPF, "could not open pcap handle for the bpf");
+            SCFree(ptv);
+            return TM_ECODE_FAILED;
+        }
+
         if(pcap_compile(pcap_g.pcap_handle,&pcap_g.filter,tmpbpfstring,1,0) < 0) {
             SCLogError(SC_ERR_BPF,"bpf compilation error %s",pcap_geterr(pcap_g.pcap_handle));
             SCFree(ptv);
             return TM_ECODE_FAILED;
         }
 
-        if(pcap_setfilter(pcap_g.pcap_handle,&pcap_g.filter) < 0) {
+        /* the native reader runs the filter itself */
+        if (pcap_g.reader == NULL &&
+                pcap_setfilter(pcap_g.pcap_handle,&pcap_g.filter) < 0) {
             SCLogError(SC_ERR_BPF,"could not set bpf filter %s",pcap_geterr(pcap_g.pcap_handle));
             SCFree(ptv);
             return TM_ECODE_FAILED;
         }
     }
 
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
+    if (pcap_g.reader != NULL)
+        pcap_g.datalink = pcap_g.reader->datalink;
+    else
+        pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
     SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
 
     switch(pcap_g.datalink) {
@@ -328,8 +538,9 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
             if (! RunModeUnixSocketIsActive()) {
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose();
+                PcapFileReaderClose(pcap_g.reader);
+                pcap_g.reader = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -348,6 +559,11 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
     }
     pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
 
+    if (PcapFileInflightSetup() != 0) {
+        SCFree(ptv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
     ptv->tv = tv;
     *data = (void *)ptv;
     SCReturnInt(TM_ECODE_OK);
@@ -381,11 +597,14 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data) {
     if (ptv) {
         SCFree(ptv);
     }
+    if (pcap_g.reader != NULL) {
+        PcapFileReaderClose(pcap_g.reader);
+        pcap_g.reader = NULL;
+    }
+    PcapFileInflightFree();
     SCReturnInt(TM_ECODE_OK);
 }
 
-double prev_signaled_ts = 0;
-
 TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
     SCEnter();
@@ -409,16 +628,6 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
     SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
     SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
 
-    double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
-    if (curr_ts < prev_signaled_ts || (curr_ts - prev_signaled_ts) > 60.0) {
-        prev_signaled_ts = curr_ts;
-        FlowWakeupFlowManagerThread();
-    }
-
-    /* update the engine time representation based on the timestamp
-     * of the packet. */
-    TimeSet(&p->ts);
-
     /* call the decoder */
     pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
 
@@ -428,6 +637,8 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
 
     PacketDecodeFinalize(tv, dtv, p);
 
+    PcapFileInflightDone(p);
+
     SCReturnInt(TM_ECODE_OK);
 }
 
@@ -464,5 +675,92 @@ void PcapIncreaseInvalidChecksum()
     (void) SC_ATOMIC_ADD(pcap_g.invalid_checksums, 1);
 }
 
-/* eof */
+#ifdef UNITTESTS
+/** \test the engine time is that of the oldest packet not decoded yet,
+ *        as when workers decode the packets out of order */
+static int PcapFileInflightTest01(void)
+{
+    PcapFileGlobalVars save = pcap_g;
+    Packet *p[3] = { NULL, NULL, NULL };
+    struct timeval ts;
+    int result = 0;
+    int i;
+
+    pcap_g.cnt = 0;
+    if (PcapFileInflightSetup() != 0)
+        goto end;
+
+    for (i = 0; i < 3; i++) {
+        p[i] = PacketGetFromAlloc();
+        if (p[i] == NULL)
+            goto end;
+        p[i]->ts.tv_sec = 100 + i;
+        PcapFileInflightAdd(p[i]);
+    }
+    if (p[2]->pcap_cnt != 3)
+        goto end;
+
+    /* the second and the third are decoded, the first still waits */
+    PcapFileInflightDone(p[1]);
+    PcapFileInflightDone(p[2]);
+    if (PcapFileInflightOldest(&ts) != 1 || ts.tv_sec != 100)
+        goto end;
+
+    PcapFileInflightDone(p[0]);
+    if (PcapFileInflightOldest(&ts) != 0 || pcap_g.inflight_oldest != 4)
+        goto end;
+
+    result = 1;
+end:
+    for (i = 0; i < 3; i++) {
+        if (p[i] != NULL)
+            PacketFree(p[i]);
+    }
+    PcapFileInflightFree();
+    pcap_g = save;
+    return result;
+}
+
+/** \test the list is reused once packets are decoded */
+static int PcapFileInflightTest02(void)
+{
+    PcapFileGlobalVars save = pcap_g;
+    Packet *p = PacketGetFromAlloc();
+    struct timeval ts;
+    uint32_t u;
+    int result = 0;
+
+    if (p == NULL)
+        return 0;
+    pcap_g.cnt = 0;
+    if (PcapFileInflightSetup() != 0)
+        goto end;
+
+    for (u = 0; u < pcap_g.inflight_size * 3; u++) {
+        p->ts.tv_sec = u;
+        PcapFileInflightAdd(p);
+        if (PcapFileInflightOldest(&ts) != 1 || ts.tv_sec != (time_t)u)
+            goto end;
+        PcapFileInflightDone(p);
+    }
+    if (PcapFileInflightOldest(&ts) != 0)
+        goto end;
+
+    result = 1;
+end:
+    PacketFree(p);
+    PcapFileInflightFree();
+    pcap_g = save;
+    return result;
+}
+#endif /* UNITTESTS */
+
+static void PcapFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileInflightTest01", PcapFileInflightTest01, 1);
+    UtRegisterTest("PcapFileInflightTest02", PcapFileInflightTest02, 1);
+#endif /* UNITTESTS */
+}
 
+/* eof */
@@ -27,6 +27,7 @@
 #include "decode.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-streaming-buffer.h"
 
 #define STREAMTCP_QUEUE_FLAG_TS     0x01
 #define STREAMTCP_QUEUE_FLAG_WS     0x02
@@ -84,6 +85,10 @@ typedef struct TcpStream_ {
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
 
+    StreamingBuffer *sb;            /**< stream data if the streaming buffer mode is used,
+                                         seg_list is unused in that case */
+    uint32_t sb_base_seq;           /**< seq of the first byte in sb */
+
     StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
     StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
 } TcpStream;
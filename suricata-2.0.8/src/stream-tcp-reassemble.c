@@ -86,6 +86,17 @@ static uint64_t segment_pool_cnt = 0;
 #endif
 /* index to the right pool for all packet sizes. */
 static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
+
+/* Each thread with a reassembly ctx keeps a small cache of free segments
+ * per pool, so that in the common case getting and returning a segment
+ * doesn't touch the pool locks. Segments are exchanged with the global
+ * pools in batches of half the cache size. 0 disables the cache. */
+static uint32_t segment_cache_size = 64;
+#ifdef TLS
+/* reassembly ctx of the current thread. Segments are returned from code
+ * that has no access to the thread ctx, so we look it up here. */
+static __thread TcpReassemblyThreadCtx *segment_cache_ctx = NULL;
+#endif
 static int check_overlap_different_data = 0;
 
 /* Memory use counter */
@@ -134,8 +145,20 @@ void StreamTcpReassembleDecrMemuse(uint64_t size) {
 
 void StreamTcpReassembleMemuseCounter(ThreadVars *tv, TcpReassemblyThreadCtx *rtv) {
     uint64_t smemuse = SC_ATOMIC_GET(ra_memuse);
-    if (tv != NULL && rtv != NULL)
+    if (tv != NULL && rtv != NULL) {
         SCPerfCounterSetUI64(rtv->counter_tcp_reass_memuse, tv->sc_perf_pca, smemuse);
+
+        if (rtv->seg_mags != NULL) {
+            SCPerfCounterSetUI64(rtv->counter_tcp_segment_cache_hit,
+                    tv->sc_perf_pca, rtv->seg_cache_hits);
+            SCPerfCounterSetUI64(rtv->counter_tcp_segment_cache_miss,
+                    tv->sc_perf_pca, rtv->seg_cache_misses);
+            SCPerfCounterSetUI64(rtv->counter_tcp_segment_cache_refill,
+                    tv->sc_perf_pca, rtv->seg_cache_refills);
+            SCPerfCounterSetUI64(rtv->counter_tcp_segment_cache_flush,
+                    tv->sc_perf_pca, rtv->seg_cache_flushes);
+        }
+    }
     return;
 }
 
@@ -154,6 +177,53 @@ int StreamTcpReassembleCheckMemcap(uint32_t size) {
     return 0;
 }
 
+/** \internal
+ *  \brief streaming buffer memory callbacks, accounting the memory
+ *         against the reassembly memcap */
+static void *StreamTcpReassembleSbMalloc(size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)size) == 0)
+        return NULL;
+
+    void *ptr = SCMalloc(size);
+    if (ptr == NULL)
+        return NULL;
+
+    StreamTcpReassembleIncrMemuse((uint64_t)size);
+    return ptr;
+}
+
+static void *StreamTcpReassembleSbRealloc(void *optr, size_t orig_size, size_t size)
+{
+    if (size > orig_size) {
+        if (StreamTcpReassembleCheckMemcap((uint32_t)(size - orig_size)) == 0)
+            return NULL;
+    }
+
+    void *ptr = SCRealloc(optr, size);
+    if (ptr == NULL)
+        return NULL;
+
+    if (size > orig_size)
+        StreamTcpReassembleIncrMemuse((uint64_t)(size - orig_size));
+    else
+        StreamTcpReassembleDecrMemuse((uint64_t)(orig_size - size));
+    return ptr;
+}
+
+static void StreamTcpReassembleSbFree(void *ptr, size_t size)
+{
+    SCFree(ptr);
+    StreamTcpReassembleDecrMemuse((uint64_t)size);
+}
+
+static const StreamingBufferConfig stream_sb_config = {
+    4096,
+    StreamTcpReassembleSbMalloc,
+    StreamTcpReassembleSbRealloc,
+    StreamTcpReassembleSbFree,
+};
+
 /** \brief alloc a tcp segment pool entry */
 void *TcpSegmentPoolAlloc()
 {
@@ -223,9 +293,112 @@ void TcpSegmentPoolCleanup(void *ptr) {
     return;
 }
 
+/**
+ *  \brief Take a batch of free segments from the global pool into the
+ *         thread's segment cache, holding the pool lock only once.
+ *
+ *  Only the first segment may be newly allocated by the pool, the rest
+ *  of the batch is taken from the segments already available so that
+ *  the cache doesn't make us allocate more than we need.
+ *
+ *  \param ra_ctx reassembly thread ctx owning the cache
+ *  \param idx segment pool index
+ *
+ *  \retval cnt number of segments added to the cache
+ */
+static uint32_t StreamTcpSegmentCacheRefill(TcpReassemblyThreadCtx *ra_ctx,
+        uint16_t idx)
+{
+    TcpSegmentMagazine *mag = &ra_ctx->seg_mags[idx];
+    uint32_t batch = segment_cache_size / 2;
+    uint32_t cnt = 0;
+
+    if (batch == 0)
+        batch = 1;
+
+    SCMutexLock(&segment_pool_mutex[idx]);
+    while (cnt < batch) {
+        if (cnt > 0 && segment_pool[idx]->alloc_stack_size == 0)
+            break;
+
+        TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+        if (seg == NULL)
+            break;
+
+        seg->next = mag->head;
+        mag->head = seg;
+        mag->cnt++;
+        cnt++;
+    }
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+
+    if (cnt > 0)
+        ra_ctx->seg_cache_refills++;
+    return cnt;
+}
+
+/**
+ *  \brief Return segments from the thread's segment cache to the global
+ *         pool until only 'keep' segments are left.
+ *
+ *  \param ra_ctx reassembly thread ctx owning the cache
+ *  \param idx segment pool index
+ *  \param keep number of segments to leave in the cache
+ */
+static void StreamTcpSegmentCacheFlush(TcpReassemblyThreadCtx *ra_ctx,
+        uint16_t idx, uint32_t keep)
+{
+    TcpSegmentMagazine *mag = &ra_ctx->seg_mags[idx];
+
+    if (mag->cnt <= keep)
+        return;
+
+    SCMutexLock(&segment_pool_mutex[idx]);
+    while (mag->cnt > keep) {
+        TcpSegment *seg = mag->head;
+        mag->head = seg->next;
+        mag->cnt--;
+
+        seg->next = NULL;
+        PoolReturn(segment_pool[idx], (void *) seg);
+    }
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+
+    ra_ctx->seg_cache_flushes++;
+}
+
+/**
+ *  \brief Put a segment in the segment cache of the current thread.
+ *
+ *  \retval 1 segment was cached
+ *  \retval 0 no cache available, caller should return it to the pool
+ */
+static int StreamTcpSegmentCachePut(TcpSegment *seg, uint16_t idx)
+{
+#ifdef TLS
+    TcpReassemblyThreadCtx *ra_ctx = segment_cache_ctx;
+    if (ra_ctx == NULL || ra_ctx->seg_mags == NULL)
+        return 0;
+
+    TcpSegmentMagazine *mag = &ra_ctx->seg_mags[idx];
+    if (mag->cnt >= segment_cache_size)
+        StreamTcpSegmentCacheFlush(ra_ctx, idx, segment_cache_size / 2);
+
+    seg->next = mag->head;
+    mag->head = seg;
+    mag->cnt++;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 /**
  *  \brief Function to return the segment back to the pool.
  *
+ *  If the calling thread has a segment cache the segment is kept there,
+ *  otherwise it's returned to the global pool directly.
+ *
  *  \param seg Segment which will be returned back to the pool.
  */
 void StreamTcpSegmentReturntoPool(TcpSegment *seg)
@@ -237,11 +410,13 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     seg->prev = NULL;
 
     uint16_t idx = segment_pool_idx[seg->pool_size];
-    SCMutexLock(&segment_pool_mutex[idx]);
-    PoolReturn(segment_pool[idx], (void *) seg);
-    SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
-               idx,segment_pool[idx]->empty_stack_size);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    if (StreamTcpSegmentCachePut(seg, idx) == 0) {
+        SCMutexLock(&segment_pool_mutex[idx]);
+        PoolReturn(segment_pool[idx], (void *) seg);
+        SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
+                   idx,segment_pool[idx]->empty_stack_size);
+        SCMutexUnlock(&segment_pool_mutex[idx]);
+    }
 
 #ifdef DEBUG
     SCMutexLock(&segment_pool_cnt_mutex);
@@ -251,7 +426,8 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
 }
 
 /**
- *  \brief return all segments in this stream into the pool(s)
+ *  \brief return all segments in this stream into the pool(s) and
+ *         free the streaming buffer if it's in use
  *
  *  \param stream the stream to cleanup
  */
@@ -260,6 +436,11 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     TcpSegment *seg = stream->seg_list;
     TcpSegment *next_seg;
 
+    if (stream->sb != NULL) {
+        StreamingBufferFree(stream->sb);
+        stream->sb = NULL;
+    }
+
     if (seg == NULL)
         return;
 
@@ -439,7 +620,21 @@ int StreamTcpReassemblyConfig(char quiet)
 
         idx++;
     }
+    uint32_t cache_size = 64;
+    ConfNode *cache = ConfGetNode("stream.reassembly.segment-cache-size");
+    if (cache) {
+        if (ByteExtractStringUint32(&cache_size, 10, strlen(cache->val), cache->val) == -1)
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "segment-cache-size of "
+                    "%s is invalid", cache->val);
+            return -1;
+        }
+    }
+    if (!quiet)
+        SCLogInfo("stream.reassembly \"segment-cache-size\": %u", cache_size);
+
     /* set the globals */
+    segment_cache_size = cache_size;
     segment_pool = my_segment_pool;
     segment_pool_mutex = my_segment_lock;
     segment_pool_pktsizes = my_segment_pktsizes;
@@ -485,6 +680,15 @@ static uint32_t dbg_app_layer_gap_candidate;
 void StreamTcpReassembleFree(char quiet)
 {
     uint16_t u16 = 0;
+
+#ifdef TLS
+    /* hand back the segments cached by this thread before the pools go */
+    if (segment_cache_ctx != NULL && segment_cache_ctx->seg_mags != NULL) {
+        for (u16 = 0; u16 < segment_cache_ctx->seg_mags_cnt; u16++) {
+            StreamTcpSegmentCacheFlush(segment_cache_ctx, u16, 0);
+        }
+    }
+#endif
     for (u16 = 0; u16 < segment_pool_num; u16++) {
         SCMutexLock(&segment_pool_mutex[u16]);
 
@@ -538,6 +742,17 @@ TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv)
 
     ra_ctx->app_tctx = AppLayerGetCtxThread(tv);
 
+#ifdef TLS
+    if (segment_cache_size > 0 && segment_pool_num > 0) {
+        ra_ctx->seg_mags = SCMalloc(segment_pool_num * sizeof(TcpSegmentMagazine));
+        if (ra_ctx->seg_mags != NULL) {
+            memset(ra_ctx->seg_mags, 0x00, segment_pool_num * sizeof(TcpSegmentMagazine));
+            ra_ctx->seg_mags_cnt = (uint16_t)segment_pool_num;
+            segment_cache_ctx = ra_ctx;
+        }
+    }
+#endif
+
     SCReturnPtr(ra_ctx, "TcpReassemblyThreadCtx");
 }
 
@@ -545,6 +760,20 @@ void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
 {
     SCEnter();
     AppLayerDestroyCtxThread(ra_ctx->app_tctx);
+
+    if (ra_ctx->seg_mags != NULL) {
+        uint16_t u16;
+        for (u16 = 0; u16 < ra_ctx->seg_mags_cnt; u16++) {
+            StreamTcpSegmentCacheFlush(ra_ctx, u16, 0);
+        }
+        SCFree(ra_ctx->seg_mags);
+        ra_ctx->seg_mags = NULL;
+    }
+#ifdef TLS
+    if (segment_cache_ctx == ra_ctx)
+        segment_cache_ctx = NULL;
+#endif
+
     SCFree(ra_ctx);
     SCReturn;
 }
@@ -1822,6 +2051,86 @@ static void StreamTcpStoreStreamChunk(TcpSession *ssn, StreamMsg *smsg, const Pa
     }
 }
 
+/**
+ *  \internal
+ *  \brief Add a packets TCP data to the streams streaming buffer
+ *
+ *  \param size part of the payload to add, after the depth check
+ *
+ *  \retval 0 data added, or ignored because it's before the buffer
+ *  \retval -1 memcap reached
+ */
+static int StreamTcpReassembleInsertStreamingBuffer(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpStream *stream, Packet *p,
+        uint32_t size)
+{
+    SCEnter();
+
+    const uint8_t *data = p->payload;
+    uint32_t seq = TCP_GET_SEQ(p);
+
+    /* proto detection skipped, but now we do get data. Set event. */
+    if (!StreamTcpStreamHasData(stream) &&
+        stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_SKIPPED) {
+
+        AppLayerDecoderEventsSetEventRaw(&p->app_layer_events,
+                APPLAYER_PROTO_DETECTION_SKIPPED);
+    }
+
+    if (stream->sb == NULL) {
+        stream->sb = StreamingBufferInit(&stream_sb_config);
+        if (stream->sb == NULL) {
+            SCPerfCounterIncr(ra_ctx->counter_tcp_segment_memcap, tv->sc_perf_pca);
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
+
+        /* buffer starts at the oldest point reassembly still needs */
+        if (SEQ_LT(stream->ra_raw_base_seq, stream->ra_app_base_seq))
+            stream->sb_base_seq = stream->ra_raw_base_seq + 1;
+        else
+            stream->sb_base_seq = stream->ra_app_base_seq + 1;
+    }
+
+    /* data we've already slid past is of no use to us */
+    if (SEQ_LEQ(seq + size, stream->sb_base_seq)) {
+        SCLogDebug("data before sb_base_seq %u, ignoring", stream->sb_base_seq);
+        SCReturnInt(0);
+    }
+    if (SEQ_LT(seq, stream->sb_base_seq)) {
+        uint32_t skip = stream->sb_base_seq - seq;
+        data += skip;
+        size -= skip;
+        seq = stream->sb_base_seq;
+    }
+
+    int overlap_diff = 0;
+    uint64_t offset = stream->sb->stream_offset + (seq - stream->sb_base_seq);
+    if (StreamingBufferInsertAt(stream->sb, data, size, offset,
+                check_overlap_different_data ? &overlap_diff : NULL) != 0) {
+        SCLogDebug("failed to add %u bytes to the streaming buffer", size);
+        SCPerfCounterIncr(ra_ctx->counter_tcp_segment_memcap, tv->sc_perf_pca);
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+        SCReturnInt(-1);
+    }
+
+    if (overlap_diff) {
+        /* interesting, overlap with different data */
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA);
+    }
+
+    /* if raw reassembly is disabled for new data and raw is caught up,
+     * move it past this data so it's never inspected */
+    if ((stream->flags & STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED) &&
+        SEQ_GEQ(stream->ra_raw_base_seq + 1, seq) &&
+        SEQ_GT(seq + size, stream->ra_raw_base_seq + 1))
+    {
+        stream->ra_raw_base_seq = seq + size - 1;
+    }
+
+    SCReturnInt(0);
+}
+
 /**
  *  \brief Insert a packets TCP data into the stream reassembly engine.
  *
@@ -1870,6 +2179,14 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         size = p->payload_len;
 #endif
 
+    if (stream->sb != NULL ||
+        (stream->seg_list == NULL && !StreamTcpInlineMode() &&
+         (stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER)))
+    {
+        SCReturnInt(StreamTcpReassembleInsertStreamingBuffer(tv, ra_ctx,
+                    stream, p, size));
+    }
+
     TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
     if (seg == NULL) {
         SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
@@ -2760,6 +3077,48 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
     SCReturnInt(0);
 }
 
+/**
+ *  \internal
+ *  \brief move the start of the streaming buffer forward to the oldest
+ *         point that app layer, raw reassembly or the stored smsgs still
+ *         need. Mirrors the logic of StreamTcpReturnSegmentCheck.
+ */
+static void StreamTcpStreamingBufferSlide(const Flow *f, TcpSession *ssn,
+        TcpStream *stream)
+{
+    /* if proto detect isn't done, we keep all data */
+    if (!(StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)))
+        return;
+
+    uint32_t seq = stream->last_ack;
+
+    if (!(f->flags & FLOW_NO_APPLAYER_INSPECTION) &&
+        !(stream->flags & STREAMTCP_STREAM_FLAG_GAP) &&
+        SEQ_LT(stream->ra_app_base_seq + 1, seq))
+    {
+        seq = stream->ra_app_base_seq + 1;
+    }
+    if (!(ssn->flags & STREAMTCP_FLAG_DISABLE_RAW) &&
+        SEQ_LT(stream->ra_raw_base_seq + 1, seq))
+    {
+        seq = stream->ra_raw_base_seq + 1;
+    }
+
+    /* keep the data of the smsgs that are still queued for logging */
+    StreamMsg *smsg = (stream == &ssn->client) ?
+        ssn->toserver_smsg_head : ssn->toclient_smsg_head;
+    if (smsg != NULL && SEQ_LT(smsg->seq, seq))
+        seq = smsg->seq;
+
+    if (SEQ_GT(seq, stream->sb_base_seq)) {
+        SCLogDebug("sliding streaming buffer from %u to %u",
+                stream->sb_base_seq, seq);
+        StreamingBufferSlideToOffset(stream->sb,
+                stream->sb->stream_offset + (seq - stream->sb_base_seq));
+        stream->sb_base_seq = seq;
+    }
+}
+
 /** \brief Remove idle TcpSegments from TcpSession
  *
  *  \param f flow
@@ -2780,6 +3139,11 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags) {
         return;
     }
 
+    if (stream->sb != NULL) {
+        StreamTcpStreamingBufferSlide(f, ssn, stream);
+        return;
+    }
+
     /* loop through the segments and fill one or more msgs */
     TcpSegment *seg = stream->seg_list;
 
@@ -2834,6 +3198,120 @@ static void GetSessionSize(TcpSession *ssn, Packet *p) {
 }
 #endif
 
+/**
+ *  \internal
+ *  \brief signal a gap in the stream to the app layer and stop
+ *         app layer reassembly for this stream
+ */
+static void StreamTcpReassembleAppLayerGap(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, TcpStream *stream,
+        Packet *p)
+{
+    uint8_t flags = 0;
+
+    /* send gap signal */
+    STREAM_SET_FLAGS(ssn, stream, p, flags);
+    AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+            NULL, 0, flags|STREAM_GAP);
+    AppLayerProfilingStore(ra_ctx->app_tctx, p);
+
+    /* set a GAP flag and make sure not bothering this stream anymore */
+    SCLogDebug("STREAMTCP_STREAM_FLAG_GAP set");
+    stream->flags |= STREAMTCP_STREAM_FLAG_GAP;
+
+    StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEQ_GAP);
+    SCPerfCounterIncr(ra_ctx->counter_tcp_reass_gap, tv->sc_perf_pca);
+#ifdef DEBUG
+    dbg_app_layer_gap++;
+#endif
+}
+
+/**
+ *  \internal
+ *  \brief app layer reassembly for streams using a streaming buffer
+ *
+ *  The ack'd data following ra_app_base_seq is passed to the app layer
+ *  straight from the buffer, without copying it.
+ */
+static int StreamTcpReassembleAppLayerStreamingBuffer(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, TcpStream *stream,
+        Packet *p)
+{
+    SCEnter();
+
+    uint8_t flags = 0;
+    uint32_t next_seq = stream->ra_app_base_seq + 1;
+
+    /* send an empty EOF msg if we have no new data but TCP state
+     * is beyond ESTABLISHED */
+    if (!(StreamTcpStreamHasData(stream)) ||
+        !(SEQ_GT(StreamTcpStreamDataEndSeq(stream), next_seq)))
+    {
+        if (ssn->state >= TCP_CLOSING || (p->flags & PKT_PSEUDO_STREAM_END)) {
+            SCLogDebug("sending empty eof message");
+            STREAM_SET_FLAGS(ssn, stream, p, flags);
+            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+                                  NULL, 0, flags);
+            AppLayerProfilingStore(ra_ctx->app_tctx, p);
+        }
+        SCReturnInt(0);
+    }
+
+    if (stream->flags & STREAMTCP_STREAM_FLAG_GAP)
+        SCReturnInt(0);
+    if (p->flow->flags & FLOW_NO_APPLAYER_INSPECTION) {
+        SCLogDebug("FLOW_NO_APPLAYER_INSPECTION set");
+        SCReturnInt(0);
+    }
+
+    /* the data we need was already removed from the buffer */
+    if (SEQ_LT(next_seq, stream->sb_base_seq)) {
+        StreamTcpReassembleAppLayerGap(tv, ra_ctx, ssn, stream, p);
+        SCReturnInt(0);
+    }
+
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = stream->sb->stream_offset + (next_seq - stream->sb_base_seq);
+
+    if (StreamingBufferGetDataAtOffset(stream->sb, &data, &data_len, offset) == 1 &&
+        SEQ_LT(next_seq, stream->last_ack))
+    {
+        if (data_len > stream->last_ack - next_seq)
+            data_len = stream->last_ack - next_seq;
+
+        SCLogDebug("passing %u bytes at seq %u to the app layer", data_len, next_seq);
+        STREAM_SET_FLAGS(ssn, stream, p, flags);
+        AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+                              (uint8_t *)data, data_len, flags);
+        AppLayerProfilingStore(ra_ctx->app_tctx, p);
+
+        /* stream->ra_app_base_seq remains at stream->isn until protocol is
+         * detected. */
+        if (StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream))
+            stream->ra_app_base_seq += data_len;
+
+        next_seq += data_len;
+        offset += data_len;
+    }
+
+    /* Check if we have a gap at next_seq. If there is data after it
+     * that has been ack'd, the missing data won't get retransmitted. */
+    uint64_t next = 0;
+    if (!(stream->flags & STREAMTCP_STREAM_FLAG_GAP) &&
+        SEQ_LT(next_seq, stream->last_ack) &&
+        StreamingBufferGetNextDataOffset(stream->sb, offset, &next) == 1 &&
+        next > offset &&
+        SEQ_LT(next_seq + (uint32_t)(next - offset), stream->last_ack))
+    {
+        SCLogDebug("gap of %u bytes at seq %u", (uint32_t)(next - offset), next_seq);
+        StreamTcpReassembleAppLayerGap(tv, ra_ctx, ssn, stream, p);
+    }
+
+    SCLogDebug("stream->ra_app_base_seq %u", stream->ra_app_base_seq);
+    SCReturnInt(0);
+}
+
 /**
  *  \brief Update the stream reassembly upon receiving an ACK packet.
  *
@@ -2862,6 +3340,11 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         SCReturnInt(0);
     }
 
+    if (stream->sb != NULL) {
+        SCReturnInt(StreamTcpReassembleAppLayerStreamingBuffer(tv, ra_ctx,
+                    ssn, stream, p));
+    }
+
     uint8_t flags = 0;
 
     SCLogDebug("stream->seg_list %p", stream->seg_list);
@@ -3215,6 +3698,106 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCReturnInt(0);
 }
 
+/**
+ *  \internal
+ *  \brief raw reassembly for streams using a streaming buffer
+ *
+ *  Fills smsgs from the ack'd data following ra_raw_base_seq. Gaps
+ *  are skipped over.
+ */
+static int StreamTcpReassembleRawStreamingBuffer(TcpReassemblyThreadCtx *ra_ctx,
+        TcpSession *ssn, TcpStream *stream, Packet *p)
+{
+    SCEnter();
+
+    /* check if we have enough data */
+    if (StreamTcpReassembleRawCheckLimit(ssn,stream,p) == 0) {
+        SCLogDebug("not yet reassembling");
+        SCReturnInt(0);
+    }
+
+    uint32_t ra_base_seq = stream->ra_raw_base_seq;
+    StreamMsg *smsg = NULL;
+    int r = 0;
+
+    /* data before the buffer is gone */
+    if (SEQ_LT(ra_base_seq + 1, stream->sb_base_seq))
+        ra_base_seq = stream->sb_base_seq - 1;
+
+    while (SEQ_LT(ra_base_seq + 1, stream->last_ack)) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+        uint64_t offset = stream->sb->stream_offset +
+            ((ra_base_seq + 1) - stream->sb_base_seq);
+
+        if (StreamingBufferGetDataAtOffset(stream->sb, &data, &data_len, offset) == 0) {
+            uint64_t next = 0;
+            if (StreamingBufferGetNextDataOffset(stream->sb, offset, &next) == 0)
+                break;
+
+            /* only skip over the gap if data after it was ack'd */
+            uint32_t gap_len = (uint32_t)(next - offset);
+            if (!(SEQ_LT(ra_base_seq + 1 + gap_len, stream->last_ack)))
+                break;
+
+            SCLogDebug("skipping gap of %u bytes at seq %u", gap_len, ra_base_seq + 1);
+
+            /* pass on pre existing smsg (if any) */
+            if (smsg != NULL) {
+                StreamTcpStoreStreamChunk(ssn, smsg, p, 0);
+                smsg = NULL;
+            }
+            ra_base_seq += gap_len;
+            continue;
+        }
+
+        if (data_len > stream->last_ack - (ra_base_seq + 1))
+            data_len = stream->last_ack - (ra_base_seq + 1);
+
+        while (data_len > 0) {
+            if (smsg == NULL) {
+                smsg = StreamMsgGetFromPool();
+                if (smsg == NULL) {
+                    SCLogDebug("stream_msg_pool is empty");
+                    r = -1;
+                    goto end;
+                }
+
+                StreamTcpSetupMsg(ssn, stream, p, smsg);
+                smsg->seq = ra_base_seq + 1;
+                SCLogDebug("smsg->seq %u", smsg->seq);
+            }
+
+            /* copy the data into the smsg */
+            uint32_t copy_size = sizeof(smsg->data) - smsg->data_len;
+            if (copy_size > data_len)
+                copy_size = data_len;
+
+            memcpy(smsg->data + smsg->data_len, data, copy_size);
+            smsg->data_len += copy_size;
+            data += copy_size;
+            data_len -= copy_size;
+            ra_base_seq += copy_size;
+
+            /* queue the smsg if it's full */
+            if (smsg->data_len == sizeof(smsg->data)) {
+                StreamTcpStoreStreamChunk(ssn, smsg, p, 0);
+                smsg = NULL;
+            }
+        }
+    }
+
+    /* put the partly filled smsg in the queue to the l7 handler */
+    if (smsg != NULL) {
+        StreamTcpStoreStreamChunk(ssn, smsg, p, 0);
+        smsg = NULL;
+    }
+end:
+    stream->ra_raw_base_seq = ra_base_seq;
+    SCLogDebug("stream->ra_raw_base_seq %u", stream->ra_raw_base_seq);
+    SCReturnInt(r);
+}
+
 /**
  *  \brief Update the stream reassembly upon receiving an ACK packet.
  *  \todo this function is too long, we need to break it up. It needs it BAD
@@ -3228,6 +3811,10 @@ static int StreamTcpReassembleRaw (TcpReassemblyThreadCtx *ra_ctx,
     if (ssn->flags & STREAMTCP_FLAG_DISABLE_RAW)
         SCReturnInt(0);
 
+    if (stream->sb != NULL) {
+        SCReturnInt(StreamTcpReassembleRawStreamingBuffer(ra_ctx, ssn, stream, p));
+    }
+
     if (stream->seg_list == NULL) {
         SCLogDebug("no segments in the list to reassemble");
         SCReturnInt(0);
@@ -3512,6 +4099,10 @@ int StreamTcpReassembleHandleSegmentUpdateACK (ThreadVars *tv,
             r = -1;
         if (StreamTcpReassembleRaw(ra_ctx, ssn, stream, p) < 0)
             r = -1;
+
+        /* release the data that is no longer needed */
+        if (stream->sb != NULL && p->flow != NULL)
+            StreamTcpStreamingBufferSlide(p->flow, ssn, stream);
     }
 
     SCLogDebug("stream->seg_list %p", stream->seg_list);
@@ -3730,14 +4321,31 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+    TcpSegment *seg = NULL;
+    if (ra_ctx != NULL && ra_ctx->seg_mags != NULL) {
+        TcpSegmentMagazine *mag = &ra_ctx->seg_mags[idx];
+        if (mag->cnt > 0) {
+            ra_ctx->seg_cache_hits++;
+        } else {
+            ra_ctx->seg_cache_misses++;
+            (void)StreamTcpSegmentCacheRefill(ra_ctx, idx);
+        }
 
-    SCLogDebug("segment_pool[%u]->empty_stack_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_stack_size,
-               idx, segment_pool[idx]->alloc_stack_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+        if (mag->cnt > 0) {
+            seg = mag->head;
+            mag->head = seg->next;
+            mag->cnt--;
+        }
+    } else {
+        SCMutexLock(&segment_pool_mutex[idx]);
+        seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+
+        SCLogDebug("segment_pool[%u]->empty_stack_size %u, segment_pool[%u]->alloc_"
+                   "list_size %u, alloc %u", idx, segment_pool[idx]->empty_stack_size,
+                   idx, segment_pool[idx]->alloc_stack_size,
+                   segment_pool[idx]->allocated);
+        SCMutexUnlock(&segment_pool_mutex[idx]);
+    }
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
@@ -8906,6 +9514,216 @@ end:
     return ret;
 }
 
+/** \test segment cache: a returned segment is served again from the
+ *        thread cache without going to the pool */
+static int StreamTcpReassembleSegmentCacheTest01(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    if (ra_ctx->seg_mags == NULL) {
+        printf("no segment cache: ");
+        goto end;
+    }
+
+    TcpSegment *seg = StreamTcpGetSegment(&tv, ra_ctx, 100);
+    if (seg == NULL) {
+        printf("no segment: ");
+        goto end;
+    }
+    if (ra_ctx->seg_cache_misses != 1 || ra_ctx->seg_cache_refills != 1) {
+        printf("expected 1 miss and 1 refill, got %"PRIu64" and %"PRIu64": ",
+                ra_ctx->seg_cache_misses, ra_ctx->seg_cache_refills);
+        goto end;
+    }
+
+    uint16_t idx = segment_pool_idx[100];
+    uint32_t cached = ra_ctx->seg_mags[idx].cnt;
+
+    StreamTcpSegmentReturntoPool(seg);
+    if (ra_ctx->seg_mags[idx].cnt != cached + 1) {
+        printf("segment not cached on return: ");
+        goto end;
+    }
+
+    TcpSegment *seg2 = StreamTcpGetSegment(&tv, ra_ctx, 100);
+    if (seg2 != seg) {
+        printf("expected the cached segment back: ");
+        goto end;
+    }
+    if (ra_ctx->seg_cache_hits != 1) {
+        printf("expected 1 hit, got %"PRIu64": ", ra_ctx->seg_cache_hits);
+        goto end;
+    }
+    StreamTcpSegmentReturntoPool(seg2);
+
+    ret = 1;
+end:
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/** \test segment cache: returning more segments than the cache holds
+ *        flushes a batch back to the pool */
+static int StreamTcpReassembleSegmentCacheTest02(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSegment *segs[256];
+    uint32_t i;
+
+    memset(&tv, 0x00, sizeof(tv));
+    memset(&segs, 0x00, sizeof(segs));
+
+    StreamTcpUTInit(&ra_ctx);
+    if (ra_ctx->seg_mags == NULL || segment_cache_size * 2 > 256) {
+        printf("unexpected segment cache setup: ");
+        goto end;
+    }
+
+    for (i = 0; i < segment_cache_size * 2; i++) {
+        segs[i] = StreamTcpGetSegment(&tv, ra_ctx, 100);
+        if (segs[i] == NULL) {
+            printf("no segment %u: ", i);
+            goto end;
+        }
+    }
+
+    for (i = 0; i < segment_cache_size * 2; i++) {
+        StreamTcpSegmentReturntoPool(segs[i]);
+        segs[i] = NULL;
+    }
+
+    uint16_t idx = segment_pool_idx[100];
+    if (ra_ctx->seg_mags[idx].cnt > segment_cache_size) {
+        printf("cache holds %u segments, max is %u: ",
+                ra_ctx->seg_mags[idx].cnt, segment_cache_size);
+        goto end;
+    }
+    if (ra_ctx->seg_cache_flushes == 0) {
+        printf("expected a flush to the pool: ");
+        goto end;
+    }
+
+    ret = 1;
+end:
+    for (i = 0; i < 256; i++) {
+        if (segs[i] != NULL)
+            StreamTcpSegmentReturntoPool(segs[i]);
+    }
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/** \test streaming buffer mode: out of order data ends up contiguous in
+ *        the buffer, raw reassembly reads it from there and the buffer
+ *        slides once the data is no longer needed
+ */
+static int StreamTcpReassembleStreamingBufferTest01(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Flow f;
+    uint8_t payload[5] = { 0 };
+    uint8_t expected[] = "AAAAABBBBBCCCCC";
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_STREAMING_BUFFER;
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    FLOW_INITIALIZE(&f);
+    ssn.state = TCP_ESTABLISHED;
+
+    Packet *p = UTHBuildPacketReal(payload, 5, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL) {
+        printf("couldn't get a packet: ");
+        goto end;
+    }
+    p->flow = &f;
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    SCMutexLock(&f.m);
+    memset(p->payload, 'A', 5);
+    p->tcph->th_seq = htonl(2);
+    if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0)
+        goto end;
+    memset(p->payload, 'C', 5);
+    p->tcph->th_seq = htonl(12);
+    if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0)
+        goto end;
+    if (ssn.client.sb == NULL || StreamingBufferIsContiguous(ssn.client.sb)) {
+        printf("expected a streaming buffer with a gap: ");
+        goto end;
+    }
+    memset(p->payload, 'B', 5);
+    p->tcph->th_seq = htonl(7);
+    if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0)
+        goto end;
+    if (ssn.client.seg_list != NULL || !StreamingBufferIsContiguous(ssn.client.sb) ||
+        ssn.client.sb->buf_offset != 15) {
+        printf("expected 15 bytes of contiguous data and no segments: ");
+        goto end;
+    }
+
+    /* ack all data, the ACK packet goes the other way */
+    ssn.client.last_ack = 17;
+    ssn.flags |= STREAMTCP_FLAG_TRIGGER_RAW_REASSEMBLY;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    if (StreamTcpReassembleRaw(ra_ctx, &ssn, &ssn.client, p) < 0) {
+        printf("StreamTcpReassembleRaw failed: ");
+        goto end;
+    }
+
+    if (UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 1) {
+        printf("expected a single stream message: ");
+        goto end;
+    }
+    StreamMsg *smsg = ssn.toserver_smsg_head;
+    if (smsg->seq != 2 || smsg->data_len != 15 ||
+        memcmp(smsg->data, expected, 15) != 0) {
+        printf("unexpected smsg, seq %u len %u: ", smsg->seq, smsg->data_len);
+        goto end;
+    }
+    if (ssn.client.ra_raw_base_seq != 16) {
+        printf("ra_raw_base_seq %"PRIu32", expected 16: ", ssn.client.ra_raw_base_seq);
+        goto end;
+    }
+
+    /* the queued smsg keeps the data around */
+    StreamTcpSetStreamFlagAppProtoDetectionCompleted(&ssn.client);
+    f.flags |= FLOW_NO_APPLAYER_INSPECTION;
+    StreamTcpStreamingBufferSlide(&f, &ssn, &ssn.client);
+    if (ssn.client.sb_base_seq != 2 || ssn.client.sb->buf_offset != 15) {
+        printf("buffer slid while the smsg still needs it: ");
+        goto end;
+    }
+
+    StreamMsgReturnListToPool(ssn.toserver_smsg_head);
+    ssn.toserver_smsg_head = ssn.toserver_smsg_tail = NULL;
+    StreamTcpStreamingBufferSlide(&f, &ssn, &ssn.client);
+    if (ssn.client.sb_base_seq != 17 || ssn.client.sb->buf_offset != 0) {
+        printf("sb_base_seq %u, buf_offset %u, expected 17 and 0: ",
+                ssn.client.sb_base_seq, ssn.client.sb->buf_offset);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    SCMutexUnlock(&f.m);
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p);
+    StreamTcpUTClearSession(&ssn);
+    stream_config.flags &= ~STREAMTCP_INIT_FLAG_STREAMING_BUFFER;
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8976,6 +9794,10 @@ void StreamTcpReassembleRegisterTests(void) {
     UtRegisterTest("StreamTcpReassembleInsertTest02 -- insert with overlap", StreamTcpReassembleInsertTest02, 1);
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap", StreamTcpReassembleInsertTest03, 1);
 
+    UtRegisterTest("StreamTcpReassembleSegmentCacheTest01 -- cache reuse", StreamTcpReassembleSegmentCacheTest01, 1);
+    UtRegisterTest("StreamTcpReassembleSegmentCacheTest02 -- cache flush", StreamTcpReassembleSegmentCacheTest02, 1);
+    UtRegisterTest("StreamTcpReassembleStreamingBufferTest01 -- streaming buffer", StreamTcpReassembleStreamingBufferTest01, 1);
+
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
 #endif /* UNITTESTS */
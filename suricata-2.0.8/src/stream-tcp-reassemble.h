@@ -51,8 +51,26 @@ enum
     OS_POLICY_LAST
 };
 
+/** per thread cache of free segments for a single segment pool. Segments
+ *  are kept in a singly linked list through TcpSegment::next. */
+typedef struct TcpSegmentMagazine_ {
+    TcpSegment *head;
+    uint32_t cnt;
+} TcpSegmentMagazine;
+
 typedef struct TcpReassemblyThreadCtx_ {
     void *app_tctx;
+
+    /** per thread segment caches, one per segment pool. NULL if disabled. */
+    TcpSegmentMagazine *seg_mags;
+    uint16_t seg_mags_cnt;
+
+    /** segment cache stats, published through the counters below */
+    uint64_t seg_cache_hits;
+    uint64_t seg_cache_misses;
+    uint64_t seg_cache_refills;
+    uint64_t seg_cache_flushes;
+
     /** TCP segments which are not being reassembled due to memcap was reached */
     uint16_t counter_tcp_segment_memcap;
     /** number of streams that stop reassembly because their depth is reached */
@@ -66,6 +84,14 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_htp_memuse;
     /* number of allocation failed due to memcap when handling HTTP protocol */
     uint16_t counter_htp_memcap;
+    /** segment requests served from the thread local cache */
+    uint16_t counter_tcp_segment_cache_hit;
+    /** segment requests that had to go to the global pool */
+    uint16_t counter_tcp_segment_cache_miss;
+    /** batches taken from the global pools */
+    uint16_t counter_tcp_segment_cache_refill;
+    /** batches returned to the global pools */
+    uint16_t counter_tcp_segment_cache_flush;
 } TcpReassemblyThreadCtx;
 
 #define OS_POLICY_DEFAULT   OS_POLICY_BSD
@@ -399,6 +399,12 @@ void StreamTcpInitConfig(char quiet)
         SCLogInfo("stream \"async-oneside\": %s", stream_config.async_oneside ? "enabled" : "disabled");
     }
 
+    ConfGetBool("stream.bypass", &stream_config.bypass);
+
+    if (!quiet) {
+        SCLogInfo("stream \"bypass\": %s", stream_config.bypass ? "enabled" : "disabled");
+    }
+
     int csum = 0;
 
     if ((ConfGetBool("stream.checksum-validation", &csum)) == 1) {
@@ -487,6 +493,25 @@ void StreamTcpInitConfig(char quiet)
         SCLogInfo("stream.reassembly \"depth\": %"PRIu32"", stream_config.reassembly_depth);
     }
 
+    int streaming_buffer = 0;
+    if ((ConfGetBool("stream.reassembly.streaming-buffer", &streaming_buffer)) == 1 &&
+            streaming_buffer == 1) {
+        /* inline mode needs the per segment handling to be able to
+         * modify packets */
+        if (stream_inline) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "stream.reassembly.streaming-buffer "
+                    "is not supported in inline mode, ignoring");
+        } else {
+            stream_config.flags |= STREAMTCP_INIT_FLAG_STREAMING_BUFFER;
+        }
+    }
+
+    if (!quiet) {
+        SCLogInfo("stream.reassembly \"streaming-buffer\": %s",
+                stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER ?
+                "enabled" : "disabled");
+    }
+
     int randomize = 0;
     if ((ConfGetBool("stream.reassembly.randomize-chunk-size", &randomize)) == 0) {
         /* randomize by default if value not set
@@ -2168,10 +2193,10 @@ static int HandleEstablishedPacketToClient(ThreadVars *tv, TcpSession *ssn, Pack
 static inline uint32_t StreamTcpResetGetMaxAck(TcpStream *stream, uint32_t seq) {
     uint32_t ack = seq;
 
-    if (stream->seg_list_tail != NULL) {
-        if (SEQ_GT((stream->seg_list_tail->seq + stream->seg_list_tail->payload_len), ack))
+    if (StreamTcpStreamHasData(stream)) {
+        if (SEQ_GT(StreamTcpStreamDataEndSeq(stream), ack))
         {
-            ack = stream->seg_list_tail->seq + stream->seg_list_tail->payload_len;
+            ack = StreamTcpStreamDataEndSeq(stream);
         }
     }
 
@@ -4357,7 +4382,59 @@ static int StreamTcpPacketIsBadWindowUpdate(TcpSession *ssn, Packet *p)
 }
 
 
+/** a stream that won't bring new data to inspect: it reached the
+ *  reassembly depth or it sent its FIN/RST */
+#define StreamTcpStreamDone(stream) \
+    ((stream)->flags & (STREAMTCP_STREAM_FLAG_DEPTH_REACHED | \
+                        STREAMTCP_STREAM_FLAG_CLOSE_INITIATED))
+
 /* flow is and stays locked */
+/**
+ *  \internal
+ *  \brief check if a session can be locally bypassed: both of its streams
+ *         are done, at least one by reaching the reassembly depth, and
+ *         neither stream data nor open files are still waiting to be
+ *         inspected.
+ *
+ *  A single stream at depth is not enough: on a keep-alive connection a
+ *  large response would otherwise stop inspection of the next requests.
+ *
+ *  \retval 1 session can be bypassed
+ *  \retval 0 session needs further inspection
+ */
+static int StreamTcpSessionCanBypass(const Flow *f, TcpSession *ssn)
+{
+    if (!(ssn->client.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED) &&
+        !(ssn->server.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED))
+        return 0;
+
+    if (!StreamTcpStreamDone(&ssn->client) || !StreamTcpStreamDone(&ssn->server))
+        return 0;
+
+    if (StreamNeedsReassembly(ssn, 0) != STREAM_HAS_UNPROCESSED_SEGMENTS_NONE ||
+        StreamNeedsReassembly(ssn, 1) != STREAM_HAS_UNPROCESSED_SEGMENTS_NONE)
+        return 0;
+
+    if (f->alstate != NULL) {
+        uint8_t dirs[2] = { STREAM_TOSERVER, STREAM_TOCLIENT };
+        int i;
+        for (i = 0; i < 2; i++) {
+            FileContainer *ffc = AppLayerParserGetFiles(f->proto, f->alproto,
+                    f->alstate, dirs[i]);
+            if (ffc == NULL)
+                continue;
+
+            File *ff;
+            for (ff = ffc->head; ff != NULL; ff = ff->next) {
+                if (ff->state == FILE_STATE_OPENED)
+                    return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
 int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
                      PacketQueue *pq)
 {
@@ -4597,6 +4674,16 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
         {
             p->flags |= PKT_STREAM_NOPCAPLOG;
         }
+
+        /* nothing left to inspect: let the next packets of this flow
+         * skip the stream engine and detection */
+        if (stream_config.bypass && !(p->flow->flags & FLOW_BYPASSED) &&
+            StreamTcpSessionCanBypass(p->flow, ssn))
+        {
+            SCLogDebug("ssn %p: bypassing flow %p", ssn, p->flow);
+            p->flow->flags |= FLOW_BYPASSED;
+            SCPerfCounterIncr(stt->counter_tcp_bypassed, tv->sc_perf_pca);
+        }
     }
 
     StreamTcpMemuseCounter(tv, stt);
@@ -4677,6 +4764,10 @@ TmEcode StreamTcp (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
         return TM_ECODE_OK;
     }
 
+    /* flow was bypassed, nothing to track anymore */
+    if (p->flags & PKT_BYPASSED)
+        return TM_ECODE_OK;
+
     if (stream_config.flags & STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION) {
         if (StreamTcpValidateChecksum(p) == 0) {
             SCPerfCounterIncr(stt->counter_tcp_invalid_checksum, tv->sc_perf_pca);
@@ -4740,6 +4831,9 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_rst = SCPerfTVRegisterCounter("tcp.rst", tv,
                                                         SC_PERF_TYPE_UINT64,
                                                         "NULL");
+    stt->counter_tcp_bypassed = SCPerfTVRegisterCounter("tcp.bypassed", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
 
     /* init reassembly ctx */
     stt->ra_ctx = StreamTcpReassembleInitThreadCtx(tv);
@@ -4765,6 +4859,18 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->ra_ctx->counter_htp_memcap = SCPerfTVRegisterCounter("http.memcap", tv,
                                                         SC_PERF_TYPE_UINT64,
                                                         "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_hit = SCPerfTVRegisterCounter("tcp.segment_cache_hit", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_miss = SCPerfTVRegisterCounter("tcp.segment_cache_miss", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_refill = SCPerfTVRegisterCounter("tcp.segment_cache_refill", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_flush = SCPerfTVRegisterCounter("tcp.segment_cache_flush", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
 
     SCLogDebug("StreamTcp thread specific ctx online at %p, reassembly ctx %p",
                 stt, stt->ra_ctx);
@@ -5561,7 +5667,8 @@ void StreamTcpPseudoPacketCreateStreamEndPacket(Packet *p, TcpSession *ssn, Pack
     }
 
     /* no need for a pseudo packet if there is nothing left to reassemble */
-    if (ssn->server.seg_list == NULL && ssn->client.seg_list == NULL) {
+    if (!StreamTcpStreamHasData(&ssn->server) &&
+        !StreamTcpStreamHasData(&ssn->client)) {
         SCReturn;
     }
 
@@ -5637,6 +5744,38 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag, StreamSegmentCallback
     } else {
         stream = &(ssn->client);
     }
+    if (stream->sb != NULL) {
+        /* hand out the contiguous blocks of ack'd data */
+        uint32_t seq = stream->sb_base_seq;
+        while (SEQ_LT(seq, stream->last_ack)) {
+            uint64_t offset = stream->sb->stream_offset + (seq - stream->sb_base_seq);
+            uint64_t next = 0;
+            const uint8_t *sbdata = NULL;
+            uint32_t sbdata_len = 0;
+
+            if (StreamingBufferGetNextDataOffset(stream->sb, offset, &next) == 0)
+                break;
+            seq += (uint32_t)(next - offset);
+            if (!(SEQ_LT(seq, stream->last_ack)))
+                break;
+            if (StreamingBufferGetDataAtOffset(stream->sb, &sbdata, &sbdata_len, next) == 0)
+                break;
+            if (sbdata_len > stream->last_ack - seq)
+                sbdata_len = stream->last_ack - seq;
+
+            ret = CallbackFunc(p, data, (uint8_t *)sbdata, sbdata_len);
+            if (ret != 1) {
+                SCLogDebug("Callback function has failed");
+                FLOWLOCK_UNLOCK(p->flow);
+                return -1;
+            }
+            seq += sbdata_len;
+            cnt++;
+        }
+        FLOWLOCK_UNLOCK(p->flow);
+        return cnt;
+    }
+
     TcpSegment *seg = stream->seg_list;
     for (; seg != NULL && SEQ_LT(seg->seq, stream->last_ack);) {
         ret = CallbackFunc(p, data, seg->payload, seg->payload_len);
@@ -10243,6 +10382,183 @@ end:
     return ret;
 }
 
+/**
+ *  \test  flow is only bypassed when enabled and once the streams reached
+ *         the reassembly depth.
+ */
+static int StreamTcpTest46 (void) {
+    int ret = 0;
+    Flow f;
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    PacketQueue pq;
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    TcpSession *ssn;
+
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+
+    memset(&pq,0,sizeof(PacketQueue));
+    memset (&f, 0, sizeof(Flow));
+    memset(&tv, 0, sizeof (ThreadVars));
+    memset(&stt, 0, sizeof (StreamTcpThread));
+    memset(&tcph, 0, sizeof (TCPHdr));
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.bypass = 1;
+
+    p->tcph = &tcph;
+    tcph.th_win = htons(5480);
+    p->flow = &f;
+
+    /* SYN pkt */
+    tcph.th_flags = TH_SYN;
+    tcph.th_seq = htonl(100);
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    SCMutexLock(&f.m);
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    /* SYN/ACK */
+    p->tcph->th_seq = htonl(1000);
+    p->tcph->th_ack = htonl(101);
+    p->tcph->th_flags = TH_SYN | TH_ACK;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    /* ACK */
+    p->tcph->th_ack = htonl(1001);
+    p->tcph->th_seq = htonl(101);
+    p->tcph->th_flags = TH_ACK;
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    if (f.flags & FLOW_BYPASSED) {
+        printf("flow bypassed before depth was reached: ");
+        goto end;
+    }
+
+    ssn = p->flow->protoctx;
+    ssn->server.flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+    ssn->client.flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    if (!(f.flags & FLOW_BYPASSED)) {
+        printf("flow not bypassed after depth was reached: ");
+        goto end;
+    }
+
+    StreamTcpSessionClear(p->flow->protoctx);
+
+    ret = 1;
+end:
+    StreamTcpFreeConfig(TRUE);
+    SCMutexUnlock(&f.m);
+    SCFree(p);
+    return ret;
+}
+
+/**
+ *  \test  a flow with only one stream at depth is not bypassed while the
+ *         other stream can still bring data, e.g. the next request on a
+ *         keep-alive connection after a large response.
+ */
+static int StreamTcpTest47 (void) {
+    int ret = 0;
+    Flow f;
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    PacketQueue pq;
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    TcpSession *ssn;
+
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+
+    memset(&pq,0,sizeof(PacketQueue));
+    memset (&f, 0, sizeof(Flow));
+    memset(&tv, 0, sizeof (ThreadVars));
+    memset(&stt, 0, sizeof (StreamTcpThread));
+    memset(&tcph, 0, sizeof (TCPHdr));
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.bypass = 1;
+
+    p->tcph = &tcph;
+    tcph.th_win = htons(5480);
+    p->flow = &f;
+
+    /* SYN pkt */
+    tcph.th_flags = TH_SYN;
+    tcph.th_seq = htonl(100);
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    SCMutexLock(&f.m);
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    /* SYN/ACK */
+    p->tcph->th_seq = htonl(1000);
+    p->tcph->th_ack = htonl(101);
+    p->tcph->th_flags = TH_SYN | TH_ACK;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    /* ACK */
+    p->tcph->th_ack = htonl(1001);
+    p->tcph->th_seq = htonl(101);
+    p->tcph->th_flags = TH_ACK;
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    /* the response hit the depth, the client may still send requests */
+    ssn = p->flow->protoctx;
+    ssn->server.flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    if (f.flags & FLOW_BYPASSED) {
+        printf("flow bypassed with the client stream still open: ");
+        goto end;
+    }
+
+    /* client sent its FIN */
+    ssn->client.flags |= STREAMTCP_STREAM_FLAG_CLOSE_INITIATED;
+
+    if (StreamTcpPacket(&tv, p, &stt, &pq) == -1)
+        goto end;
+
+    if (!(f.flags & FLOW_BYPASSED)) {
+        printf("flow not bypassed after the client stream closed: ");
+        goto end;
+    }
+
+    StreamTcpSessionClear(p->flow->protoctx);
+
+    ret = 1;
+end:
+    StreamTcpFreeConfig(TRUE);
+    SCMutexUnlock(&f.m);
+    SCFree(p);
+    return ret;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpRegisterTests (void) {
@@ -10319,6 +10635,8 @@ void StreamTcpRegisterTests (void) {
     UtRegisterTest("StreamTcpTest43 -- SYN/ACK queue", StreamTcpTest43, 1);
     UtRegisterTest("StreamTcpTest44 -- SYN/ACK queue", StreamTcpTest44, 1);
     UtRegisterTest("StreamTcpTest45 -- SYN/ACK queue", StreamTcpTest45, 1);
+    UtRegisterTest("StreamTcpTest46 -- local bypass", StreamTcpTest46, 1);
+    UtRegisterTest("StreamTcpTest47 -- no bypass with one stream open", StreamTcpTest47, 1);
 
     /* set up the reassembly tests as well */
     StreamTcpReassembleRegisterTests();
@@ -38,6 +38,9 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that new streams store their data in a streaming
+   buffer instead of a segment list */
+#define STREAMTCP_INIT_FLAG_STREAMING_BUFFER       0x02
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -54,6 +57,7 @@ typedef struct TcpStreamCnf_ {
     uint32_t prealloc_sessions; /**< ssns to prealloc per stream thread */
     int midstream;
     int async_oneside;
+    int bypass;     /**< locally bypass sessions that reached the depth */
     uint32_t reassembly_depth;  /**< Depth until when we reassemble the stream */
 
     uint16_t reassembly_toserver_chunk_size;
@@ -99,6 +103,8 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_synack;
     /** rst pkts */
     uint16_t counter_tcp_rst;
+    /** sessions that were locally bypassed */
+    uint16_t counter_tcp_bypassed;
 
     /** tcp reassembly thread data */
     TcpReassemblyThreadCtx *ra_ctx;
@@ -177,13 +183,52 @@ enum {
     STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION = 2,
 };
 
+/**
+ *  \brief check if the stream has any data stored, either as segments
+ *         or in the streaming buffer
+ */
+static inline int StreamTcpStreamHasData(const TcpStream *stream)
+{
+    if (stream->sb != NULL)
+        return (stream->sb->buf_offset > 0);
+    return (stream->seg_list != NULL);
+}
+
+/**
+ *  \brief get the seq right after the last byte of data in the stream.
+ *         Only valid if StreamTcpStreamHasData() returned true.
+ */
+static inline uint32_t StreamTcpStreamDataEndSeq(const TcpStream *stream)
+{
+    if (stream->sb != NULL)
+        return stream->sb_base_seq + stream->sb->buf_offset;
+    return stream->seg_list_tail->seq + stream->seg_list_tail->payload_len;
+}
+
+/**
+ *  \brief check if the stream has data that app layer or raw reassembly
+ *         didn't process yet
+ */
+static inline int StreamTcpStreamHasUnprocessedData(const TcpStream *stream)
+{
+    if (!StreamTcpStreamHasData(stream))
+        return 0;
+
+    if (stream->sb != NULL) {
+        uint32_t end_seq = StreamTcpStreamDataEndSeq(stream);
+        return (SEQ_GT(end_seq, stream->ra_raw_base_seq + 1) ||
+                SEQ_GT(end_seq, stream->ra_app_base_seq + 1));
+    }
+
+    return (!(stream->seg_list_tail->flags & SEGMENTTCP_FLAG_RAW_PROCESSED) ||
+            !(stream->seg_list_tail->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED));
+}
+
 static inline int StreamNeedsReassembly(TcpSession *ssn, int direction)
 {
     /* server tcp state */
     if (direction) {
-        if (ssn->server.seg_list != NULL &&
-            (!(ssn->server.seg_list_tail->flags & SEGMENTTCP_FLAG_RAW_PROCESSED) ||
-             !(ssn->server.seg_list_tail->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED)) ) {
+        if (StreamTcpStreamHasUnprocessedData(&ssn->server)) {
             return STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY;
         } else if (ssn->toclient_smsg_head != NULL) {
             return STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION;
@@ -191,9 +236,7 @@ static inline int StreamNeedsReassembly(TcpSession *ssn, int direction)
             return STREAM_HAS_UNPROCESSED_SEGMENTS_NONE;
         }
     } else {
-        if (ssn->client.seg_list != NULL &&
-            (!(ssn->client.seg_list_tail->flags & SEGMENTTCP_FLAG_RAW_PROCESSED) ||
-             !(ssn->client.seg_list_tail->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED)) ) {
+        if (StreamTcpStreamHasUnprocessedData(&ssn->client)) {
             return STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY;
         } else if (ssn->toserver_smsg_head != NULL) {
             return STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION;
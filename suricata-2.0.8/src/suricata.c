@@ -122,6 +122,7 @@
 #include "flow.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "util-logopenfile-async.h"
 #include "flow-var.h"
 #include "flow-bit.h"
 #include "pkt-var.h"
@@ -2292,6 +2293,8 @@ int main(int argc, char **argv)
         }
         /* Spawn the flow manager thread */
         FlowManagerThreadSpawn();
+        /* Spawn the log writer thread, if there are async outputs */
+        LogFileAsyncWriterSpawn();
 
         SCPerfSpawnThreads();
     }
@@ -46,6 +46,7 @@
 #define SCCtrlCondT pthread_cond_t
 #define SCCtrlCondInit pthread_cond_init
 #define SCCtrlCondSignal pthread_cond_signal
+#define SCCtrlCondBroadcast pthread_cond_broadcast
 #define SCCtrlCondTimedwait pthread_cond_timedwait
 #define SCCtrlCondDestroy pthread_cond_destroy
 
@@ -90,6 +91,7 @@ static inline void cycle_sleep(int cycles)
     ;
 }
 #define SCCondWait(x,y) cycle_sleep(300)
+#define SCCondTimedwait(x,y,z) cycle_sleep(300)
 
 /* spinlocks */
 
@@ -139,6 +139,7 @@
 #define SCCondSignal pthread_cond_signal
 #define SCCondDestroy pthread_cond_destroy
 #define SCCondWait SCCondWait_dbg
+#define SCCondTimedwait(cond, mut, ts) pthread_cond_timedwait(cond, mut, ts)
 
 /* spinlocks */
 
@@ -382,6 +383,7 @@
 #define SCCtrlCondT pthread_cond_t
 #define SCCtrlCondInit pthread_cond_init
 #define SCCtrlCondSignal pthread_cond_signal
+#define SCCtrlCondBroadcast pthread_cond_broadcast
 #define SCCtrlCondTimedwait pthread_cond_timedwait
 #define SCCtrlCondDestroy pthread_cond_destroy
 
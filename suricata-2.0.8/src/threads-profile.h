@@ -89,6 +89,7 @@ extern __thread uint64_t mutex_lock_cnt;
 #define SCCondSignal pthread_cond_signal
 #define SCCondDestroy pthread_cond_destroy
 #define SCCondWait(cond, mut) pthread_cond_wait(cond, mut)
+#define SCCondTimedwait(cond, mut, ts) pthread_cond_timedwait(cond, mut, ts)
 
 /* spinlocks */
 
@@ -211,6 +212,7 @@ extern __thread uint64_t rwr_lock_cnt;
 #define SCCtrlCondT pthread_cond_t
 #define SCCtrlCondInit pthread_cond_init
 #define SCCtrlCondSignal pthread_cond_signal
+#define SCCtrlCondBroadcast pthread_cond_broadcast
 #define SCCtrlCondTimedwait pthread_cond_timedwait
 #define SCCtrlCondDestroy pthread_cond_destroy
 
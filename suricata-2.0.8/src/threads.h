@@ -138,6 +138,7 @@ enum {
 #define SCCondSignal pthread_cond_signal
 #define SCCondDestroy pthread_cond_destroy
 #define SCCondWait(cond, mut) pthread_cond_wait(cond, mut)
+#define SCCondTimedwait(cond, mut, ts) pthread_cond_timedwait(cond, mut, ts)
 
 /* ctrl mutex */
 #define SCCtrlMutex pthread_mutex_t
@@ -152,6 +153,7 @@ enum {
 #define SCCtrlCondT pthread_cond_t
 #define SCCtrlCondInit pthread_cond_init
 #define SCCtrlCondSignal pthread_cond_signal
+#define SCCtrlCondBroadcast pthread_cond_broadcast
 #define SCCtrlCondTimedwait pthread_cond_timedwait
 #define SCCtrlCondDestroy pthread_cond_destroy
 
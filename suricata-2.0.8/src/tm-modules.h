@@ -45,6 +45,10 @@ typedef struct TmModule_ {
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
+    /** optional function processing a vector of packets at once. Only
+     *  used by the varslot threads, see TmThreadsSlotVar() */
+    TmEcode (*FuncBatch)(ThreadVars *, Packet **, uint32_t, void *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     /** global Init/DeInit */
@@ -49,6 +49,7 @@ void TmqhSetup (void) {
 /** \brief Clean up registration time allocs */
 void TmqhCleanup(void) {
     TmqhRingBufferDestroy();
+    TmqhFlowRingCleanup();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(char *name) {
@@ -62,3 +63,21 @@ Tmqh* TmqhGetQueueHandlerByName(char *name) {
     return NULL;
 }
 
+/**
+ * \brief get the number of packets waiting in the input queue of a thread,
+ *        including the ones held by its input queue handler
+ */
+uint32_t TmqhInputQueueLen(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    uint32_t len;
+
+    SCMutexLock(&q->mutex_q);
+    len = q->len;
+    SCMutexUnlock(&q->mutex_q);
+
+    if (tv->tmqh_in == tmqh_table[TMQH_FLOW_RING].InHandler)
+        len += TmqhFlowRingQueueLen(tv->inq->id);
+
+    return len;
+}
@@ -29,6 +29,9 @@ enum {
     TMQH_NFQ,
     TMQH_PACKETPOOL,
     TMQH_FLOW,
+    TMQH_FLOW_RING,
+    TMQH_FLOW_TUPLE,
+    TMQH_FLOW_TUPLE_RING,
     TMQH_RINGBUFFER_MRSW,
     TMQH_RINGBUFFER_SRSW,
     TMQH_RINGBUFFER_SRMW,
@@ -39,6 +42,8 @@ enum {
 typedef struct Tmqh_ {
     char *name;
     Packet *(*InHandler)(ThreadVars *);
+    /** optional, called when a thread is created with this input handler */
+    int (*InHandlerSetup)(ThreadVars *);
     void (*InShutdownHandler)(ThreadVars *);
     void (*OutHandler)(ThreadVars *, Packet *);
     void *(*OutHandlerCtxSetup)(char *);
@@ -51,6 +56,7 @@ Tmqh tmqh_table[TMQH_SIZE];
 void TmqhSetup (void);
 void TmqhCleanup(void);
 Tmqh* TmqhGetQueueHandlerByName(char *name);
+uint32_t TmqhInputQueueLen(ThreadVars *tv);
 
 #endif /* __TM_QUEUEHANDLERS_H__ */
 
@@ -663,6 +663,9 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
         return NULL;
     }
 
+    /* the capture thread owns the packets it hands out */
+    PacketPoolInitThread(tv);
+
     for (slot = s; slot != NULL; slot = slot->slot_next) {
         if (slot->SlotThreadInit != NULL) {
             void *slot_data = NULL;
@@ -730,6 +733,8 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
         }
     }
 
+    PacketPoolDestroyThread();
+
     SCLogDebug("%s ending", tv->name);
     TmThreadsSetFlag(tv, THV_CLOSED);
     pthread_exit((void *) 0);
@@ -737,6 +742,195 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
 }
 
 
+/** packets a varslot thread collected for its batch slot */
+typedef struct TmBatch_ {
+    TmSlot *slot;
+    uint32_t size;
+    uint32_t cnt;
+    Packet *pkts[TM_BATCH_MAX];
+} TmBatch;
+
+/**
+ * \internal
+ * \brief Get the slot of the thread that takes packet vectors, if the
+ *        thread can use it.
+ *
+ * The thread has to be the only reader of a trans_q based input queue,
+ * so it can see if more packets are waiting without blocking.
+ */
+static TmSlot *TmThreadsSlotVarGetBatchSlot(ThreadVars *tv)
+{
+    TmSlot *s;
+
+    if (threading_detect_batch_size <= 1)
+        return NULL;
+    if (tv->inq == NULL || tv->inq->q_type != 0 || tv->inq->reader_cnt != 1)
+        return NULL;
+    if (tv->tmqh_in != tmqh_table[TMQH_SIMPLE].InHandler &&
+        tv->tmqh_in != tmqh_table[TMQH_FLOW].InHandler &&
+        tv->tmqh_in != tmqh_table[TMQH_FLOW_RING].InHandler)
+        return NULL;
+
+    for (s = (TmSlot *)tv->tm_slots; s != NULL; s = s->slot_next) {
+        if (s->SlotFuncBatch != NULL)
+            return s;
+    }
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief Run the batch slot over the collected packets. The slots after
+ *        it and the output handler then run per packet, in the order the
+ *        packets were collected.
+ *
+ * While the batch slot is replaced by the dummy function (delayed detect,
+ * rule reload), the packets just take the normal per packet path.
+ */
+static TmEcode TmThreadsSlotVarBatchFlush(ThreadVars *tv, TmBatch *b)
+{
+    TmSlot *bs = b->slot;
+    TmEcode r = TM_ECODE_OK;
+    uint32_t i = 0;
+
+    if (b->cnt == 0)
+        return TM_ECODE_OK;
+
+    if (SC_ATOMIC_GET(bs->SlotFunc) == bs->SlotFuncSingle) {
+        r = bs->SlotFuncBatch(tv, b->pkts, b->cnt, SC_ATOMIC_GET(bs->slot_data));
+        if (unlikely(r == TM_ECODE_FAILED))
+            goto error;
+
+        for (i = 0; i < b->cnt; i++) {
+            if (bs->slot_next != NULL) {
+                r = TmThreadsSlotVarRun(tv, b->pkts[i], bs->slot_next);
+                if (unlikely(r == TM_ECODE_FAILED))
+                    goto error;
+            }
+            tv->tmqh_out(tv, b->pkts[i]);
+        }
+    } else {
+        for (i = 0; i < b->cnt; i++) {
+            r = TmThreadsSlotVarRun(tv, b->pkts[i], bs);
+            if (unlikely(r == TM_ECODE_FAILED))
+                goto error;
+            tv->tmqh_out(tv, b->pkts[i]);
+        }
+    }
+
+    b->cnt = 0;
+    return TM_ECODE_OK;
+
+error:
+    for ( ; i < b->cnt; i++)
+        TmqhOutputPacketpool(tv, b->pkts[i]);
+    b->cnt = 0;
+    return TM_ECODE_FAILED;
+}
+
+/**
+ * \internal
+ * \brief Run the slots before the batch slot and add the packet to the
+ *        batch. Packets the slots create are added first, as
+ *        TmThreadsSlotVarRun() would process those first too.
+ *
+ * \retval TM_ECODE_FAILED on error, the packet wasn't added then
+ */
+static TmEcode TmThreadsSlotVarBatchAdd(ThreadVars *tv, Packet *p,
+                                        TmSlot *slot, TmBatch *b)
+{
+    TmEcode r;
+    TmSlot *s;
+    Packet *extra_p;
+
+    for (s = slot; s != b->slot; s = s->slot_next) {
+        TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
+        PACKET_PROFILING_TMM_START(p, s->tm_id);
+
+        if (unlikely(s->id == 0)) {
+            r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, &s->slot_post_pq);
+        } else {
+            r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, NULL);
+        }
+
+        PACKET_PROFILING_TMM_END(p, s->tm_id);
+
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+            SCMutexLock(&s->slot_post_pq.mutex_q);
+            TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+            SCMutexUnlock(&s->slot_post_pq.mutex_q);
+            return TM_ECODE_FAILED;
+        }
+
+        while (s->slot_pre_pq.top != NULL) {
+            extra_p = PacketDequeue(&s->slot_pre_pq);
+            if (unlikely(extra_p == NULL))
+                continue;
+
+            r = TmThreadsSlotVarBatchAdd(tv, extra_p, s->slot_next, b);
+            if (unlikely(r == TM_ECODE_FAILED)) {
+                TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+                TmqhOutputPacketpool(tv, extra_p);
+                return TM_ECODE_FAILED;
+            }
+        }
+    }
+
+    if (b->cnt == b->size) {
+        if (TmThreadsSlotVarBatchFlush(tv, b) != TM_ECODE_OK)
+            return TM_ECODE_FAILED;
+    }
+    b->pkts[b->cnt++] = p;
+    return TM_ECODE_OK;
+}
+
+/**
+ * \internal
+ * \brief Take packets from the input queue for as long as it has them,
+ *        up to the batch size, and run them through the slots.
+ *
+ * A batch holds the packets of a flow in order, and the slots before the
+ * batch slot (stream engine) never run for a packet while an earlier
+ * packet of its flow waits for detection: when a packet of a flow that
+ * is in the batch comes in, the batch is flushed first.
+ */
+static TmEcode TmThreadsSlotVarBatchRun(ThreadVars *tv, TmSlot *s, TmBatch *b)
+{
+    Packet *p = tv->tmqh_in(tv);
+    uint32_t i;
+
+    while (p != NULL) {
+        if (p->flow != NULL) {
+            for (i = 0; i < b->cnt; i++) {
+                if (b->pkts[i]->flow == p->flow)
+                    break;
+            }
+            if (i < b->cnt && TmThreadsSlotVarBatchFlush(tv, b) != TM_ECODE_OK) {
+                TmqhOutputPacketpool(tv, p);
+                return TM_ECODE_FAILED;
+            }
+        }
+
+        if (TmThreadsSlotVarBatchAdd(tv, p, s, b) != TM_ECODE_OK) {
+            TmqhOutputPacketpool(tv, p);
+            for (i = 0; i < b->cnt; i++)
+                TmqhOutputPacketpool(tv, b->pkts[i]);
+            b->cnt = 0;
+            return TM_ECODE_FAILED;
+        }
+
+        /* we're the only reader, so a packet in the queue means
+         * tmqh_in won't block */
+        if (b->cnt >= b->size || TmqhInputQueueLen(tv) == 0)
+            break;
+        p = tv->tmqh_in(tv);
+    }
+
+    return TmThreadsSlotVarBatchFlush(tv, b);
+}
+
 /**
  * \todo Only the first "slot" currently makes the "post_pq" available
  *       to the thread module.
@@ -751,6 +945,7 @@ void *TmThreadsSlotVar(void *td)
     Packet *p = NULL;
     char run = 1;
     TmEcode r = TM_ECODE_OK;
+    TmBatch batch;
 
     /* Set the thread name */
     if (SCSetThreadName(tv->name) < 0) {
@@ -795,6 +990,14 @@ void *TmThreadsSlotVar(void *td)
     SCPerfAddToClubbedTMTable((tv->thread_group_name != NULL) ?
             tv->thread_group_name : tv->name, &tv->sc_perf_pctx);
 
+    memset(&batch, 0, sizeof(batch));
+    batch.slot = TmThreadsSlotVarGetBatchSlot(tv);
+    batch.size = threading_detect_batch_size;
+    if (batch.slot != NULL) {
+        SCLogDebug("%s: running %s over up to %u packets at once", tv->name,
+                   TmModuleGetById(batch.slot->tm_id)->name, batch.size);
+    }
+
     TmThreadsSetFlag(tv, THV_INIT_DONE);
 
     s = (TmSlot *)tv->tm_slots;
@@ -806,8 +1009,18 @@ void *TmThreadsSlotVar(void *td)
             TmThreadsUnsetFlag(tv, THV_PAUSED);
         }
 
-        /* input a packet */
-        p = tv->tmqh_in(tv);
+        if (batch.slot != NULL) {
+            /* input and run a vector of packets */
+            r = TmThreadsSlotVarBatchRun(tv, s, &batch);
+            if (r == TM_ECODE_FAILED) {
+                TmThreadsSetFlag(tv, THV_FAILED);
+                break;
+            }
+            p = NULL;
+        } else {
+            /* input a packet */
+            p = tv->tmqh_in(tv);
+        }
 
         if (p != NULL) {
             /* run the thread module(s) */
@@ -984,6 +1197,8 @@ static inline TmSlot * _TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, void *
     SC_ATOMIC_INIT(slot->SlotFunc);
     (void)SC_ATOMIC_SET(slot->SlotFunc, tm->Func);
     slot->PktAcqLoop = tm->PktAcqLoop;
+    slot->SlotFuncBatch = tm->FuncBatch;
+    slot->SlotFuncSingle = tm->Func;
     slot->SlotThreadExitPrintStats = tm->ThreadExitPrintStats;
     slot->SlotThreadDeinit = tm->ThreadDeinit;
     /* we don't have to check for the return value "-1".  We wouldn't have
@@ -1416,6 +1631,9 @@ ThreadVars *TmThreadCreate(char *name, char *inq_name, char *inqh_name,
         tv->tmqh_in = tmqh->InHandler;
         tv->InShutdownHandler = tmqh->InShutdownHandler;
         SCLogDebug("tv->tmqh_in %p", tv->tmqh_in);
+
+        if (tmqh->InHandlerSetup != NULL && tmqh->InHandlerSetup(tv) != 0)
+            goto error;
     }
 
     /* set the outgoing queue */
@@ -1647,8 +1865,7 @@ void TmThreadKillThread(ThreadVars *tv)
          * packet acquire by now using TmThreadDisableReceiveThreads()*/
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
-            PacketQueue *q = &trans_q[tv->inq->id];
-            while (q->len != 0) {
+            while (TmqhInputQueueLen(tv) != 0) {
                 usleep(1000);
             }
         }
@@ -1753,8 +1970,7 @@ again:
                  * packet acquire by now using TmThreadDisableReceiveThreads()*/
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                    PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (TmqhInputQueueLen(tv) != 0) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
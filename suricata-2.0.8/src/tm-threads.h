@@ -32,6 +32,9 @@
 #define TM_QUEUE_NAME_MAX 16
 #define TM_THREAD_NAME_MAX 16
 
+/** max number of packets a varslot thread collects for a batch slot */
+#define TM_BATCH_MAX 64
+
 typedef TmEcode (*TmSlotFunc)(ThreadVars *, Packet *, void *, PacketQueue *,
                         PacketQueue *);
 
@@ -44,6 +47,13 @@ typedef struct TmSlot_ {
 
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
+    /* TM function for a vector of packets, and the single packet
+     * function it stands in for. The batch function is only used
+     * while SlotFunc is SlotFuncSingle, so not while the slot is
+     * replaced by the dummy function. */
+    TmEcode (*SlotFuncBatch)(ThreadVars *, Packet **, uint32_t, void *);
+    TmSlotFunc SlotFuncSingle;
+
     TmEcode (*SlotThreadInit)(ThreadVars *, void *, void **);
     void (*SlotThreadExitPrintStats)(ThreadVars *, void *);
     TmEcode (*SlotThreadDeinit)(ThreadVars *, void *);
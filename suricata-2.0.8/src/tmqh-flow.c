@@ -33,17 +33,24 @@
 #include "threads.h"
 #include "threadvars.h"
 #include "tmqh-flow.h"
+#include "tmqh-packetpool.h"
 
 #include "tm-queuehandlers.h"
 
 #include "conf.h"
+#include "util-cpu.h"
+#include "util-hash-lookup3.h"
 #include "util-unittest.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
+Packet *TmqhInputFlowRing(ThreadVars *t);
+int TmqhInputFlowRingSetup(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void TmqhOutputFlowRoundRobin(ThreadVars *t, Packet *p);
+void TmqhOutputFlowTuple(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
+void *TmqhOutputFlowRingSetupCtx(char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
 void TmqhFlowRegisterTests(void);
 
@@ -55,6 +62,25 @@ void TmqhFlowRegister(void)
     tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
     tmqh_table[TMQH_FLOW].RegisterTests = TmqhFlowRegisterTests;
 
+    tmqh_table[TMQH_FLOW_RING].name = "flow-ring";
+    tmqh_table[TMQH_FLOW_RING].InHandler = TmqhInputFlowRing;
+    tmqh_table[TMQH_FLOW_RING].InHandlerSetup = TmqhInputFlowRingSetup;
+    tmqh_table[TMQH_FLOW_RING].OutHandlerCtxSetup = TmqhOutputFlowRingSetupCtx;
+    tmqh_table[TMQH_FLOW_RING].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+
+    tmqh_table[TMQH_FLOW_TUPLE].name = "flow-tuple";
+    tmqh_table[TMQH_FLOW_TUPLE].InHandler = TmqhInputFlow;
+    tmqh_table[TMQH_FLOW_TUPLE].OutHandler = TmqhOutputFlowTuple;
+    tmqh_table[TMQH_FLOW_TUPLE].OutHandlerCtxSetup = TmqhOutputFlowSetupCtx;
+    tmqh_table[TMQH_FLOW_TUPLE].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+
+    tmqh_table[TMQH_FLOW_TUPLE_RING].name = "flow-tuple-ring";
+    tmqh_table[TMQH_FLOW_TUPLE_RING].InHandler = TmqhInputFlowRing;
+    tmqh_table[TMQH_FLOW_TUPLE_RING].InHandlerSetup = TmqhInputFlowRingSetup;
+    tmqh_table[TMQH_FLOW_TUPLE_RING].OutHandler = TmqhOutputFlowTuple;
+    tmqh_table[TMQH_FLOW_TUPLE_RING].OutHandlerCtxSetup = TmqhOutputFlowRingSetupCtx;
+    tmqh_table[TMQH_FLOW_TUPLE_RING].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+
     char *scheduler = NULL;
     if (ConfGet("autofp-scheduler", &scheduler) == 1) {
         if (strcasecmp(scheduler, "round-robin") == 0) {
@@ -76,6 +102,7 @@ void TmqhFlowRegister(void)
         SCLogInfo("AutoFP mode using default \"Active Packets\" flow load balancer");
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
     }
+    tmqh_table[TMQH_FLOW_RING].OutHandler = tmqh_table[TMQH_FLOW].OutHandler;
 
     return;
 }
@@ -221,6 +248,490 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     return;
 }
 
+/* flow-ring: a lock-free ring per writer (capture) thread in front of
+ * each autofp queue. Writers never share a ring, so no atomic read-modify-
+ * write is needed on either side. */
+
+/** global, indexed by queue id like trans_q */
+static TmqhFlowRingQueue *flow_ring_queues[256];
+
+/** spin budget of a reader before it falls back to yield and sleep */
+#define TMQH_FLOW_RING_SPIN_INIT    256
+#define TMQH_FLOW_RING_SPIN_MAX     16384
+/** sched_yield rounds between spinning and sleeping */
+#define TMQH_FLOW_RING_YIELDS       4
+/** max time a reader sleeps, it's also the worst case wakeup delay
+ *  if the writer misses the sleeping flag */
+#define TMQH_FLOW_RING_SLEEP_NSEC   1000000
+
+#define RING_READ_IDX(idx)          (*(volatile uint32_t *)&(idx))
+#define RING_WRITE_IDX(idx, v)      (*(volatile uint32_t *)&(idx) = (v))
+
+/* x86 doesn't reorder a store with older stores or a load with older
+ * loads, so keeping the compiler in line is enough there. */
+#if defined(__i386__) || defined(__x86_64__)
+#define ring_barrier()  cc_barrier()
+#define ring_pause()    __asm__ __volatile__("pause")
+#else
+#define ring_barrier()  hw_barrier()
+#define ring_pause()    cc_barrier()
+#endif
+
+static PacketRing *PacketRingAlloc(uint32_t size)
+{
+    PacketRing *r = SCMallocAligned(sizeof(PacketRing), CLS);
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0x00, sizeof(PacketRing));
+
+    r->slots = SCMalloc(size * sizeof(Packet *));
+    if (unlikely(r->slots == NULL)) {
+        SCFreeAligned(r);
+        return NULL;
+    }
+    memset(r->slots, 0x00, size * sizeof(Packet *));
+
+    r->size = size;
+    r->mask = size - 1;
+    return r;
+}
+
+static void PacketRingFree(PacketRing *r)
+{
+    if (r == NULL)
+        return;
+    if (r->slots != NULL)
+        SCFree(r->slots);
+    SCFreeAligned(r);
+}
+
+/** \brief ring size: room for all packets of a writer's packet pool plus
+ *         the tunnel packets decode may alloc on top of it */
+static uint32_t PacketRingSize(void)
+{
+    extern intmax_t max_pending_packets;
+    uint32_t want = (max_pending_packets > 64) ? (uint32_t)max_pending_packets : 64;
+    uint32_t size = 64;
+
+    want *= 2;
+    while (size < want)
+        size <<= 1;
+    return size;
+}
+
+/** \internal
+ *  \brief add a packet to the ring, writer side
+ *  \retval 0 ok, -1 ring full */
+static inline int PacketRingPut(PacketRing *r, Packet *p)
+{
+    uint32_t tail = r->tail;
+
+    if (tail - r->head_cache == r->size) {
+        r->head_cache = RING_READ_IDX(r->head);
+        if (tail - r->head_cache == r->size)
+            return -1;
+    }
+
+    r->slots[tail & r->mask] = p;
+    /* slot must be visible before the new tail */
+    ring_barrier();
+    RING_WRITE_IDX(r->tail, tail + 1);
+    return 0;
+}
+
+/** \internal
+ *  \brief copy up to max packets from the ring, reader side. The slots are
+ *         only handed back to the writer by PacketRingRelease.
+ *  \param depth set to the number of packets in the ring
+ *  \retval cnt number of packets copied */
+static inline uint32_t PacketRingReadBulk(PacketRing *r, Packet **pkts,
+                                          uint32_t max, uint32_t *depth)
+{
+    uint32_t head = r->head;
+    uint32_t avail = r->tail_cache - head;
+
+    if (avail < max) {
+        r->tail_cache = RING_READ_IDX(r->tail);
+        avail = r->tail_cache - head;
+        if (avail == 0)
+            return 0;
+    }
+    /* don't read the slots before the tail */
+    ring_barrier();
+
+    *depth = avail;
+    uint32_t cnt = (avail < max) ? avail : max;
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        pkts[i] = r->slots[(head + i) & r->mask];
+    }
+    return cnt;
+}
+
+static inline void PacketRingRelease(PacketRing *r, uint32_t cnt)
+{
+    /* done reading the slots before the writer may reuse them */
+    ring_barrier();
+    RING_WRITE_IDX(r->head, r->head + cnt);
+}
+
+static inline uint32_t PacketRingLen(PacketRing *r)
+{
+    uint32_t head = RING_READ_IDX(r->head);
+    return RING_READ_IDX(r->tail) - head;
+}
+
+static TmqhFlowRingQueue *TmqhFlowRingQueueGet(uint16_t id)
+{
+    if (flow_ring_queues[id] == NULL) {
+        TmqhFlowRingQueue *rq = SCMalloc(sizeof(TmqhFlowRingQueue));
+        if (unlikely(rq == NULL))
+            return NULL;
+        memset(rq, 0x00, sizeof(TmqhFlowRingQueue));
+        flow_ring_queues[id] = rq;
+    }
+    return flow_ring_queues[id];
+}
+
+/**
+ * \brief number of packets waiting for the reader of a flow-ring queue
+ *
+ * Safe to call from any thread. The rings are read before the reader's
+ * batch, as the reader fills its batch before releasing the ring slots,
+ * so a packet moving between the two is not missed.
+ */
+uint32_t TmqhFlowRingQueueLen(uint16_t id)
+{
+    TmqhFlowRingQueue *rq = flow_ring_queues[id];
+    if (rq == NULL)
+        return 0;
+
+    uint32_t len = 0;
+    uint16_t i;
+    for (i = 0; i < RING_READ_IDX(rq->rings_cnt); i++) {
+        len += PacketRingLen(rq->rings[i]);
+    }
+    hw_barrier();
+
+    uint32_t idx = RING_READ_IDX(rq->batch_idx);
+    uint32_t cnt = RING_READ_IDX(rq->batch_cnt);
+    if (cnt > idx)
+        len += cnt - idx;
+    return len;
+}
+
+void TmqhFlowRingCleanup(void)
+{
+    uint16_t id, i;
+
+    for (id = 0; id < 256; id++) {
+        TmqhFlowRingQueue *rq = flow_ring_queues[id];
+        if (rq == NULL)
+            continue;
+
+        uint64_t full = 0;
+        for (i = 0; i < rq->rings_cnt; i++) {
+            full += rq->rings[i]->full;
+            PacketRingFree(rq->rings[i]);
+        }
+        SCLogDebug("flow-ring queue %"PRIu16": %"PRIu32" rings, %"PRIu64
+                " full, %"PRIu32" batches", id, rq->rings_cnt, full, rq->batches);
+
+        SCFree(rq);
+        flow_ring_queues[id] = NULL;
+    }
+}
+
+/**
+ * \brief setup the flow-ring queue handlers ctx
+ *
+ * Same as TmqhOutputFlowSetupCtx, but also gives the calling thread its
+ * own ring in front of each of the queues.
+ *
+ * \param queue_str comma separated string with output queue names
+ *
+ * \retval ctx queues handlers ctx or NULL in error
+ */
+void *TmqhOutputFlowRingSetupCtx(char *queue_str)
+{
+    TmqhFlowCtx *ctx = TmqhOutputFlowSetupCtx(queue_str);
+    if (ctx == NULL)
+        return NULL;
+
+    uint32_t size = PacketRingSize();
+    uint16_t i;
+    for (i = 0; i < ctx->size; i++) {
+        TmqhFlowMode *m = &ctx->queues[i];
+        uint16_t id = (uint16_t)(m->q - trans_q);
+
+        TmqhFlowRingQueue *rq = TmqhFlowRingQueueGet(id);
+        if (rq == NULL)
+            goto error;
+        if (rq->rings_cnt == TMQH_FLOW_RING_MAX_WRITERS) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "flow-ring queue %"PRIu16
+                    " has more than %d writers", id, TMQH_FLOW_RING_MAX_WRITERS);
+            goto error;
+        }
+
+        PacketRing *r = PacketRingAlloc(size);
+        if (r == NULL)
+            goto error;
+
+        /* the reader may already be running: publish the ring first */
+        rq->rings[rq->rings_cnt] = r;
+        hw_barrier();
+        RING_WRITE_IDX(rq->rings_cnt, rq->rings_cnt + 1);
+
+        m->ring = r;
+        m->rq = rq;
+    }
+
+    SCLogDebug("flow-ring: %"PRIu16" rings of %"PRIu32" packets", ctx->size, size);
+    return ctx;
+
+error:
+    TmqhOutputFlowFreeCtx(ctx);
+    SCFree(ctx);
+    return NULL;
+}
+
+/** \internal
+ *  \brief wake up the reader of a queue */
+static void TmqhFlowRingWakeup(PacketQueue *q)
+{
+    SCMutexLock(&q->mutex_q);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+/** \internal
+ *  \brief put a packet in our ring of the queue, waiting for the reader
+ *         if the ring is full. */
+static void TmqhFlowRingPut(TmqhFlowMode *m, Packet *p)
+{
+    PacketRing *r = m->ring;
+
+    if (unlikely(PacketRingPut(r, p) != 0)) {
+        r->full++;
+        do {
+            TmqhFlowRingWakeup(m->q);
+            sched_yield();
+        } while (PacketRingPut(r, p) != 0);
+    }
+
+    /* the writer doesn't fence here, so it may miss the reader going to
+     * sleep. That delays the packet by at most TMQH_FLOW_RING_SLEEP_NSEC. */
+    if (m->rq->sleeping)
+        TmqhFlowRingWakeup(m->q);
+}
+
+/** \internal
+ *  \brief get the next packet for the reader of a flow-ring queue
+ *
+ *  Packets from the reader's batch go first, then packets queued to the
+ *  regular queue (pseudo packets, detect reload), then a new batch from
+ *  the rings, which are visited round robin.
+ *
+ *  \param depth set to the depth of the ring a new batch was taken from
+ */
+static inline Packet *TmqhFlowRingGet(TmqhFlowRingQueue *rq, PacketQueue *q,
+                                      uint32_t *depth)
+{
+    if (rq->batch_idx < rq->batch_cnt)
+        return rq->batch[rq->batch_idx++];
+
+    if (q->len > 0) {
+        Packet *p = NULL;
+        SCMutexLock(&q->mutex_q);
+        if (q->len > 0)
+            p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+        if (p != NULL)
+            return p;
+    }
+
+    uint32_t rings_cnt = RING_READ_IDX(rq->rings_cnt);
+    uint32_t i;
+    for (i = 0; i < rings_cnt; i++) {
+        PacketRing *r = rq->rings[rq->next];
+        if (++rq->next >= rings_cnt)
+            rq->next = 0;
+
+        uint32_t cnt = PacketRingReadBulk(r, rq->batch, TMQH_FLOW_RING_BATCH, depth);
+        if (cnt > 0) {
+            /* batch before release, see TmqhFlowRingQueueLen */
+            RING_WRITE_IDX(rq->batch_idx, 1);
+            RING_WRITE_IDX(rq->batch_cnt, cnt);
+            PacketRingRelease(r, cnt);
+            rq->batches++;
+            return rq->batch[0];
+        }
+    }
+
+    return NULL;
+}
+
+static void TmqhFlowRingUpdateFull(ThreadVars *tv, TmqhFlowRingQueue *rq)
+{
+    uint64_t full = 0;
+    uint16_t i;
+    for (i = 0; i < RING_READ_IDX(rq->rings_cnt); i++) {
+        full += rq->rings[i]->full;
+    }
+    SCPerfCounterSetUI64(rq->counter_full, tv->sc_perf_pca, full);
+}
+
+/** \internal
+ *  \brief update the depth counters when a new batch was taken */
+static inline Packet *TmqhFlowRingGetCounted(ThreadVars *tv,
+        TmqhFlowRingQueue *rq, PacketQueue *q)
+{
+    uint32_t depth = 0;
+    uint32_t batches = rq->batches;
+
+    Packet *p = TmqhFlowRingGet(rq, q, &depth);
+    if (rq->batches != batches) {
+        SCPerfCounterAddUI64(rq->counter_depth_avg, tv->sc_perf_pca, depth);
+        SCPerfCounterSetUI64(rq->counter_depth_max, tv->sc_perf_pca, depth);
+        if ((rq->batches & 0xff) == 0)
+            TmqhFlowRingUpdateFull(tv, rq);
+    }
+    return p;
+}
+
+/**
+ * \brief flow-ring input handler
+ *
+ * If there are no packets, spin for a while, then yield, then sleep on
+ * the queue's condition. The spin budget adapts: it grows when spinning
+ * finds packets and shrinks when it doesn't. On a single cpu there is
+ * no spinning at all.
+ */
+Packet *TmqhInputFlowRing(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhFlowRingQueue *rq = flow_ring_queues[tv->inq->id];
+    Packet *p;
+    uint32_t i;
+
+    SCPerfSyncCountersIfSignalled(tv);
+
+    p = TmqhFlowRingGetCounted(tv, rq, q);
+    if (p != NULL)
+        return p;
+
+    for (i = 0; i < rq->spin; i++) {
+        ring_pause();
+        p = TmqhFlowRingGetCounted(tv, rq, q);
+        if (p != NULL) {
+            if (rq->spin < rq->spin_max)
+                rq->spin <<= 1;
+            return p;
+        }
+    }
+
+    for (i = 0; i < TMQH_FLOW_RING_YIELDS; i++) {
+        sched_yield();
+        p = TmqhFlowRingGetCounted(tv, rq, q);
+        if (p != NULL)
+            return p;
+    }
+
+    if (rq->spin > TMQH_FLOW_RING_SPIN_INIT)
+        rq->spin >>= 1;
+
+    SCMutexLock(&q->mutex_q);
+    rq->sleeping = 1;
+    /* pairs with the writer's check of the flag */
+    hw_barrier();
+    if (q->len == 0 && TmqhFlowRingQueueLen(tv->inq->id) == 0) {
+        struct timeval tv_now;
+        struct timespec ts;
+
+        gettimeofday(&tv_now, NULL);
+        ts.tv_sec = tv_now.tv_sec;
+        ts.tv_nsec = tv_now.tv_usec * 1000 + TMQH_FLOW_RING_SLEEP_NSEC;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        SCCondTimedwait(&q->cond_q, &q->mutex_q, &ts);
+        SCPerfCounterIncr(rq->counter_sleeps, tv->sc_perf_pca);
+    }
+    rq->sleeping = 0;
+    SCMutexUnlock(&q->mutex_q);
+
+    TmqhFlowRingUpdateFull(tv, rq);
+
+    /* may be NULL, e.g. when woken up by a signal */
+    return TmqhFlowRingGetCounted(tv, rq, q);
+}
+
+/**
+ * \brief flow-ring reader thread setup: register its counters
+ */
+int TmqhInputFlowRingSetup(ThreadVars *tv)
+{
+    TmqhFlowRingQueue *rq = TmqhFlowRingQueueGet(tv->inq->id);
+    if (rq == NULL)
+        return -1;
+
+    rq->spin_max = (UtilCpuGetNumProcessorsOnline() > 1) ?
+        TMQH_FLOW_RING_SPIN_MAX : 0;
+    rq->spin = (rq->spin_max > 0) ? TMQH_FLOW_RING_SPIN_INIT : 0;
+
+    rq->counter_depth_avg = SCPerfTVRegisterAvgCounter("autofp.ring_depth_avg",
+            tv, SC_PERF_TYPE_UINT64, "NULL");
+    rq->counter_depth_max = SCPerfTVRegisterMaxCounter("autofp.ring_depth_max",
+            tv, SC_PERF_TYPE_UINT64, "NULL");
+    rq->counter_sleeps = SCPerfTVRegisterCounter("autofp.ring_sleeps",
+            tv, SC_PERF_TYPE_UINT64, "NULL");
+    rq->counter_full = SCPerfTVRegisterCounter("autofp.ring_full",
+            tv, SC_PERF_TYPE_UINT64, "NULL");
+    return 0;
+}
+
+/** \internal
+ *  \brief queue a packet to the selected queue */
+static inline void TmqhFlowEnqueue(TmqhFlowMode *m, Packet *p)
+{
+    if (m->ring != NULL) {
+        TmqhFlowRingPut(m, p);
+        return;
+    }
+
+    PacketQueue *q = m->q;
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+/** \internal
+ *  \brief packets waiting in the selected queue */
+static inline uint32_t TmqhFlowLen(TmqhFlowMode *m)
+{
+    if (m->rq != NULL)
+        return m->q->len + TmqhFlowRingQueueLen((uint16_t)(m->q - trans_q));
+    return m->q->len;
+}
+
+/**
+ * \brief return packets of locally bypassed flows to the pool right away,
+ *        instead of passing them to the stream and detect threads. In IPS
+ *        mode they still need their verdict, so they are queued as usual.
+ *
+ * \retval 1 packet was released, 0 packet needs to be queued
+ */
+static inline int TmqhOutputFlowBypassed(ThreadVars *tv, Packet *p)
+{
+    if (!(p->flags & PKT_BYPASSED) || EngineModeIsIPS())
+        return 0;
+
+    TmqhOutputPacketpool(tv, p);
+    return 1;
+}
+
 /**
  * \brief select the queue to output in a round robin fashion.
  *
@@ -231,6 +742,9 @@ void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
 {
     int32_t qid = 0;
 
+    if (TmqhOutputFlowBypassed(tv, p))
+        return;
+
     TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
 
     /* if no flow we use the first queue,
@@ -254,11 +768,7 @@ void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 
     return;
 }
@@ -273,6 +783,9 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
 {
     int32_t qid = 0;
 
+    if (TmqhOutputFlowBypassed(tv, p))
+        return;
+
     TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
 
     /* if no flow we use the first queue,
@@ -283,10 +796,11 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
             uint16_t i = 0;
             int lowest_id = 0;
             TmqhFlowMode *queues = ctx->queues;
-            uint32_t lowest = queues[i].q->len;
+            uint32_t lowest = TmqhFlowLen(&queues[i]);
             for (i = 1; i < ctx->size; i++) {
-                if (queues[i].q->len < lowest) {
-                    lowest = queues[i].q->len;
+                uint32_t len = TmqhFlowLen(&queues[i]);
+                if (len < lowest) {
+                    lowest = len;
                     lowest_id = i;
                 }
             }
@@ -302,11 +816,7 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 
     return;
 }
@@ -321,6 +831,9 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 {
     int32_t qid = 0;
 
+    if (TmqhOutputFlowBypassed(tv, p))
+        return;
+
     TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
 
     /* if no flow we use the first queue,
@@ -349,15 +862,159 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 
     return;
 }
 
+/**
+ * \brief hash the raw packet on its addresses and ports
+ *
+ * For readers that hand out undecoded packets: the layers are parsed just
+ * far enough to find the ip header. The hash is the same for both
+ * directions. The ipv6 extension headers in front of the ports are
+ * skipped. Like the kernel's flow fanout, fragments are hashed on the
+ * addresses only: they usually go to another queue than the unfragmented
+ * packets of their flow, which are then handled by two threads.
+ *
+ * \retval hash 0 for non ip packets
+ */
+static uint32_t TmqhFlowTupleHash(const Packet *p)
+{
+    const uint8_t *pkt = GET_PKT_DATA(p);
+    uint32_t len = GET_PKT_LEN(p);
+    uint32_t off = 0;
+    uint16_t proto = 0;
+    uint32_t key[10];
+    uint32_t key_len;
+
+    switch (p->datalink) {
+        case LINKTYPE_ETHERNET:
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            proto = (pkt[12] << 8) | pkt[13];
+            off = ETHERNET_HEADER_LEN;
+            while ((proto == ETHERNET_TYPE_VLAN || proto == ETHERNET_TYPE_8021AD ||
+                    proto == ETHERNET_TYPE_8021QINQ) && len >= off + 4) {
+                proto = (pkt[off + 2] << 8) | pkt[off + 3];
+                off += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < SLL_HEADER_LEN)
+                return 0;
+            proto = (pkt[14] << 8) | pkt[15];
+            off = SLL_HEADER_LEN;
+            break;
+        case LINKTYPE_PPP:
+            if (len < PPP_HEADER_LEN)
+                return 0;
+            proto = (pkt[2] << 8) | pkt[3];
+            if (proto == PPP_IP)
+                proto = ETHERNET_TYPE_IP;
+            else if (proto == PPP_IPV6)
+                proto = ETHERNET_TYPE_IPV6;
+            off = PPP_HEADER_LEN;
+            break;
+        case LINKTYPE_RAW:
+            if (len < 1)
+                return 0;
+            proto = ((pkt[0] >> 4) == 6) ? ETHERNET_TYPE_IPV6 : ETHERNET_TYPE_IP;
+            break;
+        default:
+            return 0;
+    }
+
+    const uint8_t *src, *dst;
+    uint32_t alen, l4;
+    uint8_t l4proto;
+
+    if (proto == ETHERNET_TYPE_IP) {
+        if (len < off + IPV4_HEADER_LEN || (pkt[off] >> 4) != 4)
+            return 0;
+        alen = 4;
+        src = pkt + off + 12;
+        dst = pkt + off + 16;
+        l4proto = pkt[off + 9];
+        l4 = off + (pkt[off] & 0x0f) * 4;
+        /* no ports in fragments */
+        if ((((pkt[off + 6] << 8) | pkt[off + 7]) & 0x3fff) != 0)
+            l4proto = 0;
+    } else if (proto == ETHERNET_TYPE_IPV6) {
+        if (len < off + IPV6_HEADER_LEN || (pkt[off] >> 4) != 6)
+            return 0;
+        alen = 16;
+        src = pkt + off + 8;
+        dst = pkt + off + 24;
+        l4proto = pkt[off + 6];
+        l4 = off + IPV6_HEADER_LEN;
+
+        int hdrs;
+        for (hdrs = 0; hdrs < 8 && len >= l4 + 8; hdrs++) {
+            if (l4proto == IPPROTO_HOPOPTS || l4proto == IPPROTO_ROUTING ||
+                l4proto == IPPROTO_DSTOPTS) {
+                l4proto = pkt[l4];
+                l4 += (pkt[l4 + 1] + 1) * 8;
+            } else if (l4proto == IPPROTO_AH) {
+                l4proto = pkt[l4];
+                l4 += (pkt[l4 + 1] + 2) * 4;
+            } else {
+                /* IPPROTO_FRAGMENT included, no ports */
+                break;
+            }
+        }
+    } else {
+        return 0;
+    }
+
+    uint16_t sp = 0, dp = 0;
+    if ((l4proto == IPPROTO_TCP || l4proto == IPPROTO_UDP ||
+         l4proto == IPPROTO_SCTP) && len >= l4 + 4) {
+        sp = (pkt[l4] << 8) | pkt[l4 + 1];
+        dp = (pkt[l4 + 2] << 8) | pkt[l4 + 3];
+    } else {
+        l4proto = 0;
+    }
+
+    /* same order for both directions */
+    int cmp = memcmp(src, dst, alen);
+    if (cmp > 0 || (cmp == 0 && sp > dp)) {
+        const uint8_t *ta = src;
+        src = dst;
+        dst = ta;
+        uint16_t tp = sp;
+        sp = dp;
+        dp = tp;
+    }
+
+    memcpy(key, src, alen);
+    memcpy((uint8_t *)key + alen, dst, alen);
+    key_len = (alen * 2) / sizeof(uint32_t);
+    key[key_len++] = (sp << 16) | dp;
+    key[key_len++] = l4proto;
+
+    return hashword(key, key_len, 0);
+}
+
+/**
+ * \brief select the queue to output to based on the packet's tuple.
+ *
+ * For readers that don't decode, like the pcap-file workers mode. The
+ * packets of a flow all go to the same queue, without looking up the flow.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowTuple(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    int32_t qid = TmqhFlowTupleHash(p) % ctx->size;
+
+    (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
+}
+
 #ifdef UNITTESTS
 
 static int TmqhOutputFlowSetupCtxTest01(void)
@@ -496,6 +1153,306 @@ end:
     return retval;
 }
 
+/**
+ * \test ring put and get, wrapping around and running full.
+ */
+static int TmqhFlowRingTest01(void)
+{
+    int retval = 0;
+    Packet *pkts[TMQH_FLOW_RING_BATCH];
+    uint32_t depth = 0;
+    uintptr_t i, n = 1;
+
+    PacketRing *r = PacketRingAlloc(8);
+    if (r == NULL)
+        goto end;
+
+    /* move the indexes up to the point of wrapping around */
+    r->head = r->tail = r->head_cache = r->tail_cache = UINT32_MAX - 2;
+
+    for (i = 0; i < 8; i++) {
+        if (PacketRingPut(r, (Packet *)n++) != 0)
+            goto end;
+    }
+    if (PacketRingPut(r, (Packet *)n) != -1)
+        goto end;
+    if (PacketRingLen(r) != 8)
+        goto end;
+
+    if (PacketRingReadBulk(r, pkts, 5, &depth) != 5 || depth != 8)
+        goto end;
+    /* not released yet, so still full */
+    if (PacketRingPut(r, (Packet *)n) != -1)
+        goto end;
+    PacketRingRelease(r, 5);
+    for (i = 0; i < 5; i++) {
+        if (pkts[i] != (Packet *)(i + 1))
+            goto end;
+    }
+
+    for (i = 0; i < 5; i++) {
+        if (PacketRingPut(r, (Packet *)n++) != 0)
+            goto end;
+    }
+    if (PacketRingReadBulk(r, pkts, TMQH_FLOW_RING_BATCH, &depth) != 8 ||
+            depth != 8)
+        goto end;
+    PacketRingRelease(r, 8);
+    for (i = 0; i < 8; i++) {
+        if (pkts[i] != (Packet *)(i + 6))
+            goto end;
+    }
+    if (PacketRingLen(r) != 0 ||
+            PacketRingReadBulk(r, pkts, TMQH_FLOW_RING_BATCH, &depth) != 0)
+        goto end;
+
+    retval = 1;
+end:
+    PacketRingFree(r);
+    return retval;
+}
+
+/**
+ * \test two writers to a queue, the reader takes batches from the rings
+ *       in turn and the queue length covers both rings and the batch.
+ */
+static int TmqhFlowRingTest02(void)
+{
+    int retval = 0;
+    TmqhFlowCtx *fctx1 = NULL, *fctx2 = NULL;
+    uintptr_t i;
+    uint32_t depth = 0;
+
+    TmqResetQueues();
+
+    Tmq *tmq = TmqCreateQueue("queue1");
+    if (tmq == NULL)
+        goto end;
+    PacketQueue *q = &trans_q[tmq->id];
+
+    fctx1 = TmqhOutputFlowRingSetupCtx("queue1");
+    fctx2 = TmqhOutputFlowRingSetupCtx("queue1");
+    if (fctx1 == NULL || fctx2 == NULL)
+        goto end;
+
+    TmqhFlowRingQueue *rq = flow_ring_queues[tmq->id];
+    if (rq == NULL || rq->rings_cnt != 2 ||
+            fctx1->queues[0].rq != rq || fctx2->queues[0].rq != rq ||
+            fctx1->queues[0].ring == fctx2->queues[0].ring)
+        goto end;
+
+    /* writer 1 queues 40 packets, writer 2 queues 2 */
+    for (i = 1; i <= 40; i++) {
+        TmqhFlowEnqueue(&fctx1->queues[0], (Packet *)i);
+    }
+    TmqhFlowEnqueue(&fctx2->queues[0], (Packet *)1001);
+    TmqhFlowEnqueue(&fctx2->queues[0], (Packet *)1002);
+
+    if (TmqhFlowRingQueueLen(tmq->id) != 42 ||
+            TmqhFlowLen(&fctx1->queues[0]) != 42)
+        goto end;
+
+    /* a full batch from ring 1 */
+    for (i = 1; i <= TMQH_FLOW_RING_BATCH; i++) {
+        if (TmqhFlowRingGet(rq, q, &depth) != (Packet *)i)
+            goto end;
+    }
+    if (depth != 40 || TmqhFlowRingQueueLen(tmq->id) != 42 - TMQH_FLOW_RING_BATCH)
+        goto end;
+    /* then ring 2 gets its turn */
+    if (TmqhFlowRingGet(rq, q, &depth) != (Packet *)1001 ||
+            TmqhFlowRingGet(rq, q, &depth) != (Packet *)1002)
+        goto end;
+    for (i = TMQH_FLOW_RING_BATCH + 1; i <= 40; i++) {
+        if (TmqhFlowRingGet(rq, q, &depth) != (Packet *)i)
+            goto end;
+    }
+    if (TmqhFlowRingGet(rq, q, &depth) != NULL ||
+            TmqhFlowRingQueueLen(tmq->id) != 0)
+        goto end;
+
+    retval = 1;
+end:
+    if (fctx1 != NULL) {
+        TmqhOutputFlowFreeCtx(fctx1);
+        SCFree(fctx1);
+    }
+    if (fctx2 != NULL) {
+        TmqhOutputFlowFreeCtx(fctx2);
+        SCFree(fctx2);
+    }
+    TmqhFlowRingCleanup();
+    TmqResetQueues();
+    return retval;
+}
+
+static Packet *TmqhFlowTupleTestPacket(uint8_t *raw, uint16_t len)
+{
+    Packet *p = PacketGetFromAlloc();
+    if (p == NULL)
+        return NULL;
+    p->datalink = LINKTYPE_ETHERNET;
+    if (PacketCopyData(p, raw, len) != 0) {
+        PacketFree(p);
+        return NULL;
+    }
+    return p;
+}
+
+/**
+ * \test the tuple hash is the same for both directions of a flow and
+ *       with vlan tags, and differs for another flow.
+ */
+static int TmqhFlowTupleHashTest01(void)
+{
+    /* 10.0.0.1:1234 -> 10.0.0.2:80 */
+    uint8_t fwd[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+        0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    /* 10.0.0.2:80 -> 10.0.0.1:1234 */
+    uint8_t rev[] = {
+        0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+        0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x02, 0x0a, 0x00, 0x00, 0x01,
+        0x00, 0x50, 0x04, 0xd2, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x12, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    /* 10.0.0.1:1234 -> 10.0.0.2:80, vlan 10 */
+    uint8_t vlan[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x81, 0x00, 0x00, 0x0a, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+        0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    /* arp */
+    uint8_t arp[] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x08, 0x06,
+        0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01 };
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL, *p4 = NULL;
+    int result = 0;
+
+    p1 = TmqhFlowTupleTestPacket(fwd, sizeof(fwd));
+    p2 = TmqhFlowTupleTestPacket(rev, sizeof(rev));
+    p3 = TmqhFlowTupleTestPacket(vlan, sizeof(vlan));
+    p4 = TmqhFlowTupleTestPacket(arp, sizeof(arp));
+    if (p1 == NULL || p2 == NULL || p3 == NULL || p4 == NULL)
+        goto end;
+
+    uint32_t hash = TmqhFlowTupleHash(p1);
+    if (hash == 0 || TmqhFlowTupleHash(p2) != hash ||
+            TmqhFlowTupleHash(p3) != hash || TmqhFlowTupleHash(p4) != 0)
+        goto end;
+
+    /* other source port */
+    GET_PKT_DATA(p1)[ETHERNET_HEADER_LEN + IPV4_HEADER_LEN + 1] = 0xd3;
+    if (TmqhFlowTupleHash(p1) == hash)
+        goto end;
+
+    /* fragment: addresses only */
+    GET_PKT_DATA(p2)[ETHERNET_HEADER_LEN + 6] = 0x20;
+    GET_PKT_DATA(p3)[ETHERNET_HEADER_LEN + 4 + 6] = 0x20;
+    GET_PKT_DATA(p3)[ETHERNET_HEADER_LEN + 4 + IPV4_HEADER_LEN + 3] = 0x51;
+    if (TmqhFlowTupleHash(p2) == hash ||
+            TmqhFlowTupleHash(p2) != TmqhFlowTupleHash(p3))
+        goto end;
+
+    result = 1;
+end:
+    if (p1 != NULL)
+        PacketFree(p1);
+    if (p2 != NULL)
+        PacketFree(p2);
+    if (p3 != NULL)
+        PacketFree(p3);
+    if (p4 != NULL)
+        PacketFree(p4);
+    return result;
+}
+
+/**
+ * \test ipv6: extension headers don't change the hash, fragments are
+ *       hashed on the addresses only. Packets pointing into a mapped
+ *       file hash like copied ones.
+ */
+static int TmqhFlowTupleHashTest02(void)
+{
+    /* 2001:db8::1:1234 -> 2001:db8::2:80 */
+    uint8_t plain[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x86, 0xdd,
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x14, 0x06, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    /* same, behind a hop-by-hop header */
+    uint8_t hbh[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x86, 0xdd,
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x1c, 0x00, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        0x06, 0x00, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00,
+        0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    /* same, first fragment */
+    uint8_t frag[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x86, 0xdd,
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x1c, 0x2c, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        0x06, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+        0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    Packet *p1 = TmqhFlowTupleTestPacket(plain, sizeof(plain));
+    Packet *p2 = TmqhFlowTupleTestPacket(hbh, sizeof(hbh));
+    Packet *p3 = TmqhFlowTupleTestPacket(frag, sizeof(frag));
+    Packet *p4 = PacketGetFromAlloc();
+    int result = 0;
+
+    if (p1 == NULL || p2 == NULL || p3 == NULL || p4 == NULL)
+        goto end;
+
+    uint32_t hash = TmqhFlowTupleHash(p1);
+    if (hash == 0 || TmqhFlowTupleHash(p2) != hash)
+        goto end;
+
+    /* the fragment goes elsewhere: its flow is split over two workers */
+    if (TmqhFlowTupleHash(p3) == 0 || TmqhFlowTupleHash(p3) == hash)
+        goto end;
+
+    /* zero copy, as the pcap-file reader does for mapped files */
+    p4->datalink = LINKTYPE_ETHERNET;
+    if (PacketSetData(p4, plain, sizeof(plain)) != 0 ||
+            GET_PKT_DATA(p4) != plain || TmqhFlowTupleHash(p4) != hash)
+        goto end;
+
+    result = 1;
+end:
+    if (p1 != NULL)
+        PacketFree(p1);
+    if (p2 != NULL)
+        PacketFree(p2);
+    if (p3 != NULL)
+        PacketFree(p3);
+    if (p4 != NULL)
+        PacketFree(p4);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -504,6 +1461,10 @@ void TmqhFlowRegisterTests(void)
     UtRegisterTest("TmqhOutputFlowSetupCtxTest01", TmqhOutputFlowSetupCtxTest01, 1);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest02", TmqhOutputFlowSetupCtxTest02, 1);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03", TmqhOutputFlowSetupCtxTest03, 1);
+    UtRegisterTest("TmqhFlowRingTest01", TmqhFlowRingTest01, 1);
+    UtRegisterTest("TmqhFlowRingTest02", TmqhFlowRingTest02, 1);
+    UtRegisterTest("TmqhFlowTupleHashTest01", TmqhFlowTupleHashTest01, 1);
+    UtRegisterTest("TmqhFlowTupleHashTest02", TmqhFlowTupleHashTest02, 1);
 #endif
 
     return;
@@ -24,8 +24,60 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+/** packets a flow-ring reader takes from a ring at once */
+#define TMQH_FLOW_RING_BATCH        32
+/** max writers (capture threads) per flow-ring queue */
+#define TMQH_FLOW_RING_MAX_WRITERS  64
+
+/** \brief bounded lock-free ring of packets for a single writer and a
+ *         single reader. The indexes run freely, size is a power of 2.
+ *         Each side caches the index of the other side, so the shared
+ *         cache lines are only touched when the ring looks full or empty */
+typedef struct PacketRing_ {
+    /** writer side */
+    uint32_t tail;          /**< next slot to fill */
+    uint32_t head_cache;    /**< last head seen by the writer */
+    uint64_t full;          /**< packets that found the ring full */
+    uint8_t pad0[CLS - 16];
+
+    /** reader side */
+    uint32_t head;          /**< next slot to take */
+    uint32_t tail_cache;    /**< last tail seen by the reader */
+    uint8_t pad1[CLS - 8];
+
+    uint32_t size;
+    uint32_t mask;
+    Packet **slots;
+} PacketRing;
+
+/** \brief input side of a flow-ring queue: one ring per writer thread */
+typedef struct TmqhFlowRingQueue_ {
+    PacketRing *rings[TMQH_FLOW_RING_MAX_WRITERS];
+    uint32_t rings_cnt;
+
+    /** reader side */
+    uint16_t next;          /**< ring to read first, for fairness */
+    uint32_t spin;          /**< current spin budget before sleeping */
+    uint32_t spin_max;
+    uint32_t batch_idx;
+    uint32_t batch_cnt;
+    Packet *batch[TMQH_FLOW_RING_BATCH];
+    uint32_t batches;
+
+    /** set while the reader waits on the queue's condition */
+    volatile int sleeping;
+
+    uint16_t counter_depth_avg;
+    uint16_t counter_depth_max;
+    uint16_t counter_sleeps;
+    uint16_t counter_full;
+} TmqhFlowRingQueue;
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    /** flow-ring handler: our ring of the queue and the queue itself */
+    PacketRing *ring;
+    TmqhFlowRingQueue *rq;
     SC_ATOMIC_DECLARE(uint64_t, total_packets);
     SC_ATOMIC_DECLARE(uint64_t, total_flows);
 } TmqhFlowMode;
@@ -44,5 +96,7 @@ typedef struct TmqhFlowCtx_ {
 
 void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
+void TmqhFlowRingCleanup(void);
+uint32_t TmqhFlowRingQueueLen(uint16_t);
 
 #endif /* __TMQH_FLOW_H__ */
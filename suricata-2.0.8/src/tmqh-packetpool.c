@@ -20,12 +20,16 @@
  *
  * \author Victor Julien <victor@inliniac.net>
  *
- * Packetpool queue handlers. Packet pool is implemented as a ringbuffer.
- * We're using a multi reader / multi writer version of the ringbuffer,
- * that is relatively expensive due to the CAS function. But it is necessary
- * because every thread can return packets to the pool and multiple parts
- * of the code retrieve packets (Decode, Defrag) and these can run in their
- * own threads as well.
+ * Packetpool queue handlers. Every capture thread has its own pool of
+ * packets (PktPool). Getting a packet and returning it from the thread
+ * that owns it are simple list operations on the thread's own pool.
+ *
+ * Packets can be returned from any thread though, e.g. by the detect
+ * threads in autofp mode, decoders or the flow manager. Those go onto
+ * a lock free return stack of the owning pool, which the owner takes
+ * over as a whole when it runs out of packets.
+ *
+ * Threads without a pool get their packets from PacketGetFromAlloc().
  */
 
 #include "suricata.h"
@@ -43,18 +47,74 @@
 #include "stream-tcp-reassemble.h"
 
 #include "tm-queuehandlers.h"
+#include "tm-threads.h"
 
 #include "pkt-var.h"
 
 #include "tmqh-packetpool.h"
 
-#include "util-ringbuffer.h"
+#include "util-atomic.h"
 #include "util-debug.h"
 #include "util-error.h"
 #include "util-profiling.h"
 #include "util-device.h"
+#include "util-unittest.h"
+
+/* return stack of a pool whose thread is gone: packets returned
+ * to it are freed */
+#define PKTPOOL_ORPHANED ((Packet *)0x1)
+
+/* time to wait for packets to be returned to an empty pool */
+#define PKTPOOL_WAIT_USEC 1
+
+/** packets per thread pool */
+static intmax_t pool_size = 0;
+
+/** all pools, so they can be freed at shutdown. The pool itself has
+ *  to outlive its thread as other threads may still return packets. */
+static PktPool *pool_list = NULL;
+static SCMutex pool_list_lock = SCMUTEX_INITIALIZER;
+
+/** packets freed as their pool's thread was gone already */
+SC_ATOMIC_DECLARE(uint64_t, pool_orphan_frees);
+
+#ifdef TLS
+static __thread PktPool *thread_pkt_pool = NULL;
+
+static inline PktPool *GetThreadPacketPool(void)
+{
+    return thread_pkt_pool;
+}
+
+static inline void SetThreadPacketPool(PktPool *pool)
+{
+    thread_pkt_pool = pool;
+}
+#else
+static pthread_key_t pkt_pool_thread_key;
+static pthread_once_t pkt_pool_thread_key_once = PTHREAD_ONCE_INIT;
+
+static void PktPoolThreadKeyInit(void)
+{
+    if (pthread_key_create(&pkt_pool_thread_key, NULL) != 0) {
+        SCLogError(SC_ERR_FATAL, "failed to create packet pool thread key");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline PktPool *GetThreadPacketPool(void)
+{
+    (void)pthread_once(&pkt_pool_thread_key_once, PktPoolThreadKeyInit);
+    return (PktPool *)pthread_getspecific(pkt_pool_thread_key);
+}
+
+static inline void SetThreadPacketPool(PktPool *pool)
+{
+    (void)pthread_once(&pkt_pool_thread_key_once, PktPoolThreadKeyInit);
+    pthread_setspecific(pkt_pool_thread_key, pool);
+}
+#endif /* TLS */
 
-static RingBuffer16 *ringbuffer = NULL;
 /**
  * \brief TmqhPacketpoolRegister
  * \initonly
@@ -63,12 +123,7 @@ void TmqhPacketpoolRegister (void) {
     tmqh_table[TMQH_PACKETPOOL].name = "packetpool";
     tmqh_table[TMQH_PACKETPOOL].InHandler = TmqhInputPacketpool;
     tmqh_table[TMQH_PACKETPOOL].OutHandler = TmqhOutputPacketpool;
-
-    ringbuffer = RingBufferInit();
-    if (ringbuffer == NULL) {
-        SCLogError(SC_ERR_FATAL, "Error registering Packet pool handler (at ring buffer init)");
-        exit(EXIT_FAILURE);
-    }
+    tmqh_table[TMQH_PACKETPOOL].RegisterTests = TmqhPacketpoolRegisterTests;
 }
 
 void TmqhPacketpoolDestroy (void) {
@@ -76,16 +131,63 @@ void TmqhPacketpoolDestroy (void) {
      * where we also clean the packets */
 }
 
+/** \internal
+ *  \brief move the packets other threads returned to our own list
+ *
+ *  Only the owner gets here, so it also does the counting of the
+ *  returns: the returning threads don't need to touch a shared counter.
+ */
+static void PacketPoolGetReturnedPackets(PktPool *pool)
+{
+    Packet *list;
+    uint32_t cnt = 0;
+
+    do {
+        list = pool->return_stack;
+    } while (list != NULL &&
+             !SCAtomicCompareAndSwap(&pool->return_stack, list, NULL));
+
+    while (list != NULL) {
+        Packet *next = list->next;
+        list->next = pool->head;
+        pool->head = list;
+        pool->cnt++;
+        cnt++;
+        list = next;
+    }
+
+    if (cnt > 0) {
+        pool->remote_returns += cnt;
+        if (pool->tv != NULL && pool->tv->sc_perf_pca != NULL)
+            SCPerfCounterAddUI64(pool->counter_remote_returns,
+                    pool->tv->sc_perf_pca, cnt);
+    }
+}
+
 int PacketPoolIsEmpty(void) {
-    return RingBufferIsEmpty(ringbuffer);
+    return (PacketPoolSize() == 0);
 }
 
+/** \brief number of packets available in this thread's pool */
 uint16_t PacketPoolSize(void) {
-    return RingBufferSize(ringbuffer);
+    PktPool *pool = GetThreadPacketPool();
+    if (pool == NULL)
+        return 0;
+
+    if (pool->head == NULL)
+        PacketPoolGetReturnedPackets(pool);
+    return (uint16_t)pool->cnt;
 }
 
+/** \brief give other threads a moment to return packets to this
+ *         thread's pool, if it is empty */
 void PacketPoolWait(void) {
-    RingBufferWait(ringbuffer);
+    PktPool *pool = GetThreadPacketPool();
+    if (pool == NULL)
+        return;
+
+    if (pool->head == NULL && pool->return_stack == NULL)
+        usleep(PKTPOOL_WAIT_USEC);
 }
 
 /** \brief a initialized packet
@@ -93,44 +195,127 @@ void PacketPoolWait(void) {
  *  \warning Use *only* at init, not at packet runtime
  */
 void PacketPoolStorePacket(Packet *p) {
-    if (RingBufferIsFull(ringbuffer)) {
-        exit(1);
-    }
+    PktPool *pool = GetThreadPacketPool();
+    BUG_ON(pool == NULL);
 
     /* Clear the PKT_ALLOC flag, since that indicates to push back
-     * onto the ring buffer. */
+     * onto the pool. */
     p->flags &= ~PKT_ALLOC;
     p->ReleasePacket = PacketPoolReturnPacket;
+    p->pool = pool;
+    pool->size++;
     PacketPoolReturnPacket(p);
 
-    SCLogDebug("buffersize %u", RingBufferSize(ringbuffer));
+    SCLogDebug("pool size %u", pool->cnt);
 }
 
-/** \brief get a packet from the packet pool, but if the
+/** \brief get a packet from this thread's packet pool, but if the
  *         pool is empty, don't wait, just return NULL
  */
 Packet *PacketPoolGetPacket(void) {
-    if (RingBufferIsEmpty(ringbuffer))
+    PktPool *pool = GetThreadPacketPool();
+    if (pool == NULL)
         return NULL;
 
-    Packet *p = RingBufferMrMwGetNoWait(ringbuffer);
+    if (pool->head == NULL) {
+        PacketPoolGetReturnedPackets(pool);
+        if (pool->head == NULL)
+            return NULL;
+    }
+
+    Packet *p = pool->head;
+    pool->head = p->next;
+    pool->cnt--;
+    p->next = NULL;
     return p;
 }
 
 /** \brief Return packet to Packet pool
  *
+ *  Can be called from any thread. Packets of the calling thread's own
+ *  pool go straight back onto its list, others onto the return stack
+ *  of the pool they belong to.
  */
 void PacketPoolReturnPacket(Packet *p)
 {
+    PktPool *my_pool = GetThreadPacketPool();
+    PktPool *pool = p->pool;
+
     PACKET_RECYCLE(p);
-    RingBufferMrMwPut(ringbuffer, (void *)p);
+
+    if (unlikely(pool == NULL)) {
+        PacketFree(p);
+        return;
+    }
+
+    if (pool == my_pool) {
+        p->next = pool->head;
+        pool->head = p;
+        pool->cnt++;
+        return;
+    }
+
+    /* As the owner always takes the whole stack, there is no ABA
+     * problem here: 'next' is just whatever the top is now. */
+    Packet *top;
+    do {
+        top = pool->return_stack;
+        if (top == PKTPOOL_ORPHANED) {
+            PacketFree(p);
+            (void)SC_ATOMIC_ADD(pool_orphan_frees, 1);
+            return;
+        }
+        p->next = top;
+    } while (!SCAtomicCompareAndSwap(&pool->return_stack, top, p));
 }
 
+/** \brief global packet pool setup
+ *
+ *  \param max_pending_packets size of each capture thread's pool
+ */
 void PacketPoolInit(intmax_t max_pending_packets) {
+    pool_size = max_pending_packets;
+    SC_ATOMIC_INIT(pool_orphan_frees);
+
+    SCLogInfo("using %"PRIiMAX" packets per capture thread. Memory per "
+            "thread %"PRIuMAX"", max_pending_packets,
+            (uintmax_t)(max_pending_packets*SIZE_OF_PACKET));
+}
+
+/** \brief set up the packet pool of the calling thread
+ *
+ *  Preallocates the packets, so it should be called by the thread that
+ *  is going to use them. Registers the pool counters of the thread, so
+ *  it has to be called before its counter array is set up.
+ *
+ *  \param tv the calling thread, or NULL for no counters
+ */
+void PacketPoolInitThread(ThreadVars *tv) {
+    if (GetThreadPacketPool() != NULL || pool_size == 0)
+        return;
+
+    PktPool *pool = SCMalloc(sizeof(PktPool));
+    if (unlikely(pool == NULL)) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered while allocating a packet pool. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    memset(pool, 0x00, sizeof(PktPool));
+    if (tv != NULL) {
+        pool->tv = tv;
+        pool->counter_remote_returns = SCPerfTVRegisterCounter(
+                "packetpool.remote_returns", tv, SC_PERF_TYPE_UINT64, "NULL");
+    }
+    SetThreadPacketPool(pool);
+
+    SCMutexLock(&pool_list_lock);
+    pool->next = pool_list;
+    pool_list = pool;
+    SCMutexUnlock(&pool_list_lock);
+
     /* pre allocate packets */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "", (uintmax_t)SIZE_OF_PACKET);
-    int i = 0;
-    for (i = 0; i < max_pending_packets; i++) {
+    intmax_t i = 0;
+    for (i = 0; i < pool_size; i++) {
         Packet *p = PacketGetFromAlloc();
         if (unlikely(p == NULL)) {
             SCLogError(SC_ERR_FATAL, "Fatal error encountered while allocating a packet. Exiting...");
@@ -138,31 +323,81 @@ void PacketPoolInit(intmax_t max_pending_packets) {
         }
         PacketPoolStorePacket(p);
     }
-    SCLogInfo("preallocated %"PRIiMAX" packets. Total memory %"PRIuMAX"",
-            max_pending_packets, (uintmax_t)(max_pending_packets*SIZE_OF_PACKET));
+    SCLogDebug("preallocated %"PRIiMAX" packets", pool_size);
 }
 
-void PacketPoolDestroy(void) {
-    if (ringbuffer == NULL) {
+/** \brief free the packets of the calling thread's pool
+ *
+ *  Packets that are still in use elsewhere are freed when they are
+ *  returned. The pool itself is freed by PacketPoolDestroy().
+ */
+void PacketPoolDestroyThread(void) {
+    PktPool *pool = GetThreadPacketPool();
+    if (pool == NULL)
         return;
+
+    /* close the return stack and take what is on it */
+    Packet *list;
+    do {
+        list = pool->return_stack;
+    } while (!SCAtomicCompareAndSwap(&pool->return_stack, list, PKTPOOL_ORPHANED));
+
+    uint32_t freed = 0;
+    while (list != NULL) {
+        Packet *next = list->next;
+        PacketFree(list);
+        pool->remote_returns++;
+        freed++;
+        list = next;
     }
 
     Packet *p = NULL;
-    while ((p = PacketPoolGetPacket()) != NULL) {
-        PACKET_CLEANUP(p);
-        SCFree(p);
+    while ((p = pool->head) != NULL) {
+        pool->head = p->next;
+        PacketFree(p);
+        freed++;
     }
+    pool->cnt = 0;
+
+    SCLogInfo("packet pool: %u packets, %"PRIu64" returned by other threads, "
+              "%u still in use at exit", pool->size,
+              pool->remote_returns, pool->size - freed);
 
-    RingBufferDestroy(ringbuffer);
-    ringbuffer = NULL;
+    /* the thread is going away */
+    pool->tv = NULL;
+    SetThreadPacketPool(NULL);
 }
 
+void PacketPoolDestroy(void) {
+    SCMutexLock(&pool_list_lock);
+    while (pool_list != NULL) {
+        PktPool *pool = pool_list;
+        pool_list = pool->next;
+
+        SCFree(pool);
+    }
+    SCMutexUnlock(&pool_list_lock);
+
+    SCLogDebug("%"PRIu64" packets were freed after their thread ended",
+               SC_ATOMIC_GET(pool_orphan_frees));
+}
+
+/** \brief get a packet from the calling thread's pool, waiting for one
+ *         to be returned if it's empty */
 Packet *TmqhInputPacketpool(ThreadVars *t)
 {
     Packet *p = NULL;
 
-    while (p == NULL && ringbuffer->shutdown == FALSE) {
-        p = RingBufferMrMwGet(ringbuffer);
+    if (GetThreadPacketPool() == NULL)
+        return PacketGetFromAlloc();
+
+    while (p == NULL) {
+        p = PacketPoolGetPacket();
+        if (p == NULL) {
+            if (t != NULL && TmThreadsCheckFlag(t, THV_KILL))
+                break;
+            PacketPoolWait();
+        }
     }
 
     /* packet is clean */
@@ -179,7 +414,8 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
 
     /** \todo make this a callback
      *  Release tcp segments. Done here after alerting can use them. */
-    if (p->flow != NULL && p->proto == IPPROTO_TCP) {
+    if (p->flow != NULL && p->proto == IPPROTO_TCP &&
+        !(p->flags & PKT_BYPASSED)) {
         SCMutexLock(&p->flow->m);
         StreamTcpPruneSession(p->flow, p->flowflags & FLOW_PKT_TOSERVER ?
                 STREAM_TOSERVER : STREAM_TOCLIENT);
@@ -302,3 +538,92 @@ void TmqhReleasePacketsToPacketPool(PacketQueue *pq)
 
     return;
 }
+
+#ifdef UNITTESTS
+
+static void *PacketPoolTestReturnThread(void *data)
+{
+    Packet *p = (Packet *)data;
+    p->ReleasePacket(p);
+    return NULL;
+}
+
+/** \test packets returned by other threads get back to the owner, and
+ *        are freed once the owner's pool is gone */
+static int PacketPoolTest01(void)
+{
+    int result = 0;
+    intmax_t saved_size = pool_size;
+    pthread_t thread;
+    Packet *p1 = NULL, *p2 = NULL;
+    ThreadVars tv;
+    char tv_name[] = "PacketPoolTest01";
+
+    memset(&tv, 0, sizeof(tv));
+    tv.name = tv_name;
+    pool_size = 4;
+    SC_ATOMIC_INIT(pool_orphan_frees);
+    PacketPoolInitThread(&tv);
+    PktPool *pool = GetThreadPacketPool();
+    if (pool == NULL || PacketPoolSize() != 4)
+        goto end;
+    tv.sc_perf_pca = SCPerfGetAllCountersArray(&tv.sc_perf_pctx);
+    if (tv.sc_perf_pca == NULL)
+        goto end;
+
+    p1 = PacketPoolGetPacket();
+    p2 = PacketPoolGetPacket();
+    if (p1 == NULL || p2 == NULL || p1->pool != pool || PacketPoolSize() != 2)
+        goto end;
+
+    /* return p1 from another thread: it goes onto the return stack */
+    if (pthread_create(&thread, NULL, PacketPoolTestReturnThread, p1) != 0)
+        goto end;
+    pthread_join(thread, NULL);
+
+    if (pool->return_stack != p1 || pool->remote_returns != 0)
+        goto end;
+
+    /* use up the local list, then the returned packet is picked up */
+    if (PacketPoolGetPacket() == NULL || PacketPoolGetPacket() == NULL)
+        goto end;
+    if (PacketPoolGetPacket() != p1 || pool->return_stack != NULL)
+        goto end;
+    p1->ReleasePacket(p1);
+
+    /* and counted by the owner */
+    if (pool->remote_returns != 1 ||
+        tv.sc_perf_pca->head[pool->counter_remote_returns].ui64_cnt != 1)
+        goto end;
+
+    PacketPoolDestroyThread();
+    if (GetThreadPacketPool() != NULL)
+        goto end;
+
+    /* the pool is gone, so p2 is freed */
+    p2->ReleasePacket(p2);
+    p2 = NULL;
+    if (SC_ATOMIC_GET(pool_orphan_frees) != 1)
+        goto end;
+
+    result = 1;
+end:
+    if (p2 != NULL)
+        p2->ReleasePacket(p2);
+    PacketPoolDestroyThread();
+    PacketPoolDestroy();
+    if (tv.sc_perf_pca != NULL)
+        SCPerfReleasePCA(tv.sc_perf_pca);
+    SCPerfReleasePerfCounterS(tv.sc_perf_pctx.head);
+    pool_size = saved_size;
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhPacketpoolRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PacketPoolTest01", PacketPoolTest01, 1);
+#endif
+}
@@ -24,6 +24,28 @@
 #ifndef __TMQH_PACKETPOOL_H__
 #define __TMQH_PACKETPOOL_H__
 
+/** Per thread packet pool. Owned by a capture thread, which gets and
+ *  returns its packets without any locking or atomics. Other threads
+ *  return the owner's packets by pushing them onto the return stack,
+ *  which the owner takes over as a whole when its own list runs out. */
+typedef struct PktPool_ {
+    /* used by the owner thread only */
+    Packet *head;               /**< free packets */
+    uint32_t cnt;               /**< number of packets in 'head' */
+    uint32_t size;              /**< number of packets the pool owns */
+    uint64_t remote_returns;    /**< packets taken back from the return stack */
+    ThreadVars *tv;             /**< owner, for its counters */
+    uint16_t counter_remote_returns;
+
+    /** keep the return stack off the owner's cache line */
+    uint8_t pad[CLS];
+
+    /** packets returned by other threads, pushed with a CAS */
+    Packet *return_stack;
+
+    struct PktPool_ *next;      /**< list of all pools */
+} PktPool;
+
 Packet *TmqhInputPacketpool(ThreadVars *);
 void TmqhOutputPacketpool(ThreadVars *, Packet *);
 void TmqhReleasePacketsToPacketPool(PacketQueue *);
@@ -36,5 +58,9 @@ void PacketPoolWait(void);
 void PacketPoolReturnPacket(Packet *p);
 void PacketPoolInit(intmax_t max_pending_packets);
 void PacketPoolDestroy(void);
+void PacketPoolInitThread(ThreadVars *);
+void PacketPoolDestroyThread(void);
+
+void TmqhPacketpoolRegisterTests(void);
 
 #endif /* __TMQH_PACKETPOOL_H__ */
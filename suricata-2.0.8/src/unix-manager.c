@@ -32,6 +32,7 @@
 #include "util-privs.h"
 #include "util-debug.h"
 #include "util-signal.h"
+#include "util-profiling.h"
 
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -702,7 +703,6 @@ TmEcode UnixManagerListCommand(json_t *cmd,
 }
 
 
-#if 0
 TmEcode UnixManagerReloadRules(json_t *cmd,
                                json_t *server_msg, void *data)
 {
@@ -711,16 +711,58 @@ TmEcode UnixManagerReloadRules(json_t *cmd,
         json_object_set_new(server_msg, "message",
                             json_string("Live rule swap no longer possible."
                                         " Engine in shutdown mode."));
-        SCReturn(TM_ECODE_FAILED);
-    } else {
-        /* FIXME : need to check option value */
-        UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2Idle);
-        DetectEngineSpawnLiveRuleSwapMgmtThread();
-        json_object_set_new(server_msg, "message", json_string("Reloading rules"));
+        SCReturnInt(TM_ECODE_FAILED);
+    } else if (UtilSignalIsHandler(SIGUSR2, SignalHandlerSigusr2Idle)) {
+        json_object_set_new(server_msg, "message",
+                            json_string("Rule reload already in progress"));
+        SCReturnInt(TM_ECODE_FAILED);
+    } else if (!UtilSignalIsHandler(SIGUSR2, SignalHandlerSigusr2)) {
+        /* disabled in the config, -s/-S used or still starting up */
+        json_object_set_new(server_msg, "message",
+                            json_string("Live rule reload not possible"));
+        SCReturnInt(TM_ECODE_FAILED);
     }
-    SCReturn(TM_ECODE_OK);
+
+    UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2Idle);
+    DetectEngineSpawnLiveRuleSwapMgmtThread();
+    json_object_set_new(server_msg, "message", json_string("Reloading rules"));
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode UnixManagerReloadStats(json_t *cmd,
+                               json_t *server_msg, void *data)
+{
+    SCEnter();
+    DetectEngineReloadStats stats;
+
+    if (DetectEngineReloadGetStats(&stats) == 0) {
+        json_object_set_new(server_msg, "message",
+                            json_string("No rule reload done yet"));
+        SCReturnInt(TM_ECODE_OK);
+    }
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(server_msg, "message",
+                            json_string("internal error at json object creation"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    json_object_set_new(jdata, "count", json_integer(stats.cnt));
+    json_object_set_new(jdata, "status", json_string(stats.in_progress ?
+                "in progress" : (stats.result ? "done" : "failed")));
+    json_object_set_new(jdata, "start", json_integer(stats.start));
+    json_object_set_new(jdata, "build_msec", json_integer(stats.build_msec));
+    json_object_set_new(jdata, "swap_msec", json_integer(stats.swap_msec));
+    json_object_set_new(jdata, "total_msec", json_integer(stats.total_msec));
+    json_object_set_new(jdata, "signatures", json_integer(stats.sig_cnt));
+    json_object_set_new(jdata, "rss_start", json_integer(stats.rss_start));
+    json_object_set_new(jdata, "rss_peak", json_integer(stats.rss_peak));
+    json_object_set_new(jdata, "rss_peak_sampled",
+                        stats.rss_peak_sampled ? json_true() : json_false());
+    json_object_set_new(jdata, "rss_end", json_integer(stats.rss_end));
+    json_object_set_new(server_msg, "message", jdata);
+    SCReturnInt(TM_ECODE_OK);
 }
-#endif
 
 static UnixCommand command;
 
@@ -860,8 +902,11 @@ void *UnixManagerThread(void *td)
     UnixManagerRegisterCommand("capture-mode", UnixManagerCaptureModeCommand, &command, 0);
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dump-counters", SCPerfOutputCounterSocket, NULL, 0);
-#if 0
     UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
+    UnixManagerRegisterCommand("ruleset-reload-stats", UnixManagerReloadStats, NULL, 0);
+#ifdef PROFILING
+    UnixManagerRegisterCommand("rule-profiling-dump", SCProfilingRuleDumpSocket, NULL, 0);
+    UnixManagerRegisterCommand("rule-profiling-reset", SCProfilingRuleResetSocket, NULL, 0);
 #endif
 
     TmThreadsSetFlag(th_v, THV_INIT_DONE);
@@ -0,0 +1,441 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer, see util-json-builder.h
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-buffer.h"
+#include "util-json-builder.h"
+#include "util-unittest.h"
+
+static const char hex_chars[] = "0123456789abcdef";
+
+/** \internal
+ *  \brief append raw data to the buffer. Always keeps one byte free
+ *         for the NUL terminator. */
+static inline void JBWrite(JsonBuilder *jb, const void *data, uint32_t data_len)
+{
+    MemBuffer *b = jb->buffer;
+
+    if (jb->error)
+        return;
+    if (data_len >= b->size - b->offset) {
+        jb->error = 1;
+        return;
+    }
+    memcpy(b->buffer + b->offset, data, data_len);
+    b->offset += data_len;
+}
+
+static inline void JBWriteChar(JsonBuilder *jb, char c)
+{
+    JBWrite(jb, &c, 1);
+}
+
+/** \internal
+ *  \brief write a \\uXXXX escape */
+static inline void JBWriteUnicodeEscape(JsonBuilder *jb, uint32_t cp)
+{
+    char esc[6] = { '\\', 'u',
+        hex_chars[(cp >> 12) & 0xf], hex_chars[(cp >> 8) & 0xf],
+        hex_chars[(cp >> 4) & 0xf], hex_chars[cp & 0xf] };
+    JBWrite(jb, esc, sizeof(esc));
+}
+
+/** \internal
+ *  \brief decode a multi byte UTF-8 sequence
+ *  \retval len number of bytes used, 0 if the sequence is invalid
+ */
+static uint32_t JBDecodeUtf8(const uint8_t *data, uint32_t data_len, uint32_t *cp)
+{
+    uint32_t len, u, i;
+    uint8_t c = data[0];
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        len = 2;
+        u = c & 0x1f;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        len = 3;
+        u = c & 0x0f;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        len = 4;
+        u = c & 0x07;
+    } else {
+        return 0;
+    }
+    if (len > data_len)
+        return 0;
+
+    for (i = 1; i < len; i++) {
+        if ((data[i] & 0xc0) != 0x80)
+            return 0;
+        u = (u << 6) | (data[i] & 0x3f);
+    }
+
+    /* overlong, surrogates and out of range */
+    if ((len == 3 && u < 0x800) || (len == 4 && u < 0x10000) ||
+        (u >= 0xd800 && u <= 0xdfff) || u > 0x10ffff)
+        return 0;
+
+    *cp = u;
+    return len;
+}
+
+/** \internal
+ *  \brief write a quoted and escaped string */
+static void JBWriteQuoted(JsonBuilder *jb, const uint8_t *data, uint32_t data_len)
+{
+    uint32_t i = 0, run = 0;
+
+    JBWriteChar(jb, '"');
+    while (i < data_len) {
+        uint8_t c = data[i];
+        if (likely(c >= 0x20 && c < 0x7f && c != '"' && c != '\\' && c != '/')) {
+            i++;
+            continue;
+        }
+
+        /* write out the run of plain chars */
+        if (i > run)
+            JBWrite(jb, data + run, i - run);
+
+        switch (c) {
+            case '"':  JBWrite(jb, "\\\"", 2); break;
+            case '\\': JBWrite(jb, "\\\\", 2); break;
+            case '/':  JBWrite(jb, "\\/", 2); break;
+            case '\b': JBWrite(jb, "\\b", 2); break;
+            case '\f': JBWrite(jb, "\\f", 2); break;
+            case '\n': JBWrite(jb, "\\n", 2); break;
+            case '\r': JBWrite(jb, "\\r", 2); break;
+            case '\t': JBWrite(jb, "\\t", 2); break;
+            default:
+                if (c < 0x80) {
+                    JBWriteUnicodeEscape(jb, c);
+                } else {
+                    uint32_t cp = 0;
+                    uint32_t len = JBDecodeUtf8(data + i, data_len - i, &cp);
+                    if (len == 0) {
+                        /* not UTF-8, log the byte as is */
+                        JBWriteUnicodeEscape(jb, c);
+                    } else {
+                        if (cp >= 0x10000) {
+                            cp -= 0x10000;
+                            JBWriteUnicodeEscape(jb, 0xd800 | (cp >> 10));
+                            JBWriteUnicodeEscape(jb, 0xdc00 | (cp & 0x3ff));
+                        } else {
+                            JBWriteUnicodeEscape(jb, cp);
+                        }
+                        i += len - 1;
+                    }
+                }
+                break;
+        }
+        i++;
+        run = i;
+    }
+    if (i > run)
+        JBWrite(jb, data + run, i - run);
+    JBWriteChar(jb, '"');
+}
+
+/** \internal
+ *  \brief write the comma and key of the next value */
+static void JBWriteKey(JsonBuilder *jb, const char *key)
+{
+    if (jb->error)
+        return;
+
+    /* keys are required in objects and not allowed in arrays */
+    if (jb->depth == 0 ||
+        (key != NULL) != (jb->close[jb->depth - 1] == '}')) {
+        SCLogDebug("invalid use of JsonBuilder, key %s", key ? key : "(null)");
+        jb->error = 1;
+        return;
+    }
+
+    if (jb->comma[jb->depth - 1])
+        JBWriteChar(jb, ',');
+    jb->comma[jb->depth - 1] = 1;
+
+    if (key != NULL) {
+        JBWriteQuoted(jb, (const uint8_t *)key, strlen(key));
+        JBWriteChar(jb, ':');
+    }
+}
+
+static void JBOpen(JsonBuilder *jb, const char *key, char open, char close)
+{
+    if (jb->depth >= JSON_BUILDER_MAX_DEPTH) {
+        jb->error = 1;
+        return;
+    }
+    JBWriteKey(jb, key);
+    JBWriteChar(jb, open);
+
+    jb->close[jb->depth] = close;
+    jb->comma[jb->depth] = 0;
+    jb->depth++;
+}
+
+/** \brief start a new record at the end of the buffer
+ *
+ *  Opens the top level object.
+ */
+void JsonBuilderStart(JsonBuilder *jb, MemBuffer *buffer)
+{
+    jb->buffer = buffer;
+    jb->start = MEMBUFFER_OFFSET(buffer);
+    jb->depth = 0;
+    jb->error = 0;
+
+    JBWriteChar(jb, '{');
+    jb->close[0] = '}';
+    jb->comma[0] = 0;
+    jb->depth = 1;
+}
+
+/** \brief close all open objects and arrays and finish the record
+ *
+ *  \retval 0 record is complete and NUL terminated
+ *  \retval -1 record didn't fit, buffer is back at the start of it
+ */
+int JsonBuilderEnd(JsonBuilder *jb)
+{
+    while (jb->depth > 0) {
+        JBWriteChar(jb, jb->close[jb->depth - 1]);
+        jb->depth--;
+    }
+
+    if (jb->error) {
+        jb->buffer->offset = jb->start;
+        jb->buffer->buffer[jb->start] = '\0';
+        return -1;
+    }
+
+    jb->buffer->buffer[jb->buffer->offset] = '\0';
+    return 0;
+}
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key)
+{
+    JBOpen(jb, key, '{', '}');
+}
+
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key)
+{
+    JBOpen(jb, key, '[', ']');
+}
+
+/** \brief close the last opened object or array */
+void JsonBuilderClose(JsonBuilder *jb)
+{
+    if (jb->depth <= 1) {
+        jb->error = 1;
+        return;
+    }
+    JBWriteChar(jb, jb->close[jb->depth - 1]);
+    jb->depth--;
+}
+
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *str)
+{
+    JsonBuilderSetStringN(jb, key, (const uint8_t *)str, strlen(str));
+}
+
+/** \brief add a string that is not NUL terminated and may contain
+ *         any byte value */
+void JsonBuilderSetStringN(JsonBuilder *jb, const char *key,
+        const uint8_t *data, uint32_t data_len)
+{
+    JBWriteKey(jb, key);
+    JBWriteQuoted(jb, data, data_len);
+}
+
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val)
+{
+    char buf[20];
+    int i = sizeof(buf);
+
+    do {
+        buf[--i] = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+
+    JBWriteKey(jb, key);
+    JBWrite(jb, buf + i, sizeof(buf) - i);
+}
+
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    if (val >= 0) {
+        JsonBuilderSetUint(jb, key, (uint64_t)val);
+        return;
+    }
+
+    char buf[21];
+    uint64_t u = -(uint64_t)val;
+    int i = sizeof(buf);
+
+    do {
+        buf[--i] = '0' + (u % 10);
+        u /= 10;
+    } while (u != 0);
+    buf[--i] = '-';
+
+    JBWriteKey(jb, key);
+    JBWrite(jb, buf + i, sizeof(buf) - i);
+}
+
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val)
+{
+    JBWriteKey(jb, key);
+    if (val)
+        JBWrite(jb, "true", 4);
+    else
+        JBWrite(jb, "false", 5);
+}
+
+/* Unit tests */
+
+#ifdef UNITTESTS
+
+/** \test nesting, numbers and bools */
+static int JsonBuilderTest01(void)
+{
+    int result = 0;
+    JsonBuilder jb;
+    MemBuffer *buffer = MemBufferCreateNew(256);
+    if (buffer == NULL)
+        return 0;
+
+    JsonBuilderStart(&jb, buffer);
+    JsonBuilderSetString(&jb, "event_type", "dns");
+    JsonBuilderSetUint(&jb, "pcap_cnt", 18446744073709551615ULL);
+    JsonBuilderSetInt(&jb, "neg", -9223372036854775807LL - 1);
+    JsonBuilderOpenArray(&jb, "vlan");
+    JsonBuilderSetUint(&jb, NULL, 1);
+    JsonBuilderSetUint(&jb, NULL, 0);
+    JsonBuilderClose(&jb);
+    JsonBuilderOpenObject(&jb, "dns");
+    JsonBuilderSetBool(&jb, "a", 1);
+    JsonBuilderSetBool(&jb, "b", 0);
+    JsonBuilderOpenObject(&jb, "empty");
+    if (JsonBuilderEnd(&jb) != 0)
+        goto end;
+
+    const char *expect = "{\"event_type\":\"dns\","
+        "\"pcap_cnt\":18446744073709551615,"
+        "\"neg\":-9223372036854775808,"
+        "\"vlan\":[1,0],\"dns\":{\"a\":true,\"b\":false,\"empty\":{}}}";
+    if (strcmp(JsonBuilderGetRecord(&jb), expect) != 0) {
+        printf("got \"%s\": ", JsonBuilderGetRecord(&jb));
+        goto end;
+    }
+    if (JsonBuilderGetRecordLen(&jb) != strlen(expect))
+        goto end;
+
+    result = 1;
+end:
+    MemBufferFree(buffer);
+    return result;
+}
+
+/** \test string escaping */
+static int JsonBuilderTest02(void)
+{
+    int result = 0;
+    JsonBuilder jb;
+    MemBuffer *buffer = MemBufferCreateNew(256);
+    if (buffer == NULL)
+        return 0;
+
+    /* quote, backslash, slash, control chars, 2 and 4 byte UTF-8,
+     * an invalid byte, an overlong sequence and a NUL byte */
+    const uint8_t str[] = "a\"\\/\n\x01" "\xc3\xa9" "\xf0\x9f\x98\x80"
+        "\xff" "\xc0\xaf" "\0z";
+
+    JsonBuilderStart(&jb, buffer);
+    JsonBuilderSetStringN(&jb, "s", str, sizeof(str) - 1);
+    if (JsonBuilderEnd(&jb) != 0)
+        goto end;
+
+    const char *expect = "{\"s\":\"a\\\"\\\\\\/\\n\\u0001\\u00e9"
+        "\\ud83d\\ude00\\u00ff\\u00c0\\u00af\\u0000z\"}";
+    if (strcmp(JsonBuilderGetRecord(&jb), expect) != 0) {
+        printf("got \"%s\": ", JsonBuilderGetRecord(&jb));
+        goto end;
+    }
+
+    result = 1;
+end:
+    MemBufferFree(buffer);
+    return result;
+}
+
+/** \test a record that doesn't fit is removed again, records before
+ *        it are untouched */
+static int JsonBuilderTest03(void)
+{
+    int result = 0;
+    JsonBuilder jb;
+    MemBuffer *buffer = MemBufferCreateNew(32);
+    if (buffer == NULL)
+        return 0;
+
+    JsonBuilderStart(&jb, buffer);
+    JsonBuilderSetUint(&jb, "a", 1);
+    if (JsonBuilderEnd(&jb) != 0)
+        goto end;
+
+    JsonBuilderStart(&jb, buffer);
+    JsonBuilderSetString(&jb, "b", "this string is too long to fit");
+    if (JsonBuilderEnd(&jb) != -1)
+        goto end;
+    if (MEMBUFFER_OFFSET(buffer) != 7 ||
+        strcmp((char *)MEMBUFFER_BUFFER(buffer), "{\"a\":1}") != 0)
+        goto end;
+
+    /* key in an array is invalid */
+    JsonBuilderStart(&jb, buffer);
+    JsonBuilderOpenArray(&jb, "c");
+    JsonBuilderSetUint(&jb, "d", 1);
+    if (JsonBuilderEnd(&jb) != -1)
+        goto end;
+    if (MEMBUFFER_OFFSET(buffer) != 7)
+        goto end;
+
+    result = 1;
+end:
+    MemBufferFree(buffer);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void JsonBuilderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonBuilderTest01", JsonBuilderTest01, 1);
+    UtRegisterTest("JsonBuilderTest02", JsonBuilderTest02, 1);
+    UtRegisterTest("JsonBuilderTest03", JsonBuilderTest03, 1);
+#endif /* UNITTESTS */
+}
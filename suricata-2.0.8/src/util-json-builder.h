@@ -0,0 +1,74 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer. Builds a single compact JSON object directly
+ * at the end of a MemBuffer, without creating an object tree first.
+ *
+ * Strings are escaped like jansson does with JSON_ENSURE_ASCII and
+ * JSON_ESCAPE_SLASH. Bytes that are not valid UTF-8 are written as
+ * \\u00XX instead of failing the whole string.
+ *
+ * If the record doesn't fit in the buffer the builder goes into error
+ * state, ignores all further calls and JsonBuilderEnd() removes the
+ * partial record from the buffer again.
+ */
+
+#ifndef __UTIL_JSON_BUILDER_H__
+#define __UTIL_JSON_BUILDER_H__
+
+#include "util-buffer.h"
+
+#define JSON_BUILDER_MAX_DEPTH 16
+
+typedef struct JsonBuilder_ {
+    MemBuffer *buffer;
+    uint32_t start;         /**< offset of the record in the buffer */
+    uint8_t depth;          /**< number of open objects and arrays */
+    uint8_t error;          /**< record didn't fit or was malformed */
+    /** per level: closing char of the object/array */
+    char close[JSON_BUILDER_MAX_DEPTH];
+    /** per level: a value was written already, so next needs a comma */
+    uint8_t comma[JSON_BUILDER_MAX_DEPTH];
+} JsonBuilder;
+
+void JsonBuilderStart(JsonBuilder *jb, MemBuffer *buffer);
+int JsonBuilderEnd(JsonBuilder *jb);
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key);
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key);
+void JsonBuilderClose(JsonBuilder *jb);
+
+/* for all setters the key is NULL for array elements */
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *str);
+void JsonBuilderSetStringN(JsonBuilder *jb, const char *key,
+        const uint8_t *data, uint32_t data_len);
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val);
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val);
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val);
+
+/** \brief get the finished record, NUL terminated */
+#define JsonBuilderGetRecord(jb) \
+    ((const char *)MEMBUFFER_BUFFER((jb)->buffer) + (jb)->start)
+#define JsonBuilderGetRecordLen(jb) \
+    (MEMBUFFER_OFFSET((jb)->buffer) - (jb)->start)
+
+void JsonBuilderRegisterTests(void);
+
+#endif /* __UTIL_JSON_BUILDER_H__ */
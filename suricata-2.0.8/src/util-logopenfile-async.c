@@ -0,0 +1,572 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Asynchronous log writing.
+ *
+ * For a LogFileCtx with "async" enabled, Write copies the record into a
+ * queue entry and returns. The queue is a lock free list the producers
+ * push onto with a CAS. The log writer thread takes the whole list at
+ * once, reverses it to get the records in order and writes them through
+ * the original Write function.
+ *
+ * All queued records together are limited by log-writer.memcap. When
+ * that is reached, records are either dropped or the packet thread
+ * waits for the writer to catch up ("policy: block").
+ *
+ * As only the writer thread touches the file of an async LogFileCtx, it
+ * doesn't take the fp_mutex. This also means a packet thread that blocks
+ * on the memcap while holding the fp_mutex can't deadlock the writer.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "threads.h"
+#include "counters.h"
+
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-privs.h"
+#include "util-unittest.h"
+
+#include "util-logopenfile.h"
+#include "util-logopenfile-async.h"
+
+/* default memcap of all queued records together */
+#define LOGFILE_ASYNC_DEFAULT_MEMCAP    (32 * 1024 * 1024)
+
+/* time the writer sleeps when there is nothing to write */
+#define LOGFILE_ASYNC_IDLE_USEC         1000
+/* time a packet thread waits for room with policy block */
+#define LOGFILE_ASYNC_BLOCK_USEC        100
+
+typedef struct LogFileAsyncRecord_ {
+    struct LogFileAsyncRecord_ *next;
+    LogFileCtx *ctx;
+    uint32_t len;
+    char data[];
+} LogFileAsyncRecord;
+
+/** newest record first, pushed to by the packet threads */
+static LogFileAsyncRecord *async_queue = NULL;
+/** serializes the consumers: the writer thread and LogFileAsyncDrain() */
+static SCMutex async_consumer_lock = SCMUTEX_INITIALIZER;
+
+static uint64_t async_memcap = LOGFILE_ASYNC_DEFAULT_MEMCAP;
+static int async_policy = LOGFILE_ASYNC_POLICY_DROP;
+static int async_config_done = 0;
+static uint32_t async_ctx_cnt = 0;
+
+SC_ATOMIC_DECLARE(uint64_t, async_memuse);      /**< bytes queued */
+SC_ATOMIC_DECLARE(uint64_t, async_dropped);     /**< records dropped */
+SC_ATOMIC_DECLARE(uint64_t, async_written);     /**< records written */
+/** set while the writer thread is taking records off the queue */
+SC_ATOMIC_DECLARE(int, async_writer_running);
+/** packet threads in LogFileAsyncWrite() that may still push a record */
+SC_ATOMIC_DECLARE(uint32_t, async_producers);
+
+static void LogFileAsyncConfig(void)
+{
+    char *str = NULL;
+
+    SC_ATOMIC_INIT(async_memuse);
+    SC_ATOMIC_INIT(async_dropped);
+    SC_ATOMIC_INIT(async_written);
+    SC_ATOMIC_INIT(async_writer_running);
+    SC_ATOMIC_INIT(async_producers);
+
+    if (ConfGet("log-writer.memcap", &str) == 1) {
+        if (ParseSizeStringU64(str, &async_memcap) < 0 || async_memcap == 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing log-writer.memcap "
+                       "from conf file - %s.  Killing engine", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (ConfGet("log-writer.policy", &str) == 1) {
+        if (strcasecmp(str, "block") == 0) {
+            async_policy = LOGFILE_ASYNC_POLICY_BLOCK;
+        } else if (strcasecmp(str, "drop") == 0) {
+            async_policy = LOGFILE_ASYNC_POLICY_DROP;
+        } else {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry for "
+                       "log-writer.policy: \"%s\". Expected \"drop\" or "
+                       "\"block\". Killing engine", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    SCLogInfo("async log writer: memcap %"PRIu64", policy %s", async_memcap,
+              async_policy == LOGFILE_ASYNC_POLICY_BLOCK ? "block" : "drop");
+    async_config_done = 1;
+}
+
+/** \internal
+ *  \brief account for a new record, if it fits in the memcap */
+static int LogFileAsyncReserve(uint64_t size)
+{
+    if (SC_ATOMIC_ADD(async_memuse, size) > async_memcap) {
+        (void)SC_ATOMIC_SUB(async_memuse, size);
+        return 0;
+    }
+    return 1;
+}
+
+/** \internal
+ *  \brief Write function of an async LogFileCtx: queue the record
+ *
+ *  If the writer thread isn't running (yet, or anymore), e.g. in unix
+ *  socket mode, the record is written right away.
+ *
+ *  The thread counts itself in async_producers before it looks at
+ *  async_writer_running. So when LogFileAsyncStop() has seen no
+ *  producers after clearing the flag, no record can be pushed anymore.
+ *
+ *  \retval 1 record queued or written
+ *  \retval -1 record dropped
+ */
+static int LogFileAsyncWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+{
+    int ret = 1;
+
+    if (buffer_len <= 0)
+        return 0;
+
+    (void)SC_ATOMIC_ADD(async_producers, 1);
+    if (SC_ATOMIC_GET(async_writer_running) == 0) {
+        ret = log_ctx->WriteSync(buffer, buffer_len, log_ctx);
+        goto end;
+    }
+
+    uint64_t size = sizeof(LogFileAsyncRecord) + (uint64_t)buffer_len;
+    while (LogFileAsyncReserve(size) == 0) {
+        if (async_policy == LOGFILE_ASYNC_POLICY_DROP) {
+            (void)SC_ATOMIC_ADD(async_dropped, 1);
+            ret = -1;
+            goto end;
+        }
+        if (SC_ATOMIC_GET(async_writer_running) == 0) {
+            ret = log_ctx->WriteSync(buffer, buffer_len, log_ctx);
+            goto end;
+        }
+        usleep(LOGFILE_ASYNC_BLOCK_USEC);
+    }
+
+    LogFileAsyncRecord *rec = SCMalloc(size);
+    if (unlikely(rec == NULL)) {
+        (void)SC_ATOMIC_SUB(async_memuse, size);
+        (void)SC_ATOMIC_ADD(async_dropped, 1);
+        ret = -1;
+        goto end;
+    }
+    rec->ctx = log_ctx;
+    rec->len = (uint32_t)buffer_len;
+    memcpy(rec->data, buffer, buffer_len);
+
+    /* push. As the consumer always takes the whole list, there is no
+     * ABA problem here: 'next' is just whatever the head is now. */
+    do {
+        rec->next = async_queue;
+    } while (!SCAtomicCompareAndSwap(&async_queue, rec->next, rec));
+
+end:
+    (void)SC_ATOMIC_SUB(async_producers, 1);
+    return ret;
+}
+
+/** \internal
+ *  \brief write out everything that is queued right now
+ *
+ *  \retval cnt number of records written
+ */
+static uint32_t LogFileAsyncProcessQueue(void)
+{
+    LogFileAsyncRecord *list, *rec, *prev = NULL;
+    uint32_t cnt = 0;
+
+    SCMutexLock(&async_consumer_lock);
+
+    do {
+        list = async_queue;
+    } while (list != NULL && !SCAtomicCompareAndSwap(&async_queue, list, NULL));
+
+    /* reverse, the list has the newest record first */
+    while (list != NULL) {
+        rec = list;
+        list = list->next;
+        rec->next = prev;
+        prev = rec;
+    }
+
+    rec = prev;
+    while (rec != NULL) {
+        LogFileAsyncRecord *next = rec->next;
+
+        rec->ctx->WriteSync(rec->data, (int)rec->len, rec->ctx);
+        (void)SC_ATOMIC_SUB(async_memuse, sizeof(LogFileAsyncRecord) + rec->len);
+        SCFree(rec);
+        cnt++;
+
+        rec = next;
+    }
+
+    SCMutexUnlock(&async_consumer_lock);
+
+    if (cnt > 0)
+        (void)SC_ATOMIC_ADD(async_written, cnt);
+    return cnt;
+}
+
+/** \brief write out all queued records
+ *
+ *  Called before an async LogFileCtx is closed, so that none of its
+ *  records are left in the queue.
+ */
+void LogFileAsyncDrain(void)
+{
+    while (LogFileAsyncProcessQueue() > 0)
+        ;
+}
+
+/** \internal
+ *  \brief stop queueing and write out what is left
+ *
+ *  Once the flag is cleared, new writes go straight to the file. Threads
+ *  that saw the flag set may still push a record, so wait for them before
+ *  the final drain.
+ */
+static void LogFileAsyncStop(void)
+{
+    (void)SC_ATOMIC_SET(async_writer_running, 0);
+    while (SC_ATOMIC_GET(async_producers) > 0)
+        usleep(LOGFILE_ASYNC_BLOCK_USEC);
+    LogFileAsyncDrain();
+}
+
+/** \brief turn a LogFileCtx into an async one
+ *
+ *  Must be called after the Write function was set up.
+ */
+int LogFileAsyncSetup(LogFileCtx *log_ctx)
+{
+    if (log_ctx->async)
+        return 0;
+
+    if (!async_config_done)
+        LogFileAsyncConfig();
+
+    log_ctx->WriteSync = log_ctx->Write;
+    log_ctx->Write = LogFileAsyncWrite;
+    log_ctx->async = 1;
+    async_ctx_cnt++;
+    return 0;
+}
+
+static void *LogFileAsyncWriterThread(void *td)
+{
+    ThreadVars *th_v = (ThreadVars *)td;
+
+    uint16_t cnt_written = SCPerfTVRegisterCounter("log_writer.records", th_v,
+            SC_PERF_TYPE_UINT64,
+            "NULL");
+    uint16_t cnt_dropped = SCPerfTVRegisterCounter("log_writer.dropped", th_v,
+            SC_PERF_TYPE_UINT64,
+            "NULL");
+    uint16_t cnt_memuse = SCPerfTVRegisterCounter("log_writer.queued_bytes", th_v,
+            SC_PERF_TYPE_UINT64,
+            "NULL");
+
+    if (th_v->thread_setup_flags != 0)
+        TmThreadSetupOptions(th_v);
+
+    /* set the thread name */
+    if (SCSetThreadName(th_v->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    } else {
+        SCLogDebug("%s started...", th_v->name);
+    }
+
+    th_v->sc_perf_pca = SCPerfGetAllCountersArray(&th_v->sc_perf_pctx);
+    SCPerfAddToClubbedTMTable(th_v->name, &th_v->sc_perf_pctx);
+
+    /* Set the threads capability */
+    th_v->cap_flags = 0;
+    SCDropCaps(th_v);
+
+    (void)SC_ATOMIC_SET(async_writer_running, 1);
+
+    TmThreadsSetFlag(th_v, THV_INIT_DONE);
+    while (1)
+    {
+        if (TmThreadsCheckFlag(th_v, THV_PAUSE)) {
+            TmThreadsSetFlag(th_v, THV_PAUSED);
+            TmThreadTestThreadUnPaused(th_v);
+            TmThreadsUnsetFlag(th_v, THV_PAUSED);
+        }
+
+        uint32_t cnt = LogFileAsyncProcessQueue();
+
+        SCPerfCounterSetUI64(cnt_written, th_v->sc_perf_pca,
+                SC_ATOMIC_GET(async_written));
+        SCPerfCounterSetUI64(cnt_dropped, th_v->sc_perf_pca,
+                SC_ATOMIC_GET(async_dropped));
+        SCPerfCounterSetUI64(cnt_memuse, th_v->sc_perf_pca,
+                SC_ATOMIC_GET(async_memuse));
+
+        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
+            /* other management threads, like the flow manager, may
+             * still log, so from here on records are written directly */
+            LogFileAsyncStop();
+            SCPerfSyncCounters(th_v);
+            break;
+        }
+
+        if (cnt == 0)
+            usleep(LOGFILE_ASYNC_IDLE_USEC);
+
+        SCPerfSyncCountersIfSignalled(th_v);
+    }
+
+    TmThreadsSetFlag(th_v, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(th_v, THV_DEINIT);
+
+    SCLogInfo("async log writer: %"PRIu64" records written, %"PRIu64
+              " dropped", SC_ATOMIC_GET(async_written),
+              SC_ATOMIC_GET(async_dropped));
+
+    TmThreadsSetFlag(th_v, THV_CLOSED);
+    pthread_exit((void *) 0);
+    return NULL;
+}
+
+/** \brief spawn the log writer thread if any output is async */
+void LogFileAsyncWriterSpawn(void)
+{
+    if (async_ctx_cnt == 0)
+        return;
+
+    ThreadVars *tv_writer = TmThreadCreateMgmtThread("LogWriterThread",
+            LogFileAsyncWriterThread, 0);
+    if (tv_writer == NULL) {
+        printf("ERROR: TmThreadsCreate failed\n");
+        exit(1);
+    }
+    TmThreadSetCPU(tv_writer, MANAGEMENT_CPU_SET);
+
+    if (TmThreadSpawn(tv_writer) != TM_ECODE_OK) {
+        printf("ERROR: TmThreadSpawn failed\n");
+        exit(1);
+    }
+}
+
+#ifdef UNITTESTS
+
+static char async_test_buf[256];
+static uint32_t async_test_len = 0;
+
+static int LogFileAsyncTestWrite(const char *buffer, int buffer_len, LogFileCtx *ctx)
+{
+    if (async_test_len + buffer_len < sizeof(async_test_buf)) {
+        memcpy(async_test_buf + async_test_len, buffer, buffer_len);
+        async_test_len += buffer_len;
+    }
+    return 1;
+}
+
+static void LogFileAsyncTestReset(uint64_t memcap, int policy)
+{
+    async_config_done = 1;
+    async_memcap = memcap;
+    async_policy = policy;
+    async_test_len = 0;
+    memset(async_test_buf, 0, sizeof(async_test_buf));
+    SC_ATOMIC_INIT(async_memuse);
+    SC_ATOMIC_INIT(async_dropped);
+    SC_ATOMIC_INIT(async_written);
+    SC_ATOMIC_INIT(async_writer_running);
+    SC_ATOMIC_INIT(async_producers);
+    /* pretend the writer is running so records get queued */
+    (void)SC_ATOMIC_SET(async_writer_running, 1);
+}
+
+/** \test records come out in the order they were queued */
+static int LogFileAsyncTest01(void)
+{
+    int result = 0;
+    LogFileAsyncTestReset(LOGFILE_ASYNC_DEFAULT_MEMCAP, LOGFILE_ASYNC_POLICY_DROP);
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (ctx == NULL)
+        goto end;
+    ctx->Write = LogFileAsyncTestWrite;
+    LogFileAsyncSetup(ctx);
+
+    ctx->Write("one\n", 4, ctx);
+    ctx->Write("two\n", 4, ctx);
+    ctx->Write("three\n", 6, ctx);
+
+    /* nothing is written before the queue is processed */
+    if (async_test_len != 0 || SC_ATOMIC_GET(async_memuse) == 0)
+        goto end;
+
+    LogFileAsyncDrain();
+
+    if (async_test_len != 14 ||
+        memcmp(async_test_buf, "one\ntwo\nthree\n", 14) != 0) {
+        printf("unexpected output \"%s\": ", async_test_buf);
+        goto end;
+    }
+    if (SC_ATOMIC_GET(async_memuse) != 0 || SC_ATOMIC_GET(async_written) != 3)
+        goto end;
+
+    result = 1;
+end:
+    (void)SC_ATOMIC_SET(async_writer_running, 0);
+    LogFileFreeCtx(ctx);
+    async_ctx_cnt = 0;
+    return result;
+}
+
+/** \test records over the memcap are dropped with policy drop */
+static int LogFileAsyncTest02(void)
+{
+    int result = 0;
+    LogFileAsyncTestReset(sizeof(LogFileAsyncRecord) + 8, LOGFILE_ASYNC_POLICY_DROP);
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (ctx == NULL)
+        goto end;
+    ctx->Write = LogFileAsyncTestWrite;
+    LogFileAsyncSetup(ctx);
+
+    if (ctx->Write("first\n", 6, ctx) != 1)
+        goto end;
+    if (ctx->Write("second\n", 7, ctx) != -1)
+        goto end;
+    if (SC_ATOMIC_GET(async_dropped) != 1)
+        goto end;
+
+    LogFileAsyncDrain();
+
+    /* room again */
+    if (ctx->Write("third\n", 6, ctx) != 1)
+        goto end;
+    LogFileAsyncDrain();
+
+    if (async_test_len != 12 ||
+        memcmp(async_test_buf, "first\nthird\n", 12) != 0) {
+        printf("unexpected output \"%s\": ", async_test_buf);
+        goto end;
+    }
+
+    result = 1;
+end:
+    (void)SC_ATOMIC_SET(async_writer_running, 0);
+    LogFileFreeCtx(ctx);
+    async_ctx_cnt = 0;
+    return result;
+}
+
+SC_ATOMIC_DECLARE(uint32_t, async_test_records);
+
+static int LogFileAsyncTestCountWrite(const char *buffer, int buffer_len,
+                                      LogFileCtx *ctx)
+{
+    (void)SC_ATOMIC_ADD(async_test_records, 1);
+    return 1;
+}
+
+#define ASYNC_TEST_THREADS  4
+#define ASYNC_TEST_RECORDS  20000
+
+static void *LogFileAsyncTestProducer(void *data)
+{
+    LogFileCtx *ctx = (LogFileCtx *)data;
+    int i;
+
+    for (i = 0; i < ASYNC_TEST_RECORDS; i++)
+        ctx->Write("record\n", 7, ctx);
+    return NULL;
+}
+
+/** \test records pushed while the writer stops are all written, none
+ *        are left behind in the queue */
+static int LogFileAsyncTest03(void)
+{
+    pthread_t threads[ASYNC_TEST_THREADS];
+    int started = 0;
+    int result = 0;
+    int i;
+
+    LogFileAsyncTestReset(LOGFILE_ASYNC_DEFAULT_MEMCAP, LOGFILE_ASYNC_POLICY_BLOCK);
+    SC_ATOMIC_INIT(async_test_records);
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (ctx == NULL)
+        goto end;
+    ctx->Write = LogFileAsyncTestCountWrite;
+    LogFileAsyncSetup(ctx);
+
+    for (i = 0; i < ASYNC_TEST_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, LogFileAsyncTestProducer, ctx) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        goto end;
+
+    /* stop in the middle of the pushes */
+    while (SC_ATOMIC_GET(async_memuse) == 0 && SC_ATOMIC_GET(async_test_records) == 0)
+        LogFileAsyncProcessQueue();
+    LogFileAsyncProcessQueue();
+    LogFileAsyncStop();
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (async_queue != NULL || SC_ATOMIC_GET(async_memuse) != 0 ||
+        SC_ATOMIC_GET(async_test_records) != (uint32_t)(started * ASYNC_TEST_RECORDS)) {
+        printf("%u of %u records written, queue %s: ",
+                SC_ATOMIC_GET(async_test_records), started * ASYNC_TEST_RECORDS,
+                async_queue != NULL ? "not empty" : "empty");
+        goto end;
+    }
+
+    result = 1;
+end:
+    (void)SC_ATOMIC_SET(async_writer_running, 0);
+    LogFileFreeCtx(ctx);
+    async_ctx_cnt = 0;
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void LogFileAsyncRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogFileAsyncTest01", LogFileAsyncTest01, 1);
+    UtRegisterTest("LogFileAsyncTest02", LogFileAsyncTest02, 1);
+    UtRegisterTest("LogFileAsyncTest03", LogFileAsyncTest03, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,44 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Asynchronous log writing. The packet threads queue their records
+ * and a single log writer thread does the actual file I/O, so that a
+ * slow disk doesn't stall packet processing.
+ */
+
+#ifndef __UTIL_LOGOPENFILE_ASYNC_H__
+#define __UTIL_LOGOPENFILE_ASYNC_H__
+
+#include "util-logopenfile.h"      /* LogFileCtx */
+
+/** what to do with a record if the queue is at its memcap */
+enum {
+    LOGFILE_ASYNC_POLICY_DROP = 0,
+    LOGFILE_ASYNC_POLICY_BLOCK,
+};
+
+int LogFileAsyncSetup(LogFileCtx *log_ctx);
+void LogFileAsyncDrain(void);
+
+void LogFileAsyncWriterSpawn(void);
+
+void LogFileAsyncRegisterTests(void);
+
+#endif /* __UTIL_LOGOPENFILE_ASYNC_H__ */
@@ -33,6 +33,9 @@
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
+#include "util-logopenfile-async.h"
+#include "util-misc.h"       /* ParseSizeStringU32 */
+#include "util-unittest.h"
 
 /** \brief connect to the indicated local stream socket, logging any errors
  *  \param path filesystem path to connect to
@@ -186,6 +189,25 @@ SCConfLogOpenGeneric(ConfNode *conf,
     if (append == NULL)
         append = DEFAULT_LOG_MODE_APPEND;
 
+    /* per thread batching of records */
+    const char *batch_size = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (batch_size != NULL) {
+        if (ParseSizeStringU32(batch_size, &log_ctx->batch_size) < 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry for "
+                       "%s.buffer-size: \"%s\"", conf->name, batch_size);
+            return -1;
+        }
+    }
+    intmax_t batch_interval = 0;
+    if (ConfGetChildValueInt(conf, "flush-interval", &batch_interval) == 1) {
+        if (batch_interval < 0 || batch_interval > UINT16_MAX) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry for "
+                       "%s.flush-interval: %"PRIdMAX, conf->name, batch_interval);
+            return -1;
+        }
+        log_ctx->batch_interval = (uint32_t)batch_interval;
+    }
+
     // Now, what have we been asked to open?
     if (strcasecmp(filetype, "unix_stream") == 0) {
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_STREAM);
@@ -195,10 +217,29 @@ SCConfLogOpenGeneric(ConfNode *conf,
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_DGRAM);
         if (log_ctx->fp == NULL)
             return -1; // Error already logged by Open...Fp routine
+        /* each record has to be its own datagram */
+        if (log_ctx->batch_size > 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.buffer-size "
+                         "not supported for unix_dgram, ignoring", conf->name);
+            log_ctx->batch_size = 0;
+        }
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append);
-        if (log_ctx->fp == NULL)
-            return -1; // Error already logged by Open...Fp routine
+        int threaded = 0;
+        if (ConfGetChildValueBool(conf, "threaded", &threaded) == 1 && threaded &&
+            !(log_ctx->flags & LOGFILE_BATCHED)) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.threaded is "
+                         "not supported by this output, ignoring", conf->name);
+            threaded = 0;
+        }
+        if (threaded) {
+            /* the files are opened by the threads */
+            log_ctx->threaded = 1;
+            log_ctx->append = (strcasecmp(append, "yes") == 0);
+        } else {
+            log_ctx->fp = SCLogOpenFileFp(log_path, append);
+            if (log_ctx->fp == NULL)
+                return -1; // Error already logged by Open...Fp routine
+        }
         log_ctx->is_regular = 1;
         log_ctx->filename = SCStrdup(log_path);
         if (unlikely(log_ctx->filename == NULL)) {
@@ -218,6 +259,17 @@ SCConfLogOpenGeneric(ConfNode *conf,
                    conf->name);
     }
 
+    /* hand the records to the log writer thread */
+    int async = 0;
+    if (ConfGetChildValueBool(conf, "async", &async) == 1 && async) {
+        if (strcasecmp(filetype, "pcie") == 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async is "
+                         "not supported for pcie, ignoring", conf->name);
+        } else {
+            LogFileAsyncSetup(log_ctx);
+        }
+    }
+
     SCLogInfo("%s output device (%s) initialized: %s", conf->name, filetype,
               filename);
 
@@ -257,6 +309,288 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
     return 0;
 }
 
+/** file of a single thread of a threaded LogFileCtx */
+typedef struct LogFileThreadFile_ {
+    pthread_t thread;
+    LogFileCtx *ctx;
+} LogFileThreadFile;
+
+/** \internal
+ *  \brief file name suffix for a thread: its name with anything but
+ *         letters, digits, '-' and '_' replaced, or its id if it has
+ *         no name.
+ */
+static void LogFileThreadSuffix(ThreadVars *tv, char *suffix, size_t size)
+{
+    char *c;
+
+    if (tv == NULL || tv->name == NULL || tv->name[0] == '\0') {
+        snprintf(suffix, size, "%lu", (unsigned long)SCGetThreadIdLong());
+        return;
+    }
+
+    strlcpy(suffix, tv->name, size);
+    for (c = suffix; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_')
+            *c = '_';
+    }
+}
+
+/** \internal
+ *  \brief get the calling thread's file of a threaded LogFileCtx,
+ *         opening it on first use
+ *
+ *  The file is named after the thread, so a thread writes to the same
+ *  file across restarts whatever order the threads start in. All loggers
+ *  of a thread share the file. As a thread runs its loggers one after
+ *  the other, the file doesn't need a lock.
+ */
+static LogFileCtx *LogFileGetThreadCtx(ThreadVars *tv, LogFileCtx *log_ctx)
+{
+    LogFileCtx *thread_ctx = NULL;
+    pthread_t self = pthread_self();
+    uint32_t u;
+
+    SCMutexLock(&log_ctx->fp_mutex);
+    for (u = 0; u < log_ctx->thread_files_cnt; u++) {
+        if (pthread_equal(log_ctx->thread_files[u].thread, self)) {
+            thread_ctx = log_ctx->thread_files[u].ctx;
+            goto end;
+        }
+    }
+
+    LogFileThreadFile *files = SCRealloc(log_ctx->thread_files,
+            (log_ctx->thread_files_cnt + 1) * sizeof(LogFileThreadFile));
+    if (unlikely(files == NULL))
+        goto end;
+    log_ctx->thread_files = files;
+
+    LogFileCtx *new_ctx = LogFileNewCtx();
+    if (unlikely(new_ctx == NULL))
+        goto end;
+
+    char suffix[64];
+    char path[PATH_MAX];
+    LogFileThreadSuffix(tv, suffix, sizeof(suffix));
+    snprintf(path, sizeof(path), "%s.%s", log_ctx->filename, suffix);
+
+    /* thread names should be unique, but don't share a file if not */
+    for (u = 0; u < log_ctx->thread_files_cnt; u++) {
+        if (strcmp(log_ctx->thread_files[u].ctx->filename, path) == 0) {
+            snprintf(path, sizeof(path), "%s.%s-%lu", log_ctx->filename,
+                    suffix, (unsigned long)SCGetThreadIdLong());
+            break;
+        }
+    }
+
+    new_ctx->fp = SCLogOpenFileFp(path, log_ctx->append ? "yes" : "no");
+    new_ctx->filename = SCStrdup(path);
+    if (new_ctx->fp == NULL || new_ctx->filename == NULL) {
+        LogFileFreeCtx(new_ctx);
+        goto end;
+    }
+    new_ctx->is_regular = 1;
+    OutputRegisterFileRotationFlag(&new_ctx->rotation_flag);
+    if (log_ctx->async)
+        LogFileAsyncSetup(new_ctx);
+
+    files[log_ctx->thread_files_cnt].thread = self;
+    files[log_ctx->thread_files_cnt].ctx = new_ctx;
+    log_ctx->thread_files_cnt++;
+    thread_ctx = new_ctx;
+
+    SCLogInfo("opened per thread log file %s", path);
+end:
+    SCMutexUnlock(&log_ctx->fp_mutex);
+    return thread_ctx;
+}
+
+/** batches with a flush interval, for LogFileBatchFlushIdle() */
+static LogFileBatch *idle_batches = NULL;
+static SCMutex idle_batches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void LogFileBatchIdleRegister(LogFileBatch *batch)
+{
+    SCMutexLock(&idle_batches_mutex);
+    batch->idle_next = idle_batches;
+    idle_batches = batch;
+    SCMutexUnlock(&idle_batches_mutex);
+}
+
+static void LogFileBatchIdleUnregister(LogFileBatch *batch)
+{
+    LogFileBatch **b;
+
+    SCMutexLock(&idle_batches_mutex);
+    for (b = &idle_batches; *b != NULL; b = &(*b)->idle_next) {
+        if (*b == batch) {
+            *b = batch->idle_next;
+            break;
+        }
+    }
+    SCMutexUnlock(&idle_batches_mutex);
+}
+
+/** \internal
+ *  \brief write a part of the batch holding only complete records
+ *
+ *  The file of a thread is normally only written by that thread, but the
+ *  idle flush may write to it as well, so it's locked in both cases.
+ */
+static int LogFileBatchWrite(LogFileCtx *log_ctx, LogFileBatch *batch,
+                             uint32_t from, uint32_t to)
+{
+    LogFileCtx *ctx = batch->thread_ctx ? batch->thread_ctx : log_ctx;
+    int ret;
+
+    if (to <= from)
+        return 0;
+
+    SCMutexLock(&ctx->fp_mutex);
+    ret = ctx->Write((const char *)MEMBUFFER_BUFFER(batch->buffer) + from,
+            to - from, ctx);
+    SCMutexUnlock(&ctx->fp_mutex);
+    return ret;
+}
+
+/** \brief create a per thread output batch for a LogFileCtx
+ *
+ *  Must be called by the thread that is going to use the batch, as for
+ *  a threaded LogFileCtx it also sets up that thread's file.
+ *
+ *  \param tv the thread, names its file of a threaded LogFileCtx
+ *  \param log_ctx the log file the batch will be written to
+ *  \param record_size max size of a single record
+ *  \retval batch or NULL on error
+ */
+LogFileBatch *LogFileBatchNew(ThreadVars *tv, LogFileCtx *log_ctx,
+                              uint32_t record_size)
+{
+    LogFileBatch *batch = SCMalloc(sizeof(LogFileBatch));
+    if (unlikely(batch == NULL))
+        return NULL;
+
+    batch->thread_ctx = NULL;
+    if (log_ctx->threaded) {
+        batch->thread_ctx = LogFileGetThreadCtx(tv, log_ctx);
+        if (batch->thread_ctx == NULL) {
+            SCFree(batch);
+            return NULL;
+        }
+    }
+
+    /* room for a full batch plus the record that completes it */
+    batch->buffer = MemBufferCreateNew(log_ctx->batch_size + record_size);
+    if (batch->buffer == NULL) {
+        SCFree(batch);
+        return NULL;
+    }
+    batch->last_flush = time(NULL);
+    batch->committed = 0;
+    batch->flushed = 0;
+    batch->log_ctx = log_ctx;
+    batch->idle_next = NULL;
+    SCMutexInit(&batch->m, NULL);
+
+    if (log_ctx->batch_interval > 0)
+        LogFileBatchIdleRegister(batch);
+    return batch;
+}
+
+/** \brief flush and free a per thread output batch */
+void LogFileBatchFree(LogFileCtx *log_ctx, LogFileBatch *batch)
+{
+    if (batch == NULL)
+        return;
+
+    if (log_ctx->batch_interval > 0)
+        LogFileBatchIdleUnregister(batch);
+    LogFileBatchFlush(log_ctx, batch);
+    SCMutexDestroy(&batch->m);
+    MemBufferFree(batch->buffer);
+    SCFree(batch);
+}
+
+/** \internal
+ *  \brief write out the records the idle flush hasn't written yet and
+ *         empty the batch, batch->m must be held
+ */
+static int LogFileBatchFlushLocked(LogFileCtx *log_ctx, LogFileBatch *batch)
+{
+    int ret = LogFileBatchWrite(log_ctx, batch, batch->flushed,
+            MEMBUFFER_OFFSET(batch->buffer));
+
+    MemBufferReset(batch->buffer);
+    batch->committed = 0;
+    batch->flushed = 0;
+    batch->last_flush = time(NULL);
+    return ret;
+}
+
+/** \brief write out all records in the batch
+ *
+ *  Records are only ever added as a whole, so the batch is written with
+ *  a single Write call and lines from different threads don't mix.
+ *  Only to be called by the thread owning the batch, between records.
+ *
+ *  \retval ret result of the Write call, 0 if there was nothing to write
+ */
+int LogFileBatchFlush(LogFileCtx *log_ctx, LogFileBatch *batch)
+{
+    SCMutexLock(&batch->m);
+    int ret = LogFileBatchFlushLocked(log_ctx, batch);
+    SCMutexUnlock(&batch->m);
+    return ret;
+}
+
+/** \brief register that a complete record was added to the batch
+ *
+ *  Writes the batch out if it's full or if it's been kept for longer
+ *  than the flush interval.
+ */
+int LogFileBatchCommit(LogFileCtx *log_ctx, LogFileBatch *batch)
+{
+    int ret = 0;
+
+    SCMutexLock(&batch->m);
+    batch->committed = MEMBUFFER_OFFSET(batch->buffer);
+
+    if (MEMBUFFER_OFFSET(batch->buffer) >= log_ctx->batch_size ||
+        (log_ctx->batch_interval > 0 &&
+         time(NULL) - batch->last_flush >= (time_t)log_ctx->batch_interval))
+        ret = LogFileBatchFlushLocked(log_ctx, batch);
+    SCMutexUnlock(&batch->m);
+    return ret;
+}
+
+/** \brief write out the records of batches kept longer than their flush
+ *         interval, for threads that get no more records to log
+ *
+ *  Called by the flow manager. Only complete records are written, the
+ *  buffer itself is left to the owning thread: it may be adding the next
+ *  record behind them while we write.
+ *
+ *  \param now current time, as time(NULL)
+ */
+void LogFileBatchFlushIdle(time_t now)
+{
+    LogFileBatch *batch;
+
+    SCMutexLock(&idle_batches_mutex);
+    for (batch = idle_batches; batch != NULL; batch = batch->idle_next) {
+        SCMutexLock(&batch->m);
+        if (batch->committed > batch->flushed &&
+            now - batch->last_flush >= (time_t)batch->log_ctx->batch_interval) {
+            LogFileBatchWrite(batch->log_ctx, batch, batch->flushed,
+                    batch->committed);
+            batch->flushed = batch->committed;
+            batch->last_flush = now;
+        }
+        SCMutexUnlock(&batch->m);
+    }
+    SCMutexUnlock(&idle_batches_mutex);
+}
+
 /** \brief LogFileNewCtx() Get a new LogFileCtx
  *  \retval LogFileCtx * pointer if succesful, NULL if error
  *  */
@@ -288,6 +622,10 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    /* don't leave records of this file in the queue */
+    if (lf_ctx->async)
+        LogFileAsyncDrain();
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
@@ -296,6 +634,16 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
 
     SCMutexDestroy(&lf_ctx->fp_mutex);
 
+    if (lf_ctx->thread_files != NULL) {
+        uint32_t u;
+        for (u = 0; u < lf_ctx->thread_files_cnt; u++) {
+            LogFileCtx *thread_ctx = lf_ctx->thread_files[u].ctx;
+            OutputUnregisterFileRotationFlag(&thread_ctx->rotation_flag);
+            LogFileFreeCtx(thread_ctx);
+        }
+        SCFree(lf_ctx->thread_files);
+    }
+
     if (lf_ctx->prefix != NULL)
         SCFree(lf_ctx->prefix);
 
@@ -306,3 +654,123 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
 
     SCReturnInt(1);
 }
+
+#ifdef UNITTESTS
+
+static char batch_test_buf[256];
+static uint32_t batch_test_len = 0;
+
+static int LogFileBatchTestWrite(const char *buffer, int buffer_len, LogFileCtx *ctx)
+{
+    if (batch_test_len + buffer_len < sizeof(batch_test_buf)) {
+        memcpy(batch_test_buf + batch_test_len, buffer, buffer_len);
+        batch_test_len += buffer_len;
+        batch_test_buf[batch_test_len] = '\0';
+    }
+    return 1;
+}
+
+/** \test the batch is written out once it holds batch_size bytes */
+static int LogFileBatchTest01(void)
+{
+    int result = 0;
+    LogFileBatch *batch = NULL;
+
+    batch_test_len = 0;
+    batch_test_buf[0] = '\0';
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (ctx == NULL)
+        return 0;
+    ctx->Write = LogFileBatchTestWrite;
+    ctx->batch_size = 8;
+
+    batch = LogFileBatchNew(NULL, ctx, 16);
+    if (batch == NULL)
+        goto end;
+
+    MemBufferWriteString(batch->buffer, "abc\n");
+    LogFileBatchCommit(ctx, batch);
+    if (batch_test_len != 0)
+        goto end;
+
+    MemBufferWriteString(batch->buffer, "defgh\n");
+    LogFileBatchCommit(ctx, batch);
+    if (strcmp(batch_test_buf, "abc\ndefgh\n") != 0 ||
+        MEMBUFFER_OFFSET(batch->buffer) != 0) {
+        printf("got \"%s\": ", batch_test_buf);
+        goto end;
+    }
+
+    result = 1;
+end:
+    LogFileBatchFree(ctx, batch);
+    LogFileFreeCtx(ctx);
+    return result;
+}
+
+/** \test the idle flush writes the complete records of a batch that is
+ *        kept longer than the flush interval, and the owner doesn't
+ *        write them again */
+static int LogFileBatchTest02(void)
+{
+    int result = 0;
+    LogFileBatch *batch = NULL;
+
+    batch_test_len = 0;
+    batch_test_buf[0] = '\0';
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (ctx == NULL)
+        return 0;
+    ctx->Write = LogFileBatchTestWrite;
+    ctx->batch_size = 128;
+    ctx->batch_interval = 1;
+
+    batch = LogFileBatchNew(NULL, ctx, 16);
+    if (batch == NULL)
+        goto end;
+
+    MemBufferWriteString(batch->buffer, "one\n");
+    LogFileBatchCommit(ctx, batch);
+    if (batch_test_len != 0)
+        goto end;
+
+    /* not idle long enough yet */
+    LogFileBatchFlushIdle(batch->last_flush);
+    if (batch_test_len != 0)
+        goto end;
+
+    /* half a record is never written */
+    MemBufferWriteString(batch->buffer, "tw");
+    LogFileBatchFlushIdle(batch->last_flush + 1);
+    if (strcmp(batch_test_buf, "one\n") != 0) {
+        printf("got \"%s\": ", batch_test_buf);
+        goto end;
+    }
+
+    /* the owner completes the record and flushes the rest */
+    MemBufferWriteString(batch->buffer, "o\n");
+    LogFileBatchCommit(ctx, batch);
+    LogFileBatchFlush(ctx, batch);
+    if (strcmp(batch_test_buf, "one\ntwo\n") != 0) {
+        printf("got \"%s\": ", batch_test_buf);
+        goto end;
+    }
+
+    result = 1;
+end:
+    LogFileBatchFree(ctx, batch);
+    LogFileFreeCtx(ctx);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void LogFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogFileBatchTest01", LogFileBatchTest01, 1);
+    UtRegisterTest("LogFileBatchTest02", LogFileBatchTest02, 1);
+#endif /* UNITTESTS */
+}
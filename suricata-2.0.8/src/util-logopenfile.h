@@ -26,6 +26,7 @@
 
 #include "conf.h"            /* ConfNode   */
 #include "tm-modules.h"      /* LogFileCtx */
+#include "util-buffer.h"     /* MemBuffer  */
 
 typedef struct {
     uint16_t fileno;
@@ -68,11 +69,53 @@ typedef struct LogFileCtx_ {
 
     /* Flag set when file rotation notification is received. */
     int rotation_flag;
+
+    /** Per thread batching of records, see LogFileBatch. 0 means
+     *  every record is written right away. */
+    uint32_t batch_size;        /**< bytes to collect before writing */
+    uint32_t batch_interval;    /**< max seconds between writes, 0: no limit */
+
+    /** One file per thread: 'filename'.1, 'filename'.2, etc. The files
+     *  are opened by LogFileBatchNew(). Their lock is only contended by
+     *  the idle flush. */
+    uint8_t threaded;
+    uint8_t append;             /**< open the thread files in append mode */
+    uint32_t thread_files_cnt;
+    struct LogFileThreadFile_ *thread_files;
+
+    /** Records are handed to the log writer thread, see
+     *  util-logopenfile-async.c. Write then only queues the record and
+     *  WriteSync is the original Write, called by the writer thread. */
+    uint8_t async;
+    int (*WriteSync)(const char *buffer, int buffer_len, struct LogFileCtx_ *fp);
 } LogFileCtx;
 
+/** Per thread output buffer. Complete records are collected here and
+ *  written to the LogFileCtx in one go when the buffer is full or when
+ *  the flush interval has passed. The flow manager writes out the
+ *  records of threads that stay idle, see LogFileBatchFlushIdle(). */
+typedef struct LogFileBatch_ {
+    MemBuffer *buffer;
+    time_t last_flush;
+    /** this thread's own file if the LogFileCtx is threaded */
+    LogFileCtx *thread_ctx;
+
+    /** protects committed, flushed and last_flush against the idle
+     *  flush. The record after committed is only touched by the owner. */
+    SCMutex m;
+    uint32_t committed;     /**< end of the last complete record */
+    uint32_t flushed;       /**< written by the idle flush up to here */
+
+    LogFileCtx *log_ctx;
+    struct LogFileBatch_ *idle_next;
+} LogFileBatch;
+
 /* flags for LogFileCtx */
 #define LOGFILE_HEADER_WRITTEN 0x01
 #define LOGFILE_ALERTS_PRINTED 0x02
+/** all records are written through a LogFileBatch, set by the
+ *  output before SCConfLogOpenGeneric() to allow "threaded" */
+#define LOGFILE_BATCHED        0x04
 
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
@@ -80,4 +123,12 @@ int LogFileFreeCtx(LogFileCtx *);
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *);
 int SCConfLogReopen(LogFileCtx *);
 
+LogFileBatch *LogFileBatchNew(ThreadVars *, LogFileCtx *, uint32_t);
+void LogFileBatchFree(LogFileCtx *, LogFileBatch *);
+int LogFileBatchFlush(LogFileCtx *, LogFileBatch *);
+int LogFileBatchCommit(LogFileCtx *, LogFileBatch *);
+void LogFileBatchFlushIdle(time_t);
+
+void LogFileRegisterTests(void);
+
 #endif /* __UTIL_LOGOPENFILE_H__ */
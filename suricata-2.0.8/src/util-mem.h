@@ -43,17 +43,15 @@
 #else /* CPPCHECK */
 
 
-#if defined(_WIN32) || defined(__WIN32)
+#if defined(_WIN32) || defined(__WIN32) || defined(__x86_64__) || defined(__i386__)
 #include "mm_malloc.h"
-#endif
-
-#if defined(__tile__)
+#else
 /* Need to define __mm_ function alternatives, since these are SSE only.
  */
 #include <malloc.h>
 #define _mm_malloc(a,b) memalign((b),(a))
 #define _mm_free(a) free((a))
-#endif /* defined(__tile__) */
+#endif
 
 SC_ATOMIC_EXTERN(unsigned int, engine_stage);
 
@@ -0,0 +1,1364 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ *         Aho-Corasick MPM with compressed state tables, for large
+ *         pattern sets where the full 256 wide rows of "ac" don't fit
+ *         in the cache (or in memory).
+ *
+ *         - The input alphabet is reduced to the (lowercased) bytes that
+ *           are used in the patterns, plus one symbol for all the
+ *           others. Rows are rounded up to a power of 2 symbols.
+ *         - A next state is stored in 1, 2 or 4 bytes, depending on the
+ *           number of states of the context. The top bit tells if the
+ *           next state has outputs.
+ *         - The states closest to the root, which is where the automaton
+ *           spends most of its time, get a full (delta) row. If the table
+ *           for all states would be too big, the deeper states only store
+ *           the band of their goto transitions, from the first to the last
+ *           symbol that has one, plus a failure transition.
+ *         - States are numbered in breadth first order, so the dense
+ *           states are a prefix and a single compare tells the row type.
+ *
+ *         Same idea as ac-tile, which is Tile-Gx only.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "util-memcmp.h"
+#include "util-memcpy.h"
+#include "util-mpm-ac-compact.h"
+
+void SCACCompactInitCtx(MpmCtx *);
+void SCACCompactInitThreadCtx(MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCACCompactDestroyCtx(MpmCtx *);
+void SCACCompactDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCACCompactAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                            uint32_t, uint32_t, uint8_t);
+int SCACCompactAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                            uint32_t, uint32_t, uint8_t);
+int SCACCompactPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCACCompactSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen);
+uint32_t SCACCompactSearchContinue(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                                   PatternMatcherQueue *pmq, uint8_t *buf,
+                                   uint32_t buflen, uint32_t offset,
+                                   uint32_t *state);
+void SCACCompactPrintInfo(MpmCtx *mpm_ctx);
+void SCACCompactPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCACCompactRegisterTests(void);
+
+/* a placeholder to denote a failure transition in the goto table */
+#define SC_AC_COMPACT_FAIL (-1)
+/* size of the hash table used to speed up pattern insertions initially */
+#define INIT_HASH_SIZE 65536
+
+/** max size of the dense part of the state table. If all states fit,
+ *  there are no banded states at all. */
+#define SC_AC_COMPACT_DENSE_MAX (2 * 1024 * 1024)
+
+static uint32_t ac_compact_dense_max = SC_AC_COMPACT_DENSE_MAX;
+
+/**
+ * \brief Outputs of a state, only used while building the tables
+ */
+typedef struct SCACCompactOutput_ {
+    uint32_t *pids;
+    uint32_t no_of_entries;
+} SCACCompactOutput;
+
+/**
+ * \brief Automaton as it's built, before it's converted to the compressed
+ *        tables.
+ */
+typedef struct SCACCompactBuild_ {
+    int32_t *goto_table;            /**< state_count * alphabet_size */
+    int32_t *failure_table;
+    SCACCompactOutput *output_table;
+    uint32_t state_count;
+    uint32_t state_size;            /**< allocated states */
+} SCACCompactBuild;
+
+static inline uint32_t SCACCompactInitHashRaw(uint8_t *pat, uint16_t patlen)
+{
+    uint32_t hash = patlen * pat[0];
+    if (patlen > 1)
+        hash += pat[1];
+
+    return (hash % INIT_HASH_SIZE);
+}
+
+static inline SCACCompactPattern *SCACCompactInitHashLookup(SCACCompactCtx *ctx,
+        uint8_t *pat, uint16_t patlen, uint32_t pid)
+{
+    uint32_t hash = SCACCompactInitHashRaw(pat, patlen);
+
+    if (ctx->init_hash == NULL) {
+        return NULL;
+    }
+
+    SCACCompactPattern *t = ctx->init_hash[hash];
+    for ( ; t != NULL; t = t->next) {
+        if (t->id == pid)
+            return t;
+    }
+
+    return NULL;
+}
+
+static void SCACCompactFreePattern(MpmCtx *mpm_ctx, SCACCompactPattern *p)
+{
+    if (p == NULL)
+        return;
+
+    if (p->ci != NULL) {
+        SCFree(p->ci);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    if (p->original_pat != NULL) {
+        SCFree(p->original_pat);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    SCFree(p);
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACCompactPattern);
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the mpm-ac-compact context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCACCompactAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                                 uint16_t offset, uint16_t depth, uint32_t pid,
+                                 uint32_t sid, uint8_t flags)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+
+    SCLogDebug("Adding pattern for ctx %p, patlen %"PRIu16" and pid %" PRIu32,
+               ctx, patlen, pid);
+
+    if (patlen == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
+        return 0;
+    }
+
+    /* check if we have already inserted this pattern */
+    if (SCACCompactInitHashLookup(ctx, pat, patlen, pid) != NULL)
+        return 0;
+
+    SCACCompactPattern *p = SCMalloc(sizeof(SCACCompactPattern));
+    if (unlikely(p == NULL))
+        return -1;
+    memset(p, 0, sizeof(SCACCompactPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCompactPattern);
+
+    p->len = patlen;
+    p->flags = flags;
+    p->id = pid;
+
+    p->original_pat = SCMalloc(patlen);
+    if (p->original_pat == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    memcpy(p->original_pat, pat, patlen);
+
+    p->ci = SCMalloc(patlen);
+    if (p->ci == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    memcpy_tolower(p->ci, pat, patlen);
+
+    /* put in the pattern hash */
+    uint32_t hash = SCACCompactInitHashRaw(pat, patlen);
+    p->next = ctx->init_hash[hash];
+    ctx->init_hash[hash] = p;
+
+    mpm_ctx->pattern_cnt++;
+
+    if (mpm_ctx->maxlen < patlen)
+        mpm_ctx->maxlen = patlen;
+
+    if (mpm_ctx->minlen == 0) {
+        mpm_ctx->minlen = patlen;
+    } else {
+        if (mpm_ctx->minlen > patlen)
+            mpm_ctx->minlen = patlen;
+    }
+
+    /* we need the max pat id */
+    if (pid > ctx->max_pat_id)
+        ctx->max_pat_id = pid;
+
+    return 0;
+
+error:
+    SCACCompactFreePattern(mpm_ctx, p);
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Map the bytes used in the patterns to the symbols 1 to n, the
+ *        unused bytes to 0. Upper case maps to lower case.
+ */
+static void SCACCompactInitTranslateTable(SCACCompactCtx *ctx,
+        SCACCompactPattern **parray, uint32_t pattern_cnt)
+{
+    uint8_t used[256];
+    uint32_t i;
+    int c;
+
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < pattern_cnt; i++) {
+        uint16_t u;
+        for (u = 0; u < parray[i]->len; u++)
+            used[parray[i]->ci[u]] = 1;
+    }
+
+    ctx->alphabet_size = 1;
+    for (c = 0; c < 256; c++) {
+        if (used[c])
+            ctx->translate_table[c] = (uint8_t)ctx->alphabet_size++;
+        else
+            ctx->translate_table[c] = 0;
+    }
+    for (c = 'A'; c <= 'Z'; c++)
+        ctx->translate_table[c] = ctx->translate_table[c - 'A' + 'a'];
+
+    ctx->row_shift = 0;
+    while ((1U << ctx->row_shift) < ctx->alphabet_size)
+        ctx->row_shift++;
+}
+
+static int32_t SCACCompactNewState(SCACCompactBuild *b, uint16_t alphabet_size)
+{
+    if (b->state_count == b->state_size) {
+        uint32_t size = b->state_size ? b->state_size * 2 : 256;
+        void *ptmp;
+
+        ptmp = SCRealloc(b->goto_table, (size_t)size * alphabet_size * sizeof(int32_t));
+        if (ptmp == NULL)
+            return -1;
+        b->goto_table = ptmp;
+
+        ptmp = SCRealloc(b->output_table, (size_t)size * sizeof(SCACCompactOutput));
+        if (ptmp == NULL)
+            return -1;
+        b->output_table = ptmp;
+
+        b->state_size = size;
+    }
+
+    uint16_t aa;
+    for (aa = 0; aa < alphabet_size; aa++) {
+        b->goto_table[(size_t)b->state_count * alphabet_size + aa] = SC_AC_COMPACT_FAIL;
+    }
+    memset(&b->output_table[b->state_count], 0, sizeof(SCACCompactOutput));
+
+    return (int32_t)b->state_count++;
+}
+
+static int SCACCompactAddOutput(SCACCompactOutput *out, uint32_t pid)
+{
+    uint32_t i;
+    for (i = 0; i < out->no_of_entries; i++) {
+        if (out->pids[i] == pid)
+            return 0;
+    }
+
+    void *ptmp = SCRealloc(out->pids, (out->no_of_entries + 1) * sizeof(uint32_t));
+    if (ptmp == NULL)
+        return -1;
+    out->pids = ptmp;
+    out->pids[out->no_of_entries++] = pid;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Build the goto trie for all patterns.
+ */
+static int SCACCompactCreateGotoTable(SCACCompactCtx *ctx, SCACCompactBuild *b,
+        SCACCompactPattern **parray, uint32_t pattern_cnt)
+{
+    uint16_t stride = ctx->alphabet_size;
+    uint32_t i;
+
+    if (SCACCompactNewState(b, stride) < 0)
+        return -1;
+
+    for (i = 0; i < pattern_cnt; i++) {
+        SCACCompactPattern *p = parray[i];
+        int32_t state = 0;
+        uint16_t u;
+
+        for (u = 0; u < p->len; u++) {
+            uint8_t tc = ctx->translate_table[p->ci[u]];
+            int32_t next = b->goto_table[(size_t)state * stride + tc];
+            if (next == SC_AC_COMPACT_FAIL) {
+                next = SCACCompactNewState(b, stride);
+                if (next < 0)
+                    return -1;
+                b->goto_table[(size_t)state * stride + tc] = next;
+            }
+            state = next;
+        }
+
+        if (SCACCompactAddOutput(&b->output_table[state], p->id) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Create the failure table and merge the outputs of the failure
+ *        states. Fills order with the states in breadth first order and
+ *        depth with the depth of each state.
+ */
+static int SCACCompactCreateFailureTable(SCACCompactCtx *ctx, SCACCompactBuild *b,
+        int32_t *order, uint16_t *depth)
+{
+    uint16_t stride = ctx->alphabet_size;
+    uint32_t head = 0, tail = 0;
+    uint16_t aa;
+
+    b->failure_table = SCMalloc(b->state_count * sizeof(int32_t));
+    if (b->failure_table == NULL)
+        return -1;
+    memset(b->failure_table, 0, b->state_count * sizeof(int32_t));
+
+    order[tail++] = 0;
+    depth[0] = 0;
+    head = 1;
+
+    for (aa = 0; aa < stride; aa++) {
+        int32_t t = b->goto_table[aa];
+        if (t == SC_AC_COMPACT_FAIL) {
+            /* root loops on itself */
+            b->goto_table[aa] = 0;
+        } else {
+            b->failure_table[t] = 0;
+            depth[t] = 1;
+            order[tail++] = t;
+        }
+    }
+
+    while (head < tail) {
+        int32_t r = order[head++];
+        for (aa = 0; aa < stride; aa++) {
+            int32_t t = b->goto_table[(size_t)r * stride + aa];
+            if (t == SC_AC_COMPACT_FAIL)
+                continue;
+
+            depth[t] = depth[r] + 1;
+            order[tail++] = t;
+
+            int32_t f = b->failure_table[r];
+            while (b->goto_table[(size_t)f * stride + aa] == SC_AC_COMPACT_FAIL)
+                f = b->failure_table[f];
+            f = b->goto_table[(size_t)f * stride + aa];
+            b->failure_table[t] = f;
+
+            uint32_t k;
+            for (k = 0; k < b->output_table[f].no_of_entries; k++) {
+                if (SCACCompactAddOutput(&b->output_table[t],
+                                         b->output_table[f].pids[k]) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static inline void SCACCompactSetNext(void *table, uint32_t idx, uint32_t value,
+                                      uint8_t bytes_per_state)
+{
+    switch (bytes_per_state) {
+        case 1:
+            ((uint8_t *)table)[idx] = (uint8_t)value;
+            break;
+        case 2:
+            ((uint16_t *)table)[idx] = (uint16_t)value;
+            break;
+        default:
+            ((uint32_t *)table)[idx] = value;
+            break;
+    }
+}
+
+static inline uint32_t SCACCompactGetNext(const void *table, uint32_t idx,
+                                          const uint8_t bytes_per_state)
+{
+    switch (bytes_per_state) {
+        case 1:
+            return ((const uint8_t *)table)[idx];
+        case 2:
+            return ((const uint16_t *)table)[idx];
+        default:
+            return ((const uint32_t *)table)[idx];
+    }
+}
+
+/** \internal
+ *  \brief size of the tables used at search time */
+static uint32_t SCACCompactTableSize(SCACCompactCtx *ctx)
+{
+    return (ctx->dense_cnt << ctx->row_shift) * ctx->bytes_per_state +
+        (ctx->state_count - ctx->dense_cnt) * sizeof(SCACCompactBand) +
+        ctx->band_table_cnt * ctx->bytes_per_state +
+        (ctx->state_count + 1) * sizeof(uint32_t) +
+        (ctx->state_count ? ctx->out_offset[ctx->state_count] : 0) * sizeof(uint32_t);
+}
+
+/**
+ * \internal
+ * \brief Convert the automaton to the compressed search tables.
+ */
+static int SCACCompactCreateTables(SCACCompactCtx *ctx, SCACCompactBuild *b,
+        int32_t *order, uint16_t *depth)
+{
+    uint16_t stride = ctx->alphabet_size;
+    uint32_t state_count = b->state_count;
+    uint32_t n, u;
+    uint16_t aa;
+
+    uint32_t *new_id = SCMalloc(state_count * sizeof(uint32_t));
+    if (new_id == NULL)
+        return -1;
+    for (n = 0; n < state_count; n++)
+        new_id[order[n]] = n;
+
+    ctx->state_count = state_count;
+    if (state_count < 128)
+        ctx->bytes_per_state = 1;
+    else if (state_count < 32768)
+        ctx->bytes_per_state = 2;
+    else
+        ctx->bytes_per_state = 4;
+    uint32_t flag = 1U << (ctx->bytes_per_state * 8 - 1);
+    uint32_t row_size = (1U << ctx->row_shift) * ctx->bytes_per_state;
+
+    /* dense rows for whole levels of the trie, as many as fit */
+    if ((uint64_t)state_count * row_size <= ac_compact_dense_max) {
+        ctx->dense_cnt = state_count;
+    } else {
+        ctx->dense_cnt = 1;
+        for (n = 1; n <= state_count; n++) {
+            if (n == state_count || depth[order[n]] != depth[order[n - 1]]) {
+                if ((uint64_t)n * row_size > ac_compact_dense_max)
+                    break;
+                ctx->dense_cnt = n;
+            }
+        }
+    }
+
+    ctx->dense_table = SCMalloc((size_t)ctx->dense_cnt * row_size);
+    if (ctx->dense_table == NULL)
+        goto error;
+    memset(ctx->dense_table, 0, (size_t)ctx->dense_cnt * row_size);
+
+    /* delta rows: a fail transition takes the row of the failure state,
+     * which is closer to the root so it's done already */
+    for (n = 0; n < ctx->dense_cnt; n++) {
+        int32_t s = order[n];
+        uint32_t row = n << ctx->row_shift;
+        uint32_t frow = new_id[b->failure_table[s]] << ctx->row_shift;
+
+        for (aa = 0; aa < stride; aa++) {
+            int32_t t = b->goto_table[(size_t)s * stride + aa];
+            uint32_t value;
+            if (t == SC_AC_COMPACT_FAIL) {
+                value = SCACCompactGetNext(ctx->dense_table, frow + aa,
+                                           ctx->bytes_per_state);
+            } else {
+                value = new_id[t];
+                if (b->output_table[t].no_of_entries > 0)
+                    value |= flag;
+            }
+            SCACCompactSetNext(ctx->dense_table, row + aa, value,
+                               ctx->bytes_per_state);
+        }
+    }
+
+    /* bands for the rest */
+    if (ctx->dense_cnt < state_count) {
+        ctx->bands = SCMalloc((state_count - ctx->dense_cnt) * sizeof(SCACCompactBand));
+        if (ctx->bands == NULL)
+            goto error;
+        memset(ctx->bands, 0, (state_count - ctx->dense_cnt) * sizeof(SCACCompactBand));
+
+        ctx->band_table_cnt = 0;
+        for (n = ctx->dense_cnt; n < state_count; n++) {
+            int32_t s = order[n];
+            SCACCompactBand *band = &ctx->bands[n - ctx->dense_cnt];
+            int lo = -1, hi = -1;
+
+            for (aa = 0; aa < stride; aa++) {
+                if (b->goto_table[(size_t)s * stride + aa] != SC_AC_COMPACT_FAIL) {
+                    if (lo == -1)
+                        lo = aa;
+                    hi = aa;
+                }
+            }
+            band->fail = new_id[b->failure_table[s]];
+            band->offset = ctx->band_table_cnt;
+            if (lo != -1) {
+                band->lo = (uint8_t)lo;
+                band->len = (uint16_t)(hi - lo + 1);
+                ctx->band_table_cnt += band->len;
+            }
+        }
+
+        ctx->band_table = SCMalloc((size_t)ctx->band_table_cnt * ctx->bytes_per_state + 1);
+        if (ctx->band_table == NULL)
+            goto error;
+
+        for (n = ctx->dense_cnt; n < state_count; n++) {
+            int32_t s = order[n];
+            SCACCompactBand *band = &ctx->bands[n - ctx->dense_cnt];
+
+            for (u = 0; u < band->len; u++) {
+                /* no goto transition leads to the root, so 0 is a fail */
+                int32_t t = b->goto_table[(size_t)s * stride + band->lo + u];
+                uint32_t value = 0;
+                if (t != SC_AC_COMPACT_FAIL) {
+                    value = new_id[t];
+                    if (b->output_table[t].no_of_entries > 0)
+                        value |= flag;
+                }
+                SCACCompactSetNext(ctx->band_table, band->offset + u, value,
+                                   ctx->bytes_per_state);
+            }
+        }
+    }
+
+    /* outputs */
+    ctx->out_offset = SCMalloc((state_count + 1) * sizeof(uint32_t));
+    if (ctx->out_offset == NULL)
+        goto error;
+    uint32_t out_cnt = 0;
+    for (n = 0; n < state_count; n++) {
+        ctx->out_offset[n] = out_cnt;
+        out_cnt += b->output_table[order[n]].no_of_entries;
+    }
+    ctx->out_offset[state_count] = out_cnt;
+
+    ctx->out_pids = SCMalloc(out_cnt * sizeof(uint32_t) + 1);
+    if (ctx->out_pids == NULL)
+        goto error;
+    for (n = 0; n < state_count; n++) {
+        SCACCompactOutput *out = &b->output_table[order[n]];
+        if (out->no_of_entries > 0) {
+            memcpy(ctx->out_pids + ctx->out_offset[n], out->pids,
+                   out->no_of_entries * sizeof(uint32_t));
+        }
+    }
+
+    SCFree(new_id);
+    return 0;
+
+error:
+    SCFree(new_id);
+    return -1;
+}
+
+static void SCACCompactBuildFree(SCACCompactBuild *b)
+{
+    uint32_t n;
+
+    if (b->output_table != NULL) {
+        for (n = 0; n < b->state_count; n++) {
+            if (b->output_table[n].pids != NULL)
+                SCFree(b->output_table[n].pids);
+        }
+        SCFree(b->output_table);
+    }
+    if (b->goto_table != NULL)
+        SCFree(b->goto_table);
+    if (b->failure_table != NULL)
+        SCFree(b->failure_table);
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCACCompactPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    SCACCompactPattern **parray = NULL;
+    SCACCompactBuild b;
+    int32_t *order = NULL;
+    uint16_t *depth = NULL;
+    uint32_t i, p = 0;
+    int ret = -1;
+
+    memset(&b, 0, sizeof(b));
+
+    if (mpm_ctx->pattern_cnt == 0 || ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCACCompactPattern *));
+    if (parray == NULL)
+        goto end;
+
+    for (i = 0; i < INIT_HASH_SIZE; i++) {
+        SCACCompactPattern *node = ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(ctx->init_hash);
+    ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACCompactPattern *) * INIT_HASH_SIZE;
+
+    /* case sensitive patterns are verified after a match. Patterns
+     * without letters don't need that. */
+    ctx->pid_pat_list = SCMalloc((ctx->max_pat_id + 1) * sizeof(SCACCompactPatternList));
+    if (ctx->pid_pat_list == NULL)
+        goto end;
+    memset(ctx->pid_pat_list, 0, (ctx->max_pat_id + 1) * sizeof(SCACCompactPatternList));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (ctx->max_pat_id + 1) * sizeof(SCACCompactPatternList);
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCACCompactPattern *pat = parray[i];
+        ctx->pid_pat_list[pat->id].patlen = pat->len;
+
+        if (pat->flags & MPM_PATTERN_FLAG_NOCASE)
+            continue;
+        uint16_t u;
+        for (u = 0; u < pat->len; u++) {
+            if (isalpha(pat->original_pat[u]))
+                break;
+        }
+        if (u == pat->len)
+            continue;
+
+        ctx->pid_pat_list[pat->id].cs = SCMalloc(pat->len);
+        if (ctx->pid_pat_list[pat->id].cs == NULL)
+            goto end;
+        memcpy(ctx->pid_pat_list[pat->id].cs, pat->original_pat, pat->len);
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += pat->len;
+    }
+
+    SCACCompactInitTranslateTable(ctx, parray, mpm_ctx->pattern_cnt);
+
+    if (SCACCompactCreateGotoTable(ctx, &b, parray, mpm_ctx->pattern_cnt) < 0)
+        goto end;
+
+    order = SCMalloc(b.state_count * sizeof(int32_t));
+    depth = SCMalloc(b.state_count * sizeof(uint16_t));
+    if (order == NULL || depth == NULL)
+        goto end;
+
+    if (SCACCompactCreateFailureTable(ctx, &b, order, depth) < 0)
+        goto end;
+    if (SCACCompactCreateTables(ctx, &b, order, depth) < 0)
+        goto end;
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += SCACCompactTableSize(ctx);
+
+    SCLogDebug("%u states (%u dense), %u symbols, %u byte states, "
+               "%u band entries, %u bytes", ctx->state_count, ctx->dense_cnt,
+               ctx->alphabet_size, ctx->bytes_per_state, ctx->band_table_cnt,
+               SCACCompactTableSize(ctx));
+    ret = 0;
+
+end:
+    if (ret != 0)
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for the "
+                   "ac-compact state tables");
+
+    SCACCompactBuildFree(&b);
+    if (order != NULL)
+        SCFree(order);
+    if (depth != NULL)
+        SCFree(depth);
+    if (parray != NULL) {
+        for (i = 0; i < p; i++)
+            SCACCompactFreePattern(mpm_ctx, parray[i]);
+        SCFree(parray);
+    }
+    return ret;
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCACCompactInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                              uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCACCompactThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCACCompactThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCACCompactThreadCtx);
+}
+
+/**
+ * \brief Initialize the AC context.
+ *
+ * \param mpm_ctx Mpm context.
+ */
+void SCACCompactInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACCompactCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACCompactCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCompactCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    ctx->init_hash = SCMalloc(sizeof(SCACCompactPattern *) * INIT_HASH_SIZE);
+    if (ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->init_hash, 0, sizeof(SCACCompactPattern *) * INIT_HASH_SIZE);
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCompactPattern *) * INIT_HASH_SIZE;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACCompactDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCACCompactPrintSearchStats(mpm_thread_ctx);
+
+    if (mpm_thread_ctx->ctx != NULL) {
+        SCFree(mpm_thread_ctx->ctx);
+        mpm_thread_ctx->ctx = NULL;
+        mpm_thread_ctx->memory_cnt--;
+        mpm_thread_ctx->memory_size -= sizeof(SCACCompactThreadCtx);
+    }
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCACCompactDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->init_hash != NULL) {
+        for (i = 0; i < INIT_HASH_SIZE; i++) {
+            SCACCompactPattern *node = ctx->init_hash[i], *nnode = NULL;
+            while (node != NULL) {
+                nnode = node->next;
+                SCACCompactFreePattern(mpm_ctx, node);
+                node = nnode;
+            }
+        }
+        SCFree(ctx->init_hash);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= sizeof(SCACCompactPattern *) * INIT_HASH_SIZE;
+    }
+
+    if (ctx->out_offset != NULL) {
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= SCACCompactTableSize(ctx);
+    }
+    if (ctx->dense_table != NULL)
+        SCFree(ctx->dense_table);
+    if (ctx->bands != NULL)
+        SCFree(ctx->bands);
+    if (ctx->band_table != NULL)
+        SCFree(ctx->band_table);
+    if (ctx->out_offset != NULL)
+        SCFree(ctx->out_offset);
+    if (ctx->out_pids != NULL)
+        SCFree(ctx->out_pids);
+
+    if (ctx->pid_pat_list != NULL) {
+        for (i = 0; i < (ctx->max_pat_id + 1); i++) {
+            if (ctx->pid_pat_list[i].cs != NULL) {
+                SCFree(ctx->pid_pat_list[i].cs);
+                mpm_ctx->memory_cnt--;
+                mpm_ctx->memory_size -= ctx->pid_pat_list[i].patlen;
+            }
+        }
+        SCFree(ctx->pid_pat_list);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (ctx->max_pat_id + 1) * sizeof(SCACCompactPatternList);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACCompactCtx);
+}
+
+/**
+ * \internal
+ * \brief Add the outputs of state to the pmq, verifying the case
+ *        sensitive ones. i is the offset of the last byte of the match.
+ */
+static inline uint32_t SCACCompactReportMatches(const SCACCompactCtx *ctx,
+        PatternMatcherQueue *pmq, const uint8_t *buf, uint32_t i, uint32_t state)
+{
+    uint32_t matches = 0;
+    uint32_t k;
+
+    for (k = ctx->out_offset[state]; k < ctx->out_offset[state + 1]; k++) {
+        uint32_t pid = ctx->out_pids[k];
+        const SCACCompactPatternList *pl = &ctx->pid_pat_list[pid];
+
+        /* if the match starts before buf (continued search) it can't be
+         * verified, let the content inspection sort it out */
+        if (pl->cs != NULL && i + 1 >= pl->patlen &&
+            SCMemcmp(pl->cs, buf + i + 1 - pl->patlen, pl->patlen) != 0)
+            continue;
+
+        if (!(pmq->pattern_id_bitarray[pid / 8] & (1 << (pid % 8)))) {
+            pmq->pattern_id_bitarray[pid / 8] |= (1 << (pid % 8));
+            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pid;
+        }
+        matches++;
+    }
+
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Run the automaton over buf[offset..buflen), starting in *state_p.
+ *        bytes_per_state is a constant at every call site, so this is
+ *        specialized per state width.
+ */
+static inline uint32_t SCACCompactSearchInternal(const SCACCompactCtx *ctx,
+        PatternMatcherQueue *pmq, const uint8_t *buf, uint32_t offset,
+        uint32_t buflen, uint32_t *state_p, const uint8_t bytes_per_state)
+{
+    const uint32_t flag = 1U << (bytes_per_state * 8 - 1);
+    const uint8_t *xlate = ctx->translate_table;
+    const void *dense_table = ctx->dense_table;
+    const uint32_t dense_cnt = ctx->dense_cnt;
+    const uint8_t row_shift = ctx->row_shift;
+    uint32_t state = *state_p;
+    uint32_t matches = 0;
+    uint32_t i;
+
+    for (i = offset; i < buflen; i++) {
+        uint32_t c = xlate[buf[i]];
+        uint32_t s = state;
+        uint32_t next;
+
+        while (1) {
+            if (likely(s < dense_cnt)) {
+                next = SCACCompactGetNext(dense_table, (s << row_shift) + c,
+                                          bytes_per_state);
+                break;
+            }
+
+            const SCACCompactBand *band = &ctx->bands[s - dense_cnt];
+            uint32_t d = c - band->lo;
+            if (d < band->len) {
+                next = SCACCompactGetNext(ctx->band_table, band->offset + d,
+                                          bytes_per_state);
+                if (next != 0)
+                    break;
+            }
+            s = band->fail;
+        }
+
+        state = next & ~flag;
+        if (unlikely(next & flag)) {
+            matches += SCACCompactReportMatches(ctx, pmq, buf, i, state);
+        }
+    }
+
+    *state_p = state;
+    return matches;
+}
+
+static uint32_t SCACCompactSearchDispatch(const SCACCompactCtx *ctx,
+        PatternMatcherQueue *pmq, const uint8_t *buf, uint32_t offset,
+        uint32_t buflen, uint32_t *state)
+{
+    switch (ctx->bytes_per_state) {
+        case 1:
+            return SCACCompactSearchInternal(ctx, pmq, buf, offset, buflen, state, 1);
+        case 2:
+            return SCACCompactSearchInternal(ctx, pmq, buf, offset, buflen, state, 2);
+        default:
+            return SCACCompactSearchInternal(ctx, pmq, buf, offset, buflen, state, 4);
+    }
+}
+
+/**
+ * \brief The aho corasick search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACCompactSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t state = 0;
+
+    if (ctx->state_count == 0)
+        return 0;
+
+    return SCACCompactSearchDispatch(ctx, pmq, buf, 0, buflen, &state);
+}
+
+/**
+ * \brief Continue a search from a saved state, see SCACSearchContinue.
+ */
+uint32_t SCACCompactSearchContinue(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                                   PatternMatcherQueue *pmq, uint8_t *buf,
+                                   uint32_t buflen, uint32_t offset,
+                                   uint32_t *state)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+
+    if (ctx->state_count == 0)
+        return 0;
+    if (*state >= ctx->state_count)
+        *state = 0;
+
+    return SCACCompactSearchDispatch(ctx, pmq, buf, offset, buflen, state);
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ */
+int SCACCompactAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                            uint16_t offset, uint16_t depth, uint32_t pid,
+                            uint32_t sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return SCACCompactAddPattern(mpm_ctx, pat, patlen, offset, depth,
+                                 pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ */
+int SCACCompactAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                            uint16_t offset, uint16_t depth, uint32_t pid,
+                            uint32_t sid, uint8_t flags)
+{
+    return SCACCompactAddPattern(mpm_ctx, pat, patlen, offset, depth,
+                                 pid, sid, flags);
+}
+
+void SCACCompactPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+#ifdef SC_AC_COMPACT_COUNTERS
+    SCACCompactThreadCtx *ctx = (SCACCompactThreadCtx *)mpm_thread_ctx->ctx;
+    printf("AC Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_AC_COMPACT_COUNTERS */
+}
+
+void SCACCompactPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+
+    printf("MPM AC Compact Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("States:          %" PRIu32 " (%" PRIu32 " dense)\n",
+           ctx->state_count, ctx->dense_cnt);
+    printf("Alphabet:        %" PRIu32 "\n", ctx->alphabet_size);
+    printf("Bytes per state: %" PRIu32 "\n", ctx->bytes_per_state);
+    printf("\n");
+}
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the aho-corasick mpm with compressed state tables.
+ */
+void MpmACCompactRegister(void)
+{
+    mpm_table[MPM_AC_COMPACT].name = "ac-compact";
+    mpm_table[MPM_AC_COMPACT].max_pattern_length = 0;
+
+    mpm_table[MPM_AC_COMPACT].InitCtx = SCACCompactInitCtx;
+    mpm_table[MPM_AC_COMPACT].InitThreadCtx = SCACCompactInitThreadCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyCtx = SCACCompactDestroyCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx = SCACCompactDestroyThreadCtx;
+    mpm_table[MPM_AC_COMPACT].AddPattern = SCACCompactAddPatternCS;
+    mpm_table[MPM_AC_COMPACT].AddPatternNocase = SCACCompactAddPatternCI;
+    mpm_table[MPM_AC_COMPACT].Prepare = SCACCompactPreparePatterns;
+    mpm_table[MPM_AC_COMPACT].Search = SCACCompactSearch;
+    mpm_table[MPM_AC_COMPACT].SearchContinue = SCACCompactSearchContinue;
+    mpm_table[MPM_AC_COMPACT].Cleanup = NULL;
+    mpm_table[MPM_AC_COMPACT].PrintCtx = SCACCompactPrintInfo;
+    mpm_table[MPM_AC_COMPACT].PrintThreadCtx = SCACCompactPrintSearchStats;
+    mpm_table[MPM_AC_COMPACT].RegisterUnittests = SCACCompactRegisterTests;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCACCompactTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test case sensitive and nocase patterns, overlapping matches */
+static int SCACCompactTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"AbC", 3, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"bcd", 3, 0, 0, 1, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"CDE", 3, 0, 0, 2, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"12", 2, 0, 0, 3, 0, 0);
+    PmqSetup(&pmq, 4);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    /* AbC doesn't match, bcd does, cde nocase does, 12 twice */
+    char *buf = "abcde 12 12";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    if (cnt != 4 || pmq.pattern_id_array_cnt != 3 ||
+        (pmq.pattern_id_bitarray[0] & 0x01)) {
+        printf("cnt %u, pids %u: ", cnt, pmq.pattern_id_array_cnt);
+        goto end;
+    }
+
+    PmqReset(&pmq);
+    buf = "xAbCDEx";
+    cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                            (uint8_t *)buf, strlen(buf));
+    if (cnt != 2 || !(pmq.pattern_id_bitarray[0] & 0x01) ||
+        !(pmq.pattern_id_bitarray[0] & 0x04)) {
+        printf("cnt %u: ", cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/**
+ * \internal
+ * \brief Add pattern_cnt pseudo random patterns to ac and ac-compact and
+ *        compare the results on pseudo random data.
+ *
+ * \param symbols number of different bytes in the patterns and data
+ */
+static int SCACCompactCompare(uint32_t pattern_cnt, uint8_t symbols,
+                              uint32_t dense_max, uint8_t expect_bytes_per_state,
+                              int expect_banded)
+{
+    int result = 0;
+    MpmCtx ac_ctx, compact_ctx;
+    MpmThreadCtx ac_tctx, compact_tctx;
+    PatternMatcherQueue ac_pmq, compact_pmq;
+    uint32_t seed = 1234567;
+    uint32_t i, j;
+    uint8_t pat[16];
+    uint8_t buf[4096];
+
+#define SCAC_COMPACT_RAND() (seed = seed * 1103515245 + 12345, (seed >> 16) & 0x7fff)
+
+    ac_compact_dense_max = dense_max;
+
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    memset(&compact_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    MpmInitCtx(&compact_ctx, MPM_AC_COMPACT);
+    MpmInitThreadCtx(&ac_tctx, MPM_AC, 0);
+    MpmInitThreadCtx(&compact_tctx, MPM_AC_COMPACT, 0);
+
+    for (i = 0; i < pattern_cnt; i++) {
+        uint16_t len = 2 + SCAC_COMPACT_RAND() % 12;
+        for (j = 0; j < len; j++) {
+            pat[j] = 'a' + SCAC_COMPACT_RAND() % symbols;
+            if (SCAC_COMPACT_RAND() % 4 == 0)
+                pat[j] = toupper(pat[j]);
+        }
+        if (i % 3 == 0) {
+            MpmAddPatternCI(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+            MpmAddPatternCI(&compact_ctx, pat, len, 0, 0, i, 0, 0);
+        } else {
+            MpmAddPatternCS(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+            MpmAddPatternCS(&compact_ctx, pat, len, 0, 0, i, 0, 0);
+        }
+    }
+    mpm_table[MPM_AC].Prepare(&ac_ctx);
+    mpm_table[MPM_AC_COMPACT].Prepare(&compact_ctx);
+    PmqSetup(&ac_pmq, pattern_cnt);
+    PmqSetup(&compact_pmq, pattern_cnt);
+
+    SCACCompactCtx *ctx = (SCACCompactCtx *)compact_ctx.ctx;
+    if (ctx->bytes_per_state != expect_bytes_per_state ||
+        (ctx->dense_cnt < ctx->state_count) != expect_banded) {
+        printf("%u states, %u dense, %u bytes per state: ", ctx->state_count,
+               ctx->dense_cnt, ctx->bytes_per_state);
+        goto end;
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < sizeof(buf); j++) {
+            buf[j] = 'a' + SCAC_COMPACT_RAND() % (symbols + 2);
+            if (SCAC_COMPACT_RAND() % 4 == 0)
+                buf[j] = toupper(buf[j]);
+        }
+
+        uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_tctx,
+                &ac_pmq, buf, sizeof(buf));
+        uint32_t compact_cnt = mpm_table[MPM_AC_COMPACT].Search(&compact_ctx,
+                &compact_tctx, &compact_pmq, buf, sizeof(buf));
+
+        if (ac_cnt != compact_cnt ||
+            ac_pmq.pattern_id_array_cnt != compact_pmq.pattern_id_array_cnt ||
+            memcmp(ac_pmq.pattern_id_bitarray, compact_pmq.pattern_id_bitarray,
+                   ac_pmq.pattern_id_bitarray_size) != 0) {
+            printf("ac %u (%u pids) != ac-compact %u (%u pids): ", ac_cnt,
+                   ac_pmq.pattern_id_array_cnt, compact_cnt,
+                   compact_pmq.pattern_id_array_cnt);
+            goto end;
+        }
+        PmqReset(&ac_pmq);
+        PmqReset(&compact_pmq);
+    }
+
+    result = 1;
+end:
+#undef SCAC_COMPACT_RAND
+    ac_compact_dense_max = SC_AC_COMPACT_DENSE_MAX;
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_AC_COMPACT].DestroyCtx(&compact_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_tctx);
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx(&compact_ctx, &compact_tctx);
+    PmqFree(&ac_pmq);
+    PmqFree(&compact_pmq);
+    return result;
+}
+
+/** \test 8 bit states, all dense */
+static int SCACCompactTest03(void)
+{
+    return SCACCompactCompare(10, 4, SC_AC_COMPACT_DENSE_MAX, 1, 0);
+}
+
+/** \test 16 bit states, dense and banded */
+static int SCACCompactTest04(void)
+{
+    return SCACCompactCompare(500, 12, SC_AC_COMPACT_DENSE_MAX, 2, 0) &&
+           SCACCompactCompare(500, 12, 4096, 2, 1) &&
+           SCACCompactCompare(500, 12, 1, 2, 1);
+}
+
+/** \test 32 bit states, banded */
+static int SCACCompactTest05(void)
+{
+    return SCACCompactCompare(8000, 20, SC_AC_COMPACT_DENSE_MAX, 4, 1);
+}
+
+/** \test continuing a search gives the same result as one search */
+static int SCACCompactTest06(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t state = 0;
+
+    ac_compact_dense_max = 1;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcdef", 6, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"defgh", 5, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq, 2);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    uint8_t *buf = (uint8_t *)"xxabcdefghxx";
+    uint32_t cnt = SCACCompactSearchContinue(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                             buf, 4, 0, &state);
+    cnt += SCACCompactSearchContinue(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     buf, 7, 4, &state);
+    cnt += SCACCompactSearchContinue(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     buf, 12, 7, &state);
+    if (cnt != 2 || pmq.pattern_id_array_cnt != 2) {
+        printf("cnt %u: ", cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    ac_compact_dense_max = SC_AC_COMPACT_DENSE_MAX;
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test memory accounting drops back to 0 on destroy */
+static int SCACCompactTest07(void)
+{
+    MpmCtx mpm_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"Abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
+    SCACCompactPreparePatterns(&mpm_ctx);
+    if (mpm_ctx.memory_size == 0) {
+        SCACCompactDestroyCtx(&mpm_ctx);
+        return 0;
+    }
+    SCACCompactDestroyCtx(&mpm_ctx);
+
+    if (mpm_ctx.memory_cnt != 0 || mpm_ctx.memory_size != 0) {
+        printf("memory_cnt %u, memory_size %u: ", mpm_ctx.memory_cnt,
+               mpm_ctx.memory_size);
+        return 0;
+    }
+    return 1;
+}
+
+#endif /* UNITTESTS */
+
+void SCACCompactRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCACCompactTest01", SCACCompactTest01, 1);
+    UtRegisterTest("SCACCompactTest02", SCACCompactTest02, 1);
+    UtRegisterTest("SCACCompactTest03", SCACCompactTest03, 1);
+    UtRegisterTest("SCACCompactTest04", SCACCompactTest04, 1);
+    UtRegisterTest("SCACCompactTest05", SCACCompactTest05, 1);
+    UtRegisterTest("SCACCompactTest06", SCACCompactTest06, 1);
+    UtRegisterTest("SCACCompactTest07", SCACCompactTest07, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,100 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with compressed state tables. See util-mpm-ac-compact.c.
+ */
+
+#ifndef __UTIL_MPM_AC_COMPACT__H__
+#define __UTIL_MPM_AC_COMPACT__H__
+
+typedef struct SCACCompactPattern_ {
+    /* length of the pattern */
+    uint16_t len;
+    /* flags decribing the pattern */
+    uint8_t flags;
+    /* holds the original pattern that was added */
+    uint8_t *original_pat;
+    /* case INsensitive */
+    uint8_t *ci;
+    /* pattern id */
+    uint32_t id;
+
+    struct SCACCompactPattern_ *next;
+} SCACCompactPattern;
+
+typedef struct SCACCompactPatternList_ {
+    /* case sensitive pattern, NULL if nocase */
+    uint8_t *cs;
+    uint16_t patlen;
+} SCACCompactPatternList;
+
+/** goto transitions of a state that isn't in the dense table: the
+ *  transitions for the symbols lo to lo + len - 1 are stored at offset
+ *  in the band table, anything else takes the failure transition. */
+typedef struct SCACCompactBand_ {
+    uint32_t offset;
+    uint32_t fail;
+    uint16_t len;
+    uint8_t lo;
+} SCACCompactBand;
+
+typedef struct SCACCompactCtx_ {
+    /* input byte to symbol */
+    uint8_t translate_table[256];
+
+    /* size of a next state in bytes: 1, 2 or 4 */
+    uint8_t bytes_per_state;
+    /* log2 of the dense row size */
+    uint8_t row_shift;
+    /* number of symbols, including the one for unused bytes */
+    uint16_t alphabet_size;
+
+    /* states below dense_cnt have a full row in dense_table */
+    uint32_t dense_cnt;
+    uint32_t state_count;
+    void *dense_table;
+
+    /* the other states have a band, indexed by state - dense_cnt */
+    SCACCompactBand *bands;
+    void *band_table;
+    uint32_t band_table_cnt;
+
+    /* outputs of state s are out_pids[out_offset[s]] up to
+     * out_pids[out_offset[s + 1]] */
+    uint32_t *out_offset;
+    uint32_t *out_pids;
+
+    SCACCompactPatternList *pid_pat_list;
+    uint32_t max_pat_id;
+
+    /* only used at init time */
+    SCACCompactPattern **init_hash;
+} SCACCompactCtx;
+
+typedef struct SCACCompactThreadCtx_ {
+    /* the total calls we make to the search function */
+    uint32_t total_calls;
+    /* the total patterns that we ended up matching against */
+    uint64_t total_matches;
+} SCACCompactThreadCtx;
+
+void MpmACCompactRegister(void);
+
+#endif /* __UTIL_MPM_AC_COMPACT__H__ */
@@ -64,7 +64,7 @@ int SCACGfbsAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
                          uint32_t, uint32_t, uint8_t);
 int SCACGfbsPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACGfbsSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                        PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+                        PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen);
 void SCACGfbsPrintInfo(MpmCtx *mpm_ctx);
 void SCACGfbsPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACGfbsRegisterTests(void);
@@ -1260,7 +1260,7 @@ void SCACGfbsDestroyCtx(MpmCtx *mpm_ctx)
  * \retval matches Match count.
  */
 uint32_t SCACGfbsSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                        PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+                        PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen)
 {
     SCACGfbsCtx *ctx = (SCACGfbsCtx *)mpm_ctx->ctx;
     int matches = 0;
@@ -1277,7 +1277,7 @@ uint32_t SCACGfbsSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
         uint16_t **goto_table_mod_pointers = (uint16_t **)ctx->goto_table_mod_pointers;
 
         //int32_t *failure_table = ctx->failure_table;
-        int i;
+        uint32_t i;
         /* \todo tried loop unrolling with register var, with no perf increase.  Need
          * to dig deeper */
         /* with so many var declarations the register declaration here is useless */
@@ -1404,7 +1404,7 @@ uint32_t SCACGfbsSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
         uint8_t *ascii_codes = NULL;
         uint32_t **goto_table_mod_pointers = (uint32_t **)ctx->goto_table_mod_pointers;
         //int32_t *failure_table = ctx->failure_table;
-        int i = 0;
+        uint32_t i = 0;
         /* \todo tried loop unrolling with register var, with no perf increase.  Need
          * to dig deeper */
         register int32_t state = 0;
@@ -2583,7 +2583,7 @@ static int SCACGfbsTest28(void)
 static int SCACGfbsTest29(void)
 {
     uint8_t *buf = (uint8_t *)"onetwothreefourfivesixseveneightnine";
-    uint16_t buflen = strlen((char *)buf);
+    uint32_t buflen = strlen((char *)buf);
     Packet *p = NULL;
     ThreadVars th_v;
     DetectEngineThreadCtx *det_ctx = NULL;
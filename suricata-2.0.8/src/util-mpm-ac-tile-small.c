@@ -32,7 +32,7 @@
 
 /* This function handles (ctx->state_count < 32767) */
 uint32_t FUNC_NAME(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
-                   PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+                   PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen)
 {
     int i = 0;
     int matches = 0;
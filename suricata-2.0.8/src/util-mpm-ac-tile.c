@@ -100,51 +100,51 @@ int SCACTileAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCACTilePreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACTileSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                         PatternMatcherQueue *pmq, uint8_t *buf,
-                        uint16_t buflen);
+                        uint32_t buflen);
 void SCACTilePrintInfo(MpmCtx *mpm_ctx);
 void SCACTilePrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACTileRegisterTests(void);
 
 uint32_t SCACTileSearchLarge(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                              PatternMatcherQueue *pmq,
-                             uint8_t *buf, uint16_t buflen);
+                             uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchSmall256(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                 PatternMatcherQueue *pmq,
-                                uint8_t *buf, uint16_t buflen);
+                                uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchSmall128(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                 PatternMatcherQueue *pmq,
-                                uint8_t *buf, uint16_t buflen);
+                                uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchSmall64(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                PatternMatcherQueue *pmq,
-                               uint8_t *buf, uint16_t buflen);
+                               uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchSmall32(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                PatternMatcherQueue *pmq,
-                               uint8_t *buf, uint16_t buflen);
+                               uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchSmall16(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                PatternMatcherQueue *pmq,
-                               uint8_t *buf, uint16_t buflen);
+                               uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchSmall8(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                               PatternMatcherQueue *pmq,
-                              uint8_t *buf, uint16_t buflen);
+                              uint8_t *buf, uint32_t buflen);
 
 uint32_t SCACTileSearchTiny256(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                 PatternMatcherQueue *pmq,
-                                uint8_t *buf, uint16_t buflen);
+                                uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchTiny128(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                 PatternMatcherQueue *pmq,
-                                uint8_t *buf, uint16_t buflen);
+                                uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchTiny64(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                PatternMatcherQueue *pmq,
-                               uint8_t *buf, uint16_t buflen);
+                               uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchTiny32(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                PatternMatcherQueue *pmq,
-                               uint8_t *buf, uint16_t buflen);
+                               uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchTiny16(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                                PatternMatcherQueue *pmq,
-                               uint8_t *buf, uint16_t buflen);
+                               uint8_t *buf, uint32_t buflen);
 uint32_t SCACTileSearchTiny8(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                               PatternMatcherQueue *pmq,
-                              uint8_t *buf, uint16_t buflen);
+                              uint8_t *buf, uint32_t buflen);
 
 
 static void SCACTileDestroyInitCtx(MpmCtx *mpm_ctx);
@@ -1388,7 +1388,7 @@ void SCACTileDestroyCtx(MpmCtx *mpm_ctx)
 #define BYTE3(x) __insn_bfextu(x, 24, 31)
 
 int CheckMatch(SCACTileSearchCtx *ctx, PatternMatcherQueue *pmq,
-               uint8_t *buf, uint16_t buflen,
+               uint8_t *buf, uint32_t buflen,
                uint16_t state, int i, int matches)
 {
     SCACTilePatternList *pid_pat_list = ctx->pid_pat_list;
@@ -1441,7 +1441,7 @@ int CheckMatch(SCACTileSearchCtx *ctx, PatternMatcherQueue *pmq,
  * \retval matches Match count.
  */
 uint32_t SCACTileSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                        PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+                        PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen)
 {
     SCACTileSearchCtx *search_ctx = (SCACTileSearchCtx *)mpm_ctx->ctx;
 
@@ -1455,7 +1455,7 @@ uint32_t SCACTileSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
 /* This function handles (ctx->state_count >= 32767) */
 uint32_t SCACTileSearchLarge(SCACTileSearchCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
                              PatternMatcherQueue *pmq,
-                             uint8_t *buf, uint16_t buflen)
+                             uint8_t *buf, uint32_t buflen)
 {
     int i = 0;
     int matches = 0;
@@ -2702,7 +2702,7 @@ static int SCACTileTest28(void)
 static int SCACTileTest29(void)
 {
     uint8_t *buf = (uint8_t *)"onetwothreefourfivesixseveneightnine";
-    uint16_t buflen = strlen((char *)buf);
+    uint32_t buflen = strlen((char *)buf);
     Packet *p = NULL;
     ThreadVars th_v;
     DetectEngineThreadCtx *det_ctx = NULL;
@@ -79,7 +79,10 @@ int SCACAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
                      uint32_t, uint32_t, uint8_t);
 int SCACPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                    PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+                    PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen);
+uint32_t SCACSearchContinue(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                            PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen,
+                            uint32_t offset, uint32_t *state);
 void SCACPrintInfo(MpmCtx *mpm_ctx);
 void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACRegisterTests(void);
@@ -1192,33 +1195,27 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
 }
 
 /**
- * \brief The aho corasick search function.
+ * \brief Run the automaton over buf[offset..buflen), starting in *state_p.
  *
- * \param mpm_ctx        Pointer to the mpm context.
- * \param mpm_thread_ctx Pointer to the mpm thread context.
- * \param pmq            Pointer to the Pattern Matcher Queue to hold
- *                       search matches.
- * \param buf            Buffer to be searched.
- * \param buflen         Buffer length.
- *
- * \retval matches Match count.
+ *        Bytes before offset are only used to verify case sensitive
+ *        patterns. If a match reaches back before buf it can't be verified
+ *        and is counted anyway, the content inspection will sort it out.
  */
-uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                    PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+static inline uint32_t SCACSearchInternal(SCACCtx *ctx, PatternMatcherQueue *pmq,
+                                          uint8_t *buf, uint32_t offset,
+                                          uint32_t buflen, uint32_t *state_p)
 {
-    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
-    int i = 0;
-    int matches = 0;
+    uint32_t i = 0;
+    uint32_t matches = 0;
 
     /* \todo tried loop unrolling with register var, with no perf increase.  Need
      * to dig deeper */
-    /* \todo Change it for stateful MPM.  Supply the state using mpm_thread_ctx */
     SCACPatternList *pid_pat_list = ctx->pid_pat_list;
 
     if (ctx->state_count < 32767) {
-        register SC_AC_STATE_TYPE_U16 state = 0;
+        register SC_AC_STATE_TYPE_U16 state = (SC_AC_STATE_TYPE_U16)*state_p;
         SC_AC_STATE_TYPE_U16 (*state_table_u16)[256] = ctx->state_table_u16;
-        for (i = 0; i < buflen; i++) {
+        for (i = offset; i < buflen; i++) {
             state = state_table_u16[state & 0x7FFF][u8_tolower(buf[i])];
             if (state & 0x8000) {
                 uint32_t no_of_entries = ctx->output_table[state & 0x7FFF].no_of_entries;
@@ -1226,9 +1223,10 @@ uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                 uint32_t k;
                 for (k = 0; k < no_of_entries; k++) {
                     if (pids[k] & 0xFFFF0000) {
-                        if (SCMemcmp(pid_pat_list[pids[k] & 0x0000FFFF].cs,
-                                     buf + i - pid_pat_list[pids[k] & 0x0000FFFF].patlen + 1,
-                                     pid_pat_list[pids[k] & 0x0000FFFF].patlen) != 0) {
+                        uint16_t patlen = pid_pat_list[pids[k] & 0x0000FFFF].patlen;
+                        if (i + 1 >= patlen &&
+                            SCMemcmp(pid_pat_list[pids[k] & 0x0000FFFF].cs,
+                                     buf + i - patlen + 1, patlen) != 0) {
                             /* inside loop */
                             continue;
                         }
@@ -1248,16 +1246,15 @@ uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                         }
                         matches++;
                     }
-                    //loop1:
-                    //;
                 }
             }
-        } /* for (i = 0; i < buflen; i++) */
+        } /* for (i = offset; i < buflen; i++) */
+        *state_p = state & 0x7FFF;
 
     } else {
-        register SC_AC_STATE_TYPE_U32 state = 0;
+        register SC_AC_STATE_TYPE_U32 state = *state_p;
         SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
-        for (i = 0; i < buflen; i++) {
+        for (i = offset; i < buflen; i++) {
             state = state_table_u32[state & 0x00FFFFFF][u8_tolower(buf[i])];
             if (state & 0xFF000000) {
                 uint32_t no_of_entries = ctx->output_table[state & 0x00FFFFFF].no_of_entries;
@@ -1265,9 +1262,10 @@ uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                 uint32_t k;
                 for (k = 0; k < no_of_entries; k++) {
                     if (pids[k] & 0xFFFF0000) {
-                        if (SCMemcmp(pid_pat_list[pids[k] & 0x0000FFFF].cs,
-                                     buf + i - pid_pat_list[pids[k] & 0x0000FFFF].patlen + 1,
-                                     pid_pat_list[pids[k] & 0x0000FFFF].patlen) != 0) {
+                        uint16_t patlen = pid_pat_list[pids[k] & 0x0000FFFF].patlen;
+                        if (i + 1 >= patlen &&
+                            SCMemcmp(pid_pat_list[pids[k] & 0x0000FFFF].cs,
+                                     buf + i - patlen + 1, patlen) != 0) {
                             /* inside loop */
                             continue;
                         }
@@ -1287,16 +1285,58 @@ uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                         }
                         matches++;
                     }
-                    //loop1:
-                    //;
                 }
             }
-        } /* for (i = 0; i < buflen; i++) */
+        } /* for (i = offset; i < buflen; i++) */
+        *state_p = state & 0x00FFFFFF;
     }
 
     return matches;
 }
 
+/**
+ * \brief The aho corasick search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                    PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen)
+{
+    uint32_t state = 0;
+    return SCACSearchInternal((SCACCtx *)mpm_ctx->ctx, pmq, buf, 0, buflen, &state);
+}
+
+/**
+ * \brief Continue a search from a saved automaton state.
+ *
+ * \param buf     Buffer, the bytes before offset were scanned before.
+ * \param buflen  Buffer length.
+ * \param offset  Offset in buf to continue scanning at.
+ * \param state   In: state after the last scanned byte, 0 to start
+ *                fresh. Out: state after buf[buflen - 1].
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearchContinue(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                            PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen,
+                            uint32_t offset, uint32_t *state)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    /* state from a different ctx, start over */
+    if (*state >= ctx->state_count)
+        *state = 0;
+
+    return SCACSearchInternal(ctx, pmq, buf, offset, buflen, state);
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -2106,6 +2146,7 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].AddPatternNocase = SCACAddPatternCI;
     mpm_table[MPM_AC].Prepare = SCACPreparePatterns;
     mpm_table[MPM_AC].Search = SCACSearch;
+    mpm_table[MPM_AC].SearchContinue = SCACSearchContinue;
     mpm_table[MPM_AC].Cleanup = NULL;
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].PrintThreadCtx = SCACPrintSearchStats;
@@ -3118,7 +3159,7 @@ static int SCACTest28(void)
 static int SCACTest29(void)
 {
     uint8_t *buf = (uint8_t *)"onetwothreefourfivesixseveneightnine";
-    uint16_t buflen = strlen((char *)buf);
+    uint32_t buflen = strlen((char *)buf);
     Packet *p = NULL;
     ThreadVars th_v;
     DetectEngineThreadCtx *det_ctx = NULL;
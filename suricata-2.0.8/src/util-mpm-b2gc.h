@@ -105,14 +105,14 @@ typedef struct B2gcPattern_ {
 
 typedef struct B2gcCtx_ {
     /* we store our own multi byte search func ptr here for B2gcSearch1 */
-    uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
+    uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t);
     /* hash for looking up the idx in the pattern array */
     uint16_t *ha1;
     uint8_t *patterns1;
     uint32_t pat_x_cnt;
     uint32_t pat_1_cnt;
     /* we store our own multi byte search func ptr here for B2gcSearch1 */
-    uint32_t (*MBSearch)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
+    uint32_t (*MBSearch)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t);
 
     B2GC_TYPE m;
     uint32_t hash_size;
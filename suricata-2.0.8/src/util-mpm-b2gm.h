@@ -84,15 +84,15 @@ typedef struct B2gmLookup_ {
 
 typedef struct B2gmCtx_ {
     /* we store our own multi byte search func ptr here for B2gmSearch1 */
-    uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
+    uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t);
 
     /* hash for looking up the idx in the pattern array */
     uint16_t *ha1;
     uint8_t *patterns1;
 
     /* we store our own multi byte search func ptr here for B2gmSearch1 */
-    //uint32_t (*MBSearch2)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
-    uint32_t (*MBSearch)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
+    //uint32_t (*MBSearch2)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t);
+    uint32_t (*MBSearch)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t);
 
     uint16_t pat_1_cnt;
     uint16_t pat_x_cnt;
@@ -0,0 +1,1084 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Literal prefilter MPM, modeled after the "Teddy" matcher of Hyperscan.
+ *
+ * - The patterns are sorted and spread over 8 buckets. For each of the
+ *   first (up to 3) pattern bytes a low and a high nibble table holds
+ *   the buckets that have a pattern with that nibble at that position.
+ * - The search looks up the nibbles of 16 (SSSE3) or 32 (AVX2) input
+ *   bytes at once with pshufb and ANDs the results of all positions.
+ *   A bucket bit that survives marks a possible match start.
+ * - Candidates are verified against the patterns with the same
+ *   (lowercased) leading bytes, found through a small hash.
+ * - The vector code is compiled with target attributes and selected at
+ *   startup based on the cpu. Other cpu's use a scalar version of the
+ *   same filter, on full bytes instead of nibbles.
+ *
+ * This works best for small and medium sized pattern sets. With many
+ * patterns all buckets fill up and most positions become candidates.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "util-mpm.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-memcpy.h"
+#include "util-mpm-teddy.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SC_TEDDY_X86 1
+#include <immintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/* size of the hash table used to cull duplicate pattern ids */
+#define INIT_HASH_SIZE 4096
+
+/** search implementations */
+enum {
+    SC_TEDDY_IMPL_SCALAR = 0,
+    SC_TEDDY_IMPL_SSSE3,
+    SC_TEDDY_IMPL_AVX2,
+};
+
+static const char *teddy_impl_names[] = { "scalar", "ssse3", "avx2" };
+
+/** implementation picked at registration, based on the cpu */
+static int teddy_impl = SC_TEDDY_IMPL_SCALAR;
+
+static inline uint32_t SCTeddyInitHash(uint32_t pid)
+{
+    return (pid % INIT_HASH_SIZE);
+}
+
+/**
+ * \internal
+ * \brief Hash of the lowercased leading bytes of a pattern or buffer.
+ */
+static inline uint32_t SCTeddyFpHash(const uint8_t *buf, uint8_t fp_len,
+                                     uint32_t mask)
+{
+    uint32_t h = u8_tolower(buf[0]);
+    if (fp_len > 1)
+        h |= (uint32_t)u8_tolower(buf[1]) << 8;
+    if (fp_len > 2)
+        h |= (uint32_t)u8_tolower(buf[2]) << 16;
+
+    return ((h * 2654435761U) >> 8) & mask;
+}
+
+static void SCTeddyFreePattern(MpmCtx *mpm_ctx, SCTeddyPattern *p)
+{
+    if (p == NULL)
+        return;
+
+    if (p->cs != NULL && p->cs != p->ci) {
+        SCFree(p->cs);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+    if (p->ci != NULL) {
+        SCFree(p->ci);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    SCFree(p);
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyPattern);
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the teddy context.
+ *
+ * \param mpm_ctx Mpm context.
+ * \param pat     Pointer to the pattern.
+ * \param patlen  Length of the pattern.
+ * \param pid     Pattern id
+ * \param sid     Signature id (internal id).
+ * \param flags   Pattern's MPM_PATTERN_* flags.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCTeddyAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                             uint16_t offset, uint16_t depth, uint32_t pid,
+                             uint32_t sid, uint8_t flags)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    SCLogDebug("Adding pattern for ctx %p, patlen %"PRIu16" and pid %" PRIu32,
+               ctx, patlen, pid);
+
+    if (patlen == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
+        return 0;
+    }
+    if (ctx->init_hash == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "adding patterns to a prepared "
+                   "teddy ctx is not supported");
+        return -1;
+    }
+
+    /* check if we have already inserted this pattern */
+    uint32_t hash = SCTeddyInitHash(pid);
+    SCTeddyPattern *p = ctx->init_hash[hash];
+    for ( ; p != NULL; p = p->next) {
+        if (p->id == pid)
+            return 0;
+    }
+
+    p = SCMalloc(sizeof(SCTeddyPattern));
+    if (unlikely(p == NULL))
+        return -1;
+    memset(p, 0, sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyPattern);
+
+    p->len = patlen;
+    p->flags = flags;
+    p->id = pid;
+
+    p->ci = SCMalloc(patlen);
+    if (p->ci == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    memcpy_tolower(p->ci, pat, patlen);
+
+    if (p->flags & MPM_PATTERN_FLAG_NOCASE || memcmp(p->ci, pat, patlen) == 0) {
+        /* nocase or all lowercase: no need for a separate copy */
+        p->cs = p->ci;
+    } else {
+        p->cs = SCMalloc(patlen);
+        if (p->cs == NULL)
+            goto error;
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += patlen;
+        memcpy(p->cs, pat, patlen);
+    }
+
+    p->next = ctx->init_hash[hash];
+    ctx->init_hash[hash] = p;
+
+    mpm_ctx->pattern_cnt++;
+
+    if (mpm_ctx->maxlen < patlen)
+        mpm_ctx->maxlen = patlen;
+    if (mpm_ctx->minlen == 0 || mpm_ctx->minlen > patlen)
+        mpm_ctx->minlen = patlen;
+
+    return 0;
+
+error:
+    SCTeddyFreePattern(mpm_ctx, p);
+    return -1;
+}
+
+/** \internal sort on the lowercased pattern, so that patterns with the
+ *            same leading bytes end up in the same bucket */
+static int SCTeddyPatternCmp(const void *a, const void *b)
+{
+    const SCTeddyPattern *pa = *(const SCTeddyPattern **)a;
+    const SCTeddyPattern *pb = *(const SCTeddyPattern **)b;
+
+    int r = memcmp(pa->ci, pb->ci, pa->len < pb->len ? pa->len : pb->len);
+    if (r != 0)
+        return r;
+    return (int)pa->len - (int)pb->len;
+}
+
+/** \internal set the bucket bit for byte c at fingerprint position pos */
+static inline void SCTeddySetMask(SCTeddyCtx *ctx, int pos, uint8_t c,
+                                  uint8_t bit)
+{
+    ctx->byte_mask[pos][c] |= bit;
+    ctx->lo_mask[pos][c & 0x0f] |= bit;
+    ctx->lo_mask[pos][16 + (c & 0x0f)] |= bit;
+    ctx->hi_mask[pos][c >> 4] |= bit;
+    ctx->hi_mask[pos][16 + (c >> 4)] |= bit;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the nibble
+ *        masks and the verification hash.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0 || ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    ctx->parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+    if (ctx->parray == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+
+    uint32_t i, p = 0;
+    for (i = 0; i < INIT_HASH_SIZE; i++) {
+        SCTeddyPattern *node = ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            ctx->parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    SCFree(ctx->init_hash);
+    ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (INIT_HASH_SIZE * sizeof(SCTeddyPattern *));
+
+    ctx->fp_len = mpm_ctx->minlen < SC_TEDDY_MAX_FP_LEN ?
+        mpm_ctx->minlen : SC_TEDDY_MAX_FP_LEN;
+
+    /* verify hash: at least 2 slots per pattern, power of 2 */
+    uint32_t size = 256;
+    while (size < mpm_ctx->pattern_cnt * 2 && size < 65536)
+        size <<= 1;
+    ctx->verify_hash = SCMalloc(size * sizeof(SCTeddyPattern *));
+    if (ctx->verify_hash == NULL)
+        goto error;
+    memset(ctx->verify_hash, 0, size * sizeof(SCTeddyPattern *));
+    ctx->verify_hash_mask = size - 1;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (size * sizeof(SCTeddyPattern *));
+
+    qsort(ctx->parray, mpm_ctx->pattern_cnt, sizeof(SCTeddyPattern *),
+          SCTeddyPatternCmp);
+
+    memset(ctx->lo_mask, 0, sizeof(ctx->lo_mask));
+    memset(ctx->hi_mask, 0, sizeof(ctx->hi_mask));
+    memset(ctx->byte_mask, 0, sizeof(ctx->byte_mask));
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCTeddyPattern *pat = ctx->parray[i];
+        uint8_t bit = 1 << ((uint64_t)i * SC_TEDDY_BUCKETS / mpm_ctx->pattern_cnt);
+        int pos;
+
+        for (pos = 0; pos < ctx->fp_len; pos++) {
+            if (pat->cs == pat->ci) {
+                /* nocase: either case of the char can start a match. For
+                 * case sensitive lowercase patterns this is a harmless
+                 * extra candidate, the verification is exact. */
+                SCTeddySetMask(ctx, pos, pat->ci[pos], bit);
+                SCTeddySetMask(ctx, pos, toupper(pat->ci[pos]), bit);
+            } else {
+                SCTeddySetMask(ctx, pos, pat->cs[pos], bit);
+            }
+        }
+
+        uint32_t h = SCTeddyFpHash(pat->ci, ctx->fp_len, ctx->verify_hash_mask);
+        pat->next = ctx->verify_hash[h];
+        ctx->verify_hash[h] = pat;
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Check all patterns that share the leading bytes of buf + pos.
+ *
+ * \retval number of patterns that match at this position
+ */
+static inline uint32_t SCTeddyVerify(const SCTeddyCtx *ctx,
+                                     PatternMatcherQueue *pmq,
+                                     const uint8_t *buf, uint32_t buflen,
+                                     uint32_t pos)
+{
+    uint32_t matches = 0;
+    uint32_t left = buflen - pos;
+    uint32_t h = SCTeddyFpHash(buf + pos, ctx->fp_len, ctx->verify_hash_mask);
+
+    SCTeddyPattern *p = ctx->verify_hash[h];
+    for ( ; p != NULL; p = p->next) {
+        if (p->len > left)
+            continue;
+
+        if (p->cs == p->ci) {
+            if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+                if (SCMemcmpLowercase(p->ci, buf + pos, p->len) != 0)
+                    continue;
+            } else {
+                if (SCMemcmp(p->cs, buf + pos, p->len) != 0)
+                    continue;
+            }
+        } else {
+            if (SCMemcmp(p->cs, buf + pos, p->len) != 0)
+                continue;
+        }
+
+        if (!(pmq->pattern_id_bitarray[p->id / 8] & (1 << (p->id % 8)))) {
+            pmq->pattern_id_bitarray[p->id / 8] |= (1 << (p->id % 8));
+            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = p->id;
+        }
+        matches++;
+    }
+
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Scalar version of the filter, from position start up to the
+ *        end of the buffer.
+ */
+static uint32_t SCTeddySearchScalar(const SCTeddyCtx *ctx,
+                                    PatternMatcherQueue *pmq,
+                                    const uint8_t *buf, uint32_t buflen,
+                                    uint32_t start)
+{
+    uint32_t matches = 0;
+    uint32_t pos;
+    uint32_t end = buflen - ctx->fp_len;
+
+    for (pos = start; pos <= end; pos++) {
+        uint8_t m = ctx->byte_mask[0][buf[pos]];
+        if (ctx->fp_len > 1)
+            m &= ctx->byte_mask[1][buf[pos + 1]];
+        if (ctx->fp_len > 2)
+            m &= ctx->byte_mask[2][buf[pos + 2]];
+
+        if (m != 0)
+            matches += SCTeddyVerify(ctx, pmq, buf, buflen, pos);
+    }
+
+    return matches;
+}
+
+#ifdef SC_TEDDY_X86
+
+/**
+ * \internal
+ * \brief 16 bytes per round with pshufb.
+ *
+ * \param done set to the first position that wasn't inspected
+ */
+__attribute__((target("ssse3")))
+static uint32_t SCTeddySearchSSSE3(const SCTeddyCtx *ctx,
+                                   PatternMatcherQueue *pmq,
+                                   const uint8_t *buf, uint32_t buflen,
+                                   uint32_t *done)
+{
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[SC_TEDDY_MAX_FP_LEN], hi[SC_TEDDY_MAX_FP_LEN];
+    int j;
+
+    for (j = 0; j < ctx->fp_len; j++) {
+        lo[j] = _mm_load_si128((const __m128i *)ctx->lo_mask[j]);
+        hi[j] = _mm_load_si128((const __m128i *)ctx->hi_mask[j]);
+    }
+
+    for ( ; i + 16 + ctx->fp_len - 1 <= buflen; i += 16) {
+        __m128i res = _mm_set1_epi8((char)0xff);
+
+        for (j = 0; j < ctx->fp_len; j++) {
+            __m128i in = _mm_loadu_si128((const __m128i *)(buf + i + j));
+            __m128i l = _mm_shuffle_epi8(lo[j], _mm_and_si128(in, nibble));
+            __m128i h = _mm_shuffle_epi8(hi[j],
+                    _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+            res = _mm_and_si128(res, _mm_and_si128(l, h));
+        }
+
+        uint32_t bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xffff;
+        while (bits != 0) {
+            uint32_t k = __builtin_ctz(bits);
+            matches += SCTeddyVerify(ctx, pmq, buf, buflen, i + k);
+            bits &= bits - 1;
+        }
+    }
+
+    *done = i;
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief 32 bytes per round with vpshufb. The shuffle works per 128 bit
+ *        lane, which is why the masks are stored twice.
+ *
+ * \param done set to the first position that wasn't inspected
+ */
+__attribute__((target("avx2")))
+static uint32_t SCTeddySearchAVX2(const SCTeddyCtx *ctx,
+                                  PatternMatcherQueue *pmq,
+                                  const uint8_t *buf, uint32_t buflen,
+                                  uint32_t *done)
+{
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo[SC_TEDDY_MAX_FP_LEN], hi[SC_TEDDY_MAX_FP_LEN];
+    int j;
+
+    for (j = 0; j < ctx->fp_len; j++) {
+        lo[j] = _mm256_load_si256((const __m256i *)ctx->lo_mask[j]);
+        hi[j] = _mm256_load_si256((const __m256i *)ctx->hi_mask[j]);
+    }
+
+    for ( ; i + 32 + ctx->fp_len - 1 <= buflen; i += 32) {
+        __m256i res = _mm256_set1_epi8((char)0xff);
+
+        for (j = 0; j < ctx->fp_len; j++) {
+            __m256i in = _mm256_loadu_si256((const __m256i *)(buf + i + j));
+            __m256i l = _mm256_shuffle_epi8(lo[j], _mm256_and_si256(in, nibble));
+            __m256i h = _mm256_shuffle_epi8(hi[j],
+                    _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+            res = _mm256_and_si256(res, _mm256_and_si256(l, h));
+        }
+
+        uint32_t bits = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero));
+        while (bits != 0) {
+            uint32_t k = __builtin_ctz(bits);
+            matches += SCTeddyVerify(ctx, pmq, buf, buflen, i + k);
+            bits &= bits - 1;
+        }
+    }
+
+    *done = i;
+    return matches;
+}
+
+#endif /* SC_TEDDY_X86 */
+
+/** \internal search with a specific implementation */
+static uint32_t SCTeddySearchImpl(MpmCtx *mpm_ctx, PatternMatcherQueue *pmq,
+                                  const uint8_t *buf, uint32_t buflen,
+                                  int impl)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint32_t done = 0;
+
+    if (ctx == NULL || ctx->verify_hash == NULL || buflen < ctx->fp_len)
+        return 0;
+
+#ifdef SC_TEDDY_X86
+    if (impl == SC_TEDDY_IMPL_AVX2)
+        matches = SCTeddySearchAVX2(ctx, pmq, buf, buflen, &done);
+    else if (impl == SC_TEDDY_IMPL_SSSE3)
+        matches = SCTeddySearchSSSE3(ctx, pmq, buf, buflen, &done);
+#endif
+
+    /* tail, or everything if there is no vector version */
+    matches += SCTeddySearchScalar(ctx, pmq, buf, buflen, done);
+    return matches;
+}
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint32_t buflen)
+{
+    return SCTeddySearchImpl(mpm_ctx, pmq, buf, buflen, teddy_impl);
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCTeddyThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCTeddyThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCTeddyThreadCtx);
+
+    return;
+}
+
+/**
+ * \brief Initialize the teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    /* the masks need 32 byte alignment */
+    mpm_ctx->ctx = SCMallocAligned(sizeof(SCTeddyCtx), 32);
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    ctx->init_hash = SCMalloc(sizeof(SCTeddyPattern *) * INIT_HASH_SIZE);
+    if (ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->init_hash, 0, sizeof(SCTeddyPattern *) * INIT_HASH_SIZE);
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (INIT_HASH_SIZE * sizeof(SCTeddyPattern *));
+
+    SCReturn;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCTeddyPrintSearchStats(mpm_thread_ctx);
+
+    if (mpm_thread_ctx->ctx != NULL) {
+        SCFree(mpm_thread_ctx->ctx);
+        mpm_thread_ctx->ctx = NULL;
+        mpm_thread_ctx->memory_cnt--;
+        mpm_thread_ctx->memory_size -= sizeof(SCTeddyThreadCtx);
+    }
+
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    uint32_t i;
+    if (ctx->init_hash != NULL) {
+        for (i = 0; i < INIT_HASH_SIZE; i++) {
+            SCTeddyPattern *p = ctx->init_hash[i];
+            while (p != NULL) {
+                SCTeddyPattern *next = p->next;
+                SCTeddyFreePattern(mpm_ctx, p);
+                p = next;
+            }
+        }
+        SCFree(ctx->init_hash);
+        ctx->init_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (INIT_HASH_SIZE * sizeof(SCTeddyPattern *));
+    }
+
+    if (ctx->parray != NULL) {
+        for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+            SCTeddyFreePattern(mpm_ctx, ctx->parray[i]);
+        }
+        SCFree(ctx->parray);
+        ctx->parray = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+    }
+
+    if (ctx->verify_hash != NULL) {
+        SCFree(ctx->verify_hash);
+        ctx->verify_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ((ctx->verify_hash_mask + 1) * sizeof(SCTeddyPattern *));
+    }
+
+    SCFreeAligned(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+
+    return;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+
+#ifdef SC_TEDDY_COUNTERS
+    SCTeddyThreadCtx *ctx = (SCTeddyThreadCtx *)mpm_thread_ctx->ctx;
+    printf("Teddy Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_TEDDY_COUNTERS */
+
+    return;
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:    %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("  SCTeddyPattern %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Prefilter bytes: %" PRIu32 "\n", ctx->fp_len);
+    printf("Search impl:     %s\n", teddy_impl_names[teddy_impl]);
+    printf("\n");
+
+    return;
+}
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].max_pattern_length = 0;
+
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+
+#ifdef SC_TEDDY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        teddy_impl = SC_TEDDY_IMPL_AVX2;
+    else if (__builtin_cpu_supports("ssse3"))
+        teddy_impl = SC_TEDDY_IMPL_SSSE3;
+#endif
+    SCLogDebug("teddy mpm uses the %s search", teddy_impl_names[teddy_impl]);
+
+    return;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCTeddyTestSearch(char **pats, int npats, int nocase, char *buf,
+                             uint32_t expect)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    int i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    for (i = 0; i < npats; i++) {
+        if (nocase)
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)pats[i], strlen(pats[i]),
+                            0, 0, i, 0, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)pats[i], strlen(pats[i]),
+                            0, 0, i, 0, 0);
+    }
+    PmqSetup(&pmq, npats);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    if (cnt == expect)
+        result = 1;
+    else
+        printf("%" PRIu32 " != %" PRIu32 " ", expect, cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest01(void)
+{
+    char *pats[] = { "abcd", "bcde", "fghj" };
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    if (SCTeddyTestSearch(pats, 1, 0, buf, 1) == 0)
+        return 0;
+    /* no match */
+    char *nopats[] = { "abce" };
+    if (SCTeddyTestSearch(nopats, 1, 0, buf, 0) == 0)
+        return 0;
+    return SCTeddyTestSearch(pats, 3, 0, buf, 3);
+}
+
+/** \test case sensitivity, and matches in the scalar tail */
+static int SCTeddyTest02(void)
+{
+    char *pats[] = { "ABCD", "wxyz" };
+    char *buf = "abcdefghjiklmnopqrstuvwxyzABCDEFGHJIKLMNOPQRSTUVWXYZ";
+
+    /* 'wxyz' once, 'ABCD' once */
+    if (SCTeddyTestSearch(pats, 2, 0, buf, 2) == 0)
+        return 0;
+    /* nocase: both twice */
+    return SCTeddyTestSearch(pats, 2, 1, buf, 4);
+}
+
+/** \test single byte patterns and repeated matches */
+static int SCTeddyTest03(void)
+{
+    char *pats[] = { "A", "aa" };
+    char *buf = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"; /* 50 */
+
+    /* nocase: 'A' 50 times, 'aa' 49 times */
+    if (SCTeddyTestSearch(pats, 2, 1, buf, 99) == 0)
+        return 0;
+    /* case sensitive: 'aa' only */
+    return SCTeddyTestSearch(pats, 2, 0, buf, 49);
+}
+
+/** \test all implementations give the same results, and the same as ac */
+static int SCTeddyTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx, ac_ctx;
+    MpmThreadCtx ac_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint8_t buf[1000];
+    uint32_t i;
+    int impl;
+    char pat[8];
+    uint32_t seed = 12345;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    MpmInitThreadCtx(&ac_thread_ctx, MPM_AC, 0);
+
+    /* small alphabet, so that there are plenty of (partial) matches */
+    for (i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = "abcdABCD"[(seed >> 16) % 8];
+    }
+    for (i = 0; i < 64; i++) {
+        uint32_t len = 2 + i % 5, k;
+        for (k = 0; k < len; k++) {
+            seed = seed * 1103515245 + 12345;
+            pat[k] = "abcdABCD"[(seed >> 16) % 8];
+        }
+        if (i % 2) {
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)pat, len, 0, 0, i, 0, 0);
+            MpmAddPatternCI(&ac_ctx, (uint8_t *)pat, len, 0, 0, i, 0, 0);
+        } else {
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)pat, len, 0, 0, i, 0, 0);
+            MpmAddPatternCS(&ac_ctx, (uint8_t *)pat, len, 0, 0, i, 0, 0);
+        }
+    }
+    PmqSetup(&pmq, 64);
+    SCTeddyPreparePatterns(&mpm_ctx);
+    mpm_table[MPM_AC].Prepare(&ac_ctx);
+
+    /* different lengths to hit all block/tail combinations */
+    uint32_t len;
+    for (len = 0; len < sizeof(buf); len += 37) {
+        uint32_t expect = mpm_table[MPM_AC].Search(&ac_ctx, &ac_thread_ctx,
+                                                   &pmq, buf, len);
+        uint32_t expect_ids = pmq.pattern_id_array_cnt;
+        PmqReset(&pmq);
+
+        for (impl = SC_TEDDY_IMPL_SCALAR; impl <= teddy_impl; impl++) {
+            uint32_t cnt = SCTeddySearchImpl(&mpm_ctx, &pmq, buf, len, impl);
+            if (cnt != expect || pmq.pattern_id_array_cnt != expect_ids) {
+                printf("%s: len %u: %u/%u != %u/%u: ", teddy_impl_names[impl],
+                       len, cnt, pmq.pattern_id_array_cnt, expect, expect_ids);
+                goto end;
+            }
+            PmqReset(&pmq);
+        }
+    }
+
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test nocase search checked against memcmp on every position */
+static int SCTeddyTest05(void)
+{
+    char *pats[] = { "GET", "HTTP/1.", "host:", "\r\n\r\n", "ab", "Content-Length" };
+    char *buf = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n"
+                "content-length: 10\r\nUser-Agent: ab\r\n\r\nabab";
+    uint8_t lower[32];
+    uint32_t expect = 0;
+    size_t buflen = strlen(buf), i;
+    int p;
+
+    for (p = 0; p < 6; p++) {
+        size_t l = strlen(pats[p]);
+        memcpy_tolower(lower, (uint8_t *)pats[p], l);
+        for (i = 0; i + l <= buflen; i++) {
+            if (SCMemcmpLowercase(lower, buf + i, l) == 0)
+                expect++;
+        }
+    }
+    if (expect < 8)
+        return 0;
+
+    return SCTeddyTestSearch(pats, 6, 1, buf, expect);
+}
+
+/**
+ *  \test large pattern set cross checked against ac: every implementation
+ *        the cpu supports must find the same pattern id's as ac, on
+ *        generated data with planted patterns.
+ */
+static int SCTeddyTest06(void)
+{
+    const uint32_t npats = 2000;
+    const uint32_t buflen = 65536;
+    const char alpha[] = "abcdefghABCDEFGH0123\r\n :/.-";
+    int result = 0;
+    MpmCtx mpm_ctx, ac_ctx;
+    MpmThreadCtx ac_thread_ctx;
+    PatternMatcherQueue pmq, ac_pmq;
+    uint8_t *pats = NULL, *buf = NULL;
+    uint8_t patlens[2000];
+    uint32_t seed = 54321;
+    uint32_t i, k;
+    int impl;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    memset(&pmq, 0, sizeof(pmq));
+    memset(&ac_pmq, 0, sizeof(ac_pmq));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    MpmInitThreadCtx(&ac_thread_ctx, MPM_AC, 0);
+
+    pats = SCMalloc(npats * 32);
+    buf = SCMalloc(buflen);
+    if (pats == NULL || buf == NULL)
+        goto end;
+
+#define TEDDY_RAND() (seed = seed * 1103515245 + 12345, (seed >> 16))
+    for (i = 0; i < buflen; i++)
+        buf[i] = alpha[TEDDY_RAND() % (sizeof(alpha) - 1)];
+
+    for (i = 0; i < npats; i++) {
+        uint8_t *pat = pats + i * 32;
+        /* mostly 3+ bytes, so that not every position matches, some
+         * short ones for the single and double byte filter paths */
+        patlens[i] = (i % 50 == 0) ? 1 + (i / 50) % 2 : 3 + TEDDY_RAND() % 30;
+        for (k = 0; k < patlens[i]; k++) {
+            /* one in eight patterns has bytes outside of the data */
+            if (i % 8 == 7 && k + 1 == patlens[i])
+                pat[k] = (uint8_t)(0x80 | TEDDY_RAND());
+            else
+                pat[k] = alpha[TEDDY_RAND() % (sizeof(alpha) - 1)];
+        }
+        if (i % 3 == 0) {
+            MpmAddPatternCI(&mpm_ctx, pat, patlens[i], 0, 0, i, 0, 0);
+            MpmAddPatternCI(&ac_ctx, pat, patlens[i], 0, 0, i, 0, 0);
+        } else {
+            MpmAddPatternCS(&mpm_ctx, pat, patlens[i], 0, 0, i, 0, 0);
+            MpmAddPatternCS(&ac_ctx, pat, patlens[i], 0, 0, i, 0, 0);
+        }
+    }
+
+    /* plant half of the patterns in the data, some at the very end */
+    for (i = 0; i < npats; i += 2) {
+        uint32_t pos = TEDDY_RAND() % (buflen - 32);
+        if (i % 100 == 0)
+            pos = buflen - patlens[i];
+        memcpy(buf + pos, pats + i * 32, patlens[i]);
+    }
+#undef TEDDY_RAND
+
+    if (PmqSetup(&pmq, npats) < 0 || PmqSetup(&ac_pmq, npats) < 0)
+        goto end;
+    SCTeddyPreparePatterns(&mpm_ctx);
+    mpm_table[MPM_AC].Prepare(&ac_ctx);
+
+    uint32_t len;
+    for (len = buflen; len > 0; len /= 7) {
+        uint32_t expect = mpm_table[MPM_AC].Search(&ac_ctx, &ac_thread_ctx,
+                                                   &ac_pmq, buf, len);
+        if (len == buflen && ac_pmq.pattern_id_array_cnt < npats / 3) {
+            printf("only %u pattern ids found: ", ac_pmq.pattern_id_array_cnt);
+            goto end;
+        }
+
+        for (impl = SC_TEDDY_IMPL_SCALAR; impl <= teddy_impl; impl++) {
+            uint32_t cnt = SCTeddySearchImpl(&mpm_ctx, &pmq, buf, len, impl);
+            if (cnt != expect ||
+                pmq.pattern_id_array_cnt != ac_pmq.pattern_id_array_cnt ||
+                memcmp(pmq.pattern_id_bitarray, ac_pmq.pattern_id_bitarray,
+                       pmq.pattern_id_bitarray_size) != 0) {
+                printf("%s: len %u: %u/%u != %u/%u: ", teddy_impl_names[impl],
+                       len, cnt, pmq.pattern_id_array_cnt, expect,
+                       ac_pmq.pattern_id_array_cnt);
+                goto end;
+            }
+            PmqReset(&pmq);
+        }
+        PmqReset(&ac_pmq);
+    }
+
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_thread_ctx);
+    PmqFree(&pmq);
+    PmqFree(&ac_pmq);
+    if (pats != NULL)
+        SCFree(pats);
+    if (buf != NULL)
+        SCFree(buf);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01, 1);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02, 1);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03, 1);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04, 1);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05, 1);
+    UtRegisterTest("SCTeddyTest06", SCTeddyTest06, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,80 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy style literal prefilter MPM. See util-mpm-teddy.c.
+ */
+
+#ifndef __UTIL_MPM_TEDDY__H__
+#define __UTIL_MPM_TEDDY__H__
+
+/** max number of leading pattern bytes used for the prefilter */
+#define SC_TEDDY_MAX_FP_LEN     3
+/** number of buckets, one per bit of the mask bytes */
+#define SC_TEDDY_BUCKETS        8
+
+typedef struct SCTeddyPattern_ {
+    /* length of the pattern */
+    uint16_t len;
+    /* flags decribing the pattern */
+    uint8_t flags;
+    /* case sensitive */
+    uint8_t *cs;
+    /* case INsensitive */
+    uint8_t *ci;
+    /* pattern id */
+    uint32_t id;
+
+    /* next in the init hash, later in the verify hash */
+    struct SCTeddyPattern_ *next;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* nibble masks per fingerprint byte: bit n set means bucket n has a
+     * pattern with that nibble at that position. The 16 byte tables are
+     * stored twice so the 256 bit version can use them per lane. */
+    uint8_t lo_mask[SC_TEDDY_MAX_FP_LEN][32] __attribute__((aligned(32)));
+    uint8_t hi_mask[SC_TEDDY_MAX_FP_LEN][32] __attribute__((aligned(32)));
+    /* same info per full byte, for the scalar path */
+    uint8_t byte_mask[SC_TEDDY_MAX_FP_LEN][256];
+
+    /* hash used during ctx initialization */
+    SCTeddyPattern **init_hash;
+
+    /* all patterns, freed with the ctx */
+    SCTeddyPattern **parray;
+
+    /* patterns by their lowercased fingerprint, for verification */
+    SCTeddyPattern **verify_hash;
+    uint32_t verify_hash_mask;
+
+    /* number of leading bytes used for the prefilter */
+    uint8_t fp_len;
+} SCTeddyCtx;
+
+typedef struct SCTeddyThreadCtx_ {
+    /* the total calls we make to the search function */
+    uint32_t total_calls;
+    /* the total patterns that we ended up matching against */
+    uint64_t total_matches;
+} SCTeddyThreadCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY__H__ */
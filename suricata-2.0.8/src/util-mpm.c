@@ -37,6 +37,8 @@
 #include "util-mpm-ac-gfbs.h"
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-tile.h"
+#include "util-mpm-teddy.h"
+#include "util-mpm-ac-compact.h"
 #include "util-hashlist.h"
 
 #include "detect-engine.h"
@@ -239,6 +241,7 @@ void MpmFactoryReClaimMpmCtx(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx)
     if (!MpmFactoryIsMpmCtxAvailable(de_ctx, mpm_ctx)) {
         if (mpm_ctx->mpm_type != MPM_NOTSET)
             mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
+        MpmCtxFreeRecords(mpm_ctx);
         SCFree(mpm_ctx);
     }
 
@@ -440,14 +443,15 @@ int PmqSetup(PatternMatcherQueue *pmq, uint32_t patmaxid) {
         memset(pmq->pattern_id_array, 0, pmq->pattern_id_array_size);
         pmq->pattern_id_array_cnt = 0;
 
-        /* lookup bitarray */
+        /* lookup bitarray. The batch filter in detect-simd.c reads it
+         * 4 bytes at a time, so it gets 3 bytes of slack. */
         pmq->pattern_id_bitarray_size = (patmaxid / 8) + 1;
 
-        pmq->pattern_id_bitarray = SCMalloc(pmq->pattern_id_bitarray_size);
+        pmq->pattern_id_bitarray = SCMalloc(pmq->pattern_id_bitarray_size + 3);
         if (pmq->pattern_id_bitarray == NULL) {
             SCReturnInt(-1);
         }
-        memset(pmq->pattern_id_bitarray, 0, pmq->pattern_id_bitarray_size);
+        memset(pmq->pattern_id_bitarray, 0, pmq->pattern_id_bitarray_size + 3);
 
         SCLogDebug("pmq->pattern_id_array %p, pmq->pattern_id_bitarray %p",
                 pmq->pattern_id_array, pmq->pattern_id_bitarray);
@@ -565,9 +569,135 @@ void MpmInitThreadCtx(MpmThreadCtx *mpm_thread_ctx, uint16_t matcher, uint32_t m
     mpm_table[matcher].InitThreadCtx(NULL, mpm_thread_ctx, max_id);
 }
 
+/** \brief counter for the MpmCtx id's, 0 is never handed out */
+SC_ATOMIC_DECLARE(uint32_t, mpm_ctx_id_cnt);
+
 void MpmInitCtx (MpmCtx *mpm_ctx, uint16_t matcher) {
     mpm_ctx->mpm_type = matcher;
     mpm_table[matcher].InitCtx(mpm_ctx);
+
+    do {
+        mpm_ctx->id = SC_ATOMIC_ADD(mpm_ctx_id_cnt, 1);
+    } while (mpm_ctx->id == 0);
+}
+
+/** \brief Remember that pid was found in the stream, ending at or before
+ *         stream offset end.
+ *  \retval 0 ok, -1 out of memory */
+static int MpmStreamStateAddMatch(MpmStreamState *st, uint32_t pid, uint64_t end)
+{
+    uint32_t u;
+    for (u = 0; u < st->matches_cnt; u++) {
+        if (st->matches[u].pid == pid) {
+            st->matches[u].end = end;
+            return 0;
+        }
+    }
+
+    if (st->matches_cnt == st->matches_size) {
+        uint32_t size = st->matches_size ? st->matches_size * 2 : 16;
+        MpmStreamMatch *ptmp = SCRealloc(st->matches, size * sizeof(MpmStreamMatch));
+        if (ptmp == NULL)
+            return -1;
+        st->matches = ptmp;
+        st->matches_size = size;
+    }
+    st->matches[st->matches_cnt].pid = pid;
+    st->matches[st->matches_cnt].end = end;
+    st->matches_cnt++;
+    return 0;
+}
+
+/**
+ *  \brief Search a buffer that is a window on a stream of data, continuing
+ *         where the last search on the same stream left off.
+ *
+ *  The buffer covers the stream offsets buf_offset to buf_offset + buflen.
+ *  Bytes that were scanned by a previous call are not scanned again, the
+ *  patterns found in them are re-added to the pmq instead. If the mpm
+ *  supports SearchContinue the saved automaton state is used, otherwise
+ *  only the last maxlen - 1 already scanned bytes are scanned again.
+ *
+ *  \param pmq     pmq to add the matches to
+ *  \param scratch empty pmq used for the new part of the buffer, it's
+ *                 reset on return
+ *  \param st      state of this stream, zeroed before first use
+ *
+ *  \retval matches number of matches
+ */
+uint32_t MpmSearchStream(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                         PatternMatcherQueue *pmq, PatternMatcherQueue *scratch,
+                         MpmStreamState *st, uint8_t *buf, uint32_t buflen,
+                         uint64_t buf_offset)
+{
+    uint64_t end = buf_offset + buflen;
+    uint32_t matches = 0;
+    uint32_t u;
+
+    /* different ctx or not a continuation of what we scanned before */
+    if (st->mpm_ctx_id != mpm_ctx->id ||
+        st->scanned < buf_offset || st->scanned > end)
+    {
+        st->mpm_ctx_id = mpm_ctx->id;
+        st->state = 0;
+        st->scanned = buf_offset;
+        st->matches_cnt = 0;
+    }
+
+    uint32_t offset = (uint32_t)(st->scanned - buf_offset);
+    if (offset < buflen) {
+        if (mpm_table[mpm_ctx->mpm_type].SearchContinue != NULL) {
+            matches += mpm_table[mpm_ctx->mpm_type].SearchContinue(mpm_ctx,
+                    mpm_thread_ctx, scratch, buf, buflen, offset, &st->state);
+        } else {
+            uint32_t overlap = mpm_ctx->maxlen > 1 ? mpm_ctx->maxlen - 1 : 0;
+            uint32_t start = offset > overlap ? offset - overlap : 0;
+            matches += mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                    mpm_thread_ctx, scratch, buf + start, buflen - start);
+        }
+    }
+
+    /* re-add what we found before in the part of the buffer we skipped,
+     * forget about patterns that are out of the window now */
+    uint32_t keep = 0;
+    for (u = 0; u < st->matches_cnt; u++) {
+        if (st->matches[u].end <= buf_offset)
+            continue;
+
+        uint32_t pid = st->matches[u].pid;
+        if (!(pmq->pattern_id_bitarray[pid / 8] & (1 << (pid % 8)))) {
+            pmq->pattern_id_bitarray[pid / 8] |= (1 << (pid % 8));
+            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pid;
+        }
+        matches++;
+        st->matches[keep++] = st->matches[u];
+    }
+    st->matches_cnt = keep;
+
+    for (u = 0; u < scratch->pattern_id_array_cnt; u++) {
+        uint32_t pid = scratch->pattern_id_array[u];
+
+        if (MpmStreamStateAddMatch(st, pid, end) < 0) {
+            /* can't track it, make the next call start over */
+            st->mpm_ctx_id = 0;
+        }
+        if (!(pmq->pattern_id_bitarray[pid / 8] & (1 << (pid % 8)))) {
+            pmq->pattern_id_bitarray[pid / 8] |= (1 << (pid % 8));
+            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pid;
+        }
+    }
+    PmqReset(scratch);
+
+    st->scanned = end;
+    return matches;
+}
+
+/** \brief Free the memory held by a stream state and reset it */
+void MpmStreamStateFree(MpmStreamState *st)
+{
+    if (st->matches != NULL)
+        SCFree(st->matches);
+    memset(st, 0, sizeof(*st));
 }
 
 void MpmTableSetup(void) {
@@ -582,6 +712,8 @@ void MpmTableSetup(void) {
     MpmACBSRegister();
     MpmACGfbsRegister();
     MpmACTileRegister();
+    MpmTeddyRegister();
+    MpmACCompactRegister();
 #ifdef __SC_CUDA_SUPPORT__
     MpmACCudaRegister();
 #endif /* __SC_CUDA_SUPPORT__ */
@@ -643,10 +775,42 @@ uint32_t MpmGetBloomSize(const char *conf_val)
     SCReturnInt(bloom_value);
 }
 
+static void MpmCtxRecordPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                                uint16_t offset, uint16_t depth,
+                                uint32_t pid, uint8_t flags)
+{
+    if (mpm_ctx->records_cnt == mpm_ctx->records_size) {
+        uint32_t size = mpm_ctx->records_size ? mpm_ctx->records_size * 2 : 16;
+        MpmPatternRecord *ptmp = SCRealloc(mpm_ctx->records,
+                size * sizeof(MpmPatternRecord));
+        if (ptmp == NULL) {
+            /* can't tell what is in this ctx anymore, so it won't be shared */
+            MpmCtxFreeRecords(mpm_ctx);
+            mpm_ctx->record_patterns = 0;
+            return;
+        }
+        mpm_ctx->records = ptmp;
+        mpm_ctx->records_size = size;
+    }
+
+    mpm_ctx->records_hashed = 0;
+
+    MpmPatternRecord *r = &mpm_ctx->records[mpm_ctx->records_cnt++];
+    r->pat = pat;
+    r->pid = pid;
+    r->patlen = patlen;
+    r->offset = offset;
+    r->depth = depth;
+    r->flags = flags;
+}
+
 int MpmAddPatternCS(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                     uint16_t offset, uint16_t depth,
                     uint32_t pid, uint32_t sid, uint8_t flags)
 {
+    if (mpm_ctx->record_patterns)
+        MpmCtxRecordPattern(mpm_ctx, pat, patlen, offset, depth, pid, flags);
+
     return mpm_table[mpm_ctx->mpm_type].AddPattern(mpm_ctx, pat, patlen,
                                                    offset, depth,
                                                    pid, sid, flags);
@@ -656,16 +820,287 @@ int MpmAddPatternCI(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                     uint16_t offset, uint16_t depth,
                     uint32_t pid, uint32_t sid, uint8_t flags)
 {
+    if (mpm_ctx->record_patterns)
+        MpmCtxRecordPattern(mpm_ctx, pat, patlen, offset, depth, pid,
+                            flags | MPM_PATTERN_FLAG_NOCASE);
+
     return mpm_table[mpm_ctx->mpm_type].AddPatternNocase(mpm_ctx, pat, patlen,
                                                          offset, depth,
                                                          pid, sid, flags);
 }
 
+/**
+ * \brief Keep a list of the patterns added to the mpm ctx from now on, so
+ *        it can be compared to other mpm ctxs.
+ */
+void MpmCtxRecordPatterns(MpmCtx *mpm_ctx)
+{
+    mpm_ctx->record_patterns = 1;
+}
+
+void MpmCtxFreeRecords(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->records != NULL)
+        SCFree(mpm_ctx->records);
+    mpm_ctx->records = NULL;
+    mpm_ctx->records_cnt = 0;
+    mpm_ctx->records_size = 0;
+    mpm_ctx->records_hashed = 0;
+}
+
+static int MpmPatternRecordCmp(const void *a, const void *b)
+{
+    const MpmPatternRecord *r1 = (const MpmPatternRecord *)a;
+    const MpmPatternRecord *r2 = (const MpmPatternRecord *)b;
+
+    if (r1->pid != r2->pid)
+        return r1->pid < r2->pid ? -1 : 1;
+    if (r1->patlen != r2->patlen)
+        return r1->patlen < r2->patlen ? -1 : 1;
+    if (r1->flags != r2->flags)
+        return r1->flags < r2->flags ? -1 : 1;
+    if (r1->offset != r2->offset)
+        return r1->offset < r2->offset ? -1 : 1;
+    if (r1->depth != r2->depth)
+        return r1->depth < r2->depth ? -1 : 1;
+    return memcmp(r1->pat, r2->pat, r1->patlen);
+}
+
+/**
+ * \brief Hash the recorded pattern set of a mpm ctx. The records are
+ *        sorted and duplicates are removed, so the order in which the
+ *        patterns were added doesn't matter.
+ *
+ * The sorting is only done once: the hash is kept on the ctx until
+ * another pattern is added, so repeated lookups are cheap.
+ */
+uint32_t MpmCtxRecordsHash(MpmCtx *mpm_ctx)
+{
+    uint32_t hash = mpm_ctx->mpm_type;
+    uint32_t i, cnt = 0;
+
+    if (mpm_ctx->records_hashed)
+        return mpm_ctx->records_hash;
+    if (mpm_ctx->records_cnt == 0)
+        return hash;
+
+    qsort(mpm_ctx->records, mpm_ctx->records_cnt, sizeof(MpmPatternRecord),
+          MpmPatternRecordCmp);
+    for (i = 0; i < mpm_ctx->records_cnt; i++) {
+        if (cnt > 0 && MpmPatternRecordCmp(&mpm_ctx->records[cnt - 1],
+                                           &mpm_ctx->records[i]) == 0)
+            continue;
+        mpm_ctx->records[cnt++] = mpm_ctx->records[i];
+    }
+    mpm_ctx->records_cnt = cnt;
+
+    for (i = 0; i < cnt; i++) {
+        MpmPatternRecord *r = &mpm_ctx->records[i];
+        uint16_t u;
+
+        hash = hash * 31 + r->pid;
+        hash = hash * 31 + ((uint32_t)r->flags << 16 | r->patlen);
+        for (u = 0; u < r->patlen; u++)
+            hash = hash * 31 + r->pat[u];
+    }
+
+    mpm_ctx->records_hash = hash;
+    mpm_ctx->records_hashed = 1;
+    return hash;
+}
+
+/**
+ * \retval 1 if the mpm ctxs are of the same type and have the same
+ *         recorded patterns
+ * \retval 0 otherwise
+ */
+int MpmCtxRecordsEqual(MpmCtx *mpm_ctx1, MpmCtx *mpm_ctx2)
+{
+    if (mpm_ctx1->mpm_type != mpm_ctx2->mpm_type ||
+        !mpm_ctx1->record_patterns || !mpm_ctx2->record_patterns)
+        return 0;
+
+    /* both in their sorted form, different hashes can't be equal */
+    if (MpmCtxRecordsHash(mpm_ctx1) != MpmCtxRecordsHash(mpm_ctx2) ||
+        mpm_ctx1->records_cnt != mpm_ctx2->records_cnt)
+        return 0;
+
+    uint32_t i;
+    for (i = 0; i < mpm_ctx1->records_cnt; i++) {
+        if (MpmPatternRecordCmp(&mpm_ctx1->records[i], &mpm_ctx2->records[i]) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief Drop a signature group's reference to a non-global mpm ctx.
+ *
+ * \retval 1 if it was the last user, so the ctx should be destroyed
+ * \retval 0 if the ctx is still used by other signature groups
+ */
+int MpmCtxUnref(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->shared_cnt > 0) {
+        mpm_ctx->shared_cnt--;
+        return 0;
+    }
+
+    MpmCtxFreeRecords(mpm_ctx);
+    return 1;
+}
+
 
 
 /************************************Unittests*********************************/
 
 #ifdef UNITTESTS
+/** \test search a stream in overlapping windows, like the http body
+ *        inspection does */
+static int MpmSearchStreamTestRun(uint16_t matcher)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq, scratch;
+    MpmStreamState st;
+    uint32_t cnt;
+    /*                  0         1         2
+     *                  0123456789012345678901234 */
+    uint8_t stream[] = "xxxxabcdefyyyyXYZzzzzzqqq";
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    memset(&st, 0, sizeof(st));
+    MpmInitCtx(&mpm_ctx, matcher);
+    MpmInitThreadCtx(&mpm_thread_ctx, matcher, 2);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcdef", 6, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 1, 0, 0);
+    mpm_table[matcher].Prepare(&mpm_ctx);
+    PmqSetup(&pmq, 2);
+    PmqSetup(&scratch, 2);
+
+    /* first part of the pattern only */
+    MpmSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &scratch, &st,
+                    stream, 7, 0);
+    if (pmq.pattern_id_array_cnt != 0) {
+        printf("match in first window: ");
+        goto end;
+    }
+
+    /* window grows, pattern straddles what we scanned before */
+    MpmSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &scratch, &st,
+                    stream, 12, 0);
+    if (pmq.pattern_id_array_cnt != 1 || pmq.pattern_id_array[0] != 0) {
+        printf("expected pid 0 in second window: ");
+        goto end;
+    }
+    PmqReset(&pmq);
+
+    /* window slides, abcdef ended in it so it's still reported */
+    cnt = MpmSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &scratch, &st,
+                          stream + 8, 12, 8);
+    if (cnt < 2 || pmq.pattern_id_array_cnt != 2) {
+        printf("expected 2 pids in third window, got %u: ",
+                pmq.pattern_id_array_cnt);
+        goto end;
+    }
+    PmqReset(&pmq);
+
+    /* window slides past both patterns */
+    MpmSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &scratch, &st,
+                    stream + 20, 5, 20);
+    if (pmq.pattern_id_array_cnt != 0 || st.matches_cnt != 0) {
+        printf("stale matches in fourth window: ");
+        goto end;
+    }
+
+    /* a gap makes us start over */
+    MpmSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &scratch, &st,
+                    stream + 4, 6, 104);
+    if (pmq.pattern_id_array_cnt != 1 || st.scanned != 110) {
+        printf("expected pid 0 after gap: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    MpmStreamStateFree(&st);
+    mpm_table[matcher].DestroyCtx(&mpm_ctx);
+    mpm_table[matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PmqFree(&scratch);
+    return result;
+}
+
+/** \test streaming search with saved automaton state */
+static int MpmSearchStreamTest01(void)
+{
+    return MpmSearchStreamTestRun(MPM_AC);
+}
+
+/** \test streaming search for a mpm without SearchContinue */
+static int MpmSearchStreamTest02(void)
+{
+    return MpmSearchStreamTestRun(MPM_B2G);
+}
+#endif /* UNITTESTS */
+
+#ifdef UNITTESTS
+/** \test pattern sets compare equal whatever the order and duplicates,
+ *        and the hash is only recomputed after a pattern is added */
+static int MpmCtxRecordsTest01(void)
+{
+    MpmCtx ctx1, ctx2;
+    uint8_t a[] = "abc", b[] = "defg", c[] = "hij";
+    int result = 0;
+
+    memset(&ctx1, 0, sizeof(ctx1));
+    memset(&ctx2, 0, sizeof(ctx2));
+    MpmCtxRecordPatterns(&ctx1);
+    MpmCtxRecordPatterns(&ctx2);
+
+    MpmCtxRecordPattern(&ctx1, a, 3, 0, 0, 1, 0);
+    MpmCtxRecordPattern(&ctx1, b, 4, 0, 0, 2, MPM_PATTERN_FLAG_NOCASE);
+    MpmCtxRecordPattern(&ctx2, b, 4, 0, 0, 2, MPM_PATTERN_FLAG_NOCASE);
+    MpmCtxRecordPattern(&ctx2, a, 3, 0, 0, 1, 0);
+    MpmCtxRecordPattern(&ctx2, a, 3, 0, 0, 1, 0);
+
+    uint32_t hash = MpmCtxRecordsHash(&ctx1);
+    if (!ctx1.records_hashed || ctx2.records_hashed)
+        goto end;
+    if (MpmCtxRecordsHash(&ctx2) != hash || ctx2.records_cnt != 2 ||
+        !MpmCtxRecordsEqual(&ctx1, &ctx2))
+        goto end;
+
+    /* cached: a changed record isn't noticed until a pattern is added */
+    ctx1.records[0].pid = 5;
+    if (MpmCtxRecordsHash(&ctx1) != hash)
+        goto end;
+    ctx1.records[0].pid = 1;
+
+    MpmCtxRecordPattern(&ctx1, c, 3, 0, 0, 3, 0);
+    if (ctx1.records_hashed || MpmCtxRecordsEqual(&ctx1, &ctx2) ||
+        MpmCtxRecordsHash(&ctx1) == hash)
+        goto end;
+
+    MpmCtxRecordPattern(&ctx2, c, 3, 0, 0, 3, 0);
+    if (!MpmCtxRecordsEqual(&ctx1, &ctx2))
+        goto end;
+
+    /* same patterns, other matcher */
+    ctx2.mpm_type = ctx1.mpm_type + 1;
+    ctx2.records_hashed = 0;
+    if (MpmCtxRecordsEqual(&ctx1, &ctx2))
+        goto end;
+
+    result = 1;
+end:
+    MpmCtxFreeRecords(&ctx1);
+    MpmCtxFreeRecords(&ctx2);
+    return result;
+}
 #endif /* UNITTESTS */
 
 void MpmRegisterTests(void) {
@@ -688,5 +1123,8 @@ void MpmRegisterTests(void) {
         }
     }
 
+    UtRegisterTest("MpmSearchStreamTest01", MpmSearchStreamTest01, 1);
+    UtRegisterTest("MpmSearchStreamTest02", MpmSearchStreamTest02, 1);
+    UtRegisterTest("MpmCtxRecordsTest01", MpmCtxRecordsTest01, 1);
 #endif
 }
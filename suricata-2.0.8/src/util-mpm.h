@@ -72,6 +72,10 @@ enum {
     MPM_AC_GFBS,
     MPM_AC_BS,
     MPM_AC_TILE,
+    /* simd literal prefilter */
+    MPM_TEDDY,
+    /* aho-corasick with compressed tables */
+    MPM_AC_COMPACT,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -108,6 +112,18 @@ typedef struct PatternMatcherQueue_ {
     uint32_t pattern_id_bitarray_size; /**< size in bytes */
 } PatternMatcherQueue;
 
+/** \brief a pattern as it was added to a mpm ctx. Recorded to find mpm
+ *         ctxs with identical pattern sets, see MpmCtxRecordPatterns().
+ *         The pattern itself is not copied. */
+typedef struct MpmPatternRecord_ {
+    uint8_t *pat;
+    uint32_t pid;
+    uint16_t patlen;
+    uint16_t offset;
+    uint16_t depth;
+    uint8_t flags;
+} MpmPatternRecord;
+
 typedef struct MpmCtx_ {
     void *ctx;
     uint16_t mpm_type;
@@ -126,8 +142,51 @@ typedef struct MpmCtx_ {
 
     uint32_t memory_cnt;
     uint32_t memory_size;
+
+    /* unique id, set by MpmInitCtx. Used to tell if a saved stream
+     * state belongs to this ctx. */
+    uint32_t id;
+
+    /* number of signature groups using this ctx besides its owner */
+    uint32_t shared_cnt;
+    /* set once the ctx is prepared, or queued for it */
+    uint8_t prepared;
+
+    /* patterns added so far, only kept if recording is enabled */
+    MpmPatternRecord *records;
+    uint32_t records_cnt;
+    uint32_t records_size;
+    uint8_t record_patterns;
+    /* set once the records are sorted and deduplicated, records_hash
+     * is their hash. Cleared when a pattern is added. */
+    uint8_t records_hashed;
+    uint32_t records_hash;
 } MpmCtx;
 
+/** \brief pattern found in a stream, with the (upper bound of the) stream
+ *         offset where it ends */
+typedef struct MpmStreamMatch_ {
+    uint32_t pid;
+    uint64_t end;
+} MpmStreamMatch;
+
+/** \brief saved search state for a stream of data that is inspected in
+ *         growing, overlapping buffers, e.g. a http body. Lets us scan
+ *         each byte only once. */
+typedef struct MpmStreamState_ {
+    /* id of the MpmCtx the state is for, 0 if unused */
+    uint32_t mpm_ctx_id;
+    /* automaton state after the last scanned byte */
+    uint32_t state;
+    /* stream offset up to where we scanned */
+    uint64_t scanned;
+
+    /* patterns found so far */
+    MpmStreamMatch *matches;
+    uint32_t matches_cnt;
+    uint32_t matches_size;
+} MpmStreamState;
+
 /* if we want to retrieve an unique mpm context from the mpm context factory
  * we should supply this as the key */
 #define MPM_CTX_FACTORY_UNIQUE_CONTEXT -1
@@ -180,7 +239,10 @@ typedef struct MpmTableElmt_ {
     int  (*AddPattern)(struct MpmCtx_ *, uint8_t *, uint16_t, uint16_t, uint16_t, uint32_t, uint32_t, uint8_t);
     int  (*AddPatternNocase)(struct MpmCtx_ *, uint8_t *, uint16_t, uint16_t, uint16_t, uint32_t, uint32_t, uint8_t);
     int  (*Prepare)(struct MpmCtx_ *);
-    uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
+    uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t);
+    /** optional: continue a search at an offset in the buffer, starting
+     *  from a saved state and updating it. See MpmSearchStream. */
+    uint32_t (*SearchContinue)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint32_t, uint32_t, uint32_t *);
     void (*Cleanup)(struct MpmThreadCtx_ *);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
@@ -240,6 +302,11 @@ void PmqReset(PatternMatcherQueue *);
 void PmqCleanup(PatternMatcherQueue *);
 void PmqFree(PatternMatcherQueue *);
 
+uint32_t MpmSearchStream(MpmCtx *, MpmThreadCtx *, PatternMatcherQueue *,
+                         PatternMatcherQueue *, MpmStreamState *,
+                         uint8_t *, uint32_t, uint64_t);
+void MpmStreamStateFree(MpmStreamState *);
+
 void MpmTableSetup(void);
 void MpmRegisterTests(void);
 
@@ -256,4 +323,10 @@ int MpmAddPatternCI(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                     uint16_t offset, uint16_t depth,
                     uint32_t pid, uint32_t sid, uint8_t flags);
 
+void MpmCtxRecordPatterns(MpmCtx *mpm_ctx);
+void MpmCtxFreeRecords(MpmCtx *mpm_ctx);
+uint32_t MpmCtxRecordsHash(MpmCtx *mpm_ctx);
+int MpmCtxRecordsEqual(MpmCtx *mpm_ctx1, MpmCtx *mpm_ctx2);
+int MpmCtxUnref(MpmCtx *mpm_ctx);
+
 #endif /* __UTIL_MPM_H__ */
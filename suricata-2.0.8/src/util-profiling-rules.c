@@ -36,12 +36,25 @@
 #include "util-profiling.h"
 #include "util-profiling-locks.h"
 
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
 #ifdef PROFILING
 
 #ifndef MIN
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+/* HDR style log-linear histogram of the ticks per check: values below
+ * SC_PROFILE_HIST_SUB get their own bucket, above that every power of two
+ * is split in SC_PROFILE_HIST_SUB linear buckets (12.5% precision). */
+#define SC_PROFILE_HIST_SUB_BITS    3
+#define SC_PROFILE_HIST_SUB         (1 << SC_PROFILE_HIST_SUB_BITS)
+#define SC_PROFILE_HIST_MAX_EXP     40
+#define SC_PROFILE_HIST_SIZE        \
+    ((SC_PROFILE_HIST_MAX_EXP - SC_PROFILE_HIST_SUB_BITS + 2) * SC_PROFILE_HIST_SUB)
+
 /**
  * Extra data for rule profiling.
  */
@@ -54,6 +67,9 @@ typedef struct SCProfileData_ {
     uint64_t max;
     uint64_t ticks_match;
     uint64_t ticks_no_match;
+    /** tick histogram, SC_PROFILE_HIST_SIZE buckets. Allocated on the
+     *  first check of the rule. */
+    uint32_t *hist;
 } SCProfileData;
 
 typedef struct SCProfileDetectCtx_ {
@@ -61,6 +77,10 @@ typedef struct SCProfileDetectCtx_ {
     uint32_t id;
     SCProfileData *data;
     pthread_mutex_t data_m;
+
+    /** detect threads with live counters, protected by data_m */
+    DetectEngineThreadCtx **threads;
+    uint32_t threads_cnt;
 } SCProfileDetectCtx;
 
 /**
@@ -79,13 +99,24 @@ typedef struct SCProfileSummary_ {
     uint64_t max;
     uint64_t ticks_match;
     uint64_t ticks_no_match;
+    uint64_t p50;
+    uint64_t p99;
 } SCProfileSummary;
 
 extern int profiling_output_to_file;
 int profiling_rules_enabled = 0;
+/** profile one out of this many rule checks, per thread */
+int profiling_rules_sample_rate = 1;
 static char *profiling_file_name = "";
 static const char *profiling_file_mode = "a";
 
+/** profiling ctx of the active detection engine, for the live dumps */
+static SCProfileDetectCtx *profiling_rules_live_ctx = NULL;
+static pthread_mutex_t profiling_rules_live_m = PTHREAD_MUTEX_INITIALIZER;
+
+/** bumped by a reset, threads clear their counters when they see it */
+SC_ATOMIC_DECLARE(uint32_t, profiling_rules_reset_gen);
+
 /**
  * Sort orders for dumping profiled rules.
  */
@@ -151,6 +182,15 @@ void SCProfilingRulesGlobalInit(void) {
                 }
             }
 
+            intmax_t rate_v = 0;
+            if (ConfGetChildValueInt(conf, "sample-rate", &rate_v) == 0)
+                (void)ConfGetInt("profiling.sample-rate", &rate_v);
+            if (rate_v > 0 && rate_v < INT_MAX) {
+                profiling_rules_sample_rate = (int)rate_v;
+                SCLogInfo("rule profiling samples 1 out of every %d rule checks",
+                        profiling_rules_sample_rate);
+            }
+
             val = ConfNodeLookupChildValue(conf, "limit");
             if (val != NULL) {
                 if (ByteExtractStringUint32(&profiling_rules_limit, 10,
@@ -262,6 +302,148 @@ SCProfileSummarySortByMaxTicks(const void *a, const void *b)
     return s1->max - s0->max;
 }
 
+/**
+ * \brief Sort a summary by the configured sort order.
+ */
+static void SCProfileSummarySort(SCProfileSummary *summary, uint32_t count)
+{
+    switch (profiling_rules_sort_order) {
+        case SC_PROFILING_RULES_SORT_BY_TICKS:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByTicks);
+            break;
+        case SC_PROFILING_RULES_SORT_BY_AVG_TICKS:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByAvgTicks);
+            break;
+        case SC_PROFILING_RULES_SORT_BY_CHECKS:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByChecks);
+            break;
+        case SC_PROFILING_RULES_SORT_BY_MATCHES:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByMatches);
+            break;
+        case SC_PROFILING_RULES_SORT_BY_MAX_TICKS:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByMaxTicks);
+            break;
+        case SC_PROFILING_RULES_SORT_BY_AVG_TICKS_MATCH:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByAvgTicksMatch);
+            break;
+        case SC_PROFILING_RULES_SORT_BY_AVG_TICKS_NO_MATCH:
+            qsort(summary, count, sizeof(SCProfileSummary),
+                    SCProfileSummarySortByAvgTicksNoMatch);
+            break;
+    }
+}
+
+/**
+ * \brief Histogram bucket for a tick count.
+ */
+static inline uint32_t SCProfileHistBucket(uint64_t ticks)
+{
+    if (ticks < SC_PROFILE_HIST_SUB)
+        return (uint32_t)ticks;
+
+    uint32_t e = 63 - __builtin_clzll(ticks);
+    if (e > SC_PROFILE_HIST_MAX_EXP)
+        return SC_PROFILE_HIST_SIZE - 1;
+
+    return (e - SC_PROFILE_HIST_SUB_BITS + 1) * SC_PROFILE_HIST_SUB +
+        (uint32_t)((ticks >> (e - SC_PROFILE_HIST_SUB_BITS)) & (SC_PROFILE_HIST_SUB - 1));
+}
+
+/**
+ * \brief Highest tick count that falls in a histogram bucket.
+ */
+static uint64_t SCProfileHistBucketValue(uint32_t idx)
+{
+    if (idx < SC_PROFILE_HIST_SUB)
+        return idx;
+
+    uint32_t e = idx / SC_PROFILE_HIST_SUB + SC_PROFILE_HIST_SUB_BITS - 1;
+    uint64_t m = idx % SC_PROFILE_HIST_SUB;
+    uint64_t low = (SC_PROFILE_HIST_SUB + m) << (e - SC_PROFILE_HIST_SUB_BITS);
+    return low + (1ULL << (e - SC_PROFILE_HIST_SUB_BITS)) - 1;
+}
+
+/**
+ * \brief Get a percentile from a histogram.
+ *
+ * The values of a bucket are taken to be spread evenly over its range, so
+ * the result is interpolated between the low and high end of the bucket.
+ *
+ * \param hist histogram of SC_PROFILE_HIST_SIZE buckets
+ * \param total number of values in the histogram
+ * \param pct percentile, 1-100
+ */
+static uint64_t SCProfileHistPercentile(const uint64_t *hist, uint64_t total, uint32_t pct)
+{
+    uint64_t want = (total * pct + 99) / 100;
+    uint64_t cnt = 0;
+    uint32_t i;
+
+    if (want == 0)
+        want = 1;
+    for (i = 0; i < SC_PROFILE_HIST_SIZE; i++) {
+        if (cnt + hist[i] >= want) {
+            uint64_t low = (i == 0) ? 0 : SCProfileHistBucketValue(i - 1) + 1;
+            uint64_t high = SCProfileHistBucketValue(i);
+            return low + (uint64_t)((long double)(high - low) *
+                    (want - cnt) / hist[i]);
+        }
+        cnt += hist[i];
+    }
+    return 0;
+}
+
+/**
+ * \brief Fill a summary record from the (merged) data of a rule.
+ *
+ * \param hist merged histogram to get the percentiles from, or NULL
+ */
+static void SCProfileSummaryFill(SCProfileSummary *s, const SCProfileData *d,
+                                 const uint64_t *hist)
+{
+    s->sid = d->sid;
+    s->rev = d->rev;
+    s->gid = d->gid;
+
+    s->ticks = d->ticks_match + d->ticks_no_match;
+    s->checks = d->checks;
+
+    if (s->ticks > 0) {
+        s->avgticks = (long double)s->ticks / (long double)s->checks;
+    }
+
+    s->matches = d->matches;
+    s->max = d->max;
+    s->ticks_match = d->ticks_match;
+    s->ticks_no_match = d->ticks_no_match;
+    if (s->ticks_match > 0) {
+        s->avgticks_match = (long double)s->ticks_match /
+            (long double)s->matches;
+    }
+
+    if (s->ticks_no_match > 0) {
+        s->avgticks_no_match = (long double)s->ticks_no_match /
+            ((long double)s->checks - (long double)s->matches);
+    }
+
+    if (hist != NULL && s->checks > 0) {
+        s->p50 = SCProfileHistPercentile(hist, s->checks, 50);
+        s->p99 = SCProfileHistPercentile(hist, s->checks, 99);
+        /* never above the largest value seen, the last bucket is
+         * open ended */
+        if (s->p50 > s->max)
+            s->p50 = s->max;
+        if (s->p99 > s->max)
+            s->p99 = s->max;
+    }
+}
+
 /**
  * \brief Dump rule profiling information to file
  *
@@ -304,63 +486,11 @@ SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
 
     memset(summary, 0, summary_size);
     for (i = 0; i < count; i++) {
-        summary[i].sid = rules_ctx->data[i].sid;
-        summary[i].rev = rules_ctx->data[i].rev;
-        summary[i].gid = rules_ctx->data[i].gid;
-
-        summary[i].ticks = rules_ctx->data[i].ticks_match + rules_ctx->data[i].ticks_no_match;
-        summary[i].checks = rules_ctx->data[i].checks;
-
-        if (summary[i].ticks > 0) {
-            summary[i].avgticks = (long double)summary[i].ticks / (long double)summary[i].checks;
-        }
-
-        summary[i].matches = rules_ctx->data[i].matches;
-        summary[i].max = rules_ctx->data[i].max;
-        summary[i].ticks_match = rules_ctx->data[i].ticks_match;
-        summary[i].ticks_no_match = rules_ctx->data[i].ticks_no_match;
-        if (summary[i].ticks_match > 0) {
-            summary[i].avgticks_match = (long double)summary[i].ticks_match /
-                (long double)summary[i].matches;
-        }
-
-        if (summary[i].ticks_no_match > 0) {
-            summary[i].avgticks_no_match = (long double)summary[i].ticks_no_match /
-                ((long double)summary[i].checks - (long double)summary[i].matches);
-        }
+        SCProfileSummaryFill(&summary[i], &rules_ctx->data[i], NULL);
         total_ticks += summary[i].ticks;
     }
 
-    switch (profiling_rules_sort_order) {
-        case SC_PROFILING_RULES_SORT_BY_TICKS:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByTicks);
-            break;
-        case SC_PROFILING_RULES_SORT_BY_AVG_TICKS:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByAvgTicks);
-            break;
-        case SC_PROFILING_RULES_SORT_BY_CHECKS:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByChecks);
-            break;
-        case SC_PROFILING_RULES_SORT_BY_MATCHES:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByMatches);
-            break;
-        case SC_PROFILING_RULES_SORT_BY_MAX_TICKS:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByMaxTicks);
-            break;
-        case SC_PROFILING_RULES_SORT_BY_AVG_TICKS_MATCH:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByAvgTicksMatch);
-            break;
-        case SC_PROFILING_RULES_SORT_BY_AVG_TICKS_NO_MATCH:
-            qsort(summary, count, sizeof(SCProfileSummary),
-                    SCProfileSummarySortByAvgTicksNoMatch);
-            break;
-    }
+    SCProfileSummarySort(summary, count);
 
     gettimeofday(&tval, NULL);
     struct tm local_tm;
@@ -432,9 +562,28 @@ SCProfilingRegisterRuleCounter(SCProfileDetectCtx *ctx)
     return ctx->id++;
 }
 
+/**
+ * \brief Clear the counters of a thread after a reset was requested.
+ */
+static void SCProfilingRuleThreadReset(DetectEngineThreadCtx *det_ctx, uint32_t gen)
+{
+    int i;
+    for (i = 0; i < det_ctx->rule_perf_data_size; i++) {
+        SCProfileData *p = &det_ctx->rule_perf_data[i];
+        p->checks = p->matches = p->max = 0;
+        p->ticks_match = p->ticks_no_match = 0;
+        if (p->hist != NULL)
+            memset(p->hist, 0, SC_PROFILE_HIST_SIZE * sizeof(uint32_t));
+    }
+    det_ctx->rule_perf_gen = gen;
+}
+
 /**
  * \brief Update a rule counter.
  *
+ * The counters are per thread, so no locking is needed. Live dumps read
+ * them as they are.
+ *
  * \param id The ID of this counter.
  * \param ticks Number of CPU ticks for this rule.
  * \param match Did the rule match?
@@ -443,6 +592,10 @@ void
 SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *det_ctx, uint16_t id, uint64_t ticks, int match)
 {
     if (det_ctx != NULL && det_ctx->rule_perf_data != NULL && det_ctx->rule_perf_data_size > id) {
+        uint32_t gen = SC_ATOMIC_GET(profiling_rules_reset_gen);
+        if (unlikely(gen != det_ctx->rule_perf_gen))
+            SCProfilingRuleThreadReset(det_ctx, gen);
+
         SCProfileData *p = &det_ctx->rule_perf_data[id];
 
         p->checks++;
@@ -453,6 +606,25 @@ SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *det_ctx, uint16_t id, uint64
             p->ticks_match += ticks;
         else
             p->ticks_no_match += ticks;
+
+        if (unlikely(p->hist == NULL)) {
+            p->hist = SCMalloc(SC_PROFILE_HIST_SIZE * sizeof(uint32_t));
+            if (p->hist == NULL)
+                return;
+            memset(p->hist, 0, SC_PROFILE_HIST_SIZE * sizeof(uint32_t));
+        }
+        p->hist[SCProfileHistBucket(ticks)]++;
+    }
+}
+
+static void SCProfileDataFreeHist(SCProfileData *data, uint32_t size)
+{
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        if (data[i].hist != NULL) {
+            SCFree(data[i].hist);
+            data[i].hist = NULL;
+        }
     }
 }
 
@@ -473,9 +645,18 @@ SCProfileDetectCtx *SCProfilingRuleInitCtx(void) {
 
 void SCProfilingRuleDestroyCtx(SCProfileDetectCtx *ctx) {
     if (ctx != NULL) {
+        pthread_mutex_lock(&profiling_rules_live_m);
+        if (profiling_rules_live_ctx == ctx)
+            profiling_rules_live_ctx = NULL;
+        pthread_mutex_unlock(&profiling_rules_live_m);
+
         SCProfilingRuleDump(ctx);
-        if (ctx->data != NULL)
+        if (ctx->data != NULL) {
+            SCProfileDataFreeHist(ctx->data, ctx->size);
             SCFree(ctx->data);
+        }
+        if (ctx->threads != NULL)
+            SCFree(ctx->threads);
         pthread_mutex_destroy(&ctx->data_m);
         SCFree(ctx);
     }
@@ -491,6 +672,17 @@ void SCProfilingRuleThreadSetup(SCProfileDetectCtx *ctx, DetectEngineThreadCtx *
 
         det_ctx->rule_perf_data = a;
         det_ctx->rule_perf_data_size = ctx->size;
+        det_ctx->rule_perf_gen = SC_ATOMIC_GET(profiling_rules_reset_gen);
+
+        /* register for the live dumps */
+        pthread_mutex_lock(&ctx->data_m);
+        DetectEngineThreadCtx **threads = SCRealloc(ctx->threads,
+                (ctx->threads_cnt + 1) * sizeof(DetectEngineThreadCtx *));
+        if (threads != NULL) {
+            ctx->threads = threads;
+            ctx->threads[ctx->threads_cnt++] = det_ctx;
+        }
+        pthread_mutex_unlock(&ctx->data_m);
     }
 }
 
@@ -499,6 +691,10 @@ static void SCProfilingRuleThreadMerge(DetectEngineCtx *de_ctx, DetectEngineThre
         det_ctx == NULL || det_ctx->rule_perf_data == NULL)
         return;
 
+    /* counters from before the last reset don't count */
+    if (det_ctx->rule_perf_gen != SC_ATOMIC_GET(profiling_rules_reset_gen))
+        return;
+
     int i;
     for (i = 0; i < det_ctx->rule_perf_data_size; i++) {
         de_ctx->profile_ctx->data[i].checks += det_ctx->rule_perf_data[i].checks;
@@ -507,6 +703,19 @@ static void SCProfilingRuleThreadMerge(DetectEngineCtx *de_ctx, DetectEngineThre
         de_ctx->profile_ctx->data[i].ticks_no_match += det_ctx->rule_perf_data[i].ticks_no_match;
         if (det_ctx->rule_perf_data[i].max > de_ctx->profile_ctx->data[i].max)
             de_ctx->profile_ctx->data[i].max = det_ctx->rule_perf_data[i].max;
+
+        uint32_t *hist = det_ctx->rule_perf_data[i].hist;
+        if (hist != NULL) {
+            if (de_ctx->profile_ctx->data[i].hist == NULL) {
+                /* take it over */
+                de_ctx->profile_ctx->data[i].hist = hist;
+                det_ctx->rule_perf_data[i].hist = NULL;
+            } else {
+                int b;
+                for (b = 0; b < SC_PROFILE_HIST_SIZE; b++)
+                    de_ctx->profile_ctx->data[i].hist[b] += hist[b];
+            }
+        }
     }
 }
 
@@ -514,15 +723,200 @@ void SCProfilingRuleThreadCleanup(DetectEngineThreadCtx *det_ctx) {
     if (det_ctx == NULL || det_ctx->de_ctx == NULL || det_ctx->rule_perf_data == NULL)
         return;
 
-    pthread_mutex_lock(&det_ctx->de_ctx->profile_ctx->data_m);
+    SCProfileDetectCtx *ctx = det_ctx->de_ctx->profile_ctx;
+    pthread_mutex_lock(&ctx->data_m);
     SCProfilingRuleThreadMerge(det_ctx->de_ctx, det_ctx);
-    pthread_mutex_unlock(&det_ctx->de_ctx->profile_ctx->data_m);
 
+    uint32_t i;
+    for (i = 0; i < ctx->threads_cnt; i++) {
+        if (ctx->threads[i] == det_ctx) {
+            ctx->threads[i] = ctx->threads[--ctx->threads_cnt];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ctx->data_m);
+
+    SCProfileDataFreeHist(det_ctx->rule_perf_data, det_ctx->rule_perf_data_size);
     SCFree(det_ctx->rule_perf_data);
     det_ctx->rule_perf_data = NULL;
     det_ctx->rule_perf_data_size = 0;
 }
 
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief Unix socket command: dump the live rule profiling counters of
+ *        all detect threads as JSON.
+ *
+ * The counters are read without stopping the threads, so a rule that is
+ * being updated while we read it can be off by one check.
+ */
+TmEcode SCProfilingRuleDumpSocket(json_t *cmd, json_t *answer, void *data)
+{
+    if (profiling_rules_enabled == 0) {
+        json_object_set_new(answer, "message",
+                json_string("rule profiling is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+
+    pthread_mutex_lock(&profiling_rules_live_m);
+    SCProfileDetectCtx *ctx = profiling_rules_live_ctx;
+    if (ctx == NULL || ctx->data == NULL) {
+        pthread_mutex_unlock(&profiling_rules_live_m);
+        json_object_set_new(answer, "message",
+                json_string("no rules to profile"));
+        return TM_ECODE_FAILED;
+    }
+
+    uint32_t count = ctx->size;
+    SCProfileSummary *summary = SCMalloc(count * sizeof(SCProfileSummary));
+    uint64_t *hist = SCMalloc(SC_PROFILE_HIST_SIZE * sizeof(uint64_t));
+    if (summary == NULL || hist == NULL) {
+        pthread_mutex_unlock(&profiling_rules_live_m);
+        if (summary != NULL)
+            SCFree(summary);
+        if (hist != NULL)
+            SCFree(hist);
+        json_object_set_new(answer, "message",
+                json_string("memory allocation error"));
+        return TM_ECODE_FAILED;
+    }
+    memset(summary, 0, count * sizeof(SCProfileSummary));
+
+    uint32_t gen = SC_ATOMIC_GET(profiling_rules_reset_gen);
+    uint64_t total_ticks = 0;
+    uint32_t i, t;
+    int b;
+
+    pthread_mutex_lock(&ctx->data_m);
+    for (i = 0; i < count; i++) {
+        SCProfileData d = ctx->data[i];
+        int have_hist = 0;
+
+        memset(hist, 0, SC_PROFILE_HIST_SIZE * sizeof(uint64_t));
+        if (ctx->data[i].hist != NULL) {
+            for (b = 0; b < SC_PROFILE_HIST_SIZE; b++)
+                hist[b] += ctx->data[i].hist[b];
+            have_hist = 1;
+        }
+
+        for (t = 0; t < ctx->threads_cnt; t++) {
+            DetectEngineThreadCtx *det_ctx = ctx->threads[t];
+            /* thread didn't pick up the last reset yet */
+            if (det_ctx->rule_perf_gen != gen || (int)i >= det_ctx->rule_perf_data_size)
+                continue;
+
+            SCProfileData *p = &det_ctx->rule_perf_data[i];
+            d.checks += p->checks;
+            d.matches += p->matches;
+            d.ticks_match += p->ticks_match;
+            d.ticks_no_match += p->ticks_no_match;
+            if (p->max > d.max)
+                d.max = p->max;
+            uint32_t *ph = p->hist;
+            if (ph != NULL) {
+                for (b = 0; b < SC_PROFILE_HIST_SIZE; b++)
+                    hist[b] += ph[b];
+                have_hist = 1;
+            }
+        }
+
+        SCProfileSummaryFill(&summary[i], &d, have_hist ? hist : NULL);
+        total_ticks += summary[i].ticks;
+    }
+    uint32_t threads_cnt = ctx->threads_cnt;
+    pthread_mutex_unlock(&ctx->data_m);
+    pthread_mutex_unlock(&profiling_rules_live_m);
+
+    SCFree(hist);
+
+    SCProfileSummarySort(summary, count);
+
+    json_t *jdata = json_object();
+    json_t *jrules = json_array();
+    if (jdata == NULL || jrules == NULL) {
+        SCFree(summary);
+        if (jdata != NULL)
+            json_decref(jdata);
+        if (jrules != NULL)
+            json_decref(jrules);
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    for (i = 0; i < MIN(count, profiling_rules_limit); i++) {
+        /* see SCProfilingRuleDump */
+        if (summary[i].checks == 0)
+            break;
+
+        json_t *jrule = json_object();
+        if (jrule == NULL)
+            break;
+        json_object_set_new(jrule, "signature_id", json_integer(summary[i].sid));
+        json_object_set_new(jrule, "gid", json_integer(summary[i].gid));
+        json_object_set_new(jrule, "rev", json_integer(summary[i].rev));
+        json_object_set_new(jrule, "checks", json_integer(summary[i].checks));
+        json_object_set_new(jrule, "matches", json_integer(summary[i].matches));
+        json_object_set_new(jrule, "ticks_total", json_integer(summary[i].ticks));
+        json_object_set_new(jrule, "ticks_max", json_integer(summary[i].max));
+        json_object_set_new(jrule, "ticks_avg", json_real(summary[i].avgticks));
+        json_object_set_new(jrule, "ticks_avg_match", json_real(summary[i].avgticks_match));
+        json_object_set_new(jrule, "ticks_avg_nomatch", json_real(summary[i].avgticks_no_match));
+        json_object_set_new(jrule, "ticks_p50", json_integer(summary[i].p50));
+        json_object_set_new(jrule, "ticks_p99", json_integer(summary[i].p99));
+        json_object_set_new(jrule, "percent", json_real(total_ticks ?
+                    (double)summary[i].ticks / (double)total_ticks * 100 : 0));
+        json_array_append_new(jrules, jrule);
+    }
+    SCFree(summary);
+
+    json_object_set_new(jdata, "threads", json_integer(threads_cnt));
+    json_object_set_new(jdata, "sample_rate", json_integer(profiling_rules_sample_rate));
+    json_object_set_new(jdata, "rules", jrules);
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Unix socket command: reset the rule profiling counters.
+ *
+ * The detect threads clear their own counters on their next update, so
+ * they never have to be locked.
+ */
+TmEcode SCProfilingRuleResetSocket(json_t *cmd, json_t *answer, void *data)
+{
+    if (profiling_rules_enabled == 0) {
+        json_object_set_new(answer, "message",
+                json_string("rule profiling is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+
+    pthread_mutex_lock(&profiling_rules_live_m);
+    SCProfileDetectCtx *ctx = profiling_rules_live_ctx;
+    if (ctx != NULL) {
+        pthread_mutex_lock(&ctx->data_m);
+        (void)SC_ATOMIC_ADD(profiling_rules_reset_gen, 1);
+        if (ctx->data != NULL) {
+            uint32_t i;
+            for (i = 0; i < ctx->size; i++) {
+                SCProfileData *p = &ctx->data[i];
+                p->checks = p->matches = p->max = 0;
+                p->ticks_match = p->ticks_no_match = 0;
+                if (p->hist != NULL)
+                    memset(p->hist, 0, SC_PROFILE_HIST_SIZE * sizeof(uint32_t));
+            }
+        }
+        pthread_mutex_unlock(&ctx->data_m);
+    } else {
+        (void)SC_ATOMIC_ADD(profiling_rules_reset_gen, 1);
+    }
+    pthread_mutex_unlock(&profiling_rules_live_m);
+
+    json_object_set_new(answer, "message", json_string("rule profiling counters reset"));
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
 /**
  * \brief Register the rule profiling counters.
  *
@@ -559,8 +953,172 @@ SCProfilingRuleInitCounters(DetectEngineCtx *de_ctx)
         }
     }
 
+    /* the newest engine is the one the detect threads move to */
+    pthread_mutex_lock(&profiling_rules_live_m);
+    profiling_rules_live_ctx = de_ctx->profile_ctx;
+    pthread_mutex_unlock(&profiling_rules_live_m);
+
     SCLogInfo("Registered %"PRIu32" rule profiling counters.", count);
 }
 
+#ifdef UNITTESTS
+
+/** \test histogram bucket boundaries */
+static int SCProfileHistTest01(void)
+{
+    uint32_t i;
+
+    /* exact buckets below SC_PROFILE_HIST_SUB */
+    for (i = 0; i < SC_PROFILE_HIST_SUB; i++) {
+        if (SCProfileHistBucket(i) != i)
+            return 0;
+    }
+    /* 8-15 still 1 apart, 16-31 2 apart */
+    if (SCProfileHistBucket(8) != 8 || SCProfileHistBucket(15) != 15 ||
+        SCProfileHistBucket(16) != 16 || SCProfileHistBucket(17) != 16 ||
+        SCProfileHistBucket(18) != 17 || SCProfileHistBucket(31) != 23 ||
+        SCProfileHistBucket(32) != 24)
+        return 0;
+    /* 2^MAX_EXP up to 2^(MAX_EXP + 1) - 1 are in the last row, anything
+     * above ends up in the last bucket */
+    if (SCProfileHistBucket(1ULL << SC_PROFILE_HIST_MAX_EXP) != SC_PROFILE_HIST_SIZE - SC_PROFILE_HIST_SUB ||
+        SCProfileHistBucket((1ULL << (SC_PROFILE_HIST_MAX_EXP + 1)) - 1) != SC_PROFILE_HIST_SIZE - 1 ||
+        SCProfileHistBucket(1ULL << (SC_PROFILE_HIST_MAX_EXP + 1)) != SC_PROFILE_HIST_SIZE - 1 ||
+        SCProfileHistBucket(UINT64_MAX) != SC_PROFILE_HIST_SIZE - 1)
+        return 0;
+
+    /* the buckets are contiguous: the highest value of a bucket maps to
+     * it and the next value to the next bucket */
+    for (i = 0; i < SC_PROFILE_HIST_SIZE; i++) {
+        uint64_t v = SCProfileHistBucketValue(i);
+        if (SCProfileHistBucket(v) != i) {
+            printf("bucket %u: value %"PRIu64" maps to %u: ", i, v,
+                    SCProfileHistBucket(v));
+            return 0;
+        }
+        if (i + 1 < SC_PROFILE_HIST_SIZE && SCProfileHistBucket(v + 1) != i + 1) {
+            printf("bucket %u: value %"PRIu64" maps to %u: ", i, v + 1,
+                    SCProfileHistBucket(v + 1));
+            return 0;
+        }
+    }
+    if (SCProfileHistBucketValue(SC_PROFILE_HIST_SIZE - 1) !=
+            (1ULL << (SC_PROFILE_HIST_MAX_EXP + 1)) - 1)
+        return 0;
+
+    return 1;
+}
+
+/** \test percentiles are interpolated within a bucket and capped at the
+ *        max */
+static int SCProfileHistTest02(void)
+{
+    uint64_t hist[SC_PROFILE_HIST_SIZE];
+    SCProfileData d;
+    SCProfileSummary s;
+
+    memset(hist, 0, sizeof(hist));
+    if (SCProfileHistPercentile(hist, 0, 50) != 0)
+        return 0;
+
+    /* 8 checks of 3 ticks, 8 in the 96-103 bucket */
+    hist[SCProfileHistBucket(3)] = 8;
+    hist[SCProfileHistBucket(100)] = 8;
+    if (SCProfileHistBucket(96) != SCProfileHistBucket(103) ||
+        SCProfileHistBucket(104) == SCProfileHistBucket(103))
+        return 0;
+
+    if (SCProfileHistPercentile(hist, 16, 50) != 3)
+        return 0;
+    /* the 12th value is the 4th of 8 in 96-103 */
+    if (SCProfileHistPercentile(hist, 16, 75) != 96 + 7 * 4 / 8)
+        return 0;
+    /* the 9th value, percentiles round up */
+    if (SCProfileHistPercentile(hist, 16, 51) != 96 + 7 * 1 / 8)
+        return 0;
+    if (SCProfileHistPercentile(hist, 16, 100) != 103)
+        return 0;
+
+    /* the summary doesn't report more than the max */
+    memset(&d, 0, sizeof(d));
+    memset(&s, 0, sizeof(s));
+    d.checks = 16;
+    d.max = 100;
+    d.ticks_no_match = 8 * 3 + 8 * 100;
+    SCProfileSummaryFill(&s, &d, hist);
+    if (s.p50 != 3 || s.p99 != 100)
+        return 0;
+
+    return 1;
+}
+
+/** \test a new reset generation clears the thread counters on the next
+ *        update, and counters of an older generation aren't merged */
+static int SCProfileResetTest01(void)
+{
+    DetectEngineCtx de_ctx;
+    DetectEngineThreadCtx det_ctx;
+    SCProfileDetectCtx profile_ctx;
+    SCProfileData data[2], merged[2];
+    int result = 0;
+
+    memset(&de_ctx, 0, sizeof(de_ctx));
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&profile_ctx, 0, sizeof(profile_ctx));
+    memset(data, 0, sizeof(data));
+    memset(merged, 0, sizeof(merged));
+
+    profile_ctx.data = merged;
+    profile_ctx.size = 2;
+    de_ctx.profile_ctx = &profile_ctx;
+    det_ctx.rule_perf_data = data;
+    det_ctx.rule_perf_data_size = 2;
+    det_ctx.rule_perf_gen = SC_ATOMIC_GET(profiling_rules_reset_gen);
+
+    SCProfilingRuleUpdateCounter(&det_ctx, 0, 10, 1);
+    SCProfilingRuleUpdateCounter(&det_ctx, 0, 20, 0);
+    if (data[0].checks != 2 || data[0].matches != 1 || data[0].max != 20 ||
+        data[0].hist == NULL || data[0].hist[SCProfileHistBucket(10)] != 1)
+        goto end;
+
+    (void)SC_ATOMIC_ADD(profiling_rules_reset_gen, 1);
+
+    /* counters of the old generation don't end up in the dump */
+    SCProfilingRuleThreadMerge(&de_ctx, &det_ctx);
+    if (merged[0].checks != 0 || merged[0].hist != NULL)
+        goto end;
+
+    /* the next update clears all counters of the thread first */
+    SCProfilingRuleUpdateCounter(&det_ctx, 1, 5, 0);
+    if (det_ctx.rule_perf_gen != SC_ATOMIC_GET(profiling_rules_reset_gen) ||
+        data[0].checks != 0 || data[0].matches != 0 || data[0].max != 0 ||
+        data[0].ticks_match != 0 || data[0].ticks_no_match != 0 ||
+        data[0].hist == NULL || data[0].hist[SCProfileHistBucket(10)] != 0 ||
+        data[1].checks != 1 || data[1].hist[SCProfileHistBucket(5)] != 1)
+        goto end;
+
+    SCProfilingRuleThreadMerge(&de_ctx, &det_ctx);
+    if (merged[1].checks != 1 || merged[1].hist == NULL ||
+        merged[1].hist[SCProfileHistBucket(5)] != 1 || merged[0].checks != 0)
+        goto end;
+
+    result = 1;
+end:
+    SCProfileDataFreeHist(data, 2);
+    SCProfileDataFreeHist(merged, 2);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void SCProfilingRulesRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCProfileHistTest01", SCProfileHistTest01, 1);
+    UtRegisterTest("SCProfileHistTest02", SCProfileHistTest02, 1);
+    UtRegisterTest("SCProfileResetTest01", SCProfileResetTest01, 1);
+#endif /* UNITTESTS */
+}
+
 #endif /* PROFILING */
 
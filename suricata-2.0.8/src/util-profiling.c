@@ -975,8 +975,9 @@ int SCProfileRuleStart(Packet *p) {
         return 1;
     }
 #else
-    uint64_t sample = SC_ATOMIC_ADD(samples, 1);
-    if (sample % rate == 0) {
+    /* per thread, the global sample counter is too hot to hit per rule */
+    static __thread uint64_t rule_samples = 0;
+    if (rule_samples++ % profiling_rules_sample_rate == 0) {
         p->flags |= PKT_PROFILE;
         return 1;
     }
@@ -1136,6 +1137,7 @@ SCProfilingRegisterTests(void)
 {
 #ifdef UNITTESTS
     UtRegisterTest("ProfilingGenericTicksTest01", ProfilingGenericTicksTest01, 1);
+    SCProfilingRulesRegisterTests();
 #endif /* UNITTESTS */
 }
 
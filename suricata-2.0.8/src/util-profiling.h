@@ -31,6 +31,7 @@
 #include "util-cpu.h"
 
 extern int profiling_rules_enabled;
+extern int profiling_rules_sample_rate;
 extern int profiling_packets_enabled;
 extern __thread int profiling_rules_entered;
 
@@ -51,7 +52,7 @@ int SCProfileRuleStart(Packet *p);
     }
 
 #define RULE_PROFILING_END(ctx, r, m, p) \
-    if (profiling_rules_enabled && ((p)->flags & PKT_PROFILE)) { \
+    if (profile_rule_start_ != 0) { \
         profile_rule_end_ = UtilCpuGetTicks(); \
         SCProfilingRuleUpdateCounter(ctx, r->profiling_id, \
             profile_rule_end_ - profile_rule_start_, m); \
@@ -236,6 +237,11 @@ void SCProfilingRuleInitCounters(DetectEngineCtx *);
 void SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *, uint16_t, uint64_t, int);
 void SCProfilingRuleThreadSetup(struct SCProfileDetectCtx_ *, DetectEngineThreadCtx *);
 void SCProfilingRuleThreadCleanup(DetectEngineThreadCtx *);
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+TmEcode SCProfilingRuleDumpSocket(json_t *, json_t *, void *);
+TmEcode SCProfilingRuleResetSocket(json_t *, json_t *, void *);
+#endif
 
 void SCProfilingKeywordsGlobalInit(void);
 void SCProfilingKeywordDestroyCtx(DetectEngineCtx *);//struct SCProfileKeywordDetectCtx_ *);
@@ -247,6 +253,7 @@ void SCProfilingKeywordThreadCleanup(DetectEngineThreadCtx *);
 void SCProfilingInit(void);
 void SCProfilingDestroy(void);
 void SCProfilingRegisterTests(void);
+void SCProfilingRulesRegisterTests(void);
 void SCProfilingDump(void);
 
 #else
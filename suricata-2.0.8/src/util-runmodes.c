@@ -322,6 +322,24 @@ char *RunmodeAutoFpCreatePickupQueuesString(int n) {
     return queues;
 }
 
+/** \brief get the name of the queue handler autofp passes packets
+ *         through, based on the "autofp-queue" setting.
+ */
+char *RunmodeAutoFpGetQueueHandler(void)
+{
+    char *queue = NULL;
+
+    if (ConfGet("autofp-queue", &queue) != 1 ||
+            strcasecmp(queue, "mutex") == 0)
+        return "flow";
+    if (strcasecmp(queue, "ring") == 0)
+        return "flow-ring";
+
+    SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+               "for autofp-queue in conf.  Killing engine.", queue);
+    exit(EXIT_FAILURE);
+}
+
 /**
  *  \param de_ctx detection engine, can be NULL
  */
@@ -380,7 +398,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
             ThreadVars *tv_receive =
                 TmThreadCreatePacketHandler(thread_name,
                         "packetpool", "packetpool",
-                        queues, "flow", "pktacqloop");
+                        queues, RunmodeAutoFpGetQueueHandler(), "pktacqloop");
             if (tv_receive == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                 exit(EXIT_FAILURE);
@@ -443,7 +461,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
                 ThreadVars *tv_receive =
                     TmThreadCreatePacketHandler(thread_name,
                             "packetpool", "packetpool",
-                            queues, "flow", "pktacqloop");
+                            queues, RunmodeAutoFpGetQueueHandler(), "pktacqloop");
                 if (tv_receive == NULL) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                     exit(EXIT_FAILURE);
@@ -485,7 +503,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
         }
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpGetQueueHandler(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -966,7 +984,7 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         ThreadVars *tv_receive =
             TmThreadCreatePacketHandler(thread_name,
                     "packetpool", "packetpool",
-                    queues, "flow", "pktacqloop");
+                    queues, RunmodeAutoFpGetQueueHandler(), "pktacqloop");
         if (tv_receive == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -1006,7 +1024,7 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         }
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpGetQueueHandler(),
                                         "verdict-queue", "simple",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
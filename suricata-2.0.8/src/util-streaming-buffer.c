@@ -0,0 +1,601 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming buffer implementation. See util-streaming-buffer.h for the
+ * general idea.
+ */
+
+#include "suricata-common.h"
+#include "util-streaming-buffer.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+/** default growth step if the config doesn't specify one */
+#define STREAMING_BUFFER_DEFAULT_SIZE 4096
+
+static void *SBMalloc(const StreamingBufferConfig *cfg, size_t size)
+{
+    if (cfg->Malloc != NULL)
+        return cfg->Malloc(size);
+    return SCMalloc(size);
+}
+
+static void *SBRealloc(const StreamingBufferConfig *cfg, void *ptr,
+        size_t orig_size, size_t size)
+{
+    if (cfg->Realloc != NULL)
+        return cfg->Realloc(ptr, orig_size, size);
+    return SCRealloc(ptr, size);
+}
+
+static void SBFree(const StreamingBufferConfig *cfg, void *ptr, size_t size)
+{
+    if (cfg->Free != NULL)
+        cfg->Free(ptr, size);
+    else
+        SCFree(ptr);
+}
+
+static void SBBlockListFree(StreamingBuffer *sb)
+{
+    StreamingBufferBlock *blk = sb->block_list;
+    while (blk != NULL) {
+        StreamingBufferBlock *next = blk->next;
+        SBFree(sb->cfg, blk, sizeof(*blk));
+        blk = next;
+    }
+    sb->block_list = NULL;
+}
+
+static StreamingBufferBlock *SBBlockAlloc(StreamingBuffer *sb,
+        uint64_t offset, uint32_t len)
+{
+    StreamingBufferBlock *blk = SBMalloc(sb->cfg, sizeof(*blk));
+    if (blk == NULL)
+        return NULL;
+    blk->offset = offset;
+    blk->len = len;
+    blk->next = NULL;
+    return blk;
+}
+
+/**
+ *  \brief Create a new streaming buffer
+ *
+ *  The data buffer itself is only allocated when data is added.
+ *
+ *  \param cfg config, must stay valid for the lifetime of the buffer
+ *
+ *  \retval sb the buffer or NULL on error
+ */
+StreamingBuffer *StreamingBufferInit(const StreamingBufferConfig *cfg)
+{
+    StreamingBuffer *sb = SBMalloc(cfg, sizeof(StreamingBuffer));
+    if (sb == NULL)
+        return NULL;
+
+    memset(sb, 0x00, sizeof(StreamingBuffer));
+    sb->cfg = cfg;
+    return sb;
+}
+
+void StreamingBufferFree(StreamingBuffer *sb)
+{
+    if (sb == NULL)
+        return;
+
+    SBBlockListFree(sb);
+    if (sb->buf != NULL)
+        SBFree(sb->cfg, sb->buf, sb->buf_size);
+    SBFree(sb->cfg, sb, sizeof(StreamingBuffer));
+}
+
+/**
+ *  \internal
+ *  \brief make sure the buffer can hold 'size' bytes
+ *
+ *  Grows in multiples of the configured buffer size.
+ *
+ *  \retval 0 ok
+ *  \retval -1 memory allocation failed, buffer is left untouched
+ */
+static int SBGrow(StreamingBuffer *sb, uint64_t size)
+{
+    if (size <= sb->buf_size)
+        return 0;
+
+    uint32_t step = sb->cfg->buf_size ? sb->cfg->buf_size : STREAMING_BUFFER_DEFAULT_SIZE;
+    uint64_t grow = ((size + step - 1) / step) * step;
+    if (grow > UINT32_MAX)
+        return -1;
+
+    void *ptr = SBRealloc(sb->cfg, sb->buf, sb->buf_size, (size_t)grow);
+    if (ptr == NULL)
+        return -1;
+
+    sb->buf = ptr;
+    sb->buf_size = (uint32_t)grow;
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief add a range to the block list, merging it with the blocks
+ *         it overlaps or touches
+ *
+ *  Must be called before buf_offset is updated for the new data.
+ *
+ *  \retval 0 ok
+ *  \retval -1 memory allocation failed
+ */
+static int SBMarkRange(StreamingBuffer *sb, uint64_t offset, uint32_t len)
+{
+    uint64_t end = StreamingBufferGetEndOffset(sb);
+
+    if (sb->block_list == NULL) {
+        /* still contiguous if the new data connects to what we have */
+        if (offset <= end && (sb->buf_offset > 0 || offset == sb->stream_offset))
+            return 0;
+
+        /* we're getting a gap: start tracking blocks */
+        if (sb->buf_offset > 0) {
+            sb->block_list = SBBlockAlloc(sb, sb->stream_offset, sb->buf_offset);
+            if (sb->block_list == NULL)
+                return -1;
+        }
+    }
+
+    /* find the insertion point: first block that ends at or after offset */
+    StreamingBufferBlock *prev = NULL;
+    StreamingBufferBlock *blk = sb->block_list;
+    while (blk != NULL && blk->offset + blk->len < offset) {
+        prev = blk;
+        blk = blk->next;
+    }
+
+    if (blk == NULL || blk->offset > offset + len) {
+        /* no overlap or contact with existing blocks */
+        StreamingBufferBlock *nblk = SBBlockAlloc(sb, offset, len);
+        if (nblk == NULL)
+            return -1;
+        nblk->next = blk;
+        if (prev == NULL)
+            sb->block_list = nblk;
+        else
+            prev->next = nblk;
+    } else {
+        /* extend blk to cover the new range, then swallow any following
+         * blocks it now overlaps or touches */
+        uint64_t blk_end = blk->offset + blk->len;
+        if (offset < blk->offset)
+            blk->offset = offset;
+        if (offset + len > blk_end)
+            blk_end = offset + len;
+
+        StreamingBufferBlock *next = blk->next;
+        while (next != NULL && next->offset <= blk_end) {
+            if (next->offset + next->len > blk_end)
+                blk_end = next->offset + next->len;
+            blk->next = next->next;
+            SBFree(sb->cfg, next, sizeof(*next));
+            next = blk->next;
+        }
+        blk->len = (uint32_t)(blk_end - blk->offset);
+    }
+
+    /* back to contiguous? */
+    blk = sb->block_list;
+    if (blk != NULL && blk->next == NULL && blk->offset == sb->stream_offset) {
+        SBFree(sb->cfg, blk, sizeof(*blk));
+        sb->block_list = NULL;
+    }
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief copy data into the parts of [offset, offset + len) that don't
+ *         contain data yet. Parts that already have data are left alone.
+ *
+ *  \param overlap_diff set to 1 if already present data differs from
+ *                      the new data. Can be NULL.
+ */
+static void SBFillHoles(StreamingBuffer *sb, const uint8_t *data,
+        uint32_t len, uint64_t offset, int *overlap_diff)
+{
+    const uint64_t limit = offset + len;
+    uint64_t cursor = offset;
+
+    /* in contiguous mode we use a temporary block for the data we have */
+    StreamingBufferBlock tmp = { sb->stream_offset, sb->buf_offset, NULL };
+    StreamingBufferBlock *blk = sb->block_list;
+    if (blk == NULL && sb->buf_offset > 0)
+        blk = &tmp;
+
+    for ( ; blk != NULL && cursor < limit; blk = blk->next) {
+        uint64_t blk_end = blk->offset + blk->len;
+        if (blk_end <= cursor)
+            continue;
+        if (blk->offset >= limit)
+            break;
+
+        /* hole before this block */
+        if (blk->offset > cursor) {
+            memcpy(sb->buf + (cursor - sb->stream_offset),
+                    data + (cursor - offset), blk->offset - cursor);
+            cursor = blk->offset;
+        }
+
+        /* overlap with this block */
+        uint64_t ovl_end = blk_end < limit ? blk_end : limit;
+        if (overlap_diff != NULL && *overlap_diff == 0) {
+            if (memcmp(sb->buf + (cursor - sb->stream_offset),
+                        data + (cursor - offset), ovl_end - cursor) != 0)
+                *overlap_diff = 1;
+        }
+        cursor = ovl_end;
+    }
+
+    if (cursor < limit) {
+        memcpy(sb->buf + (cursor - sb->stream_offset),
+                data + (cursor - offset), limit - cursor);
+    }
+}
+
+/**
+ *  \brief add data to the buffer at a stream offset
+ *
+ *  Data before the start of the window is ignored. Data overlapping
+ *  what is already in the buffer doesn't overwrite it.
+ *
+ *  \param overlap_diff if not NULL, set to 1 if the new data differs
+ *                      from what we already had for the same offsets
+ *
+ *  \retval 0 ok
+ *  \retval -1 memory allocation failed, no data was added
+ */
+int StreamingBufferInsertAt(StreamingBuffer *sb, const uint8_t *data,
+        uint32_t data_len, uint64_t offset, int *overlap_diff)
+{
+    if (overlap_diff != NULL)
+        *overlap_diff = 0;
+
+    if (data_len == 0 || offset + data_len <= sb->stream_offset)
+        return 0;
+
+    /* trim data that is before our window */
+    if (offset < sb->stream_offset) {
+        uint32_t skip = (uint32_t)(sb->stream_offset - offset);
+        data += skip;
+        data_len -= skip;
+        offset = sb->stream_offset;
+    }
+
+    uint64_t rel_end = (offset - sb->stream_offset) + data_len;
+    if (SBGrow(sb, rel_end) != 0)
+        return -1;
+
+    /* copy into the holes using the current block state. If tracking
+     * the new range fails below, the copied bytes simply stay in
+     * untracked space. */
+    SBFillHoles(sb, data, data_len, offset, overlap_diff);
+    if (SBMarkRange(sb, offset, data_len) != 0)
+        return -1;
+
+    if (rel_end > sb->buf_offset)
+        sb->buf_offset = (uint32_t)rel_end;
+    return 0;
+}
+
+/**
+ *  \brief add data at the end of the buffer
+ *
+ *  \retval 0 ok
+ *  \retval -1 memory allocation failed
+ */
+int StreamingBufferAppend(StreamingBuffer *sb, const uint8_t *data, uint32_t data_len)
+{
+    return StreamingBufferInsertAt(sb, data, data_len,
+            StreamingBufferGetEndOffset(sb), NULL);
+}
+
+/**
+ *  \brief move the start of the window forward to 'offset'
+ *
+ *  Data before 'offset' is discarded. The allocated buffer is kept
+ *  for reuse.
+ */
+void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset)
+{
+    if (offset <= sb->stream_offset)
+        return;
+
+    if (offset >= StreamingBufferGetEndOffset(sb)) {
+        SBBlockListFree(sb);
+        sb->stream_offset = offset;
+        sb->buf_offset = 0;
+        return;
+    }
+
+    uint32_t shift = (uint32_t)(offset - sb->stream_offset);
+    memmove(sb->buf, sb->buf + shift, sb->buf_offset - shift);
+    sb->buf_offset -= shift;
+    sb->stream_offset = offset;
+
+    /* drop the blocks that are completely before the new start and
+     * trim the one we're sliding into */
+    while (sb->block_list != NULL &&
+           sb->block_list->offset + sb->block_list->len <= offset)
+    {
+        StreamingBufferBlock *blk = sb->block_list;
+        sb->block_list = blk->next;
+        SBFree(sb->cfg, blk, sizeof(*blk));
+    }
+    StreamingBufferBlock *blk = sb->block_list;
+    if (blk != NULL && blk->offset < offset) {
+        blk->len -= (uint32_t)(offset - blk->offset);
+        blk->offset = offset;
+    }
+    if (blk != NULL && blk->next == NULL && blk->offset == sb->stream_offset) {
+        SBFree(sb->cfg, blk, sizeof(*blk));
+        sb->block_list = NULL;
+    }
+}
+
+/**
+ *  \brief get the contiguous data starting at 'offset'
+ *
+ *  \param data set to point to the data in the buffer
+ *  \param data_len set to the number of bytes available until the
+ *                  next gap or the end of the data
+ *
+ *  \retval 1 data available
+ *  \retval 0 no data at 'offset'
+ */
+int StreamingBufferGetDataAtOffset(const StreamingBuffer *sb,
+        const uint8_t **data, uint32_t *data_len, uint64_t offset)
+{
+    if (offset < sb->stream_offset || offset >= StreamingBufferGetEndOffset(sb))
+        return 0;
+
+    uint64_t end = StreamingBufferGetEndOffset(sb);
+    if (sb->block_list != NULL) {
+        const StreamingBufferBlock *blk = sb->block_list;
+        while (blk != NULL && blk->offset + blk->len <= offset)
+            blk = blk->next;
+        if (blk == NULL || blk->offset > offset)
+            return 0;
+        end = blk->offset + blk->len;
+    }
+
+    *data = sb->buf + (offset - sb->stream_offset);
+    *data_len = (uint32_t)(end - offset);
+    return 1;
+}
+
+/**
+ *  \brief find the first offset at or after 'offset' that has data
+ *
+ *  \retval 1 found, 'next' is set
+ *  \retval 0 no more data
+ */
+int StreamingBufferGetNextDataOffset(const StreamingBuffer *sb,
+        uint64_t offset, uint64_t *next)
+{
+    if (offset >= StreamingBufferGetEndOffset(sb))
+        return 0;
+
+    if (sb->block_list == NULL) {
+        if (sb->buf_offset == 0)
+            return 0;
+        *next = offset > sb->stream_offset ? offset : sb->stream_offset;
+        return 1;
+    }
+
+    const StreamingBufferBlock *blk = sb->block_list;
+    while (blk != NULL && blk->offset + blk->len <= offset)
+        blk = blk->next;
+    if (blk == NULL)
+        return 0;
+
+    *next = offset > blk->offset ? offset : blk->offset;
+    return 1;
+}
+
+/** \brief memory used by the buffer, its blocks and the struct itself */
+uint32_t StreamingBufferMemSize(const StreamingBuffer *sb)
+{
+    uint32_t size = sizeof(StreamingBuffer) + sb->buf_size;
+    const StreamingBufferBlock *blk;
+    for (blk = sb->block_list; blk != NULL; blk = blk->next)
+        size += sizeof(StreamingBufferBlock);
+    return size;
+}
+
+#ifdef UNITTESTS
+static const StreamingBufferConfig sb_test_cfg = { 16, NULL, NULL, NULL };
+
+/** \test in order appends with growth and sliding */
+static int StreamingBufferTest01(void)
+{
+    int result = 0;
+    StreamingBuffer *sb = StreamingBufferInit(&sb_test_cfg);
+    if (sb == NULL)
+        return 0;
+
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+
+    if (StreamingBufferAppend(sb, (const uint8_t *)"ABCDEFGH", 8) != 0)
+        goto end;
+    if (StreamingBufferAppend(sb, (const uint8_t *)"01234567890123456789", 20) != 0)
+        goto end;
+    if (sb->buf_size != 32 || sb->buf_offset != 28 || !StreamingBufferIsContiguous(sb)) {
+        printf("size %u offset %u: ", sb->buf_size, sb->buf_offset);
+        goto end;
+    }
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 4) != 1 ||
+        data_len != 24 || memcmp(data, "EFGH0123", 8) != 0)
+        goto end;
+
+    StreamingBufferSlideToOffset(sb, 10);
+    if (sb->stream_offset != 10 || sb->buf_offset != 18)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 4) != 0)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 10) != 1 ||
+        data_len != 18 || memcmp(data, "23456789", 8) != 0)
+        goto end;
+
+    /* slide past the end */
+    StreamingBufferSlideToOffset(sb, 100);
+    if (sb->stream_offset != 100 || sb->buf_offset != 0)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 100) != 0)
+        goto end;
+
+    result = 1;
+end:
+    StreamingBufferFree(sb);
+    return result;
+}
+
+/** \test out of order data: gaps, filling them, overlaps */
+static int StreamingBufferTest02(void)
+{
+    int result = 0;
+    int diff = 0;
+    uint64_t next = 0;
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    StreamingBuffer *sb = StreamingBufferInit(&sb_test_cfg);
+    if (sb == NULL)
+        return 0;
+
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"ABCD", 4, 0, &diff) != 0)
+        goto end;
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"IJKL", 4, 8, &diff) != 0)
+        goto end;
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"QRST", 4, 16, &diff) != 0)
+        goto end;
+    if (StreamingBufferIsContiguous(sb) || sb->buf_offset != 20)
+        goto end;
+
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 0) != 1 || data_len != 4)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 5) != 0)
+        goto end;
+    if (StreamingBufferGetNextDataOffset(sb, 5, &next) != 1 || next != 8)
+        goto end;
+    if (StreamingBufferGetNextDataOffset(sb, 9, &next) != 1 || next != 9)
+        goto end;
+
+    /* fill the first gap, overlapping with different data on both sides */
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"xxEFGHyy", 8, 2, &diff) != 0)
+        goto end;
+    if (diff != 1)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 0) != 1 ||
+        data_len != 12 || memcmp(data, "ABCDEFGHIJKL", 12) != 0)
+        goto end;
+    if (StreamingBufferIsContiguous(sb))
+        goto end;
+
+    /* same data overlap doesn't flag */
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"KLMNOPQR", 8, 10, &diff) != 0)
+        goto end;
+    if (diff != 0 || !StreamingBufferIsContiguous(sb))
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 0) != 1 ||
+        data_len != 20 || memcmp(data, "ABCDEFGHIJKLMNOPQRST", 20) != 0)
+        goto end;
+
+    /* data before the window is ignored */
+    StreamingBufferSlideToOffset(sb, 12);
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"zzzz", 4, 6, &diff) != 0)
+        goto end;
+    if (sb->stream_offset != 12 || sb->buf_offset != 8 || diff != 0)
+        goto end;
+
+    result = 1;
+end:
+    StreamingBufferFree(sb);
+    return result;
+}
+
+/** \test sliding into and over blocks */
+static int StreamingBufferTest03(void)
+{
+    int result = 0;
+    uint64_t next = 0;
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    StreamingBuffer *sb = StreamingBufferInit(&sb_test_cfg);
+    if (sb == NULL)
+        return 0;
+
+    /* first data is not at the start of the window */
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"EFGH", 4, 4, NULL) != 0)
+        goto end;
+    if (StreamingBufferIsContiguous(sb) ||
+        StreamingBufferGetDataAtOffset(sb, &data, &data_len, 0) != 0)
+        goto end;
+    if (StreamingBufferInsertAt(sb, (const uint8_t *)"MNOP", 4, 12, NULL) != 0)
+        goto end;
+
+    StreamingBufferSlideToOffset(sb, 6);
+    if (sb->block_list == NULL || sb->block_list->offset != 6 ||
+        sb->block_list->len != 2)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 6) != 1 ||
+        data_len != 2 || memcmp(data, "GH", 2) != 0)
+        goto end;
+
+    /* into the gap: first block is gone, window starts with a gap */
+    StreamingBufferSlideToOffset(sb, 10);
+    if (sb->block_list == NULL || sb->block_list->offset != 12 ||
+        sb->block_list->next != NULL)
+        goto end;
+    if (StreamingBufferGetNextDataOffset(sb, 10, &next) != 1 || next != 12)
+        goto end;
+
+    /* into the last block: contiguous again */
+    StreamingBufferSlideToOffset(sb, 13);
+    if (!StreamingBufferIsContiguous(sb) || sb->buf_offset != 3)
+        goto end;
+    if (StreamingBufferGetDataAtOffset(sb, &data, &data_len, 13) != 1 ||
+        data_len != 3 || memcmp(data, "NOP", 3) != 0)
+        goto end;
+
+    result = 1;
+end:
+    StreamingBufferFree(sb);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void StreamingBufferRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StreamingBufferTest01", StreamingBufferTest01, 1);
+    UtRegisterTest("StreamingBufferTest02", StreamingBufferTest02, 1);
+    UtRegisterTest("StreamingBufferTest03", StreamingBufferTest03, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2015 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming buffer: a single growable memory region holding a window of
+ * a (data) stream.
+ *
+ * Data is addressed by its absolute offset in the stream. The window
+ * starts at 'stream_offset' and can be moved forward with
+ * StreamingBufferSlideToOffset() once the data before that point is no
+ * longer needed.
+ *
+ * Data doesn't have to be added in order. If it arrives with gaps, the
+ * regions that actually contain data are tracked in a sorted list of
+ * blocks. While the data is contiguous from the start of the window, no
+ * block list is used at all.
+ *
+ * Overlapping data is never overwritten: the first data to arrive for a
+ * given offset wins.
+ */
+
+#ifndef __UTIL_STREAMING_BUFFER_H__
+#define __UTIL_STREAMING_BUFFER_H__
+
+typedef struct StreamingBufferConfig_ {
+    uint32_t buf_size;      /**< initial size and growth step of the buffer */
+    /** memory callbacks, can be NULL to use SCMalloc/SCRealloc/SCFree.
+     *  Realloc and Free get the old size to allow for memory accounting. */
+    void *(*Malloc)(size_t size);
+    void *(*Realloc)(void *ptr, size_t orig_size, size_t size);
+    void (*Free)(void *ptr, size_t size);
+} StreamingBufferConfig;
+
+/** region of the stream that contains data */
+typedef struct StreamingBufferBlock_ {
+    uint64_t offset;
+    uint32_t len;
+    struct StreamingBufferBlock_ *next;
+} StreamingBufferBlock;
+
+typedef struct StreamingBuffer_ {
+    const StreamingBufferConfig *cfg;
+    uint64_t stream_offset;     /**< stream offset of buf[0] */
+
+    uint8_t *buf;
+    uint32_t buf_size;          /**< allocated size of buf */
+    uint32_t buf_offset;        /**< end of the data in buf, relative to buf[0] */
+
+    /** sorted list of data regions. NULL if all data between
+     *  stream_offset and stream_offset + buf_offset is present. */
+    StreamingBufferBlock *block_list;
+} StreamingBuffer;
+
+/** \brief check if the buffer is known to have no gaps */
+#define StreamingBufferIsContiguous(sb) ((sb)->block_list == NULL)
+
+/** \brief stream offset right after the last byte of data we have */
+#define StreamingBufferGetEndOffset(sb) ((sb)->stream_offset + (sb)->buf_offset)
+
+StreamingBuffer *StreamingBufferInit(const StreamingBufferConfig *cfg);
+void StreamingBufferFree(StreamingBuffer *sb);
+
+int StreamingBufferAppend(StreamingBuffer *sb, const uint8_t *data, uint32_t data_len);
+int StreamingBufferInsertAt(StreamingBuffer *sb, const uint8_t *data,
+        uint32_t data_len, uint64_t offset, int *overlap_diff);
+
+void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset);
+
+int StreamingBufferGetDataAtOffset(const StreamingBuffer *sb,
+        const uint8_t **data, uint32_t *data_len, uint64_t offset);
+int StreamingBufferGetNextDataOffset(const StreamingBuffer *sb,
+        uint64_t offset, uint64_t *next);
+
+uint32_t StreamingBufferMemSize(const StreamingBuffer *sb);
+
+void StreamingBufferRegisterTests(void);
+
+#endif /* __UTIL_STREAMING_BUFFER_H__ */